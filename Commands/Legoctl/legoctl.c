@@ -11,9 +11,10 @@ extern int     Debug;
 int     main(int argc,char *argv[])
 
 {
-    arg_t   arg_data = {"",NULL,0,0};
+    arg_t   arg_data = {"",NULL,0,NULL,0,0};
     rct_cmd_t   cmd = RCT_CMD_STATUS;
     unsigned int    flags = RCT_PROBE_DEV_ALL;
+    int         status;
 
     switch(argc)
     {
@@ -26,7 +27,10 @@ int     main(int argc,char *argv[])
 
     if ( parse_args(argc,argv,&cmd,&arg_data,&flags) == RCT_OK )
     {
-	return legoctl(cmd,&arg_data,flags);
+	status = legoctl(cmd,&arg_data,flags);
+	if ( flags & LEGOCTL_STATS )
+	    rct_stats_print(stderr);
+	return status;
     }
     else
 	return EX_USAGE;
@@ -52,13 +56,16 @@ int     legoctl(rct_cmd_t cmd,arg_t *arg_data,unsigned int flags)
 	case    RCT_CMD_STOP:
 	    return multi_brick_cmd(&bricks,cmd,flags);
 	case    RCT_CMD_UPLOAD:
+	    return upload(&bricks,arg_data,flags);
 	case    RCT_CMD_DELETE:
+	    return delete_files(&bricks,arg_data);
 	case    RCT_CMD_START:
 	case    RCT_CMD_PLAY_SOUND:
+	case    RCT_CMD_DOWNLOAD:
+	case    RCT_CMD_LIST:
 	    return file_cmd(&bricks,arg_data->filename,cmd,flags);
 	case    RCT_CMD_PLAY_TONE:
 	    return play_tone(&bricks,arg_data->herz,arg_data->milliseconds);
-	case    RCT_CMD_DOWNLOAD:
 	case    RCT_CMD_FIRM_UP:
 	case    RCT_CMD_FIRM_DOWN:
 	    fputs("This command is not yet implemented.\n",stderr);
@@ -121,6 +128,7 @@ int     file_cmd(rct_brick_list_t *bricks,char *filename,rct_cmd_t cmd,
 {
     rct_brick_t *brick;
     rct_flag_t  loop;
+    int         status = 0;
     
     switch(rct_brick_count(bricks))
     {
@@ -136,13 +144,13 @@ int     file_cmd(rct_brick_list_t *bricks,char *filename,rct_cmd_t cmd,
 		    case    RCT_CMD_START:
 			rct_start_program(brick,filename);
 			break;
-		    case    RCT_CMD_UPLOAD:
-			if ( flags & RCT_OVERWRITE )
-			    rct_delete_file(brick,filename);
-			rct_upload_file(brick,filename,RCT_UPLOAD_PLAY_SOUND);
+		    case    RCT_CMD_DOWNLOAD:
+			if ( rct_download_file(brick,filename) != RCT_OK )
+			    status = EX_IOERR;
 			break;
-		    case    RCT_CMD_DELETE:
-			rct_delete_file(brick,filename);
+		    case    RCT_CMD_LIST:
+			if ( rct_print_files(brick,filename) != RCT_OK )
+			    status = EX_IOERR;
 			break;
 		    case    RCT_CMD_PLAY_SOUND:
 			loop = ((flags & RCT_LOOP) != 0);
@@ -158,7 +166,71 @@ int     file_cmd(rct_brick_list_t *bricks,char *filename,rct_cmd_t cmd,
 	    fputs("Error: multiple bricks connected.  Don't know which one to upload to.\n",stderr);
 	    exit(EX_DATAERR);
     }
-    return 0;
+    return status;
+}
+
+
+int     upload(rct_brick_list_t *bricks,arg_t *arg_data,unsigned int flags)
+
+{
+    rct_brick_t *brick;
+    int         status = EX_UNAVAILABLE;
+    
+    switch(rct_brick_count(bricks))
+    {
+	case    0:
+	    fputs("Sorry, accessible no bricks found.\n",stderr);
+	    exit(EX_UNAVAILABLE);
+	case    1:
+	    brick = rct_get_brick_from_list(bricks,0);
+	    if ( rct_open_brick(brick) == RCT_OK )
+	    {
+		flags = RCT_UPLOAD_PLAY_SOUND |
+			(flags & (RCT_OVERWRITE|RCT_UPLOAD_FORCE|RCT_UPLOAD_SWAP));
+		if ( rct_upload_files(brick,arg_data->filenames,
+				      arg_data->file_count,flags) == RCT_OK )
+		    status = 0;
+		else
+		    status = EX_IOERR;
+		rct_close_brick(brick);
+	    }
+	    break;
+	default:
+	    fputs("Error: multiple bricks connected.  Don't know which one to upload to.\n",stderr);
+	    exit(EX_DATAERR);
+    }
+    return status;
+}
+
+
+int     delete_files(rct_brick_list_t *bricks,arg_t *arg_data)
+
+{
+    rct_brick_t *brick;
+    int         status = EX_UNAVAILABLE;
+    
+    switch(rct_brick_count(bricks))
+    {
+	case    0:
+	    fputs("Sorry, accessible no bricks found.\n",stderr);
+	    exit(EX_UNAVAILABLE);
+	case    1:
+	    brick = rct_get_brick_from_list(bricks,0);
+	    if ( rct_open_brick(brick) == RCT_OK )
+	    {
+		if ( rct_delete_files(brick,arg_data->filenames,
+				      arg_data->file_count) == RCT_OK )
+		    status = 0;
+		else
+		    status = EX_IOERR;
+		rct_close_brick(brick);
+	    }
+	    break;
+	default:
+	    fputs("Error: multiple bricks connected.  Don't know which one to delete from.\n",stderr);
+	    exit(EX_DATAERR);
+    }
+    return status;
 }
 
 
@@ -193,11 +265,12 @@ void    legoctl_usage(char *progname)
 {
     fputs("Usage:\n",stderr);
     fprintf(stderr,"\t%s [flags] status\n",progname);
-    fprintf(stderr,"\t%s [flags] upload <filename> [slot #]\n",progname);
+    fprintf(stderr,"\t%s [flags] upload <filename> [filename ...]\n",progname);
     fprintf(stderr,"\t%s [flags] playsound <filename>\n",progname);
     fprintf(stderr,"\t%s [flags] playtone <herz> <milliseconds>\n",progname);
-    //fprintf(stderr,"\t%s [flags] download <filename|all> [slot #]\n",progname);
-    fprintf(stderr,"\t%s [flags] delete <filename> [slot #]\n",progname);
+    fprintf(stderr,"\t%s [flags] download <filename>\n",progname);
+    fprintf(stderr,"\t%s [flags] delete <pattern> [pattern ...]\n",progname);
+    fprintf(stderr,"\t%s [flags] ls [pattern]\n",progname);
     //fprintf(stderr,"\t%s [flags] firmware_up <filename>\n",progname);
     //fprintf(stderr,"\t%s [flags] firmware_down <filename>\n",progname);
     fprintf(stderr,"\t%s [flags] start <filename|slot #>\n",progname);
@@ -208,8 +281,11 @@ void    legoctl_usage(char *progname)
     //fputs("\t--bluetooth probe bluetooth interfaces only\n",stderr);
     //fputs("\t--rcx       probe for RCX only\n",stderr);
     fputs("\t--overwrite overwrite existing files on brick\n",stderr);
+    fputs("\t--force     upload even if files are unchanged on brick\n",stderr);
+    fputs("\t--swap      replace files on brick only once fully uploaded\n",stderr);
     fputs("\t--loop      repeat command indefinitely\n",stderr);
     fputs("\t--debug     enable debugging output\n",stderr);
+    fputs("\t--stats     print command latencies and counters when done\n",stderr);
     fputs("\t--btname name  Specify a non-default bluetooth name\n", stderr);
     exit(EX_USAGE);
 }
@@ -231,9 +307,13 @@ int     parse_args(int argc,char *argv[],rct_cmd_t *cmd,arg_t *arg_data,
 	else if ( strcmp(argv[arg],"upload") == 0 )
 	{
 	    *cmd = RCT_CMD_UPLOAD;
-	    /* The next argument should be the last */
-	    if ( arg == argc - 2 )
-		arg_data->filename = argv[++arg];
+	    /* The remaining arguments are files, at least one */
+	    if ( arg < argc - 1 )
+	    {
+		arg_data->filenames = argv + arg + 1;
+		arg_data->file_count = argc - arg - 1;
+		arg = argc - 1;
+	    }
 	    else
 		legoctl_usage(argv[0]);
 	}
@@ -271,6 +351,11 @@ int     parse_args(int argc,char *argv[],rct_cmd_t *cmd,arg_t *arg_data,
 	else if ( strcmp(argv[arg],"download") == 0 )
 	{
 	    *cmd = RCT_CMD_DOWNLOAD;
+	    /* The next argument should be the last */
+	    if ( arg == argc - 2 )
+		arg_data->filename = argv[++arg];
+	    else
+		legoctl_usage(argv[0]);
 	}
 	else if ( strcmp(argv[arg],"firmware_up") == 0 )
 	{
@@ -289,9 +374,24 @@ int     parse_args(int argc,char *argv[],rct_cmd_t *cmd,arg_t *arg_data,
 	else if ( strcmp(argv[arg],"delete") == 0 )
 	{
 	    *cmd = RCT_CMD_DELETE;
-	    /* The next argument should be the last */
+	    /* The remaining arguments are filenames or patterns */
+	    if ( arg < argc - 1 )
+	    {
+		arg_data->filenames = argv + arg + 1;
+		arg_data->file_count = argc - arg - 1;
+		arg = argc - 1;
+	    }
+	    else
+		legoctl_usage(argv[0]);
+	}
+	else if ( strcmp(argv[arg],"ls") == 0 )
+	{
+	    *cmd = RCT_CMD_LIST;
+	    /* An optional pattern such as '*.rso' should be the last */
 	    if ( arg == argc - 2 )
 		arg_data->filename = argv[++arg];
+	    else if ( arg == argc - 1 )
+		arg_data->filename = NULL;
 	    else
 		legoctl_usage(argv[0]);
 	}
@@ -320,6 +420,14 @@ int     parse_args(int argc,char *argv[],rct_cmd_t *cmd,arg_t *arg_data,
 	{
 	    *flags |= RCT_OVERWRITE;
 	}
+	else if ( strcmp(argv[arg],"--force") == 0 )
+	{
+	    *flags |= RCT_UPLOAD_FORCE;
+	}
+	else if ( strcmp(argv[arg],"--swap") == 0 )
+	{
+	    *flags |= RCT_UPLOAD_SWAP;
+	}
 	else if ( strcmp(argv[arg],"--loop") == 0 )
 	{
 	    *flags |= RCT_LOOP;
@@ -328,6 +436,11 @@ int     parse_args(int argc,char *argv[],rct_cmd_t *cmd,arg_t *arg_data,
 	{
 	    Debug = 1;
 	}
+	else if ( strcmp(argv[arg],"--stats") == 0 )
+	{
+	    *flags |= LEGOCTL_STATS;
+	    rct_stats_enable(1);
+	}
 	else if ( strcmp(argv[arg],"--btname") == 0 )
 	{
 	    arg_data->bluetooth_name = argv[++arg];
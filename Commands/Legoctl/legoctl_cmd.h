@@ -2,9 +2,14 @@
 typedef struct
 {
     char    *filename;
+    char    **filenames;    /* For upload and delete */
+    int     file_count;
     char    *bluetooth_name;
     int     herz;
     int     milliseconds;
 }   arg_t;
 
 
+
+/* Flags beyond those in rct_flag_t */
+#define LEGOCTL_STATS   0x10000
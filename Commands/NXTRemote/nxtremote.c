@@ -27,7 +27,7 @@
 int     main(int argc,char *argv[])
 
 {
-    int     x, y, c, bytes;
+    int     x, y, bytes;
     extern int  Debug;
     rct_brick_list_t    bricks;
     rct_brick_t         *brick;
@@ -68,10 +68,14 @@ int     main(int argc,char *argv[])
     }
     rct_print_device_info(brick);
     
-    /* Disable NXT response packets to reduce communication overhead. */
-    nxt_response_off(&brick->nxt);
+    /*
+     * Disable NXT response packets to reduce communication overhead,
+     * but keep checking that commands are getting through and slow
+     * down if they are not.  The verification probes are keep-alive
+     * commands, so they also keep the NXT from going to sleep.
+     */
+    nxt_response_adaptive(&brick->nxt, NXT_ADAPTIVE_VERIFY_EVERY);
 
-    c =0;
     while ( (bytes = gamepad_read(gp)) >= 0 )
     {
 	if ( bytes > 0 )
@@ -88,11 +92,6 @@ int     main(int argc,char *argv[])
 	    else
 		control_implement_with_joystick(brick,
 			-gamepad_z(gp),gamepad_max_z(gp), &settings);
-
-	    /* NXT will go to sleep unless it's running a program, so reset
-	       timer occasionally. */
-	    if ( ++c % 1000 == 0 )
-		nxt_keep_alive(&brick->nxt);
 	}
     }
     gamepad_close(gp);
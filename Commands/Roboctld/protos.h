@@ -0,0 +1,14 @@
+/* roboctld.c */
+int main(int argc, char *argv[]);
+void roboctld_error(const char *msg);
+void roboctld_quit(int sig);
+int roboctld_listen(char *path);
+int roboctld_serve(rct_nxt_t *nxt, int listen_fd);
+int roboctld_reply_ready(rct_nxt_t *nxt);
+void roboctld_accept(int listen_fd);
+void roboctld_read(rct_nxt_t *nxt, client_t *client);
+void roboctld_forward(rct_nxt_t *nxt, client_t *client, unsigned char *packet, int len);
+void roboctld_reply(rct_nxt_t *nxt, nxt_request_t *req);
+void roboctld_disconnect(client_t *client);
+void roboctld_usage(char *progname);
+int parse_args(int argc, char *argv[], arg_t *arg_data);
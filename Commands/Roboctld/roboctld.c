@@ -0,0 +1,513 @@
+/****************************************************************************
+ *  roboctld keeps a connection to an NXT brick open and relays
+ *  telegrams between the brick and any number of local clients.
+ *  Clients connect to a Unix domain socket and speak the Bluetooth
+ *  framing: each telegram is preceded by a 2-byte little-endian
+ *  length.  Replies are returned to the client that sent the command.
+ *  Programs using -lroboctl find the socket automatically, so they
+ *  skip device discovery, the Bluetooth connect, and the delay after
+ *  closing an RFCOMM connection.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <poll.h>
+#include <sysexits.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <roboctl.h>
+#include "roboctld.h"
+
+extern int      Debug;
+
+client_t                *Clients[ROBOCTLD_MAX_CLIENTS];
+volatile sig_atomic_t   Quit = 0;
+int                     Detached = 0;
+
+int     main(int argc,char *argv[])
+
+{
+    arg_t               arg_data = {NULL,NULL,0};
+    rct_brick_list_t    bricks;
+    rct_brick_t         *brick;
+    char                socket_path[PATH_MAX+1];
+    int                 listen_fd,
+			status;
+
+    parse_args(argc,argv,&arg_data);
+
+    if ( arg_data.socket_path != NULL )
+	strlcpy(socket_path,arg_data.socket_path,PATH_MAX);
+    else if ( rct_daemon_socket(socket_path,PATH_MAX) == NULL )
+    {
+	fputs("roboctld: Cannot determine socket path.\n",stderr);
+	return EX_CONFIG;
+    }
+
+    if ( (listen_fd = roboctld_listen(socket_path)) == -1 )
+	return EX_CANTCREAT;
+
+    signal(SIGPIPE,SIG_IGN);
+    signal(SIGINT,roboctld_quit);
+    signal(SIGTERM,roboctld_quit);
+    /* A daemon ignores hangups, but not one running in a terminal */
+    signal(SIGHUP,arg_data.foreground ? roboctld_quit : SIG_IGN);
+
+    /*
+     *  Detach before touching the brick.  Threads do not survive the
+     *  fork() in daemon(), and with RCT_LIBUSB1 the brick has an event
+     *  thread as soon as it is opened.
+     */
+    if ( !arg_data.foreground )
+    {
+	if ( daemon(0,0) == -1 )
+	{
+	    perror("roboctld: daemon()");
+	    close(listen_fd);
+	    unlink(socket_path);
+	    return EX_OSERR;
+	}
+	openlog("roboctld",LOG_PID,LOG_DAEMON);
+	Detached = 1;
+    }
+
+    /* Find the real brick, not another daemon */
+    setenv("ROBOCTL_SOCKET","",1);
+    rct_find_bricks(&bricks,arg_data.bluetooth_name,RCT_PROBE_ALL);
+    if ( rct_brick_count(&bricks) == 0 )
+    {
+	roboctld_error("No accessible bricks found.");
+	status = EX_UNAVAILABLE;
+    }
+    else if ( rct_open_brick(brick = rct_get_brick_from_list(&bricks,0))
+		!= RCT_OK )
+    {
+	roboctld_error("Error opening brick.");
+	status = EX_UNAVAILABLE;
+    }
+    else
+    {
+	status = roboctld_serve(&brick->nxt,listen_fd);
+	rct_close_brick(brick);
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Report an error about the brick.  Once detached, stderr goes to
+ *  /dev/null, so it is logged with syslog instead.
+ * Author:
+ ***************************************************************************/
+
+void    roboctld_error(const char *msg)
+
+{
+    if ( Detached )
+	syslog(LOG_ERR,"%s",msg);
+    else
+	fprintf(stderr,"roboctld: %s\n",msg);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Signal handler for SIGINT and SIGTERM.
+ * Author:
+ ***************************************************************************/
+
+void    roboctld_quit(int sig)
+
+{
+    Quit = 1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Create the listening socket, and its directory if necessary.  A
+ *  socket left behind by a daemon that died is replaced, but one with
+ *  a live daemon behind it is not.
+ * Author:
+ ***************************************************************************/
+
+int     roboctld_listen(char *path)
+
+{
+    struct sockaddr_un  addr;
+    char                dir[PATH_MAX+1],
+			*slash;
+    int                 fd;
+
+    if ( strlen(path) >= sizeof(addr.sun_path) )
+    {
+	fprintf(stderr,"roboctld: Socket path too long: %s\n",path);
+	return -1;
+    }
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strlcpy(addr.sun_path,path,sizeof(addr.sun_path));
+
+    /* Keep other users away from the brick */
+    strlcpy(dir,path,PATH_MAX);
+    if ( (slash = strrchr(dir,'/')) != NULL )
+    {
+	*slash = '\0';
+	if ( (*dir != '\0') && (mkdir(dir,0700) == -1) && (errno != EEXIST) )
+	{
+	    fprintf(stderr,"roboctld: Cannot create %s: %s\n",
+		    dir,strerror(errno));
+	    return -1;
+	}
+    }
+
+    if ( (fd = socket(AF_UNIX,SOCK_STREAM,0)) == -1 )
+    {
+	perror("roboctld: socket()");
+	return -1;
+    }
+    if ( connect(fd,(struct sockaddr *)&addr,sizeof(addr)) == 0 )
+    {
+	fprintf(stderr,"roboctld: Already running on %s\n",path);
+	close(fd);
+	return -1;
+    }
+    unlink(path);
+    if ( (bind(fd,(struct sockaddr *)&addr,sizeof(addr)) == -1) ||
+	 (listen(fd,ROBOCTLD_BACKLOG) == -1) )
+    {
+	fprintf(stderr,"roboctld: Cannot listen on %s: %s\n",
+		path,strerror(errno));
+	close(fd);
+	return -1;
+    }
+    chmod(path,0600);
+    return fd;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Relay telegrams between clients and the brick until told to quit
+ *  or the brick connection fails.
+ * Author:
+ ***************************************************************************/
+
+int     roboctld_serve(rct_nxt_t *nxt,int listen_fd)
+
+{
+    struct pollfd   fds[ROBOCTLD_MAX_CLIENTS+2];
+    client_t        *polled[ROBOCTLD_MAX_CLIENTS+2];
+    int             nfds,
+		    c,
+		    timeout_ms;
+
+    while ( !Quit )
+    {
+	while ( roboctld_reply_ready(nxt) )
+	{
+	    if ( nxt_reap(nxt,1) < 0 )
+	    {
+		roboctld_error("Lost connection to brick.");
+		return EX_IOERR;
+	    }
+	}
+
+	nfds = 0;
+	fds[nfds].fd = listen_fd;
+	fds[nfds].events = POLLIN;
+	polled[nfds++] = NULL;
+	for (c = 0; c < ROBOCTLD_MAX_CLIENTS; ++c)
+	{
+	    if ( Clients[c] != NULL )
+	    {
+		fds[nfds].fd = Clients[c]->fd;
+		fds[nfds].events = POLLIN;
+		polled[nfds++] = Clients[c];
+	    }
+	}
+
+	/*
+	 *  Wake up for replies while commands are outstanding.  Links
+	 *  without a descriptor to poll are checked every tick.
+	 */
+	timeout_ms = -1;
+	if ( nxt->engine.count > 0 )
+	{
+	    if ( nxt->fd != -1 )
+	    {
+		fds[nfds].fd = nxt->fd;
+		fds[nfds].events = POLLIN;
+		polled[nfds++] = NULL;
+		timeout_ms = rct_deadline_remaining(
+		    &nxt->engine.in_flight[nxt->engine.head]->deadline);
+	    }
+	    else
+		timeout_ms = ROBOCTLD_TICK_MS;
+	}
+
+	if ( poll(fds,nfds,timeout_ms) == -1 )
+	{
+	    if ( errno == EINTR )
+		continue;
+	    perror("roboctld: poll()");
+	    return EX_OSERR;
+	}
+
+	if ( fds[0].revents & POLLIN )
+	    roboctld_accept(listen_fd);
+	for (c = 1; c < nfds; ++c)
+	{
+	    if ( (polled[c] != NULL) && (fds[c].revents != 0) )
+		roboctld_read(nxt,polled[c]);
+	}
+    }
+    return EX_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return non-zero if the brick's engine has a reply to collect or a
+ *  request to time out.
+ * Author:
+ ***************************************************************************/
+
+int     roboctld_reply_ready(rct_nxt_t *nxt)
+
+{
+    if ( nxt->engine.count == 0 )
+	return 0;
+    if ( rct_deadline_remaining(
+	    &nxt->engine.in_flight[nxt->engine.head]->deadline) == 0 )
+	return 1;
+    return nxt_poll_response(nxt,0) > 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Accept a new client connection.
+ * Author:
+ ***************************************************************************/
+
+void    roboctld_accept(int listen_fd)
+
+{
+    client_t    *client;
+    int         fd,
+		c;
+
+    if ( (fd = accept(listen_fd,NULL,NULL)) == -1 )
+	return;
+    for (c = 0; (c < ROBOCTLD_MAX_CLIENTS) && (Clients[c] != NULL); ++c)
+	;
+    if ( c == ROBOCTLD_MAX_CLIENTS )
+    {
+	fputs("roboctld: Too many clients.\n",stderr);
+	close(fd);
+	return;
+    }
+    if ( (client = malloc(sizeof(*client))) == NULL )
+    {
+	close(fd);
+	return;
+    }
+    if ( (client->ring = nxt_ring_new()) == NULL )
+    {
+	free(client);
+	close(fd);
+	return;
+    }
+    client->fd = fd;
+    client->pending = 0;
+    Clients[c] = client;
+    debug_printf("roboctld: Client %d connected.\n",c);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Read what a client has sent and forward each complete telegram to
+ *  the brick.
+ * Author:
+ ***************************************************************************/
+
+void    roboctld_read(rct_nxt_t *nxt,client_t *client)
+
+{
+    unsigned char   *packet;
+    int             len;
+
+    if ( nxt_ring_fill(client->ring,client->fd) <= 0 )
+    {
+	roboctld_disconnect(client);
+	return;
+    }
+    while ( (len = nxt_ring_peek(client->ring,&packet)) > 0 )
+    {
+	if ( len < 2 )
+	    break;
+	roboctld_forward(nxt,client,packet,len);
+	nxt_ring_consume(client->ring);
+    }
+    if ( len != 0 )
+    {
+	fputs("roboctld: Bad telegram from client.\n",stderr);
+	roboctld_disconnect(client);
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Queue a telegram from a client to the brick.  The reply, if any,
+ *  is returned to the client by roboctld_reply().
+ * Author:
+ ***************************************************************************/
+
+void    roboctld_forward(rct_nxt_t *nxt,client_t *client,
+			 unsigned char *packet,int len)
+
+{
+    nxt_request_t   *req;
+
+    if ( (req = malloc(sizeof(*req))) == NULL )
+    {
+	fputs("roboctld: Out of memory.\n",stderr);
+	return;
+    }
+    nxt_request_init(req,packet[0],packet[1]);
+    if ( nxt_request_append(req,packet+2,len-2) != RCT_OK )
+    {
+	free(req);
+	return;
+    }
+    req->callback = roboctld_reply;
+    req->arg = client;
+    ++client->pending;
+    /* On failure, the request is completed through roboctld_reply() */
+    nxt_submit(nxt,req);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Engine callback: return the brick's reply to the client that sent
+ *  the command.  Failed requests get no reply, and time out at the
+ *  client as they would with a direct connection.
+ * Author:
+ ***************************************************************************/
+
+void    roboctld_reply(rct_nxt_t *nxt,nxt_request_t *req)
+
+{
+    client_t        *client = req->arg;
+    unsigned char   header[2];
+    struct iovec    iov[2];
+
+    if ( (req->status == RCT_OK) && (req->response_len > 0) &&
+	 (client->fd != -1) )
+    {
+	short2buf(header,req->response_len);
+	iov[0].iov_base = header;
+	iov[0].iov_len = 2;
+	iov[1].iov_base = req->response;
+	iov[1].iov_len = req->response_len;
+	/* A client that has gone away is noticed by roboctld_read() */
+	nxt_writev_all(client->fd,iov,2);
+    }
+    free(req);
+    if ( (--client->pending == 0) && (client->fd == -1) )
+	free(client);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Drop a client connection.  The client structure lives on until
+ *  its outstanding requests complete.
+ * Author:
+ ***************************************************************************/
+
+void    roboctld_disconnect(client_t *client)
+
+{
+    int     c;
+
+    for (c = 0; c < ROBOCTLD_MAX_CLIENTS; ++c)
+	if ( Clients[c] == client )
+	    Clients[c] = NULL;
+    close(client->fd);
+    client->fd = -1;
+    free(client->ring);
+    client->ring = NULL;
+    if ( client->pending == 0 )
+	free(client);
+}
+
+
+void    roboctld_usage(char *progname)
+
+{
+    fprintf(stderr,"Usage: %s [flags]\n",progname);
+    fputs("\nFlags:\n",stderr);
+    fputs("\t--btname name   Specify a non-default bluetooth name\n",stderr);
+    fputs("\t--socket path   Listen on path instead of ~/" RCT_DAEMON_SOCKET "\n",
+	  stderr);
+    fputs("\t--foreground    Do not detach from the terminal\n",stderr);
+    fputs("\t--debug         Enable debugging output (implies --foreground)\n",
+	  stderr);
+    exit(EX_USAGE);
+}
+
+
+int     parse_args(int argc,char *argv[],arg_t *arg_data)
+
+{
+    int     arg;
+
+    for (arg = 1; arg < argc; ++arg)
+    {
+	if ( strcmp(argv[arg],"--btname") == 0 )
+	{
+	    if ( ++arg == argc )
+		roboctld_usage(argv[0]);
+	    arg_data->bluetooth_name = argv[arg];
+	}
+	else if ( strcmp(argv[arg],"--socket") == 0 )
+	{
+	    if ( ++arg == argc )
+		roboctld_usage(argv[0]);
+	    arg_data->socket_path = argv[arg];
+	}
+	else if ( strcmp(argv[arg],"--foreground") == 0 )
+	{
+	    arg_data->foreground = 1;
+	}
+	else if ( strcmp(argv[arg],"--debug") == 0 )
+	{
+	    Debug = 1;
+	    arg_data->foreground = 1;
+	}
+	else
+	{
+	    fprintf(stderr,"Invalid option: %s\n",argv[arg]);
+	    roboctld_usage(argv[0]);
+	}
+    }
+    return RCT_OK;
+}
@@ -0,0 +1,21 @@
+#define ROBOCTLD_MAX_CLIENTS    32
+#define ROBOCTLD_BACKLOG        8
+#define ROBOCTLD_TICK_MS        1
+
+/* A connected client.  Freed once it has hung up and has no requests
+   left in the brick's engine. */
+typedef struct
+{
+    int         fd;         /* -1 once disconnected */
+    nxt_ring_t  *ring;
+    int         pending;
+}   client_t;
+
+typedef struct
+{
+    char    *bluetooth_name;
+    char    *socket_path;
+    int     foreground;
+}   arg_t;
+
+#include "protos.h"
@@ -74,6 +74,8 @@ int     vexctl(rct_cmd_t cmd,arg_t *arg_data,unsigned int flags)
 	monitor_controller(&pic);
     
     vex_close_controller(&pic);
+    if ( flags & VEX_STATS )
+	rct_stats_print(stderr);
     
     if ( (status == RCT_OK) && (flags & VEX_LAUNCH_PROG) )
 	return system(arg_data->launch_prog);
@@ -93,6 +95,7 @@ void    vexctl_usage(char *progname)
     fputs("\t--dev dev      Use serial port dev instead of the default.\n",stderr);
     fputs("\t--launch prog  Launch prog after successful command.\n",stderr);
     fputs("\t--monitor      Monitor output after successful command.\n",stderr);
+    fputs("\t--stats        Print command latencies and counters.\n",stderr);
     exit(EX_USAGE);
 }
 
@@ -172,6 +175,11 @@ int     parse_global_flags(int argc,char *argv[],rct_cmd_t *cmd,
 	{
 	    *flags |= VEX_MONITOR;
 	}
+	else if ( strcmp(argv[arg],"--stats") == 0 )
+	{
+	    *flags |= VEX_STATS;
+	    rct_stats_enable(1);
+	}
 	else
 	{
 	    fprintf(stderr,"Invalid flag: %s\n",argv[arg]);
@@ -45,4 +45,5 @@ typedef struct
 /* Bit flags */
 #define VEX_LAUNCH_PROG 0x0001
 #define VEX_MONITOR     0X0002
+#define VEX_STATS       0x0004
 
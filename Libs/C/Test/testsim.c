@@ -0,0 +1,519 @@
+/****************************************************************************
+ *  Regression tests for the NXT command path, run against the
+ *  in-process simulator (nxt_sim.c), so no brick is needed.  Each test
+ *  opens a fresh simulated brick, configured as ROBOCTL_SIM_LATENCY,
+ *  ROBOCTL_SIM_DROP and ROBOCTL_SIM_DISCONNECT would.
+ *
+ *  Run with "make check".  The exit status is the number of failures.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <roboctl.h>
+
+int     sim_open(rct_nxt_t *nxt, int latency_us, int drop_every,
+		 int disconnect_every);
+void    sim_setenv(const char *name, int value);
+int     sim_write_file(const char *dir, const char *name, size_t size,
+		       int seed);
+int     sim_brick_has(rct_nxt_t *nxt, const char *dir, char *name,
+		      size_t size, int seed);
+void    check(const char *test, int ok);
+void    test_pipelined_replies(void);
+void    test_dropped_reply(void);
+void    test_reconnect_resend(void);
+void    test_reconnect_gives_up(void);
+void    test_resumed_upload(void);
+void    test_swap_upload(void);
+void    test_adaptive_recovery(void);
+void    test_sched_reconnect(void);
+
+int     Failures = 0;
+
+
+int     main(int argc,char *argv[])
+
+{
+    test_pipelined_replies();
+    test_dropped_reply();
+    test_reconnect_resend();
+    test_reconnect_gives_up();
+    test_resumed_upload();
+    test_swap_upload();
+    test_adaptive_recovery();
+    test_sched_reconnect();
+    printf("%d failure%s\n", Failures, Failures == 1 ? "" : "s");
+    return Failures;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Open a simulated brick.  0 leaves a setting off.
+ * Author:
+ ***************************************************************************/
+
+int     sim_open(rct_nxt_t *nxt, int latency_us, int drop_every,
+		 int disconnect_every)
+
+{
+    sim_setenv("ROBOCTL_SIM_LATENCY", latency_us);
+    sim_setenv("ROBOCTL_SIM_DROP", drop_every);
+    sim_setenv("ROBOCTL_SIM_DISCONNECT", disconnect_every);
+    nxt_init_struct(nxt);
+    if ( (nxt_set_transport(nxt, &nxt_sim_transport) != RCT_OK) ||
+	 (nxt_open_brick(nxt) != RCT_OK) )
+    {
+	fputs("Cannot open simulator.\n", stderr);
+	exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+
+void    sim_setenv(const char *name, int value)
+
+{
+    char    buf[32];
+
+    if ( value == 0 )
+	unsetenv(name);
+    else
+    {
+	snprintf(buf, sizeof(buf), "%d", value);
+	setenv(name, buf, 1);
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Create dir/name holding size bytes of a pattern picked by seed.
+ *  Returns 0 on success.
+ * Author:
+ ***************************************************************************/
+
+int     sim_write_file(const char *dir, const char *name, size_t size,
+		       int seed)
+
+{
+    char    path[PATH_MAX+1];
+    FILE    *fp;
+    size_t  c;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ( (fp = fopen(path, "w")) == NULL )
+	return -1;
+    for (c = 0; c < size; ++c)
+	putc('a' + (c * 7 + seed) % 26, fp);
+    return fclose(fp);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Download name from the brick into dir and return non-zero if it
+ *  holds the pattern written by sim_write_file().  The copy is removed.
+ * Author:
+ ***************************************************************************/
+
+int     sim_brick_has(rct_nxt_t *nxt, const char *dir, char *name,
+		      size_t size, int seed)
+
+{
+    char    cwd[PATH_MAX+1];
+    FILE    *fp;
+    size_t  c;
+    int     ok;
+
+    if ( (getcwd(cwd, sizeof(cwd)) == NULL) || (chdir(dir) != 0) )
+	return 0;
+    ok = (nxt_download_file(nxt, name) == RCT_OK) &&
+	 ((fp = fopen(name, "r")) != NULL);
+    if ( ok )
+    {
+	for (c = 0; (c < size) && ok; ++c)
+	    ok = getc(fp) == 'a' + (c * 7 + seed) % 26;
+	ok = ok && (getc(fp) == EOF);
+	fclose(fp);
+    }
+    unlink(name);
+    return (chdir(cwd) == 0) && ok;
+}
+
+
+void    check(const char *test, int ok)
+
+{
+    printf("%-40s %s\n", test, ok ? "OK" : "**** FAILED ****");
+    if ( !ok )
+	++Failures;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  A window of requests goes out before the first reply is back, and
+ *  each reply completes its own request, in the order submitted.  The
+ *  batch must take about one simulated round trip, not one per request.
+ ***************************************************************************/
+
+void    test_pipelined_replies(void)
+
+{
+    static int      codes[] = { NXT_DC_KEEP_ALIVE, NXT_DC_BATTERY_LEVEL,
+				NXT_DC_PLAY_TONE };
+    rct_nxt_t       nxt;
+    nxt_request_t   reqs[8],
+		    *batch[8],
+		    *done;
+    struct timeval  start,
+		    end;
+    long            usec;
+    int             c,
+		    ok = 1;
+
+    sim_open(&nxt, 50000, 0, 0);
+    nxt_set_window(&nxt, 8);
+    for (c = 0; c < 8; ++c)
+    {
+	nxt_request_init(&reqs[c], NXT_DIRECT_CMD, codes[c % 3]);
+	reqs[c].callback = nxt_enqueue_completion;
+	batch[c] = &reqs[c];
+    }
+    gettimeofday(&start, NULL);
+    nxt_submit_batch(&nxt, batch, 8);
+    for (c = 0; c < 8; ++c)
+    {
+	nxt_wait(&nxt, &reqs[c]);
+	if ( ((done = nxt_get_completion(&nxt)) != &reqs[c]) ||
+	     (done->status != RCT_OK) ||
+	     (done->response[1] != codes[c % 3]) )
+	{
+	    printf("Request %d completed out of order or failed.\n", c);
+	    ok = 0;
+	}
+    }
+    gettimeofday(&end, NULL);
+    usec = (end.tv_sec - start.tv_sec) * 1000000L +
+	   (end.tv_usec - start.tv_usec);
+    nxt_close_brick(&nxt);
+    check("pipelined replies in order", ok);
+    check("pipelined batch in one round trip", usec < 4 * 50000);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  A lost reply must cost only the request it belonged to.  Every
+ *  third reply is dropped, so KEEP_ALIVEs 3, 6 and 9 time out and the
+ *  rest, which share their command code, still get their replies.
+ ***************************************************************************/
+
+void    test_dropped_reply(void)
+
+{
+    rct_nxt_t       nxt;
+    rct_status_t    status;
+    int             c,
+		    ok = 1;
+
+    sim_open(&nxt, 0, 3, 0);
+    nxt_set_timeout(&nxt, 100);
+    for (c = 1; c <= 10; ++c)
+    {
+	status = nxt_keep_alive(&nxt);
+	if ( (status == RCT_OK) != (c % 3 != 0) )
+	{
+	    printf("KEEP_ALIVE %d returned %d\n", c, status);
+	    ok = 0;
+	}
+    }
+    nxt_close_brick(&nxt);
+    check("dropped reply, then recovery", ok);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  The link drops on every twelfth telegram while a window of requests
+ *  is in flight.  nxt_reconnect() must reopen it and send the requests
+ *  in flight again, so that every one of them still gets its own reply.
+ *  The window is kept below the drop interval, or the resent requests
+ *  themselves would drop the link every time.
+ ***************************************************************************/
+
+void    test_reconnect_resend(void)
+
+{
+    rct_nxt_t       nxt;
+    nxt_request_t   reqs[16],
+		    *batch[16];
+    int             c,
+		    ok = 1;
+
+    sim_open(&nxt, 10000, 0, 12);
+    nxt_set_window(&nxt, 8);
+    for (c = 0; c < 16; ++c)
+    {
+	nxt_request_init(&reqs[c], NXT_DIRECT_CMD,
+			 c % 2 ? NXT_DC_BATTERY_LEVEL : NXT_DC_KEEP_ALIVE);
+	batch[c] = &reqs[c];
+    }
+    nxt_submit_batch(&nxt, batch, 16);
+    for (c = 0; c < 16; ++c)
+    {
+	if ( (nxt_wait(&nxt, &reqs[c]) != RCT_OK) ||
+	     (reqs[c].response[1] != reqs[c].cmd[1]) )
+	{
+	    printf("Request %d failed across the reconnect.\n", c);
+	    ok = 0;
+	}
+    }
+    check("reconnect resends in-flight requests",
+	  ok && (nxt.reconnects > 0));
+    nxt_close_brick(&nxt);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Here the resent requests themselves drop the link, so every
+ *  reconnect succeeds but no reply ever comes back.  That must count
+ *  as one outage and fail the requests once the reconnect budget is
+ *  spent, rather than reconnecting forever.
+ ***************************************************************************/
+
+void    test_reconnect_gives_up(void)
+
+{
+    rct_nxt_t       nxt;
+    nxt_request_t   reqs[8],
+		    *batch[8];
+    struct timeval  start,
+		    end;
+    long            usec;
+    int             c,
+		    ok = 1;
+
+    sim_open(&nxt, 10000, 0, 6);
+    nxt_set_window(&nxt, 8);
+    nxt_set_reconnect(&nxt, 300);
+    for (c = 0; c < 8; ++c)
+    {
+	nxt_request_init(&reqs[c], NXT_DIRECT_CMD, NXT_DC_KEEP_ALIVE);
+	batch[c] = &reqs[c];
+    }
+    gettimeofday(&start, NULL);
+    nxt_submit_batch(&nxt, batch, 8);
+    for (c = 0; c < 8; ++c)
+	if ( nxt_wait(&nxt, &reqs[c]) == RCT_OK )
+	    ok = 0;
+    gettimeofday(&end, NULL);
+    usec = (end.tv_sec - start.tv_sec) * 1000000L +
+	   (end.tv_usec - start.tv_usec);
+    check("reconnect gives up on a failing link", ok && (usec < 1000000));
+    nxt_close_brick(&nxt);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Adaptive response mode must slow down while its probes are lost,
+ *  and back off to full speed once they get through again.
+ ***************************************************************************/
+
+void    test_adaptive_recovery(void)
+
+{
+    rct_nxt_t       nxt;
+    long            lossy_gap_us;
+    int             c;
+
+    sim_open(&nxt, 0, 2, 0);
+    nxt_set_timeout(&nxt, 50);
+    nxt_response_adaptive(&nxt, 10);
+    for (c = 0; c < 60; ++c)
+    {
+	nxt_play_tone(&nxt, 440, 1);
+	usleep(2000);
+    }
+    lossy_gap_us = nxt.adaptive.gap_us;
+
+    ((nxt_sim_t *)nxt.transport_data)->drop_every = 0;
+    for (c = 0; (c < 400) && (nxt.adaptive.gap_us > 0); ++c)
+    {
+	nxt_play_tone(&nxt, 440, 1);
+	usleep(2000);
+    }
+    check("adaptive mode slows down on loss",
+	  (nxt.adaptive.lost > 0) && (lossy_gap_us > 0));
+    check("adaptive mode recovers after loss", nxt.adaptive.gap_us == 0);
+    nxt_response_on(&nxt);
+    nxt_close_brick(&nxt);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  The link drops several times while a data file is uploaded, more
+ *  often than a restart from the beginning could survive.  The upload
+ *  must resume where the brick left off and arrive intact.
+ ***************************************************************************/
+
+void    test_resumed_upload(void)
+
+{
+    rct_nxt_t   nxt;
+    char        dir[] = "/tmp/testsim.XXXXXX",
+		path[PATH_MAX+1],
+		*files[] = { path };
+    int         ok;
+
+    if ( mkdtemp(dir) == NULL )
+    {
+	check("resumed upload", 0);
+	return;
+    }
+    snprintf(path, sizeof(path), "%s/resume.txt", dir);
+    sim_write_file(dir, "resume.txt", 20000, 1);
+
+    sim_open(&nxt, 1000, 0, 40);
+    ok = (nxt_upload_files(&nxt, files, 1, RCT_UPLOAD_FORCE) == RCT_OK) &&
+	 (nxt.reconnects >= 2);
+    ((nxt_sim_t *)nxt.transport_data)->disconnect_every = 0;
+    check("resumed upload", ok && sim_brick_has(&nxt, dir, "resume.txt",
+						 20000, 1));
+    nxt_manifest_clear(&nxt);
+    nxt_close_brick(&nxt);
+    unlink(path);
+    rmdir(dir);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  RCT_UPLOAD_SWAP replaces a file in one step: the new contents are
+ *  written under a temporary name and renamed over the old file, which
+ *  leaves no temporary file behind.  When the upload of a new version
+ *  fails part way, the old file must still be there, intact.
+ ***************************************************************************/
+
+void    test_swap_upload(void)
+
+{
+    rct_nxt_t   nxt;
+    nxt_sim_t   *sim;
+    nxt_dir_t   dir;
+    char        tmp_dir[] = "/tmp/testsim.XXXXXX",
+		data[PATH_MAX+1],
+		prog[PATH_MAX+1],
+		*files[2] = { data, prog };
+    int         ok;
+
+    if ( mkdtemp(tmp_dir) == NULL )
+    {
+	check("swap upload", 0);
+	return;
+    }
+    snprintf(data, sizeof(data), "%s/swap.txt", tmp_dir);
+    snprintf(prog, sizeof(prog), "%s/swap.rxe", tmp_dir);
+    sim_write_file(tmp_dir, "swap.txt", 3000, 1);
+    sim_write_file(tmp_dir, "swap.rxe", 3000, 1);
+    sim_open(&nxt, 0, 0, 0);
+    sim = nxt.transport_data;
+    ok = nxt_upload_files(&nxt, files, 2, RCT_NO_FLAGS) == RCT_OK;
+
+    sim_write_file(tmp_dir, "swap.txt", 5000, 2);
+    ok = ok && (nxt_upload_files(&nxt, files, 1, RCT_UPLOAD_SWAP) == RCT_OK);
+    rct_cache_invalidate(&nxt.listing.entry);
+    ok = ok && (nxt_dir_open(&nxt, &dir, "~*") == RCT_OK) && (dir.count == 0);
+    nxt_dir_close(&dir);
+    check("swap upload", ok && sim_brick_has(&nxt, tmp_dir, "swap.txt",
+					      5000, 2));
+
+    /* A linear file cannot resume, so this upload fails */
+    sim_write_file(tmp_dir, "swap.rxe", 5000, 2);
+    sim->telegrams = 0;
+    sim->disconnect_every = 10;
+    ok = nxt_upload_files(&nxt, files + 1, 1, RCT_UPLOAD_SWAP) != RCT_OK;
+    sim->disconnect_every = 0;
+    check("failed swap upload keeps old file",
+	  ok && sim_brick_has(&nxt, tmp_dir, "swap.rxe", 3000, 1));
+
+    nxt_manifest_clear(&nxt);
+    nxt_close_brick(&nxt);
+    unlink(data);
+    unlink(prog);
+    rmdir(tmp_dir);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  A brick that keeps losing its link must not hold up the other
+ *  bricks on the same scheduler while it backs off between attempts
+ *  to reconnect, and its requests must fail once it is given up on.
+ ***************************************************************************/
+
+void    test_sched_reconnect(void)
+
+{
+    rct_nxt_t       flaky,
+		    good;
+    nxt_sched_t     *sched;
+    nxt_request_t   reqs[8],
+		    req;
+    struct timeval  start,
+		    sent,
+		    end;
+    long            usec,
+		    worst = 0;
+    int             c,
+		    ok = 1;
+
+    sim_open(&flaky, 10000, 0, 6);
+    nxt_set_window(&flaky, 8);
+    nxt_set_reconnect(&flaky, 300);
+    sim_open(&good, 1000, 0, 0);
+    if ( (sched = nxt_sched_new()) == NULL )
+    {
+	check("scheduler runs on during a reconnect", 0);
+	return;
+    }
+    nxt_sched_add(sched, &flaky);
+    nxt_sched_add(sched, &good);
+    nxt_sched_start(sched);
+
+    for (c = 0; c < 8; ++c)
+    {
+	nxt_request_init(&reqs[c], NXT_DIRECT_CMD, NXT_DC_KEEP_ALIVE);
+	nxt_sched_submit(sched, &flaky, &reqs[c]);
+    }
+
+    /* Longer than the flaky brick's whole reconnect budget */
+    gettimeofday(&start, NULL);
+    do
+    {
+	nxt_request_init(&req, NXT_DIRECT_CMD, NXT_DC_KEEP_ALIVE);
+	gettimeofday(&sent, NULL);
+	ok = ok && (nxt_sched_transact(sched, &good, &req) == RCT_OK);
+	gettimeofday(&end, NULL);
+	usec = (end.tv_sec - sent.tv_sec) * 1000000L +
+	       (end.tv_usec - sent.tv_usec);
+	worst = MAX(worst, usec);
+	usec = (end.tv_sec - start.tv_sec) * 1000000L +
+	       (end.tv_usec - start.tv_usec);
+    }   while ( usec < 400000 );
+
+    for (c = 0; c < 8; ++c)
+	if ( nxt_sched_wait(sched, &reqs[c]) == RCT_OK )
+	    ok = 0;
+    check("scheduler runs on during a reconnect", ok && (worst < 20000));
+    nxt_sched_free(sched);
+    nxt_close_brick(&flaky);
+    nxt_close_brick(&good);
+}
@@ -143,6 +143,12 @@ rct_status_t     rct_open_brick(rct_brick_t * brick)
  *      - RCT_OVERWRITE - replace the file if it already exists
  *          on the brick.  Otherwise, upload file will fail and
  *          and return an error code.
+ *      - RCT_UPLOAD_FORCE - upload even if the NXT upload manifest
+ *          shows the file is already on the brick.
+ *      - RCT_UPLOAD_PLAY_SOUND - play a sound on the brick when done.
+ *      - RCT_UPLOAD_SWAP - on an NXT, write the file under a temporary
+ *          name and rename it over the old copy once complete, so a
+ *          program being replaced is missing only for a moment.
  */
 
 rct_status_t     rct_upload_file(rct_brick_t * brick, char *filename,
@@ -161,6 +167,42 @@ rct_status_t     rct_upload_file(rct_brick_t * brick, char *filename,
 }
 
 
+/**
+ *  \brief  Upload several files to the brick in one session.
+ *  \param  brick - Pointer to a brick structure with an open connection.
+ *  \param  filenames - names of the files on the local computer.
+ *  \param  count - number of files.
+ *  \param  flags - upload mode, as for rct_upload_file()
+ *
+ *  Upload all the files over the connection already open, which
+ *  saves a connect and disconnect per file.  On an NXT, the files are
+ *  sent largest first and the link is kept busy between them.  All
+ *  files are attempted, and the first error is returned.
+ */
+
+rct_status_t     rct_upload_files(rct_brick_t * brick, char *filenames[],
+				  int count, rct_flag_t flags)
+{
+    rct_status_t    status = RCT_OK,
+		    file_status;
+    int             c;
+
+    switch (brick->brick_type)
+    {
+	case RCT_NXT:
+	    return nxt_upload_files(&brick->nxt, filenames, count, flags);
+	default:
+	    for (c = 0; c < count; ++c)
+	    {
+		file_status = rct_upload_file(brick, filenames[c], flags);
+		if ( (file_status != RCT_OK) && (status == RCT_OK) )
+		    status = file_status;
+	    }
+	    return status;
+    }
+}
+
+
 /**
  *  \brief  Instruct the brick to play a sound file.
  *  \param  brick - Pointer to a brick structure with an open connection.
@@ -245,6 +287,30 @@ rct_status_t     rct_delete_file(rct_brick_t * brick, char *filename)
 }
 
 
+/****************************************************************************
+ * Description: 
+ *  Delete every file on the brick matching any of count patterns, in
+ *  fnmatch(3) syntax, in one session.  On an NXT, a set that covers
+ *  every file is erased with one command.
+ *  The brick must first be opened with rct_open_brick().
+ * Author: 
+ ***************************************************************************/
+
+rct_status_t     rct_delete_files(rct_brick_t * brick, char *patterns[],
+				  int count)
+
+{
+    switch (brick->brick_type)
+    {
+	case RCT_NXT:
+	    return nxt_delete_files(&brick->nxt, patterns, count);
+	default:
+	    break;
+    }
+    return RCT_INVALID_BRICK_TYPE;
+}
+
+
 /****************************************************************************
  * Description: 
  *  Run the named file.  The file must already exist on the brick, and
@@ -377,6 +443,28 @@ rct_status_t     rct_print_battery_level(rct_brick_t * brick)
 }
 
 
+/****************************************************************************
+ * Description: 
+ *  Print the name and size of each file on the brick whose name
+ *  matches glob, or of every file if glob is NULL, to stdout.
+ *  The brick must first be opened with rct_open_brick().
+ * Author: 
+ ***************************************************************************/
+
+rct_status_t     rct_print_files(rct_brick_t * brick, char *glob)
+
+{
+    switch (brick->brick_type)
+    {
+	case RCT_NXT:
+	    return nxt_print_files(&brick->nxt, glob);
+	default:
+	    break;
+    }
+    return RCT_INVALID_BRICK_TYPE;
+}
+
+
 /****************************************************************************
  * Description: 
  *  Retrieve the brick's firmware version.
@@ -470,5 +558,36 @@ rct_status_t    rct_motor_on(rct_brick_t *brick,int port,int power)
     return RCT_INVALID_BRICK_TYPE;
 }
 
+/**
+ *  \brief  Set how long to wait for each response from a brick.
+ *  \param  brick - Pointer to an initialized brick structure.
+ *  \param  timeout_ms - Time limit in milliseconds, or < 0 for none.
+ *
+ *  Commands that get no response in time fail with RCT_TIMEOUT
+ *  instead of hanging.  The default is NXT_DEFAULT_TIMEOUT_MS for
+ *  NXT bricks and PIC_DEFAULT_TIMEOUT_MS for VEX controllers.
+ *
+ *  Supported bricks:
+ *      - NXT
+ *      - VEX
+ */
+
+rct_status_t    rct_set_timeout(rct_brick_t *brick,int timeout_ms)
+
+{
+    switch (brick->brick_type)
+    {
+	case RCT_NXT:
+	    nxt_set_timeout(&brick->nxt,timeout_ms);
+	    return RCT_OK;
+	case RCT_VEX:
+	    brick->vex.timeout_ms = timeout_ms;
+	    return RCT_OK;
+	default:
+	    break;
+    }
+    return RCT_INVALID_BRICK_TYPE;
+}
+
 /** @} */
 
@@ -0,0 +1,214 @@
+/****************************************************************************
+ *  This file contains the query cache.  Device info, firmware versions,
+ *  the battery level and the PIC bootloader version are asked for over
+ *  and over by tools and GUIs, but change slowly or not at all, so the
+ *  last answer is kept for a configurable time.  The NXT file listing
+ *  (nxt_dir.c) is kept the same way.  See rct_nxt.h for how
+ *  NXT queries use the cache.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Set up an empty cache entry that stays fresh for ttl_ms.
+ * Author:
+ ***************************************************************************/
+
+void    rct_cache_init(rct_cache_entry_t *entry, int ttl_ms)
+
+{
+    entry->ttl_ms = ttl_ms;
+    entry->valid = 0;
+    timerclear(&entry->expires);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return non-zero if the entry holds a result that has not expired.
+ * Author:
+ ***************************************************************************/
+
+int     rct_cache_fresh(const rct_cache_entry_t *entry)
+
+{
+    if ( !entry->valid || (entry->ttl_ms == 0) )
+	return 0;
+    return rct_deadline_remaining(&entry->expires) != 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Mark the entry as holding a result obtained just now.
+ * Author:
+ ***************************************************************************/
+
+void    rct_cache_store(rct_cache_entry_t *entry)
+
+{
+    rct_deadline_set(&entry->expires, entry->ttl_ms);
+    entry->valid = 1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Discard the result held by the entry, keeping its TTL.
+ * Author:
+ ***************************************************************************/
+
+void    rct_cache_invalidate(rct_cache_entry_t *entry)
+
+{
+    entry->valid = 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Set up an NXT's cache with the default TTLs.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_cache_init(rct_nxt_t *nxt)
+
+{
+    rct_cache_init(&nxt->cache[NXT_CACHE_BATTERY].entry,
+		   NXT_CACHE_BATTERY_MS);
+    rct_cache_init(&nxt->cache[NXT_CACHE_VERSIONS].entry,
+		   NXT_CACHE_VERSIONS_MS);
+    rct_cache_init(&nxt->cache[NXT_CACHE_DEVICE_INFO].entry,
+		   NXT_CACHE_DEVICE_INFO_MS);
+    rct_cache_init(&nxt->listing.entry, NXT_CACHE_LISTING_MS);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Discard everything cached for an NXT.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_cache_flush(rct_nxt_t *nxt)
+
+{
+    int     c;
+
+    for (c = 0; c < NXT_CACHE_ENTRIES; ++c)
+	rct_cache_invalidate(&nxt->cache[c].entry);
+    rct_cache_invalidate(&nxt->listing.entry);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the cache slot of a query, or -1 if it is not cached.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_cache_query(int cmd_type, int cmd_code)
+
+{
+    switch(cmd_type & ~NXT_NO_RESPONSE)
+    {
+	case    NXT_DIRECT_CMD:
+	    if ( cmd_code == NXT_DC_BATTERY_LEVEL )
+		return NXT_CACHE_BATTERY;
+	    break;
+	case    NXT_SYSTEM_CMD:
+	    if ( cmd_code == NXT_SC_GET_VERSIONS )
+		return NXT_CACHE_VERSIONS;
+	    if ( cmd_code == NXT_SC_GET_DEVICE_INFO )
+		return NXT_CACHE_DEVICE_INFO;
+	    break;
+    }
+    return -1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the cached reply for the query in req, or NULL if req is
+ *  not a cached query.
+ * Author:
+ ***************************************************************************/
+
+nxt_cached_reply_t  *nxt_cache_find(rct_nxt_t *nxt, const nxt_request_t *req)
+
+{
+    int     query;
+
+    if ( (req->cmd_len != 2) ||
+	 ((query = nxt_cache_query(req->cmd[0], req->cmd[1])) < 0) )
+	return NULL;
+    return &nxt->cache[query];
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Set how long the reply to a cached query stays fresh.  0 turns
+ *  caching off for it, and a negative value keeps it until the brick
+ *  is reopened.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_cache_set_ttl(rct_nxt_t *nxt, int cmd_type, int cmd_code,
+				  int ttl_ms)
+
+{
+    int     query;
+
+    if ( (query = nxt_cache_query(cmd_type, cmd_code)) < 0 )
+    {
+	fprintf(stderr, "Error: %s(): Command %d:%d is not cached.\n",
+		__func__, cmd_type, cmd_code);
+	return RCT_INVALID_DATA;
+    }
+    rct_cache_init(&nxt->cache[query].entry, ttl_ms);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Called for every request sent.  Commands that change the flash
+ *  or the brick name make the cached device info stale, and those
+ *  that add, remove or rename files the cached listing.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_cache_sent(rct_nxt_t *nxt, const nxt_request_t *req)
+
+{
+    if ( (req->cmd[0] & ~NXT_NO_RESPONSE) != NXT_SYSTEM_CMD )
+	return;
+    switch(req->cmd[1])
+    {
+	case    NXT_SC_OPEN_WRITE:
+	case    NXT_SC_OPEN_WRITE_LINEAR:
+	case    NXT_SC_OPEN_WRITE_DATA:
+	case    NXT_SC_OPEN_APPEND_DATA:
+	case    NXT_SC_DELETE:
+	case    NXT_SC_DELETE_USER_FLASH:
+	    rct_cache_invalidate(&nxt->listing.entry);
+	    rct_cache_invalidate(&nxt->cache[NXT_CACHE_DEVICE_INFO].entry);
+	    break;
+	case    NXT_SC_RENAME_FILE:
+	    rct_cache_invalidate(&nxt->listing.entry);
+	    break;
+	case    NXT_SC_SET_BRICK_NAME:
+	case    NXT_SC_BT_FACTORY_RESET:
+	    rct_cache_invalidate(&nxt->cache[NXT_CACHE_DEVICE_INFO].entry);
+	    break;
+	default:
+	    break;
+    }
+}
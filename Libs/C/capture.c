@@ -0,0 +1,278 @@
+/****************************************************************************
+ *  This file contains the capture file writer and reader.  The writer
+ *  is called by the transport layer for every frame sent to or
+ *  received from a brick, so it does nothing more than format a
+ *  16-byte header and hand it to a fully buffered stdio stream.
+ *  See rct_capture.h for the file format.  Captures are written by
+ *  PIC-only programs too, so this file has its own little-endian
+ *  helpers rather than using the ones in nxt.c.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <usb.h>
+#include "roboctl.h"
+
+rct_capture_t   Capture = { NULL };
+
+
+/****************************************************************************
+ * Description:
+ *  Start capturing all brick traffic to the file at path, replacing
+ *  its contents.  The capture is flushed and closed by
+ *  rct_capture_close(), or at exit.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    rct_capture_open(const char *path)
+
+{
+    unsigned char   header[RCT_CAPTURE_HEADER_LEN];
+
+    if ( Capture.fp != NULL )
+    {
+	fprintf(stderr, "Error: %s(): A capture is already open.\n", __func__);
+	return RCT_CANNOT_OPEN_FILE;
+    }
+    if ( (Capture.fp = fopen(path, "w")) == NULL )
+    {
+	fprintf(stderr, "Error: %s(): Cannot create %s: %s\n",
+		__func__, path, strerror(errno));
+	return RCT_CANNOT_OPEN_FILE;
+    }
+    setvbuf(Capture.fp, NULL, _IOFBF, RCT_CAPTURE_BUFSIZ);
+    gettimeofday(&Capture.start, NULL);
+
+    memcpy(header, RCT_CAPTURE_MAGIC, 6);
+    rct_capture_put16(header + 6, RCT_CAPTURE_VERSION);
+    rct_capture_put32(header + 8, Capture.start.tv_sec);
+    rct_capture_put32(header + 12, Capture.start.tv_usec);
+    fwrite(header, RCT_CAPTURE_HEADER_LEN, 1, Capture.fp);
+
+    if ( !Capture.atexit_done )
+    {
+	atexit(rct_capture_close);
+	Capture.atexit_done = 1;
+    }
+    debug_printf("Capturing to %s\n", path);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Start a capture if ROBOCTL_CAPTURE names a file and none is open.
+ *  Called when a brick is opened.
+ * Author:
+ ***************************************************************************/
+
+void    rct_capture_env(void)
+
+{
+    char    *path;
+
+    if ( (Capture.fp == NULL) && ((path = getenv("ROBOCTL_CAPTURE")) != NULL)
+	 && (*path != '\0') )
+	rct_capture_open(path);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Finish the current capture, if any.
+ * Author:
+ ***************************************************************************/
+
+void    rct_capture_close(void)
+
+{
+    if ( Capture.fp != NULL )
+    {
+	fclose(Capture.fp);
+	Capture.fp = NULL;
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return a new brick id for capture frames.
+ * Author:
+ ***************************************************************************/
+
+int     rct_capture_new_id(void)
+
+{
+    return Capture.next_id++ & 0xff;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Record one frame, if a capture is open.  The header and data go
+ *  out in a single fwrite(), so frames from different threads are
+ *  never interleaved.
+ * Author:
+ ***************************************************************************/
+
+void    rct_capture_frame(rct_brick_type_t brick_type, int transport,
+			  int brick_id, rct_capture_dir_t direction,
+			  const void *buf, int len)
+
+{
+    unsigned char   record[RCT_CAPTURE_FRAME_LEN + RCT_CAPTURE_DATA_MAX];
+    struct timeval  now;
+
+    if ( (Capture.fp == NULL) || (len <= 0) )
+	return;
+    if ( len > RCT_CAPTURE_DATA_MAX )
+	len = RCT_CAPTURE_DATA_MAX;
+
+    gettimeofday(&now, NULL);
+    now.tv_sec -= Capture.start.tv_sec;
+    if ( (now.tv_usec -= Capture.start.tv_usec) < 0 )
+    {
+	now.tv_usec += 1000000;
+	--now.tv_sec;
+    }
+    rct_capture_put32(record, now.tv_sec);
+    rct_capture_put32(record + 4, now.tv_usec);
+    rct_capture_put16(record + 8, len);
+    record[10] = direction;
+    record[11] = brick_type;
+    record[12] = transport;
+    record[13] = brick_id;
+    record[14] = record[15] = 0;
+    memcpy(record + RCT_CAPTURE_FRAME_LEN, buf, len);
+    fwrite(record, RCT_CAPTURE_FRAME_LEN + len, 1, Capture.fp);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Open a capture file for reading and check its header.  The start
+ *  time of the capture is stored in *start if start is not NULL.
+ *  Returns NULL on error.
+ * Author:
+ ***************************************************************************/
+
+FILE    *rct_capture_open_read(const char *path, struct timeval *start)
+
+{
+    FILE            *fp;
+    unsigned char   header[RCT_CAPTURE_HEADER_LEN];
+
+    if ( (fp = fopen(path, "r")) == NULL )
+    {
+	fprintf(stderr, "Error: %s(): Cannot open %s: %s\n",
+		__func__, path, strerror(errno));
+	return NULL;
+    }
+    if ( (fread(header, RCT_CAPTURE_HEADER_LEN, 1, fp) != 1) ||
+	 (memcmp(header, RCT_CAPTURE_MAGIC, 6) != 0) )
+    {
+	fprintf(stderr, "Error: %s(): %s is not a capture file.\n",
+		__func__, path);
+	fclose(fp);
+	return NULL;
+    }
+    if ( rct_capture_get16(header + 6) != RCT_CAPTURE_VERSION )
+    {
+	fprintf(stderr, "Error: %s(): %s: Unsupported version %u.\n",
+		__func__, path, rct_capture_get16(header + 6));
+	fclose(fp);
+	return NULL;
+    }
+    if ( start != NULL )
+    {
+	start->tv_sec = rct_capture_get32(header + 8);
+	start->tv_usec = rct_capture_get32(header + 12);
+    }
+    return fp;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Read the next frame from a capture opened by rct_capture_open_read().
+ *  Returns 1 if a frame was read, 0 at end of file, or -1 if the file
+ *  is truncated or corrupt.
+ * Author:
+ ***************************************************************************/
+
+int     rct_capture_read_frame(FILE *fp, rct_capture_frame_t *frame)
+
+{
+    unsigned char   header[RCT_CAPTURE_FRAME_LEN];
+    size_t          bytes;
+
+    if ( (bytes = fread(header, 1, RCT_CAPTURE_FRAME_LEN, fp)) == 0 )
+	return 0;
+    if ( bytes != RCT_CAPTURE_FRAME_LEN )
+    {
+	fprintf(stderr, "Error: %s(): Truncated frame header.\n", __func__);
+	return -1;
+    }
+    frame->time.tv_sec = rct_capture_get32(header);
+    frame->time.tv_usec = rct_capture_get32(header + 4);
+    frame->len = rct_capture_get16(header + 8);
+    frame->direction = header[10];
+    frame->brick_type = header[11];
+    frame->transport = header[12];
+    frame->brick_id = header[13];
+    if ( (frame->len > RCT_CAPTURE_DATA_MAX) ||
+	 (fread(frame->data, 1, frame->len, fp) != (size_t)frame->len) )
+    {
+	fprintf(stderr, "Error: %s(): Bad or truncated frame.\n", __func__);
+	return -1;
+    }
+    return 1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Store a 16 or 32 bit value in little-endian order.
+ * Author:
+ ***************************************************************************/
+
+void    rct_capture_put16(unsigned char *buf, unsigned long val)
+
+{
+    buf[0] = val & 0xff;
+    buf[1] = (val >> 8) & 0xff;
+}
+
+
+void    rct_capture_put32(unsigned char *buf, unsigned long val)
+
+{
+    buf[0] = val & 0xff;
+    buf[1] = (val >> 8) & 0xff;
+    buf[2] = (val >> 16) & 0xff;
+    buf[3] = (val >> 24) & 0xff;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return a 16 or 32 bit little-endian value.
+ * Author:
+ ***************************************************************************/
+
+unsigned int    rct_capture_get16(const unsigned char *buf)
+
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+
+unsigned long   rct_capture_get32(const unsigned char *buf)
+
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) |
+	   ((unsigned long)buf[3] << 24);
+}
@@ -0,0 +1,58 @@
+
+/****************************************************************************
+ *  Deadlines for transport reads.  A deadline is an absolute time, so
+ *  a budget covers an entire multi-read response rather than being
+ *  restarted by every byte that trickles in.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Set deadline to timeout_ms milliseconds from now.  A negative
+ *  timeout means no deadline.
+ * Author:
+ ***************************************************************************/
+
+void    rct_deadline_set(struct timeval *deadline, int timeout_ms)
+
+{
+    if ( timeout_ms < 0 )
+    {
+	deadline->tv_sec = deadline->tv_usec = 0;
+	return;
+    }
+    gettimeofday(deadline, NULL);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_usec += (timeout_ms % 1000) * 1000L;
+    if ( deadline->tv_usec >= 1000000 )
+    {
+	++deadline->tv_sec;
+	deadline->tv_usec -= 1000000;
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Milliseconds left until deadline, rounded up, in a form suitable
+ *  for poll(): 0 if it has passed and -1 if there is no deadline.
+ * Author:
+ ***************************************************************************/
+
+int     rct_deadline_remaining(const struct timeval *deadline)
+
+{
+    struct timeval  now;
+    long            ms;
+
+    if ( (deadline->tv_sec == 0) && (deadline->tv_usec == 0) )
+	return -1;
+    gettimeofday(&now, NULL);
+    ms = (deadline->tv_sec - now.tv_sec) * 1000L +
+	 (deadline->tv_usec - now.tv_usec + 999) / 1000;
+    return ms > 0 ? ms : 0;
+}
@@ -9,12 +9,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <usb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
 #include <sysexits.h>
 #include <stdarg.h>
 #include <inttypes.h>
@@ -27,19 +30,39 @@ extern int  Debug;
 /****************************************************************************
  * Description: 
  *  Open a connection to an NXT brick.  This must be done before issuing
- *  any direct or system commands.  If a USB connection is sensed, then
- *  USB will be used for the connection.  If not, an attempt is made to
- *  open a Bluetooth connection.
+ *  any direct or system commands.  If the caller preselected a transport
+ *  (see nxt_set_transport()), it is used.  Otherwise, if a USB connection
+ *  is sensed, then USB will be used for the connection.  If not, an
+ *  attempt is made to open a Bluetooth connection.
  * Author:  Jason W. Bacon
  ***************************************************************************/
 
 rct_status_t nxt_open_brick(rct_nxt_t *nxt)
 
 {
-    if ( nxt->usb_dev != NULL )
-	return nxt_open_brick_usb(nxt);
-    else
-	return nxt_open_brick_bluetooth(nxt);
+    rct_status_t    status;
+    
+    if ( nxt->transport == NULL )
+    {
+	if ( nxt->usb_dev != NULL )
+#ifdef RCT_LIBUSB1
+	    nxt->transport = &nxt_usb1_transport;
+#else
+	    nxt->transport = &nxt_usb_transport;
+#endif
+	else
+	    nxt->transport = &nxt_bluetooth_transport;
+    }
+    
+    debug_printf("Opening %s connection...\n", nxt->transport->name);
+    if ( (status = nxt->transport->open(nxt)) == RCT_OK )
+    {
+	nxt->is_open = 1;
+	nxt_cache_flush(nxt);
+	rct_capture_env();
+	nxt->capture_id = rct_capture_new_id();
+    }
+    return status;
 }
 
 
@@ -68,6 +91,7 @@ rct_status_t nxt_open_brick_usb(rct_nxt_t *nxt)
     {
 	fprintf(stderr, "Error: %s(): Could not claim interface.\n", __func__);
 	usb_close(nxt->usb_handle);
+	nxt->usb_handle = NULL;
 	return RCT_CANNOT_CLAIM_INTERFACE;
     }
 
@@ -129,6 +153,7 @@ rct_status_t nxt_open_brick_bluetooth(rct_nxt_t *nxt)
     if (bind(fd, (struct sockaddr *)&laddr, sizeof(laddr)) < 0)
     {
 	perror("nxt_open_brick_bluetooth(): Cannot bind");
+	close(fd);
 	return RCT_CANNOT_BIND_SOCKET;
     }
 
@@ -146,9 +171,10 @@ rct_status_t nxt_open_brick_bluetooth(rct_nxt_t *nxt)
 	fprintf(stderr, "Error: %s(): Connect failed: %s\n",
 		__func__, strerror(errno));
 	fputs("Try rebooting your NXT brick.\n",stderr);
+	close(fd);
 	return RCT_CANNOT_CONNECT_SOCKET;
     }
-    nxt->bluetooth_fd = fd;
+    nxt->fd = fd;
     
 #elif defined(Darwin)
     /* Use IOBluetooth framework */
@@ -248,6 +274,11 @@ rct_status_t nxt_print_firmware_version(rct_nxt_t *nxt)
  *  require significant flexibility in the arguments needed to construct
  *  the protocol for each command.
  *
+ *  The library itself now builds commands from the descriptor tables
+ *  in nxt_cmd.c (see nxt_cmd_init()), which need no format parsing.
+ *  nxt_send_cmd() and nxt_send_simple_cmd() remain for existing
+ *  client programs.
+ *
  * Author: Jason W. Bacon
  ***************************************************************************/
 
@@ -266,15 +297,13 @@ int nxt_send_simple_cmd(rct_nxt_t * nxt, int cmd_type, int cmd,
     {
 	cmd_buff[0] = cmd_type;
 	cmd_buff[1] = cmd;
-	if (nxt_send_buf(nxt, cmd_buff, 2) == 2)
-	{
-	    bytes = nxt_recv_buf(nxt, response, response_max);
-	}
-	else
+	if ( (bytes = nxt_exchange(nxt, cmd_buff, 2, response,
+				   response_max)) < 0 )
 	{
 	    fprintf(stderr, 
-		    "nxt_direct_cmd(): Error: Failed to send command %d.\n",
+		    "nxt_direct_cmd(): Error: Command %d failed.\n",
 		    cmd);
+	    bytes = 0;
 	}
     }
     return bytes;
@@ -296,7 +325,7 @@ int nxt_send_cmd(rct_nxt_t * nxt, int cmd_type, int cmd, char *response,
 {
     int     bytes,
 	    len;
-    unsigned char    cmd_buff[NXT_BUFF_LEN+1],
+    unsigned char    cmd_buff[NXT_PACKET_MAX],
 	    *outp,
 	    *string;
     uint16_t  short_word;
@@ -348,17 +377,12 @@ int nxt_send_cmd(rct_nxt_t * nxt, int cmd_type, int cmd, char *response,
 	
 	len = outp - cmd_buff;
 	
-	if (nxt_send_buf(nxt, (char *)cmd_buff, len) == len)
-	{
-	    if ( nxt->response_mask != NXT_NO_RESPONSE )
-		bytes = nxt_recv_buf(nxt, response, response_max);
-	    else
-		bytes = 0;
-	}
-	else
+	/* The engine returns 0 bytes for NXT_NO_RESPONSE commands */
+	if ( (bytes = nxt_exchange(nxt, (char *)cmd_buff, len, response,
+				   response_max)) < 0 )
 	{
 	    fprintf(stderr, 
-		    "nxt_send_cmd(): Error: Failed to send command %d:%d.\n",
+		    "nxt_send_cmd(): Error: Command %d:%d failed.\n",
 		    cmd_type,cmd);
 	    bytes = 0;
 	}
@@ -370,7 +394,7 @@ int nxt_send_cmd(rct_nxt_t * nxt, int cmd_type, int cmd, char *response,
 /****************************************************************************
  * Description: 
  *  Send the contents of buffer to an NXT brick via the currently
- *  open interface.
+ *  open transport.
  *  The rct_nxt_t structure must first be initialized using nxt_init_struct(),
  *  which is normally called (indirectly) by rct_find_bricks().
  * Author: Jason W. Bacon
@@ -380,49 +404,57 @@ int     nxt_send_buf(rct_nxt_t * nxt, char *buf, int len)
 
 {
     int     bytes;
-    unsigned short  msg_len = len;
-    char    bt_buf[NXT_BUFF_LEN+1];
-
-    switch(nxt_connection_type(nxt))
-    {
-	case    NXT_USB:
-	    debug_nxt_dump_cmd(buf,len,"");
-	    bytes = usb_bulk_write(nxt->usb_handle, NXT_USB_OUT_ENDPOINT, buf, len,
-			   USB_TIMEOUT);
-	    break;
-	case    NXT_BLUETOOTH:
-	    if ( len > NXT_BUFF_LEN - 2 )
-	    {
-		fprintf(stderr,
-		    "nxt_send_buf(): Internal error: Message length %d exceeds maximum of %d.\n",
-		    len,NXT_BUFF_LEN);
-		exit(EX_SOFTWARE);
-	    }
-	    /* Bluetooth adds a 2-byte message length to the beginning
-	       of each packet.  Otherwise, the protocol is identical to USB */
-	    short2buf((unsigned char *)bt_buf,msg_len);
-	    
-	    memcpy(bt_buf+2,buf,len);
-	    debug_printf("nxt_send_buf() sending %d bytes...\n",len+2);
-	    debug_nxt_dump_cmd(bt_buf,len+2,"");
-	    /* Subtract msg_len 2 bytes from total returned */
-	    bytes = write(nxt->bluetooth_fd,bt_buf,len+2) - 2;
-	    break;
-	case    NXT_NO_CONNECTION:
-	    fputs("nxt_send_buf(): Internal error: No connection.\n",stderr);
-	    exit(EX_SOFTWARE);
-	    break;
-	default:
-	    fprintf(stderr,
-		"nxt_send_buf(): Internal error: Unknown connection type: %d.\n",
-		nxt_connection_type(nxt));
-	    exit(EX_SOFTWARE);
-	    break;
+
+    if ( !NXT_IS_OPEN(nxt) )
+    {
+	fprintf(stderr, "Error: %s(): No connection.\n", __func__);
+	return -1;
     }
+    if ( (bytes = nxt->transport->send(nxt, buf, len)) > 0 )
+	nxt_capture(nxt, RCT_CAPTURE_TO_BRICK, buf, len);
     return bytes;
 }
 
 
+/****************************************************************************
+ * Description: 
+ *  Send several telegrams, one per iovec, using a single system call
+ *  where the transport allows.  Returns the number of telegrams sent,
+ *  or -1 if none could be sent.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_send_bufs(rct_nxt_t *nxt, const struct iovec *iov, int count)
+
+{
+    int     c,
+	    sent;
+
+    if ( !NXT_IS_OPEN(nxt) )
+    {
+	fprintf(stderr, "Error: %s(): No connection.\n", __func__);
+	return -1;
+    }
+    if ( nxt->transport->sendv != NULL )
+	sent = nxt->transport->sendv(nxt, iov, count);
+    else
+    {
+	for (sent = 0; sent < count; ++sent)
+	{
+	    if ( nxt->transport->send(nxt, iov[sent].iov_base,
+		    iov[sent].iov_len) != (int)iov[sent].iov_len )
+		break;
+	}
+	if ( sent == 0 )
+	    sent = -1;
+    }
+    for (c = 0; c < sent; ++c)
+	nxt_capture(nxt, RCT_CAPTURE_TO_BRICK, iov[c].iov_base,
+		    iov[c].iov_len);
+    return sent;
+}
+
+
 /****************************************************************************
  * Description: 
  *  Send a null-terminated string to the NXT.
@@ -440,49 +472,113 @@ rct_status_t nxt_send_str(rct_nxt_t * nxt, char *str)
 
 /****************************************************************************
  * Description: 
- *  Read a response from an NXT via the currently open connection.
+ *  Read a response from an NXT via the currently open transport.
+ *  Returns the number of bytes received, or -1 on error.
  *  The rct_nxt_t structure must first be initialized using nxt_init_struct(),
  *  which is normally called (indirectly) by rct_find_bricks().
  * Author: Jason W. Bacon
  ***************************************************************************/
 
-rct_status_t nxt_recv_buf(rct_nxt_t * nxt, char *buf, int maxlen)
+int     nxt_recv_buf(rct_nxt_t * nxt, char *buf, int maxlen)
 
 {
     int     bytes;
-    char    bt_buf[NXT_BUFF_LEN+1];
-    
-    switch(nxt_connection_type(nxt))
-    {
-	case    NXT_USB:
-	    bytes = usb_bulk_read(nxt->usb_handle, NXT_USB_IN_ENDPOINT, buf, maxlen, USB_TIMEOUT);
-	    break;
-	case    NXT_BLUETOOTH:
-	    /* Bluetooth prepends an extra 2 bytes for message length */
-	    bytes = read(nxt->bluetooth_fd,bt_buf,NXT_BUFF_LEN) - 2;
-	    if ( bytes > maxlen )
-	    {
-		fprintf(stderr,"nxt_recv_buf(): Internal error: %d byte message is greater than maxlen of %d\n",
-			bytes,maxlen);
-		exit(EX_SOFTWARE);
-	    }
-	    memcpy(buf,bt_buf+2,bytes);
-	    break;
-	case    NXT_NO_CONNECTION:
-	    fputs("nxt_recv_buf(): Internal error: No connection.\n",stderr);
-	    exit(EX_SOFTWARE);
-	    break;
-	default:
-	    fprintf(stderr,
-		"nxt_recv_buf(): Internal error: Unknown connection type: %d.\n",
-		nxt_connection_type(nxt));
-	    exit(EX_SOFTWARE);
-	    break;
+
+    if ( !NXT_IS_OPEN(nxt) )
+    {
+	fprintf(stderr, "Error: %s(): No connection.\n", __func__);
+	return -1;
+    }
+    if ( (bytes = nxt->transport->recv(nxt, buf, maxlen)) > 0 )
+	nxt_capture(nxt, RCT_CAPTURE_FROM_BRICK, buf, bytes);
+    return bytes;
+}
+
+
+/****************************************************************************
+ * Description: 
+ *  Wait up to timeout_ms milliseconds (forever if negative) for a
+ *  response from an NXT.  Returns > 0 if one is ready, 0 on timeout,
+ *  or -1 on error.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_poll_response(rct_nxt_t *nxt, int timeout_ms)
+
+{
+    if ( !NXT_IS_OPEN(nxt) )
+    {
+	fprintf(stderr, "Error: %s(): No connection.\n", __func__);
+	return -1;
     }
+    return nxt->transport->poll(nxt, timeout_ms);
+}
+
+
+/****************************************************************************
+ * Description: 
+ *  Receive the next response from an NXT, without copying it if the
+ *  transport buffers incoming data.  Otherwise it is read into buf,
+ *  which must hold NXT_PACKET_MAX bytes.  Either way, *packet points to
+ *  the response, which remains valid until nxt_release_packet().
+ *  Returns the number of bytes received, 0 if the transport timed out,
+ *  or -1 on error.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_recv_packet(rct_nxt_t *nxt, unsigned char **packet,
+			unsigned char *buf)
+
+{
+    int     bytes;
+
+    if ( !NXT_IS_OPEN(nxt) )
+    {
+	fprintf(stderr, "Error: %s(): No connection.\n", __func__);
+	return -1;
+    }
+    if ( nxt->transport->peek != NULL )
+	bytes = nxt->transport->peek(nxt, packet);
+    else
+    {
+	*packet = buf;
+	bytes = nxt->transport->recv(nxt, (char *)buf, NXT_PACKET_MAX);
+    }
+    if ( bytes > 0 )
+	nxt_capture(nxt, RCT_CAPTURE_FROM_BRICK, *packet, bytes);
     return bytes;
 }
 
 
+/****************************************************************************
+ * Description: 
+ *  Release a response returned by nxt_recv_packet().
+ * Author:
+ ***************************************************************************/
+
+void    nxt_release_packet(rct_nxt_t *nxt)
+
+{
+    if ( nxt->transport->consume != NULL )
+	nxt->transport->consume(nxt);
+}
+
+
+/****************************************************************************
+ * Description: 
+ *  Record a telegram in the capture file, if one is open.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_capture(rct_nxt_t *nxt, rct_capture_dir_t direction,
+		    const void *buf, int len)
+
+{
+    rct_capture_frame(RCT_NXT, nxt->transport->type, nxt->capture_id,
+		      direction, buf, len);
+}
+
+
 /****************************************************************************
  * Description: 
  *  Close the currently open connection to an NXT brick.
@@ -494,17 +590,16 @@ rct_status_t nxt_recv_buf(rct_nxt_t * nxt, char *buf, int maxlen)
 rct_status_t nxt_close_brick(rct_nxt_t *nxt)
 
 {
-    switch(nxt_connection_type(nxt))
+    if ( !NXT_IS_OPEN(nxt) )
     {
-	case    NXT_USB:
-	    return nxt_close_brick_usb(nxt);
-	case    NXT_BLUETOOTH:
-	    return nxt_close_brick_bluetooth(nxt);
-	case    NXT_NO_CONNECTION:
-	    fputs("nxt_close_connection(): Warning: Nothing to close.\n",stderr);
-	    return RCT_NOT_CONNECTED;
+	fputs("nxt_close_connection(): Warning: Nothing to close.\n",stderr);
+	return RCT_NOT_CONNECTED;
     }
-    return RCT_OK;
+    /* Collect outstanding replies so the brick is idle when reopened */
+    nxt_drain(nxt);
+    nxt_listing_free(nxt);
+    nxt->is_open = 0;
+    return nxt->transport->close(nxt);
 }
 
 
@@ -547,11 +642,13 @@ rct_status_t nxt_close_brick_usb(rct_nxt_t *nxt)
 rct_status_t nxt_close_brick_bluetooth(rct_nxt_t *nxt)
 
 {
-    if ( nxt->bluetooth_fd != -1 )
+    if ( nxt->fd != -1 )
     {
 	debug_printf("Closing Bluetooth connection...\n");
-	close(nxt->bluetooth_fd);
-	nxt->bluetooth_fd = -1;
+	close(nxt->fd);
+	nxt->fd = -1;
+	free(nxt->rx_ring);
+	nxt->rx_ring = NULL;
 	/* This sleep() is a hack until I figure out why connect() fails with
 	    "connection reset by peer" when running roboctl twice in
 	    quick succession.  This is a problem for ape, which runs
@@ -560,8 +657,10 @@ rct_status_t nxt_close_brick_bluetooth(rct_nxt_t *nxt)
 	    roboctl start program
 	    
 	    with no delay in between.
+	    nxt_reconnect() retries failed connects itself, so it skips this.
 	*/
-	sleep(1);
+	if ( !nxt->reconnecting )
+	    sleep(1);
     }
     else
     {
@@ -638,7 +737,7 @@ rct_status_t nxt_validate_filename(char *filename, char *correct_ext, const char
 
 /****************************************************************************
  * Description:
- *  Upload a file to an NXT brick.
+ *  Upload a file to an NXT brick.  See nxt_upload_files() for flags.
  *  The rct_nxt_t structure must first be initialized using nxt_init_struct(),
  *  which is normally called (indirectly) by rct_find_bricks().
  * Author: Jason W. Bacon
@@ -647,36 +746,131 @@ rct_status_t nxt_validate_filename(char *filename, char *correct_ext, const char
 rct_status_t nxt_upload_file(rct_nxt_t *nxt,char *filename_on_pc,rct_flag_t flags)
 
 {
-    int             file_handle;
-    rct_status_t    status;
-    char            *filename_on_brick;
-    struct stat     st;
-    
-    /* Upload file */
-    debug_printf("Uploading %s\n",filename_on_pc);
+    return nxt_upload_files(nxt,&filename_on_pc,1,flags);
+}
 
-    filename_on_brick = nxt_pc_to_brick_filename(filename_on_pc);
-    fprintf(stderr, "filename_on_brick = %s\n", filename_on_brick);
 
-    if ( stat(filename_on_pc,&st) != 0 )
+/****************************************************************************
+ * Description:
+ *  Upload several files to an NXT brick over the open connection.
+ *  Files are sent largest first, so that the biggest linear files are
+ *  placed while the flash is least fragmented.  Between files, the
+ *  CLOSE of one, the DELETE of the next (with RCT_OVERWRITE) and its
+ *  OPEN go out together, so the link does not idle for a round trip
+ *  each.  Files the manifest shows to be on the brick already are
+ *  skipped unless RCT_UPLOAD_FORCE is given.  Executables, icons and
+ *  sounds are written as linear files, anything else as data files,
+ *  which nxt_upload_write() can resume if the link drops.
+ *
+ *  Nothing is written unless the whole set fits in the free flash.
+ *  If the free flash is too fragmented for a linear file, other files
+ *  are moved aside and put back afterwards (see nxt_flash.c).
+ *
+ *  Valid flags:
+ *      RCT_OVERWRITE           Replace files that exist on the brick
+ *      RCT_UPLOAD_FORCE        Upload even if the manifest matches
+ *      RCT_UPLOAD_PLAY_SOUND   Play a sound on the brick when done
+ *      RCT_UPLOAD_SWAP         Replace files via a temp name and
+ *                              rename (see nxt_upload_swap()), so the
+ *                              old copy stays until the new one is
+ *                              complete.  Implies RCT_OVERWRITE.
+ *
+ *  Every file is attempted, and the first error is returned.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_upload_files(rct_nxt_t *nxt,char *filenames[],int count,
+				 rct_flag_t flags)
+
+{
+    nxt_upload_t        *uploads,
+			*up,
+			dest;
+    nxt_flash_plan_t    plan;
+    char                swap_name[NXT_FILENAME_MAX+1];
+    int                 c,
+			file_handle = -1;
+    rct_flag_t          open_flags = flags;
+    rct_status_t        status = RCT_OK;
+
+    if ( (uploads = malloc(count * sizeof(*uploads))) == NULL )
     {
-	fprintf(stderr,"nxt_open_file_write(): Cannot stat %s.\n",filename_on_pc);
-	return -1;
+	fprintf(stderr, "Error: %s(): Cannot allocate upload list.\n", __func__);
+	return RCT_COMMAND_FAILED;
     }
-    // Is open_write_data needed for some file types?
-    // file_handle = nxt_open_file_write_data(nxt,filename);
-    file_handle = nxt_open_file_write_linear(nxt,filename_on_brick, st.st_size);
-    if ( file_handle != -1 )
+    for (c = 0; c < count; ++c)
     {
-	status = nxt_write_file(nxt,filename_on_pc,file_handle);
-	nxt_close_file(nxt,file_handle);
+	up = &uploads[c];
+	up->path = filenames[c];
+	up->name = nxt_pc_to_brick_filename(filenames[c]);
+	if ( (up->status = nxt_validate_filename(up->name,NULL,__func__))
+		== RCT_OK )
+	    up->status = nxt_file_hash(up->path,&up->size,&up->hash);
+	up->unchanged = (up->status == RCT_OK) && !(flags & RCT_UPLOAD_FORCE)
+	    && nxt_manifest_unchanged(nxt,up->name,up->size,up->hash);
     }
-    else
+    qsort(uploads,count,sizeof(*uploads),nxt_upload_cmp);
+
+    /* Refuse a set that cannot fit before writing any of it */
+    if ( (status = nxt_flash_plan(nxt,uploads,count,flags,&plan)) != RCT_OK )
+	count = 0;
+
+    /* A temp file left by an earlier swap is stale */
+    if ( flags & RCT_UPLOAD_SWAP )
+	open_flags |= RCT_OVERWRITE;
+
+    for (c = 0; c < count; ++c)
     {
-	fprintf(stderr,"Error: %s(): Unable to open %s in write mode.\n",
-	    __func__, filename_on_brick);
-	status = RCT_OPEN_FAILED;
+	up = &uploads[c];
+	if ( up->status == RCT_OK )
+	{
+	    if ( up->unchanged )
+	    {
+		fprintf(stderr, "%s is unchanged on the brick.\n", up->name);
+		continue;
+	    }
+	    debug_printf("Uploading %s\n",up->path);
+	    debug_printf("filename_on_brick = %s\n", up->name);
+	    
+	    /* Until it has all been written, the file is not known good */
+	    nxt_manifest_remove(nxt,up->name);
+	    dest = *up;
+	    if ( flags & RCT_UPLOAD_SWAP )
+		dest.name = nxt_swap_name(up->name,swap_name);
+	    file_handle = nxt_upload_open(nxt,file_handle,&dest,open_flags);
+	    
+	    /* The free flash is fragmented: move other files out of the way */
+	    while ( (file_handle == -1) &&
+		    (dest.open_status == NXT_STATUS_NO_LINEAR_SPACE) &&
+		    (nxt_flash_evict(nxt,&plan) == RCT_OK) )
+		file_handle = nxt_upload_open(nxt,-1,&dest,open_flags);
+	    if ( file_handle == -1 )
+	    {
+		fprintf(stderr,"Error: %s(): Unable to open %s in write mode.\n",
+		    __func__, dest.name);
+		up->status = RCT_OPEN_FAILED;
+	    }
+	    else if ( (up->status = nxt_upload_write(nxt,&dest,&file_handle,flags))
+			== RCT_OK )
+	    {
+		if ( flags & RCT_UPLOAD_SWAP )
+		{
+		    up->status = nxt_upload_swap(nxt,file_handle,dest.name,
+						 up->name);
+		    file_handle = -1;
+		}
+		if ( up->status == RCT_OK )
+		    nxt_manifest_update(nxt,up->name,up->size,up->hash);
+	    }
+	}
+	if ( (up->status != RCT_OK) && (status == RCT_OK) )
+	    status = up->status;
     }
+    if ( file_handle != -1 )
+	nxt_close_file(nxt,file_handle);
+    if ( (nxt_flash_restore(nxt,&plan) != RCT_OK) && (status == RCT_OK) )
+	status = RCT_COMMAND_FAILED;
+    free(uploads);
     
     if ( flags & RCT_UPLOAD_PLAY_SOUND )
     {
@@ -689,6 +883,253 @@ rct_status_t nxt_upload_file(rct_nxt_t *nxt,char *filename_on_pc,rct_flag_t flag
 }
 
 
+/****************************************************************************
+ * Description:
+ *  Store the name an RCT_UPLOAD_SWAP upload of filename_on_brick is
+ *  written under in swap_name, and return it: NXT_SWAP_PREFIX before
+ *  the stem, shortened if needed to keep it within 15 characters.
+ * Author:
+ ***************************************************************************/
+
+char    *nxt_swap_name(const char *filename_on_brick, char *swap_name)
+
+{
+    const char  *ext;
+    size_t      stem_len;
+
+    if ( (ext = strchr(filename_on_brick,'.')) == NULL )
+	ext = filename_on_brick + strlen(filename_on_brick);
+    stem_len = MIN(ext - filename_on_brick, NXT_NameMaxLen - 1);
+    snprintf(swap_name,NXT_FILENAME_MAX+1,"%c%.*s%s",NXT_SWAP_PREFIX,
+	     (int)stem_len,filename_on_brick,ext);
+    return swap_name;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Put a file written under swap_name in place of filename_on_brick:
+ *  close it, delete the old copy and rename the new one, in one batch
+ *  that the brick executes back to back.  The old file is missing only
+ *  between the DELETE and the RENAME, not for the whole upload.  If
+ *  the old copy could not be deleted, typically because it is running,
+ *  it is kept and the new one discarded.  If the rename alone fails,
+ *  the new copy is left under swap_name.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_upload_swap(rct_nxt_t *nxt, int file_handle,
+				char *swap_name, char *filename_on_brick)
+
+{
+    nxt_cmd_t       cmds[3];
+    nxt_request_t   *reqs[3];
+    int             c,
+		    deleted;
+
+    nxt_cmd_init(nxt,&cmds[0],NXT_SYSTEM_CMD,NXT_SC_CLOSE);
+    nxt_cmd_set(&cmds[0],0,file_handle);
+    nxt_cmd_init(nxt,&cmds[1],NXT_SYSTEM_CMD,NXT_SC_DELETE);
+    nxt_cmd_set_filename(&cmds[1],0,filename_on_brick);
+    nxt_cmd_init(nxt,&cmds[2],NXT_SYSTEM_CMD,NXT_SC_RENAME_FILE);
+    nxt_cmd_set_filename(&cmds[2],0,swap_name);
+    nxt_cmd_set_filename(&cmds[2],1,filename_on_brick);
+    for (c = 0; c < 3; ++c)
+	reqs[c] = &cmds[c].req;
+    nxt_submit_batch(nxt,reqs,3);
+    for (c = 0; c < 3; ++c)
+	nxt_wait(nxt,reqs[c]);
+
+    if ( nxt_cmd_check(nxt,&cmds[0]) != RCT_OK )
+    {
+	fprintf(stderr,"Error: %s(): Cannot close %s.\n",__func__,swap_name);
+	return RCT_COMMAND_FAILED;
+    }
+    if ( (cmds[2].req.status == RCT_OK) &&
+	 (nxt_cmd_check(nxt,&cmds[2]) == RCT_OK) )
+	return RCT_OK;
+
+    /* Not finding an old copy is fine */
+    deleted = (cmds[1].req.status == RCT_OK) &&
+	      (cmds[1].req.response_len > 2) &&
+	      ((NXT_REPLY_STATUS(&cmds[1].req) == NXT_STATUS_SUCCESS) ||
+	       (NXT_REPLY_STATUS(&cmds[1].req) == NXT_STATUS_FILE_NOT_FOUND));
+    if ( deleted )
+	fprintf(stderr,"Error: %s(): Cannot rename %s to %s.  "
+		"The new copy is left as %s.\n",__func__,swap_name,
+		filename_on_brick,swap_name);
+    else
+    {
+	fprintf(stderr,"Error: %s(): Cannot replace %s, which may be "
+		"running.  The old copy is kept.\n",__func__,
+		filename_on_brick);
+	nxt_flash_delete(nxt,swap_name);
+    }
+    return RCT_COMMAND_FAILED;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  qsort() comparison for nxt_upload_files(), largest file first.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_upload_cmp(const void *a, const void *b)
+
+{
+    const nxt_upload_t  *ua = a,
+			*ub = b;
+
+    if ( ua->size == ub->size )
+	return 0;
+    return ua->size < ub->size ? 1 : -1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return non-zero if a file must be written to the brick as a linear
+ *  file, which the firmware requires of the files it runs, draws or
+ *  plays in place.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_is_linear_file(const char *filename_on_brick)
+
+{
+    static const char   *linear_exts[] =
+			    { ".rxe", ".rpg", ".rtm", ".ric", ".rso", NULL };
+    const char          *ext;
+    int                 c;
+
+    if ( (ext = strrchr(filename_on_brick,'.')) == NULL )
+	return 0;
+    for (c = 0; linear_exts[c] != NULL; ++c)
+	if ( strcasecmp(ext,linear_exts[c]) == 0 )
+	    return 1;
+    return 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Write an upload opened by nxt_upload_open(), and update
+ *  *file_handle if it has to be reopened.
+ *
+ *  If the link drops and nxt_reconnect() restores it, the brick has
+ *  closed the file, so the writes in flight fail.  A data file is then
+ *  reopened with NXT_SC_OPEN_APPEND_DATA, and the upload continues from
+ *  the last byte the brick stored.  A linear file cannot be appended
+ *  to, so it is deleted and restarted at once, without going back
+ *  through the manifest.  Up to NXT_UPLOAD_RESUMES drops are survived.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_upload_write(rct_nxt_t *nxt, nxt_upload_t *up,
+				 int *file_handle, rct_flag_t flags)
+
+{
+    unsigned int    reconnects;
+    size_t          offset = 0,
+		    available;
+    int             resumes;
+    rct_status_t    status;
+
+    for (resumes = 0; ; ++resumes)
+    {
+	reconnects = nxt->reconnects;
+	status = nxt_write_file_at(nxt,up->path,*file_handle,offset);
+	if ( (status == RCT_OK) || (nxt->reconnects == reconnects) )
+	    return status;
+
+	/* The brick closed the file when the link dropped */
+	*file_handle = -1;
+	if ( resumes == NXT_UPLOAD_RESUMES )
+	    return status;
+	offset = 0;
+	if ( !nxt_is_linear_file(up->name) )
+	{
+	    *file_handle = nxt_open_file_append_data(nxt,up->name,&available);
+	    if ( (*file_handle != -1) && (available <= up->size) )
+		offset = up->size - available;
+	    else if ( *file_handle != -1 )
+	    {
+		nxt_close_file(nxt,*file_handle);
+		*file_handle = -1;
+	    }
+	}
+	if ( (*file_handle == -1) &&
+	     ((*file_handle = nxt_upload_open(nxt,-1,up,
+					      flags | RCT_OVERWRITE)) == -1) )
+	    return RCT_OPEN_FAILED;
+	fprintf(stderr, "Link restored, %s %s at byte %lu.\n",
+		offset > 0 ? "resuming" : "restarting", up->name,
+		(unsigned long)offset);
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Open the brick file of an upload, in one batch with closing
+ *  prev_handle (unless it is -1) and, with RCT_OVERWRITE, deleting any
+ *  old copy of the file.  The brick executes them in order.  The file
+ *  is opened linear or as data according to nxt_is_linear_file().
+ *  Returns the new file handle, or -1 if the open failed, in which
+ *  case up->open_status holds the brick's reason.  Running out of
+ *  contiguous flash is left to the caller to report.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_upload_open(rct_nxt_t *nxt, int prev_handle, nxt_upload_t *up,
+			rct_flag_t flags)
+
+{
+    nxt_cmd_t       cmds[3],
+		    *open_cmd;
+    nxt_request_t   *reqs[3];
+    int             c,
+		    count = 0;
+
+    if ( prev_handle != -1 )
+    {
+	nxt_cmd_init(nxt,&cmds[count],NXT_SYSTEM_CMD,NXT_SC_CLOSE);
+	nxt_cmd_set(&cmds[count++],0,prev_handle);
+    }
+    if ( flags & RCT_OVERWRITE )
+    {
+	/* Fails harmlessly if there is nothing to delete */
+	nxt_cmd_init(nxt,&cmds[count],NXT_SYSTEM_CMD,NXT_SC_DELETE);
+	nxt_cmd_set_filename(&cmds[count++],0,up->name);
+    }
+    open_cmd = &cmds[count];
+    nxt_cmd_init(nxt,open_cmd,NXT_SYSTEM_CMD,
+		 nxt_is_linear_file(up->name) ?
+		 NXT_SC_OPEN_WRITE_LINEAR : NXT_SC_OPEN_WRITE_DATA);
+    nxt_cmd_set_filename(open_cmd,0,up->name);
+    nxt_cmd_set(open_cmd,1,up->size);
+    ++count;
+
+    for (c = 0; c < count; ++c)
+	reqs[c] = &cmds[c].req;
+    nxt_submit_batch(nxt,reqs,count);
+    for (c = 0; c < count; ++c)
+	nxt_wait(nxt,reqs[c]);
+    if ( (prev_handle != -1) && (nxt_cmd_check(nxt,&cmds[0]) != RCT_OK) )
+	fprintf(stderr,"Error: %s(): Cannot close handle %d.\n",
+		__func__, prev_handle);
+    up->open_status = (open_cmd->req.status == RCT_OK) &&
+		      (open_cmd->req.response_len > 2) ?
+		      NXT_REPLY_STATUS(&open_cmd->req) : -1;
+    if ( up->open_status == NXT_STATUS_NO_LINEAR_SPACE )
+	return -1;
+    if ( nxt_cmd_check(nxt,open_cmd) != RCT_OK )
+	return -1;
+    return open_cmd->req.response[3];
+}
+
+
 /****************************************************************************
  * Description: 
  *  Initialize an rct_nxt_t structure.  This must be done before calling
@@ -699,10 +1140,44 @@ rct_status_t nxt_upload_file(rct_nxt_t *nxt,char *filename_on_pc,rct_flag_t flag
 void    nxt_init_struct(rct_nxt_t *nxt)
 
 {
+    nxt_output_state_t  output_init = NXT_OUTPUT_INIT;
+    int                 c;
+
+    rct_stats_set_namer(RCT_STATS_NXT_DIRECT, nxt_cmd_stats_name);
+    rct_stats_set_namer(RCT_STATS_NXT_SYSTEM, nxt_cmd_stats_name);
     nxt->usb_handle = NULL;
     nxt->usb_dev = NULL;
-    nxt->bluetooth_fd = -1;
+    nxt->fd = -1;
+    nxt->stream_device = NULL;
+    memset(nxt->bluetooth_address, 0, sizeof(nxt->bluetooth_address));
+    nxt->rx_ring = NULL;
+    nxt->transport = NULL;
+    nxt->transport_data = NULL;
+    nxt->is_open = 0;
+    nxt_engine_init(&nxt->engine);
+    nxt->timeout_ms = NXT_DEFAULT_TIMEOUT_MS;
+    nxt->recv_timeout_ms = NXT_DEFAULT_TIMEOUT_MS;
     nxt->is_in_reset_mode = 0;
+    nxt->reconnect_ms = NXT_RECONNECT_MS;
+    nxt->reconnecting = 0;
+    nxt->reconnect_nowait = 0;
+    nxt->reconnect_attempts = 0;
+    nxt->link_down = 0;
+    nxt->reconnects = 0;
+    nxt->outage_delay_ms = 0;
+    nxt->outputs_set = 0;
+    nxt->write_chunk = 0;
+    for (c = 0; c < 3; ++c)
+	nxt->port[c] = output_init;
+    memset(&nxt->adaptive, 0, sizeof(nxt->adaptive));
+    nxt->adaptive.probe.done = 1;
+    nxt->sched = NULL;
+    nxt->sched_submit = NULL;
+    nxt->sched_reap = NULL;
+    nxt->sched_done = NULL;
+    nxt_cache_init(nxt);
+    nxt->listing.count = nxt->listing.max = 0;
+    nxt->listing.files = NULL;
     nxt_response_on(nxt);
 }
 
@@ -868,10 +1343,8 @@ void    nxt_init_buff_header(char *buff,int cmd_code,int file_handle)
 nxt_connection_t    nxt_connection_type(rct_nxt_t *nxt)
 
 {
-    if ( NXT_BLUETOOTH_IS_OPEN(nxt) )
-	return NXT_BLUETOOTH;
-    if ( NXT_USB_IS_OPEN(nxt) )
-	return NXT_USB;
+    if ( NXT_IS_OPEN(nxt) )
+	return nxt->transport->type;
     return NXT_NO_CONNECTION;
 }
 
@@ -941,7 +1414,10 @@ rct_status_t    nxt_upload_firmware(rct_nxt_t *nxt,char *file)
 
 /****************************************************************************
  * Description: 
- *  Download a file from an NXT brick to the local host.
+ *  Download a file from an NXT brick to the local host.  The copy is
+ *  created in the current directory under the same name, and removed
+ *  again if the transfer fails.  The size and throughput are reported
+ *  on stderr.
  *  The rct_nxt_t structure must first be initialized using nxt_init_struct(),
  *  which is normally called (indirectly) by rct_find_bricks().
  * Author: Jason W. Bacon
@@ -950,7 +1426,42 @@ rct_status_t    nxt_upload_firmware(rct_nxt_t *nxt,char *file)
 rct_status_t    nxt_download_file(rct_nxt_t *nxt,char *file)
 
 {
-    return RCT_NOT_IMPLEMENTED;
+    int             fd,
+		    file_handle;
+    size_t          size;
+    rct_status_t    status;
+    struct timeval  start,
+		    end;
+    double          seconds;
+
+    debug_printf("Downloading %s\n",file);
+    gettimeofday(&start, NULL);
+    if ( (file_handle = nxt_open_file_read(nxt,file,&size)) == -1 )
+	return RCT_OPEN_FAILED;
+    if ( (fd = open(file,O_WRONLY|O_CREAT|O_TRUNC,0644)) == -1 )
+    {
+	fprintf(stderr,"Error: %s(): Cannot create local file %s: %s\n",
+		__func__, file, strerror(errno));
+	nxt_close_file(nxt,file_handle);
+	return RCT_CANNOT_OPEN_FILE;
+    }
+    status = nxt_read_file(nxt,file_handle,size,fd);
+    nxt_close_file(nxt,file_handle);
+    if ( close(fd) != 0 )
+	status = RCT_COMMAND_FAILED;
+    if ( status != RCT_OK )
+    {
+	unlink(file);
+	return status;
+    }
+
+    gettimeofday(&end, NULL);
+    seconds = (end.tv_sec - start.tv_sec) +
+	      (end.tv_usec - start.tv_usec) / 1000000.0;
+    fprintf(stderr, "%s: %lu bytes in %.2f seconds (%.0f bytes/sec)\n",
+	    file, (unsigned long)size, seconds,
+	    seconds > 0 ? size / seconds : 0.0);
+    return RCT_OK;
 }
 
 
@@ -985,6 +1496,7 @@ void    nxt_response_on(rct_nxt_t *nxt)
 
 {
     nxt->response_mask = NXT_RESPONSE;
+    nxt->adaptive.enabled = 0;
 }
 
 
@@ -992,6 +1504,7 @@ void    nxt_response_off(rct_nxt_t *nxt)
 
 {
     nxt->response_mask = NXT_NO_RESPONSE;
+    nxt->adaptive.enabled = 0;
 }
 
 
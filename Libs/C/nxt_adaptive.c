@@ -0,0 +1,151 @@
+/****************************************************************************
+ *  This file contains the adaptive response mode.  nxt_response_off()
+ *  gives the best command rate, but a lost command is never noticed.
+ *  In adaptive mode, commands are still sent without asking for a
+ *  reply, but every nxt->adaptive.verify_every of them are followed by
+ *  a NXT_DC_KEEP_ALIVE probe.  The probe has no side effects and is
+ *  submitted asynchronously, so the caller never waits for it.  Its
+ *  reply, or lack of one, keeps a moving average of the loss rate and
+ *  the round trip time current, and sets the gap enforced between
+ *  unverified commands: doubled on every loss, and reduced by a
+ *  quarter, or at least NXT_ADAPTIVE_STEP_US, for every probe that gets
+ *  through, so that the mode backs off again soon after losses stop.
+ *
+ *  The probes also keep the brick from going to sleep.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Turn off replies to commands that allow it, and verify the link
+ *  with a probe after every verify_every commands sent that way.
+ *  verify_every <= 0 selects NXT_ADAPTIVE_VERIFY_EVERY.  The loss
+ *  estimate starts over.  nxt_response_on() and nxt_response_off()
+ *  end adaptive mode.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_response_adaptive(rct_nxt_t *nxt, int verify_every)
+
+{
+    nxt_adaptive_t  *adaptive = &nxt->adaptive;
+
+    /* The probe request is about to be cleared */
+    if ( !adaptive->probe.done )
+	nxt_wait(nxt, &adaptive->probe);
+    memset(adaptive, 0, sizeof(*adaptive));
+    adaptive->verify_every = verify_every > 0 ? verify_every :
+			     NXT_ADAPTIVE_VERIFY_EVERY;
+    adaptive->probe.done = 1;
+    adaptive->enabled = 1;
+    nxt->response_mask = NXT_NO_RESPONSE;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Wait out the gap before the next unverified command, if any.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_adaptive_pace(rct_nxt_t *nxt)
+
+{
+    nxt_adaptive_t  *adaptive = &nxt->adaptive;
+    struct timeval  now;
+    long            wait_us;
+
+    gettimeofday(&now, NULL);
+    wait_us = (adaptive->next_send.tv_sec - now.tv_sec) * 1000000L +
+	      (adaptive->next_send.tv_usec - now.tv_usec);
+    if ( wait_us > 0 )
+    {
+	usleep(wait_us);
+	gettimeofday(&now, NULL);
+    }
+    adaptive->next_send.tv_sec = now.tv_sec + adaptive->gap_us / 1000000;
+    adaptive->next_send.tv_usec = now.tv_usec + adaptive->gap_us % 1000000;
+    if ( adaptive->next_send.tv_usec >= 1000000 )
+    {
+	++adaptive->next_send.tv_sec;
+	adaptive->next_send.tv_usec -= 1000000;
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Account for count commands just sent without a reply.  Replies
+ *  that have already arrived are collected without waiting, and a
+ *  probe goes out if enough commands have been sent since the last
+ *  one and it has been answered or given up on.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_adaptive_sent(rct_nxt_t *nxt, int count)
+
+{
+    nxt_adaptive_t  *adaptive = &nxt->adaptive;
+
+    adaptive->unverified += count;
+    nxt_reap_ready(nxt);
+    if ( (adaptive->unverified < adaptive->verify_every) ||
+	 !adaptive->probe.done )
+	return;
+
+    adaptive->unverified = 0;
+    ++adaptive->probes;
+    nxt_request_init(&adaptive->probe, NXT_DIRECT_CMD, NXT_DC_KEEP_ALIVE);
+    adaptive->probe.callback = nxt_adaptive_probe_done;
+    gettimeofday(&adaptive->probe_sent, NULL);
+    nxt_submit(nxt, &adaptive->probe);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Completion callback for probes.  Updates the loss and round trip
+ *  estimates and adjusts the gap between unverified commands.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_adaptive_probe_done(rct_nxt_t *nxt, nxt_request_t *req)
+
+{
+    nxt_adaptive_t  *adaptive = &nxt->adaptive;
+    struct timeval  now;
+    long            rtt_us;
+
+    if ( req->status == RCT_OK )
+    {
+	++adaptive->replies;
+	adaptive->loss_rate -= adaptive->loss_rate / 8.0;
+	gettimeofday(&now, NULL);
+	rtt_us = (now.tv_sec - adaptive->probe_sent.tv_sec) * 1000000L +
+		 (now.tv_usec - adaptive->probe_sent.tv_usec);
+	if ( adaptive->replies == 1 )
+	    adaptive->rtt_us = rtt_us;
+	else
+	    adaptive->rtt_us += (rtt_us - adaptive->rtt_us) / 8;
+	adaptive->gap_us -= MAX(adaptive->gap_us / NXT_ADAPTIVE_DECAY,
+				NXT_ADAPTIVE_STEP_US);
+	if ( adaptive->gap_us < 0 )
+	    adaptive->gap_us = 0;
+    }
+    else
+    {
+	++adaptive->lost;
+	adaptive->loss_rate += (1.0 - adaptive->loss_rate) / 8.0;
+	adaptive->gap_us = adaptive->gap_us == 0 ? NXT_ADAPTIVE_MIN_GAP_US :
+			   MIN(adaptive->gap_us * 2, NXT_ADAPTIVE_MAX_GAP_US);
+	debug_printf("%s(): Probe lost, loss rate %.3f, gap %ldus.\n",
+		     __func__, adaptive->loss_rate, adaptive->gap_us);
+    }
+}
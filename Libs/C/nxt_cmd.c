@@ -0,0 +1,525 @@
+
+/****************************************************************************
+ *  This file contains the NXT command descriptor tables and the
+ *  encoder and reply checker driven by them.  Layouts are from the
+ *  LEGO MINDSTORMS NXT Bluetooth Developer Kit, appendices 1 and 2.
+ *  Byte 0 (command type) and byte 1 (command code) are not listed as
+ *  fields.  Commands with variable length telegrams or replies are
+ *  left out of the tables.
+ *
+ *  The first nxt_cmd_init() builds a template nxt_cmd_t for every
+ *  descriptor, with the header, length and priority filled in and the
+ *  fields zeroed.  From then on a command is a copy of its template,
+ *  and only the argument bytes are patched.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <usb.h>
+#include "roboctl.h"
+
+#define UBYTE(offset)       { NXT_FIELD_UBYTE, (offset) }
+#define UWORD(offset)       { NXT_FIELD_UWORD, (offset) }
+#define ULONG(offset)       { NXT_FIELD_ULONG, (offset) }
+#define FILENAME(offset)    { NXT_FIELD_FILENAME, (offset) }
+#define NO_FIELDS           { { NXT_FIELD_NONE, 0 } }
+
+const nxt_cmd_desc_t    Nxt_direct_cmds[NXT_DC_MESSAGE_READ + 1] =
+{
+    [NXT_DC_START_PROGRAM] =
+	{ "NXT_DC_START_PROGRAM", 22, 3, NXT_CMD_REPLY_OPTIONAL,
+	  { FILENAME(2) }, NULL },
+    [NXT_DC_STOP_PROGRAM] =
+	{ "NXT_DC_STOP_PROGRAM", 2, 3, 0,
+	  NO_FIELDS, NULL },
+    /* Loop flag, filename */
+    [NXT_DC_PLAY_SOUND_FILE] =
+	{ "NXT_DC_PLAY_SOUND_FILE", 23, 3, NXT_CMD_REPLY_OPTIONAL,
+	  { UBYTE(2), FILENAME(3) }, NULL },
+    /* Frequency (Hz), duration (ms) */
+    [NXT_DC_PLAY_TONE] =
+	{ "NXT_DC_PLAY_TONE", 6, 3, NXT_CMD_REPLY_OPTIONAL,
+	  { UWORD(2), UWORD(4) }, NULL },
+    /* Port, power, mode, regulation, turn ratio, run state, tacho limit */
+    [NXT_DC_SET_OUTPUT_STATE] =
+	{ "NXT_DC_SET_OUTPUT_STATE", 12, 3, NXT_CMD_REPLY_OPTIONAL,
+	  { UBYTE(2), UBYTE(3), UBYTE(4), UBYTE(5), UBYTE(6), UBYTE(7),
+	    ULONG(8) }, NULL },
+    /* Port, sensor type, sensor mode */
+    [NXT_DC_SET_INPUT_MODE] =
+	{ "NXT_DC_SET_INPUT_MODE", 5, 3, NXT_CMD_REPLY_OPTIONAL,
+	  { UBYTE(2), UBYTE(3), UBYTE(4) }, NULL },
+    [NXT_DC_GET_OUTPUT_STATE] =
+	{ "NXT_DC_GET_OUTPUT_STATE", 3, 25, 0,
+	  { UBYTE(2) }, NULL },
+    [NXT_DC_GET_INPUT_VALUES] =
+	{ "NXT_DC_GET_INPUT_VALUES", 3, 16, 0,
+	  { UBYTE(2) }, NULL },
+    [NXT_DC_RESET_INPUT_SCALED_VALUE] =
+	{ "NXT_DC_RESET_INPUT_SCALED_VALUE", 3, 3, NXT_CMD_REPLY_OPTIONAL,
+	  { UBYTE(2) }, NULL },
+    /* Port, relative flag */
+    [NXT_DC_RESET_MOTOR_POSITION] =
+	{ "NXT_DC_RESET_MOTOR_POSITION", 4, 3, NXT_CMD_REPLY_OPTIONAL,
+	  { UBYTE(2), UBYTE(3) }, NULL },
+    [NXT_DC_BATTERY_LEVEL] =
+	{ "NXT_DC_BATTERY_LEVEL", 2, 5, NXT_CMD_CACHED,
+	  NO_FIELDS, nxt_parse_battery_level },
+    [NXT_DC_STOP_SOUND_PLAYBACK] =
+	{ "NXT_DC_STOP_SOUND_PLAYBACK", 2, 3, NXT_CMD_REPLY_OPTIONAL,
+	  NO_FIELDS, NULL },
+    [NXT_DC_KEEP_ALIVE] =
+	{ "NXT_DC_KEEP_ALIVE", 2, 7, 0,
+	  NO_FIELDS, NULL },
+    [NXT_DC_LS_GET_STATUS] =
+	{ "NXT_DC_LS_GET_STATUS", 3, 4, 0,
+	  { UBYTE(2) }, NULL },
+    [NXT_DC_GET_CURRENT_PROGRAM_NAME] =
+	{ "NXT_DC_GET_CURRENT_PROGRAM_NAME", 2, 23, 0,
+	  NO_FIELDS, NULL },
+    /* Remote inbox, local inbox, remove flag */
+    [NXT_DC_MESSAGE_READ] =
+	{ "NXT_DC_MESSAGE_READ", 5, 64, 0,
+	  { UBYTE(2), UBYTE(3), UBYTE(4) }, NULL },
+};
+
+/* Indexed by command code - NXT_SC_OPEN_READ */
+const nxt_cmd_desc_t    Nxt_system_cmds[NXT_SC_BT_FACTORY_RESET -
+					NXT_SC_OPEN_READ + 1] =
+{
+    [NXT_SC_OPEN_READ - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_OPEN_READ", 22, 8, 0,
+	  { FILENAME(2) }, NULL },
+    /* Filename, file size */
+    [NXT_SC_OPEN_WRITE - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_OPEN_WRITE", 26, 4, 0,
+	  { FILENAME(2), ULONG(22) }, NULL },
+    /* Handle */
+    [NXT_SC_CLOSE - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_CLOSE", 3, 4, 0,
+	  { UBYTE(2) }, NULL },
+    [NXT_SC_DELETE - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_DELETE", 22, 23, 0,
+	  { FILENAME(2) }, NULL },
+    /* Wildcard pattern */
+    [NXT_SC_FIND_FIRST - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_FIND_FIRST", 22, 28, 0,
+	  { FILENAME(2) }, NULL },
+    /* Handle */
+    [NXT_SC_FIND_NEXT - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_FIND_NEXT", 3, 28, 0,
+	  { UBYTE(2) }, NULL },
+    [NXT_SC_GET_VERSIONS - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_GET_VERSIONS", 2, 7, NXT_CMD_CACHED,
+	  NO_FIELDS, nxt_parse_versions },
+    /* Filename, file size */
+    [NXT_SC_OPEN_WRITE_LINEAR - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_OPEN_WRITE_LINEAR", 26, 4, 0,
+	  { FILENAME(2), ULONG(22) }, NULL },
+    [NXT_SC_OPEN_READ_LINEAR - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_OPEN_READ_LINEAR", 22, 8, 0,
+	  { FILENAME(2) }, NULL },
+    /* Filename, file size */
+    [NXT_SC_OPEN_WRITE_DATA - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_OPEN_WRITE_DATA", 26, 4, 0,
+	  { FILENAME(2), ULONG(22) }, NULL },
+    [NXT_SC_OPEN_APPEND_DATA - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_OPEN_APPEND_DATA", 22, 8, 0,
+	  { FILENAME(2) }, NULL },
+    [NXT_SC_GET_DEVICE_INFO - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_GET_DEVICE_INFO", 2, 33, NXT_CMD_CACHED,
+	  NO_FIELDS, nxt_parse_device_info },
+    [NXT_SC_DELETE_USER_FLASH - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_DELETE_USER_FLASH", 2, 3, 0,
+	  NO_FIELDS, NULL },
+    /* Old filename, new filename */
+    [NXT_SC_RENAME_FILE - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_RENAME_FILE", 42, 3, 0,
+	  { FILENAME(2), FILENAME(22) }, NULL },
+    [NXT_SC_BT_FACTORY_RESET - NXT_SC_OPEN_READ] =
+	{ "NXT_SC_BT_FACTORY_RESET", 2, 3, 0,
+	  NO_FIELDS, NULL },
+};
+
+
+/* Built by nxt_cmd_templates_init(), indexed like the tables above */
+nxt_cmd_t       Nxt_direct_templates[NXT_DC_MESSAGE_READ + 1];
+nxt_cmd_t       Nxt_system_templates[NXT_SC_BT_FACTORY_RESET -
+				     NXT_SC_OPEN_READ + 1];
+pthread_once_t  Nxt_cmd_templates_once = PTHREAD_ONCE_INIT;
+
+
+/****************************************************************************
+ * Description:
+ *  Return the descriptor for the given command, or NULL if it has
+ *  none.
+ * Author:
+ ***************************************************************************/
+
+const nxt_cmd_desc_t    *nxt_cmd_desc(int cmd_type, int cmd_code)
+
+{
+    const nxt_cmd_desc_t    *desc;
+
+    if ( (cmd_type == NXT_DIRECT_CMD) && (cmd_code >= 0) &&
+	 (cmd_code <= NXT_DC_MESSAGE_READ) )
+	desc = &Nxt_direct_cmds[cmd_code];
+    else if ( (cmd_type == NXT_SYSTEM_CMD) &&
+	      (cmd_code >= NXT_SC_OPEN_READ) &&
+	      (cmd_code <= NXT_SC_BT_FACTORY_RESET) )
+	desc = &Nxt_system_cmds[cmd_code - NXT_SC_OPEN_READ];
+    else
+	return NULL;
+    return desc->name == NULL ? NULL : desc;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  rct_stats_namer_t for the NXT classes.
+ * Author:
+ ***************************************************************************/
+
+const char  *nxt_cmd_stats_name(rct_stats_class_t cls, int code)
+
+{
+    const nxt_cmd_desc_t    *desc;
+
+    if ( (desc = nxt_cmd_desc(cls, code)) != NULL )
+	return desc->name;
+    return NULL;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the template for the given command, or NULL if it has no
+ *  descriptor.
+ * Author:
+ ***************************************************************************/
+
+const nxt_cmd_t *nxt_cmd_template(int cmd_type, int cmd_code)
+
+{
+    const nxt_cmd_t *tmpl;
+
+    pthread_once(&Nxt_cmd_templates_once, nxt_cmd_templates_init);
+    if ( (cmd_type == NXT_DIRECT_CMD) && (cmd_code >= 0) &&
+	 (cmd_code <= NXT_DC_MESSAGE_READ) )
+	tmpl = &Nxt_direct_templates[cmd_code];
+    else if ( (cmd_type == NXT_SYSTEM_CMD) &&
+	      (cmd_code >= NXT_SC_OPEN_READ) &&
+	      (cmd_code <= NXT_SC_BT_FACTORY_RESET) )
+	tmpl = &Nxt_system_templates[cmd_code - NXT_SC_OPEN_READ];
+    else
+	return NULL;
+    return tmpl->desc == NULL ? NULL : tmpl;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Build the template of every command that has a descriptor.  Run
+ *  once, by nxt_cmd_template().
+ * Author:
+ ***************************************************************************/
+
+void    nxt_cmd_templates_init(void)
+
+{
+    int     code;
+
+    for (code = 0; code <= NXT_DC_MESSAGE_READ; ++code)
+	nxt_cmd_template_build(&Nxt_direct_templates[code], NXT_DIRECT_CMD,
+			       code);
+    for (code = NXT_SC_OPEN_READ; code <= NXT_SC_BT_FACTORY_RESET; ++code)
+	nxt_cmd_template_build(&Nxt_system_templates[code - NXT_SC_OPEN_READ],
+			       NXT_SYSTEM_CMD, code);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Build one template from its descriptor, with all fields zeroed.
+ *  Commands without a descriptor are left with a NULL desc.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_cmd_template_build(nxt_cmd_t *tmpl, int cmd_type, int cmd_code)
+
+{
+    memset(tmpl, 0, sizeof(*tmpl));
+    if ( (tmpl->desc = nxt_cmd_desc(cmd_type, cmd_code)) == NULL )
+	return;
+    nxt_request_init(&tmpl->req, cmd_type, cmd_code);
+    tmpl->req.cmd_len = tmpl->desc->cmd_len;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Build a command by copying its template, with all fields zeroed.
+ *  The reply is suppressed if the command allows it and the brick
+ *  is set not to respond.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_cmd_init(rct_nxt_t *nxt, nxt_cmd_t *cmd, int cmd_type,
+			     int cmd_code)
+
+{
+    const nxt_cmd_t *tmpl;
+
+    if ( (tmpl = nxt_cmd_template(cmd_type, cmd_code)) == NULL )
+    {
+	fprintf(stderr, "Error: %s(): No descriptor for command %d:%d.\n",
+		__func__, cmd_type, cmd_code);
+	cmd->desc = NULL;
+	return RCT_NOT_IMPLEMENTED;
+    }
+    *cmd = *tmpl;
+    if ( cmd->desc->flags & NXT_CMD_REPLY_OPTIONAL )
+	cmd->req.cmd[0] |= nxt->response_mask;
+    rct_stats_now(&cmd->req.t_init);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Store a numeric value in field number field (counting from 0).
+ * Author:
+ ***************************************************************************/
+
+void    nxt_cmd_set(nxt_cmd_t *cmd, int field, unsigned long value)
+
+{
+    const nxt_field_t   *f = &cmd->desc->fields[field];
+    unsigned char       *p = cmd->req.cmd + f->offset;
+
+    switch(f->type)
+    {
+	case    NXT_FIELD_UBYTE:
+	    *p = value;
+	    break;
+	case    NXT_FIELD_UWORD:
+	    short2buf(p, value);
+	    break;
+	case    NXT_FIELD_ULONG:
+	    long2buf(p, value);
+	    break;
+	default:
+	    fprintf(stderr, "Error: %s(): %s field %d is not numeric.\n",
+		    __func__, cmd->desc->name, field);
+	    break;
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Store a filename in field number field, truncated to
+ *  NXT_FILENAME_MAX characters.  Only the bytes after the name are
+ *  cleared.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_cmd_set_filename(nxt_cmd_t *cmd, int field, const char *filename)
+
+{
+    const nxt_field_t   *f = &cmd->desc->fields[field];
+    char                *p = (char *)cmd->req.cmd + f->offset;
+
+    if ( f->type != NXT_FIELD_FILENAME )
+    {
+	fprintf(stderr, "Error: %s(): %s field %d is not a filename.\n",
+		__func__, cmd->desc->name, field);
+	return;
+    }
+    strncpy(p, filename, NXT_FILENAME_MAX);
+    p[NXT_FILENAME_MAX] = '\0';
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Send a command built with nxt_cmd_init(), wait for the reply and
+ *  check it with nxt_cmd_check().  The reply remains in
+ *  cmd->req.response.  Cached queries are answered without sending
+ *  while the last reply is fresh.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_cmd_send(rct_nxt_t *nxt, nxt_cmd_t *cmd)
+
+{
+    nxt_cached_reply_t  *cached = NULL;
+    rct_status_t        status;
+
+    if ( !NXT_IS_OPEN(nxt) )
+    {
+	fprintf(stderr, "Error: %s(): NXT is not currently open.\n",
+		__func__);
+	return RCT_NOT_CONNECTED;
+    }
+
+    /* Reset the bookkeeping from any previous send */
+    cmd->req.response_len = 0;
+    cmd->req.status = RCT_OK;
+    cmd->req.done = 0;
+    cmd->req.next = NULL;
+
+    if ( (cmd->desc->flags & NXT_CMD_CACHED) &&
+	 ((cached = nxt_cache_find(nxt, &cmd->req)) != NULL) &&
+	 rct_cache_fresh(&cached->entry) )
+    {
+	memcpy(cmd->req.response, cached->response, cached->response_len);
+	cmd->req.response_len = cached->response_len;
+	cmd->req.done = 1;
+	return RCT_OK;
+    }
+
+    debug_nxt_dump_cmd((char *)cmd->req.cmd, cmd->req.cmd_len,
+		       cmd->desc->name);
+    if ( (status = nxt_transact(nxt, &cmd->req)) != RCT_OK )
+    {
+	fprintf(stderr, "Error: %s(): %s failed.\n", __func__,
+		cmd->desc->name);
+	return status;
+    }
+    if ( ((status = nxt_cmd_check(nxt, cmd)) == RCT_OK) && (cached != NULL) )
+    {
+	memcpy(cached->response, cmd->req.response, cmd->req.response_len);
+	cached->response_len = cmd->req.response_len;
+	rct_cache_store(&cached->entry);
+    }
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Validate the reply to a completed command against its descriptor
+ *  and pass it to the descriptor's parser, if any.  The time taken is
+ *  recorded as the decode phase in the command statistics.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_cmd_check(rct_nxt_t *nxt, nxt_cmd_t *cmd)
+
+{
+    nxt_request_t           *req = &cmd->req;
+    struct timeval          start,
+			    end;
+    rct_status_t            status;
+
+    /* No reply was requested */
+    if ( req->cmd[0] & NXT_NO_RESPONSE )
+	return RCT_OK;
+
+    rct_stats_now(&start);
+    status = nxt_cmd_decode(nxt, cmd);
+    rct_stats_now(&end);
+    rct_stats_phase(NXT_STATS_CLASS(req), req->cmd[1], RCT_PHASE_DECODE,
+		    &start, &end);
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Check the reply length, command code and status byte, and run the
+ *  descriptor's parser.  Called by nxt_cmd_check().
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_cmd_decode(rct_nxt_t *nxt, nxt_cmd_t *cmd)
+
+{
+    const nxt_cmd_desc_t    *desc = cmd->desc;
+    nxt_request_t           *req = &cmd->req;
+
+    debug_nxt_dump_response((char *)req->response, req->response_len,
+			    desc->name);
+
+    if ( req->response_len != desc->response_len )
+    {
+	fprintf(stderr, "Error: %s: Expected %d byte response, got %d\n",
+		desc->name, desc->response_len, req->response_len);
+	return RCT_COMMAND_FAILED;
+    }
+    if ( req->response[1] != req->cmd[1] )
+    {
+	fprintf(stderr, "Error: %s: Reply is for command 0x%02x.\n",
+		desc->name, req->response[1]);
+	return RCT_COMMAND_FAILED;
+    }
+    if ( NXT_REPLY_STATUS(req) != NXT_STATUS_SUCCESS )
+    {
+	fprintf(stderr, "Error: %s: Non-zero status 0x%02x in response "
+		"from NXT.\n", desc->name, NXT_REPLY_STATUS(req));
+	return RCT_COMMAND_FAILED;
+    }
+    if ( desc->parse != NULL )
+	return desc->parse(nxt, req->response);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Reply parser for NXT_DC_BATTERY_LEVEL.
+ *  3-4     battery level, mV (uword)
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_parse_battery_level(rct_nxt_t *nxt,
+					const unsigned char *response)
+
+{
+    nxt->battery_level = buf2short((unsigned char *)response + 3);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Reply parser for NXT_SC_GET_VERSIONS.
+ *  3-4     protocol version, minor then major
+ *  5-6     firmware version, minor then major
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_parse_versions(rct_nxt_t *nxt,
+				   const unsigned char *response)
+
+{
+    nxt->protocol_minor = response[3];
+    nxt->protocol_major = response[4];
+    nxt->firmware_minor = response[5];
+    nxt->firmware_major = response[6];
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Reply parser for NXT_SC_GET_DEVICE_INFO.
+ *  3-17    brick name (asciiz)
+ *  18-24   bluetooth address
+ *  25-28   bluetooth signal strength (ulong)
+ *  29-32   free user flash (ulong)
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_parse_device_info(rct_nxt_t *nxt,
+				      const unsigned char *response)
+
+{
+    strlcpy(nxt->name, (char *)response + 3, NXT_NAME_LEN);
+    memcpy(nxt->bluetooth_address, response + 18, 6);
+    nxt->bluetooth_signal_strength = buf2long((unsigned char *)response + 25);
+    nxt->free_flash = buf2long((unsigned char *)response + 29);
+    return RCT_OK;
+}
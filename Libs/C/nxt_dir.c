@@ -0,0 +1,333 @@
+/****************************************************************************
+ *  This file contains the NXT file listing.  The brick hands out its
+ *  directory one file per FIND_NEXT, which costs a round trip per file
+ *  when done one at a time, so nxt_list_files() keeps a window of
+ *  FIND_NEXT requests on the same search handle in flight.  The brick
+ *  answers them in order, each with the file after the last, and the
+ *  ones sent past the end fail harmlessly once it has released the
+ *  handle.  The listing is cached in the rct_nxt_t structure, so that
+ *  tools asking for several patterns, or asking again soon, do not
+ *  read the directory more than once.  nxt_delete_files() uses the
+ *  listing to delete many files in one session.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <sys/time.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Make sure nxt->listing holds every file on the brick, reading the
+ *  directory unless the cached listing is still fresh.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_list_files(rct_nxt_t *nxt)
+
+{
+    nxt_listing_t   *listing = &nxt->listing;
+    nxt_file_info_t info;
+    nxt_cmd_t       cmds[NXT_MAX_IN_FLIGHT];
+    nxt_request_t   *reqs[NXT_MAX_IN_FLIGHT];
+    int             c,
+		    handle = -1,
+		    window = nxt->engine.window;
+    rct_status_t    status;
+
+    if ( rct_cache_fresh(&listing->entry) )
+	return RCT_OK;
+    listing->count = 0;
+    if ( (status = nxt_find_first(nxt, "*.*", &info)) == RCT_OK )
+    {
+	handle = info.handle;
+	status = nxt_listing_add(listing, &info);
+    }
+
+    while ( status == RCT_OK )
+    {
+	for (c = 0; c < window; ++c)
+	{
+	    nxt_cmd_init(nxt, &cmds[c], NXT_SYSTEM_CMD, NXT_SC_FIND_NEXT);
+	    nxt_cmd_set(&cmds[c], 0, handle);
+	    reqs[c] = &cmds[c].req;
+	}
+	nxt_submit_batch(nxt, reqs, window);
+	for (c = 0; c < window; ++c)
+	    nxt_wait(nxt, reqs[c]);
+	for (c = 0; (c < window) && (status == RCT_OK); ++c)
+	{
+	    if ( (status = nxt_find_parse(nxt, &cmds[c], &info)) == RCT_OK )
+		status = nxt_listing_add(listing, &info);
+	}
+    }
+
+    /* RCT_CANNOT_STAT_FILE means the end was reached */
+    if ( status != RCT_CANNOT_STAT_FILE )
+    {
+	fprintf(stderr, "Error: %s(): Cannot list files.\n", __func__);
+	/* The brick only releases the handle itself at the end */
+	if ( handle >= 0 )
+	    nxt_close_file(nxt, handle);
+	return status;
+    }
+    rct_cache_store(&listing->entry);
+    debug_printf("Listed %d files.\n", listing->count);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Append a file to a listing, growing it as needed.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_listing_add(nxt_listing_t *listing, nxt_file_info_t *info)
+
+{
+    nxt_file_info_t *files;
+    int             max;
+
+    if ( listing->count == listing->max )
+    {
+	max = listing->max == 0 ? 32 : listing->max * 2;
+	if ( (files = realloc(listing->files, max * sizeof(*files))) == NULL )
+	{
+	    fprintf(stderr, "Error: %s(): Cannot allocate listing.\n",
+		    __func__);
+	    return RCT_COMMAND_FAILED;
+	}
+	listing->files = files;
+	listing->max = max;
+    }
+    listing->files[listing->count++] = *info;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Release the cached listing.  Called when the brick is closed.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_listing_free(rct_nxt_t *nxt)
+
+{
+    free(nxt->listing.files);
+    nxt->listing.files = NULL;
+    nxt->listing.count = nxt->listing.max = 0;
+    rct_cache_invalidate(&nxt->listing.entry);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Start iterating over the files on the brick whose names match glob,
+ *  in fnmatch(3) syntax, or over all of them if glob is NULL.  The
+ *  matches are copied, so the iterator is not disturbed by later
+ *  changes to the brick.  It must be released with nxt_dir_close().
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_dir_open(rct_nxt_t *nxt, nxt_dir_t *dir, const char *glob)
+
+{
+    return nxt_dir_open_globs(nxt, dir, (char **)&glob, glob == NULL ? 0 : 1);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Like nxt_dir_open(), but iterate over the files matching any of
+ *  count globs, or over all files if count is 0.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_dir_open_globs(rct_nxt_t *nxt, nxt_dir_t *dir,
+				   char *globs[], int count)
+
+{
+    nxt_listing_t   *listing = &nxt->listing;
+    rct_status_t    status;
+    int             c;
+
+    memset(dir, 0, sizeof(*dir));
+    if ( (status = nxt_list_files(nxt)) != RCT_OK )
+	return status;
+    if ( (dir->files = malloc((listing->count + 1) * sizeof(*dir->files)))
+	    == NULL )
+    {
+	fprintf(stderr, "Error: %s(): Cannot allocate iterator.\n", __func__);
+	return RCT_COMMAND_FAILED;
+    }
+    for (c = 0; c < listing->count; ++c)
+	if ( (count == 0) ||
+	     nxt_dir_match(listing->files[c].name, globs, count) )
+	    dir->files[dir->count++] = listing->files[c];
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return non-zero if name matches any of count globs.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_dir_match(const char *name, char *globs[], int count)
+
+{
+    int     c;
+
+    for (c = 0; c < count; ++c)
+	if ( fnmatch(globs[c], name, 0) == 0 )
+	    return 1;
+    return 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the next file of an iterator, or NULL when there are no more.
+ * Author:
+ ***************************************************************************/
+
+nxt_file_info_t *nxt_dir_read(nxt_dir_t *dir)
+
+{
+    if ( dir->next == dir->count )
+	return NULL;
+    return &dir->files[dir->next++];
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Release an iterator opened by nxt_dir_open().
+ * Author:
+ ***************************************************************************/
+
+void    nxt_dir_close(nxt_dir_t *dir)
+
+{
+    free(dir->files);
+    memset(dir, 0, sizeof(*dir));
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Print the name and size of each file matching glob to stdout,
+ *  followed by the number of files and bytes listed.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_print_files(rct_nxt_t *nxt, const char *glob)
+
+{
+    nxt_dir_t       dir;
+    nxt_file_info_t *info;
+    unsigned long   total = 0;
+    rct_status_t    status;
+
+    if ( (status = nxt_dir_open(nxt, &dir, glob)) != RCT_OK )
+	return status;
+    while ( (info = nxt_dir_read(&dir)) != NULL )
+    {
+	printf("%-*s %8lu\n", NXT_FILENAME_MAX, info->name, info->size);
+	total += info->size;
+    }
+    printf("%d file%s, %lu bytes\n", dir.count, dir.count == 1 ? "" : "s",
+	   total);
+    nxt_dir_close(&dir);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Delete every file on the brick matching any of count globs, which
+ *  may also be plain filenames.  The listing is read again first, since
+ *  a stale one could be missing files that must survive.  When the globs
+ *  match every file on the brick, one DELETE_USER_FLASH clears it.
+ *  Otherwise the DELETE requests go out a window at a time.  All
+ *  matching files are attempted.  Returns RCT_CANNOT_STAT_FILE if a
+ *  glob matches nothing, and RCT_COMMAND_FAILED if a file could not
+ *  be deleted.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_delete_files(rct_nxt_t *nxt, char *globs[], int count)
+
+{
+    nxt_dir_t       dir;
+    nxt_file_info_t *info,
+		    *batch_files[NXT_MAX_IN_FLIGHT];
+    nxt_cmd_t       cmds[NXT_MAX_IN_FLIGHT];
+    nxt_request_t   *reqs[NXT_MAX_IN_FLIGHT];
+    int             c,
+		    f,
+		    batch;
+    rct_status_t    status = RCT_OK;
+
+    rct_cache_invalidate(&nxt->listing.entry);
+    if ( (status = nxt_dir_open_globs(nxt, &dir, globs, count)) != RCT_OK )
+	return status;
+
+    for (c = 0; c < count; ++c)
+    {
+	for (f = 0; (f < dir.count) &&
+		    !nxt_dir_match(dir.files[f].name, globs + c, 1); ++f)
+	    ;
+	if ( f == dir.count )
+	{
+	    fprintf(stderr, "Error: %s(): No files match %s.\n",
+		    __func__, globs[c]);
+	    status = RCT_CANNOT_STAT_FILE;
+	}
+    }
+
+    if ( (dir.count > 0) && (dir.count == nxt->listing.count) &&
+	 (nxt_delete_user_flash(nxt) == RCT_OK) )
+    {
+	debug_printf("Deleted all %d files.\n", dir.count);
+	nxt_dir_close(&dir);
+	return status;
+    }
+
+    while ( dir.next < dir.count )
+    {
+	for (batch = 0; (batch < nxt->engine.window) &&
+			((info = nxt_dir_read(&dir)) != NULL); ++batch)
+	{
+	    batch_files[batch] = info;
+	    nxt_cmd_init(nxt, &cmds[batch], NXT_SYSTEM_CMD, NXT_SC_DELETE);
+	    nxt_cmd_set_filename(&cmds[batch], 0, info->name);
+	    reqs[batch] = &cmds[batch].req;
+	}
+	nxt_submit_batch(nxt, reqs, batch);
+	for (c = 0; c < batch; ++c)
+	    nxt_wait(nxt, reqs[c]);
+	for (c = 0; c < batch; ++c)
+	{
+	    if ( (reqs[c]->status == RCT_OK) &&
+		 (nxt_cmd_check(nxt, &cmds[c]) == RCT_OK) )
+		nxt_manifest_remove(nxt, batch_files[c]->name);
+	    else
+	    {
+		fprintf(stderr, "Error: %s(): Cannot delete %s.\n",
+			__func__, batch_files[c]->name);
+		status = RCT_COMMAND_FAILED;
+	    }
+	}
+    }
+    debug_printf("Deleted %d files.\n", dir.count);
+    nxt_dir_close(&dir);
+    return status;
+}
@@ -33,10 +33,9 @@ extern int  Debug;
 rct_status_t nxt_start_program(rct_nxt_t *nxt,char *raw_filename)
 
 {
-    int         bytes;
     rct_status_t    status;
-    char        response[NXT_RESPONSE_MAX+1],
-		filename[NXT_FILENAME_MAX+1];
+    nxt_cmd_t   cmd;
+    char        filename[NXT_FILENAME_MAX+1];
     
     strlcpy(filename,raw_filename,NXT_FILENAME_MAX);
 
@@ -44,9 +43,9 @@ rct_status_t nxt_start_program(rct_nxt_t *nxt,char *raw_filename)
     if ( (status = nxt_validate_filename(filename,".rxe", __func__)) != RCT_OK )
 	return status;
 
-    bytes = nxt_send_cmd(nxt,NXT_DIRECT_CMD,NXT_DC_START_PROGRAM,
-	    response,NXT_RESPONSE_MAX,"%s",filename);
-    return  nxt_check_response(nxt,response,bytes,3,"NXT_DC_START_PROGRAM");
+    nxt_cmd_init(nxt,&cmd,NXT_DIRECT_CMD,NXT_DC_START_PROGRAM);
+    nxt_cmd_set_filename(&cmd,0,filename);
+    return nxt_cmd_send(nxt,&cmd);
 }
 
 
@@ -63,14 +62,13 @@ rct_status_t nxt_start_program(rct_nxt_t *nxt,char *raw_filename)
 rct_status_t nxt_stop_program(rct_nxt_t *nxt)
 
 {
-    int         bytes;
-    char        response[NXT_RESPONSE_MAX+1];
+    nxt_cmd_t   cmd;
     
-    bytes = nxt_send_simple_cmd(nxt,NXT_DIRECT_CMD,
-			NXT_DC_STOP_PROGRAM,response,
-			NXT_RESPONSE_MAX);
-    
-    if (bytes != 3)
+    /* Only the reply length is checked: stopping when no program is
+       running is not an error */
+    nxt_cmd_init(nxt,&cmd,NXT_DIRECT_CMD,NXT_DC_STOP_PROGRAM);
+    if ( (nxt_transact(nxt,&cmd.req) != RCT_OK) ||
+	 (cmd.req.response_len != 3) )
     {
 	fputs("nxt_stop_program(): Error sending stop command.\n", stderr);
 	return RCT_COMMAND_FAILED;
@@ -93,10 +91,9 @@ rct_status_t    nxt_play_sound_file(rct_nxt_t *nxt,rct_flag_t flags,
 				    char * const raw_filename)
 
 {
-    int         bytes;
     rct_status_t    status;
-    char        response[NXT_RESPONSE_MAX+1],
-		filename[NXT_FILENAME_MAX+1];
+    nxt_cmd_t   cmd;
+    char        filename[NXT_FILENAME_MAX+1];
 
     /* Make a private copy in case users want to send a string constant */
     strlcpy(filename,raw_filename,NXT_FILENAME_MAX);
@@ -107,9 +104,10 @@ rct_status_t    nxt_play_sound_file(rct_nxt_t *nxt,rct_flag_t flags,
 
     /* Send command with a char value of 0 or 1 for loop flag */
     debug_printf("nxt_play_sound_file(%d,%s)\n",flags,filename);
-    bytes = nxt_send_cmd(nxt,NXT_DIRECT_CMD,NXT_DC_PLAY_SOUND_FILE,
-	    response,NXT_RESPONSE_MAX,"%c%s",(flags == RCT_LOOP),filename);
-    return  nxt_check_response(nxt,response,bytes,3,"NXT_DC_PLAY_SOUND_FILE");
+    nxt_cmd_init(nxt,&cmd,NXT_DIRECT_CMD,NXT_DC_PLAY_SOUND_FILE);
+    nxt_cmd_set(&cmd,0,(flags == RCT_LOOP));
+    nxt_cmd_set_filename(&cmd,1,filename);
+    return nxt_cmd_send(nxt,&cmd);
 }
 
 /****************************************************************************
@@ -125,17 +123,17 @@ rct_status_t    nxt_play_sound_file(rct_nxt_t *nxt,rct_flag_t flags,
 rct_status_t    nxt_play_tone(rct_nxt_t *nxt,int herz,int milliseconds)
 
 {
-    int         bytes;
-    char        response[NXT_RESPONSE_MAX+1];
+    nxt_cmd_t   cmd;
 
     if ( (herz < 200) || (herz > 14000) )
     {
 	fprintf(stderr,"nxt_play_tone(): Invalid frequency: %d Hz.\n",herz);
 	return RCT_INVALID_DATA;
     }
-    bytes = nxt_send_cmd(nxt,NXT_DIRECT_CMD,NXT_DC_PLAY_TONE,
-	    response,NXT_RESPONSE_MAX,"%w%w",herz,milliseconds);
-    return  nxt_check_response(nxt,response,bytes,3,"NXT_DC_PLAY_SOUND_FILE");
+    nxt_cmd_init(nxt,&cmd,NXT_DIRECT_CMD,NXT_DC_PLAY_TONE);
+    nxt_cmd_set(&cmd,0,herz);
+    nxt_cmd_set(&cmd,1,milliseconds);
+    return nxt_cmd_send(nxt,&cmd);
 }
 
 /****************************************************************************
@@ -160,13 +158,53 @@ rct_status_t    nxt_set_output_state(rct_nxt_t *nxt,int port,int power,
 				    unsigned long tacholimit)
 
 {
-    int         bytes;
-    char        response[NXT_RESPONSE_MAX+1];
+    nxt_cmd_t           cmd;
+    nxt_output_state_t  state;
+    int                 c;
     
-    bytes = nxt_send_cmd(nxt,NXT_DIRECT_CMD,NXT_DC_SET_OUTPUT_STATE,
-	    response,NXT_RESPONSE_MAX,"%c%c%c%c%c%c%l",port,power,mode,
-	    regulation,ratio,runstate,tacholimit);
-    return  nxt_check_response(nxt,response,bytes,3,"NXT_DC_SET_OUTPUT_STATE");
+    state.mode = mode;
+    state.regulation_mode = regulation;
+    state.run_state = runstate;
+    state.power = power;
+    state.turn_ratio = ratio;
+    state.tacho_limit = tacholimit;
+
+    /* Remember it, so that nxt_reconnect() can restore it */
+    for (c = 0; c < 3; ++c)
+    {
+	if ( (port == c) || (port == 0xff) )
+	{
+	    nxt->port[c] = state;
+	    nxt->outputs_set |= 1 << c;
+	}
+    }
+
+    nxt_output_cmd(nxt,&cmd,port,&state);
+    return nxt_cmd_send(nxt,&cmd);
+}
+
+
+/****************************************************************************
+ * Description: 
+ *  Build a SET_OUTPUT_STATE command for port from state.  Stopping a
+ *  motor is given emergency priority.
+ * Author: 
+ ***************************************************************************/
+
+void    nxt_output_cmd(rct_nxt_t *nxt,nxt_cmd_t *cmd,int port,
+		       const nxt_output_state_t *state)
+
+{
+    nxt_cmd_init(nxt,cmd,NXT_DIRECT_CMD,NXT_DC_SET_OUTPUT_STATE);
+    nxt_cmd_set(cmd,0,port);
+    nxt_cmd_set(cmd,1,state->power);
+    nxt_cmd_set(cmd,2,state->mode);
+    nxt_cmd_set(cmd,3,state->regulation_mode);
+    nxt_cmd_set(cmd,4,state->turn_ratio);
+    nxt_cmd_set(cmd,5,state->run_state);
+    nxt_cmd_set(cmd,6,state->tacho_limit);
+    if ( (state->power == 0) || (state->run_state == NXT_RUN_STATE_IDLE) )
+	cmd->req.priority = NXT_PRIO_EMERGENCY;
 }
 
 /****************************************************************************
@@ -237,26 +275,15 @@ rct_status_t    nxt_reset_motor_position(rct_nxt_t *nxt)
 rct_status_t    nxt_get_battery_level(rct_nxt_t *nxt)
 
 {
-    int    bytes;
-    char   response[NXT_RESPONSE_MAX + 1];
+    nxt_cmd_t   cmd;
 
     /*
      * NXT brick should respond with 5 bytes: 
      * reply command status level-lsb level-msb
+     * nxt_parse_battery_level() stores the level.
      */
-    bytes = nxt_send_simple_cmd(nxt, NXT_DIRECT_CMD,
-			NXT_DC_BATTERY_LEVEL, response,
-			NXT_RESPONSE_MAX);
-    nxt_check_response(nxt,response,bytes,5,"NXT_SC_BATTERY_LEVEL");
-    if ( bytes == 5 )
-    {
-	nxt->battery_level = buf2short((unsigned char *)response+3);
-	return RCT_OK;
-    }
-    else
-    {
-	return RCT_COMMAND_FAILED;
-    }
+    nxt_cmd_init(nxt, &cmd, NXT_DIRECT_CMD, NXT_DC_BATTERY_LEVEL);
+    return nxt_cmd_send(nxt, &cmd);
 }
 
 
@@ -281,25 +308,14 @@ rct_status_t    nxt_stop_sound_playback(rct_nxt_t *nxt)
 rct_status_t    nxt_keep_alive(rct_nxt_t *nxt)
 
 {
-    int    bytes;
-    char   response[NXT_RESPONSE_MAX + 1];
+    nxt_cmd_t   cmd;
 
     /*
      * NXT brick should respond with 7 bytes: 
-     * reply command status level-lsb level-msb
+     * reply command status sleep-time-limit
      */
-    bytes = nxt_send_simple_cmd(nxt, NXT_DIRECT_CMD,
-			NXT_DC_KEEP_ALIVE, response,
-			NXT_RESPONSE_MAX);
-    nxt_check_response(nxt,response,bytes,7,"NXT_DC_KEEP_ALIVE");
-    if ( bytes == 7 )
-    {
-	return RCT_OK;
-    }
-    else
-    {
-	return RCT_COMMAND_FAILED;
-    }
+    nxt_cmd_init(nxt, &cmd, NXT_DIRECT_CMD, NXT_DC_KEEP_ALIVE);
+    return nxt_cmd_send(nxt, &cmd);
 }
 
 
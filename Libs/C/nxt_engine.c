@@ -0,0 +1,907 @@
+
+/****************************************************************************
+ *  This file contains the NXT command engine, which keeps several
+ *  commands in flight per brick instead of waiting a full round trip
+ *  for each one.  The synchronous nxt_ command functions are built on
+ *  nxt_transact(), so they can be freely mixed with asynchronous
+ *  requests submitted by nxt_submit().
+ *
+ *  Typical asynchronous use:
+ *
+ *      nxt_request_init(&req[c], NXT_DIRECT_CMD, NXT_DC_GET_INPUT_VALUES);
+ *      nxt_request_append(&req[c], &port, 1);
+ *      req[c].callback = nxt_enqueue_completion;
+ *      nxt_submit(nxt, &req[c]);
+ *      ...
+ *      nxt_reap(nxt, 1);
+ *      while ( (done = nxt_get_completion(nxt)) != NULL )
+ *          use done->response
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Reset a brick's engine to an empty state with the default window.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_engine_init(nxt_engine_t *engine)
+
+{
+    memset(engine, 0, sizeof(*engine));
+    engine->window = NXT_DEFAULT_WINDOW;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Set the maximum number of commands awaiting a reply at once.
+ *  A window of 1 gives the classic one-command-per-round-trip behavior.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_set_window(rct_nxt_t *nxt, int window)
+
+{
+    if ( (window < 1) || (window > NXT_MAX_IN_FLIGHT) )
+    {
+	fprintf(stderr, "Error: %s(): Window must be 1 to %d.\n",
+		__func__, NXT_MAX_IN_FLIGHT);
+	return RCT_INVALID_DATA;
+    }
+    nxt->engine.window = window;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Set the brick's default reply deadline, used by requests that do
+ *  not set their own timeout_ms.  A negative timeout waits forever.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_set_timeout(rct_nxt_t *nxt, int timeout_ms)
+
+{
+    nxt->timeout_ms = timeout_ms;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Start building a request.  cmd_type is NXT_DIRECT_CMD or
+ *  NXT_SYSTEM_CMD, optionally or'd with NXT_NO_RESPONSE.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_request_init(nxt_request_t *req, int cmd_type, int cmd_code)
+
+{
+    req->cmd[0] = cmd_type;
+    req->cmd[1] = cmd_code;
+    req->cmd_len = 2;
+    req->response_len = 0;
+    req->status = RCT_OK;
+    req->done = 0;
+    req->timeout_ms = 0;
+    req->callback = NULL;
+    req->arg = NULL;
+    req->next = NULL;
+    req->priority = nxt_default_priority(cmd_type, cmd_code);
+    rct_stats_now(&req->t_init);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Priority class of a command, as described in rct_nxt.h.
+ * Author:
+ ***************************************************************************/
+
+nxt_priority_t  nxt_default_priority(int cmd_type, int cmd_code)
+
+{
+    if ( (cmd_type & ~NXT_NO_RESPONSE) == NXT_SYSTEM_CMD )
+    {
+	switch(cmd_code)
+	{
+	    case    NXT_SC_GET_VERSIONS:
+	    case    NXT_SC_GET_DEVICE_INFO:
+	    case    NXT_SC_GET_BT_ADDRESS:
+		return NXT_PRIO_TELEMETRY;
+	    default:
+		return NXT_PRIO_BULK;
+	}
+    }
+    switch(cmd_code)
+    {
+	case    NXT_DC_STOP_PROGRAM:
+	case    NXT_DC_STOP_SOUND_PLAYBACK:
+	    return NXT_PRIO_EMERGENCY;
+	case    NXT_DC_GET_OUTPUT_STATE:
+	case    NXT_DC_GET_INPUT_VALUES:
+	case    NXT_DC_BATTERY_LEVEL:
+	case    NXT_DC_LS_GET_STATUS:
+	case    NXT_DC_LS_READ:
+	case    NXT_DC_GET_CURRENT_PROGRAM_NAME:
+	case    NXT_DC_GET_BUTTON_STATE:
+	case    NXT_DC_MESSAGE_READ:
+	    return NXT_PRIO_TELEMETRY;
+	default:
+	    return NXT_PRIO_CONTROL;
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Append raw bytes to the command telegram in a request.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_request_append(nxt_request_t *req, const void *data,
+				   int len)
+
+{
+    if ( req->cmd_len + len > (int)sizeof(req->cmd) )
+    {
+	fprintf(stderr, "Error: %s(): Command exceeds %d bytes.\n",
+		__func__, (int)sizeof(req->cmd));
+	return RCT_INVALID_DATA;
+    }
+    memcpy(req->cmd + req->cmd_len, data, len);
+    req->cmd_len += len;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Send a request to the brick, first waiting for a reply if the
+ *  window is full.  Requests that ask for no reply complete as soon
+ *  as they are sent.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_submit(rct_nxt_t *nxt, nxt_request_t *req)
+
+{
+    return nxt_submit_batch(nxt, &req, 1);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Send several requests, or queue them with the brick's scheduler
+ *  if it has one and this is not the dispatcher thread.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_submit_batch(rct_nxt_t *nxt, nxt_request_t **reqs,
+				 int count)
+
+{
+    if ( nxt->sched_submit != NULL )
+	return nxt->sched_submit(nxt, reqs, count);
+    return nxt_engine_submit(nxt, reqs, count);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Send several requests, as many at a time as the window allows,
+ *  with one nxt_send_bufs() call per group.  An emergency request at
+ *  the head of the batch may exceed the window.  If a send fails, the
+ *  link is reconnected if possible, or the requests are parked until
+ *  it is if nxt_relink() does not wait.  Requests that cannot be sent
+ *  are completed with RCT_COMMAND_FAILED.  In adaptive response mode,
+ *  requests sent without a reply are paced and verified by
+ *  nxt_adaptive_pace() and nxt_adaptive_sent().
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_engine_submit(rct_nxt_t *nxt, nxt_request_t **reqs,
+				  int count)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    struct iovec    iov[NXT_MAX_IN_FLIGHT];
+    struct timeval  t_submit,
+		    t_send,
+		    t_sent;
+    int             c,
+		    n,
+		    limit,
+		    sent,
+		    slot,
+		    unverified = 0;
+    rct_status_t    status = RCT_OK;
+
+    rct_stats_now(&t_submit);
+    while ( count > 0 )
+    {
+	limit = reqs[0]->priority == NXT_PRIO_EMERGENCY ?
+		NXT_MAX_IN_FLIGHT : engine->window;
+	while ( engine->count >= limit )
+	{
+	    if ( nxt_engine_reap(nxt, 1) < 0 )
+		break;
+	}
+
+	n = MIN(count, limit - engine->count);
+	for (c = 0; c < n; ++c)
+	{
+	    reqs[c]->done = 0;
+	    reqs[c]->response_len = 0;
+	    iov[c].iov_base = reqs[c]->cmd;
+	    iov[c].iov_len = reqs[c]->cmd_len;
+	}
+
+	if ( nxt->adaptive.enabled && (reqs[0]->cmd[0] & NXT_NO_RESPONSE) )
+	    nxt_adaptive_pace(nxt);
+	rct_stats_now(&t_send);
+	if ( nxt->link_down || ((sent = nxt_send_bufs(nxt, iov, n)) < 0) )
+	    sent = 0;
+	gettimeofday(&t_sent, NULL);
+	for (c = 0; c < sent; ++c)
+	{
+	    nxt_stats_sent(reqs[c], &t_submit, &t_send, &t_sent);
+	    rct_deadline_set(&reqs[c]->deadline, reqs[c]->timeout_ms != 0 ?
+			     reqs[c]->timeout_ms : nxt->timeout_ms);
+	    nxt_cache_sent(nxt, reqs[c]);
+	    if ( reqs[c]->cmd[0] & NXT_NO_RESPONSE )
+	    {
+		nxt_complete_request(nxt, reqs[c], RCT_OK);
+		++unverified;
+	    }
+	    else
+	    {
+		nxt_retire_stale(nxt, reqs[c]->cmd[1]);
+		slot = (engine->head + engine->count) % NXT_MAX_IN_FLIGHT;
+		engine->in_flight[slot] = reqs[c];
+		++engine->count;
+	    }
+	}
+
+	if ( sent < n )
+	    status = nxt_relink(nxt);
+	if ( (sent < n) && (status == RCT_OK) )
+	{
+	    /* Those already sent were resent by nxt_reconnect() */
+	    reqs += sent;
+	    count -= sent;
+	    continue;
+	}
+	if ( (sent < n) && (status == RCT_RECONNECTING) )
+	{
+	    /* The rest go out with them once the link is back */
+	    nxt_park_requests(nxt, reqs + sent, n - sent);
+	    reqs += n;
+	    count -= n;
+	    continue;
+	}
+	if ( sent < n )
+	{
+	    fprintf(stderr, "Error: %s(): Failed to send command %d:%d.\n",
+		    __func__, reqs[sent]->cmd[0], reqs[sent]->cmd[1]);
+	    for (c = sent; c < count; ++c)
+		nxt_complete_request(nxt, reqs[c], RCT_COMMAND_FAILED);
+	    return RCT_COMMAND_FAILED;
+	}
+	reqs += n;
+	count -= n;
+    }
+    if ( nxt->adaptive.enabled && (unverified > 0) )
+	nxt_adaptive_sent(nxt, unverified);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Put requests that could not be sent because the link is down in
+ *  flight anyway, so that nxt_restore_session() sends them with the
+ *  others when it comes back.  Requests that want no reply are failed
+ *  instead, since no reply would ever complete them.  Output states
+ *  among them are replayed by the restore regardless.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_park_requests(rct_nxt_t *nxt, nxt_request_t **reqs, int count)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    int             c,
+		    slot;
+
+    for (c = 0; c < count; ++c)
+    {
+	if ( reqs[c]->cmd[0] & NXT_NO_RESPONSE )
+	    nxt_complete_request(nxt, reqs[c], RCT_COMMAND_FAILED);
+	else
+	{
+	    nxt_cache_sent(nxt, reqs[c]);
+	    slot = (engine->head + engine->count) % NXT_MAX_IN_FLIGHT;
+	    engine->in_flight[slot] = reqs[c];
+	    ++engine->count;
+	}
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Wait for at least min requests to complete, or until none remain
+ *  outstanding.  Returns the number completed, or -1 if the link
+ *  failed.  On a brick driven by a scheduler, other threads wait for
+ *  the dispatcher instead of receiving replies themselves.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_reap(rct_nxt_t *nxt, int min)
+
+{
+    if ( nxt->sched_reap != NULL )
+	return nxt->sched_reap(nxt, min);
+    return nxt_engine_reap(nxt, min);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Receive replies and complete the matching requests until at least
+ *  min requests have completed or none remain in flight.  Waits no
+ *  longer than the deadline of the oldest request, which is completed
+ *  with RCT_TIMEOUT if it expires.  Returns the number of requests
+ *  completed, or -1 if the link failed and could not be reconnected,
+ *  in which case all outstanding requests are failed.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_engine_reap(rct_nxt_t *nxt, int min)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    unsigned char   buf[NXT_PACKET_MAX],
+		    *response;
+    int             bytes,
+		    ready,
+		    completed = 0;
+
+    while ( (completed < min) && (engine->count > 0) )
+    {
+	nxt->recv_timeout_ms =
+	    rct_deadline_remaining(&engine->in_flight[engine->head]->deadline);
+	if ( nxt->link_down )
+	    bytes = -1;
+	else if ( (ready = nxt_poll_response(nxt, nxt->recv_timeout_ms)) > 0 )
+	    bytes = nxt_recv_packet(nxt, &response, buf);
+	else
+	    bytes = ready;
+
+	if ( bytes < 0 )
+	{
+	    /* Requests in flight are resent if the link comes back */
+	    if ( nxt_reconnect(nxt) == RCT_OK )
+		continue;
+	    completed += nxt_fail_in_flight(nxt, RCT_COMMAND_FAILED);
+	    return -1;
+	}
+	else if ( bytes == 0 )
+	{
+	    nxt_expire_oldest(nxt);
+	    ++completed;
+	}
+	else
+	    completed += nxt_match_reply(nxt, response, bytes);
+    }
+    return completed;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Collect the replies that have already arrived and expire requests
+ *  whose deadlines have passed, without waiting.  Returns the number
+ *  of requests completed, or -1 as for nxt_reap().  If the link fails
+ *  and nxt_relink() does not wait, the requests stay in flight.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_reap_ready(rct_nxt_t *nxt)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    unsigned char   buf[NXT_PACKET_MAX],
+		    *response;
+    int             bytes,
+		    ready,
+		    completed = 0;
+    rct_status_t    status;
+
+    while ( engine->count > 0 )
+    {
+	nxt->recv_timeout_ms =
+	    rct_deadline_remaining(&engine->in_flight[engine->head]->deadline);
+	if ( nxt->link_down )
+	    ready = -1;
+	else if ( (ready = nxt_poll_response(nxt, 0)) == 0 )
+	{
+	    if ( nxt->recv_timeout_ms != 0 )
+		break;
+	    nxt_expire_oldest(nxt);
+	    ++completed;
+	    continue;
+	}
+	bytes = ready > 0 ? nxt_recv_packet(nxt, &response, buf) : ready;
+	if ( bytes < 0 )
+	{
+	    /* A pending reconnect keeps the requests in flight */
+	    if ( (status = nxt_relink(nxt)) == RCT_OK )
+		continue;
+	    if ( status == RCT_RECONNECTING )
+		break;
+	    completed += nxt_fail_in_flight(nxt, RCT_COMMAND_FAILED);
+	    return -1;
+	}
+	else if ( bytes == 0 )
+	{
+	    nxt_expire_oldest(nxt);
+	    ++completed;
+	}
+	else
+	    completed += nxt_match_reply(nxt, response, bytes);
+    }
+    return completed;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Complete the oldest in-flight request with RCT_TIMEOUT, and
+ *  remember its command code so that a late reply can be discarded,
+ *  unless a request with the same code is still in flight, and only
+ *  until nxt_retire_stale() forgets it.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_expire_oldest(rct_nxt_t *nxt)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    nxt_request_t   *req;
+    int             c;
+
+    req = nxt_dequeue_in_flight(nxt);
+    fprintf(stderr, "Error: %s(): No reply to command %d:%d.\n",
+	    __func__, req->cmd[0], req->cmd[1]);
+
+    /* A later request with the same code owns the next such reply */
+    for (c = 0; c < engine->count; ++c)
+	if ( engine->in_flight[(engine->head + c) % NXT_MAX_IN_FLIGHT]->cmd[1]
+		== req->cmd[1] )
+	{
+	    nxt_complete_request(nxt, req, RCT_TIMEOUT);
+	    return;
+	}
+    if ( engine->stale_count == NXT_MAX_IN_FLIGHT )
+    {
+	engine->stale_head = (engine->stale_head + 1) % NXT_MAX_IN_FLIGHT;
+	--engine->stale_count;
+    }
+    engine->stale[(engine->stale_head + engine->stale_count++)
+		  % NXT_MAX_IN_FLIGHT] = req->cmd[1];
+    nxt_complete_request(nxt, req, RCT_TIMEOUT);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Forget the timed out requests with the given command code, when a
+ *  new request with that code is sent.  A reply with the code could
+ *  then belong to either, and discarding it would make the new request
+ *  time out too, and so on for every later one if the old reply was
+ *  lost for good.  Matching it to the new request instead costs at
+ *  most one misattributed reply if the old one was only late.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_retire_stale(rct_nxt_t *nxt, int code)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    int             c,
+		    kept = 0;
+    unsigned char   code_at;
+
+    for (c = 0; c < engine->stale_count; ++c)
+    {
+	code_at = engine->stale[(engine->stale_head + c) % NXT_MAX_IN_FLIGHT];
+	if ( code_at != code )
+	    engine->stale[(engine->stale_head + kept++) % NXT_MAX_IN_FLIGHT] =
+		code_at;
+    }
+    engine->stale_count = kept;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Check whether a reply belongs to a request that already timed out.
+ *  The brick answers in order, so a late reply precedes those of all
+ *  requests still in flight, and any timed out request ahead of it
+ *  whose code does not match will never be answered.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_is_stale_reply(rct_nxt_t *nxt, unsigned char *response)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    int             code;
+
+    while ( engine->stale_count > 0 )
+    {
+	code = engine->stale[engine->stale_head];
+	engine->stale_head = (engine->stale_head + 1) % NXT_MAX_IN_FLIGHT;
+	--engine->stale_count;
+	if ( code == response[1] )
+	    return 1;
+    }
+    return 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Complete the request that a reply belongs to.  Replies are matched
+ *  to the oldest in-flight request with the same command code.  Older
+ *  requests of other types must have lost their replies, and are
+ *  failed.  The packet is released before any callbacks run, so they
+ *  are free to submit and wait on further requests.  Returns the
+ *  number of requests completed.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_match_reply(rct_nxt_t *nxt, unsigned char *response, int bytes)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    nxt_request_t   *req,
+		    *skipped[NXT_MAX_IN_FLIGHT];
+    int             c,
+		    completed;
+
+    debug_nxt_dump_response((char *)response, bytes, "engine");
+    if ( (bytes < 3) || (response[0] != NXT_CmdReply) )
+    {
+	fprintf(stderr, "Error: %s(): Discarding malformed %d byte reply.\n",
+		__func__, bytes);
+	nxt_release_packet(nxt);
+	return 0;
+    }
+
+    if ( nxt_is_stale_reply(nxt, response) )
+    {
+	debug_printf("Discarding late reply to command 0x%02x.\n",
+		     response[1]);
+	nxt_release_packet(nxt);
+	return 0;
+    }
+
+    for (c = 0; c < engine->count; ++c)
+    {
+	req = engine->in_flight[(engine->head + c) % NXT_MAX_IN_FLIGHT];
+	if ( req->cmd[1] == response[1] )
+	    break;
+    }
+    if ( c == engine->count )
+    {
+	fprintf(stderr, "Error: %s(): Unexpected reply to command 0x%02x.\n",
+		__func__, response[1]);
+	nxt_release_packet(nxt);
+	return 0;
+    }
+
+    /* The link works again, so a later failure is a new outage */
+    nxt->outage_delay_ms = 0;
+
+    req = engine->in_flight[(engine->head + c) % NXT_MAX_IN_FLIGHT];
+    bytes = MIN(bytes, (int)sizeof(req->response));
+    memcpy(req->response, response, bytes);
+    req->response_len = bytes;
+    nxt_release_packet(nxt);
+
+    /*
+     *  Dequeue everything first, so callbacks see a consistent engine.
+     *  Everything ahead of the match lost its reply.
+     */
+    for (completed = 0; completed <= c; ++completed)
+	skipped[completed] = nxt_dequeue_in_flight(nxt);
+    for (completed = 0; completed < c; ++completed)
+	nxt_complete_request(nxt, skipped[completed], RCT_COMMAND_FAILED);
+    nxt_complete_request(nxt, req, RCT_OK);
+    return completed + 1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Remove and return the oldest in-flight request.
+ * Author:
+ ***************************************************************************/
+
+nxt_request_t   *nxt_dequeue_in_flight(rct_nxt_t *nxt)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    nxt_request_t   *req;
+
+    req = engine->in_flight[engine->head];
+    engine->head = (engine->head + 1) % NXT_MAX_IN_FLIGHT;
+    --engine->count;
+    return req;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Fail every in-flight request, e.g. after the link is lost.
+ *  Returns the number of requests failed.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_fail_in_flight(rct_nxt_t *nxt, rct_status_t status)
+
+{
+    int     failed = 0;
+
+    while ( nxt->engine.count > 0 )
+    {
+	nxt_complete_request(nxt, nxt_dequeue_in_flight(nxt), status);
+	++failed;
+    }
+    return failed;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Mark a request done and notify its owner.  Replies also update the
+ *  brick's smoothed turnaround time.  On a scheduled brick, the
+ *  scheduler marks it done, since other threads may be waiting for it.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_complete_request(rct_nxt_t *nxt, nxt_request_t *req,
+			     rct_status_t status)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    struct timeval  now;
+    long            usec;
+
+    req->status = status;
+    if ( (status == RCT_OK) && (req->response_len > 0) )
+    {
+	gettimeofday(&now, NULL);
+	usec = (now.tv_sec - req->t_sent.tv_sec) * 1000000L +
+	       (now.tv_usec - req->t_sent.tv_usec);
+	if ( engine->turnaround_us == 0 )
+	    engine->turnaround_us = usec;
+	else
+	    engine->turnaround_us += (usec - engine->turnaround_us) / 8;
+    }
+    nxt_stats_completed(req);
+    if ( nxt->sched_done != NULL )
+	nxt->sched_done(nxt, req);
+    else
+    {
+	req->done = 1;
+	if ( req->callback != NULL )
+	    req->callback(nxt, req);
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Record the encode and send phases of a request that was just sent.
+ *  Encoding is timed only the first time a request is sent after
+ *  nxt_request_init(), since reused requests are not rebuilt.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_stats_sent(nxt_request_t *req, const struct timeval *t_submit,
+		       const struct timeval *t_send,
+		       const struct timeval *t_sent)
+
+{
+    int     cls = NXT_STATS_CLASS(req),
+	    code = req->cmd[1];
+
+    rct_stats_phase(cls, code, RCT_PHASE_ENCODE, &req->t_init, t_submit);
+    rct_stats_phase(cls, code, RCT_PHASE_SEND, t_send, t_sent);
+    rct_stats_count(cls, code, RCT_COUNT_COMMANDS, 1);
+    rct_stats_count(cls, code, RCT_COUNT_BYTES_SENT, req->cmd_len);
+    timerclear(&req->t_init);
+    req->t_sent = *t_sent;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Record the outcome of a completed request, and the wait for its
+ *  reply if it got one.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_stats_completed(nxt_request_t *req)
+
+{
+    struct timeval  now;
+    int             cls = NXT_STATS_CLASS(req),
+		    code = req->cmd[1];
+
+    switch(req->status)
+    {
+	case    RCT_OK:
+	    if ( req->response_len == 0 )
+		break;
+	    rct_stats_now(&now);
+	    rct_stats_phase(cls, code, RCT_PHASE_WAIT, &req->t_sent, &now);
+	    rct_stats_count(cls, code, RCT_COUNT_BYTES_RECEIVED,
+			    req->response_len);
+	    break;
+	case    RCT_TIMEOUT:
+	    rct_stats_count(cls, code, RCT_COUNT_TIMEOUTS, 1);
+	    break;
+	default:
+	    rct_stats_count(cls, code, RCT_COUNT_FAILURES, 1);
+	    break;
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Completion callback that appends the request to the brick's
+ *  completion queue, to be collected with nxt_get_completion().
+ * Author:
+ ***************************************************************************/
+
+void    nxt_enqueue_completion(rct_nxt_t *nxt, nxt_request_t *req)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+
+    req->next = NULL;
+    if ( engine->done_tail == NULL )
+	engine->done_head = req;
+    else
+	engine->done_tail->next = req;
+    engine->done_tail = req;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Remove and return the oldest request on the completion queue, or
+ *  NULL if it is empty.  Does not wait.
+ * Author:
+ ***************************************************************************/
+
+nxt_request_t   *nxt_get_completion(rct_nxt_t *nxt)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    nxt_request_t   *req;
+
+    if ( (req = engine->done_head) != NULL )
+    {
+	engine->done_head = req->next;
+	if ( engine->done_head == NULL )
+	    engine->done_tail = NULL;
+	req->next = NULL;
+    }
+    return req;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Wait for a particular request to complete.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_wait(rct_nxt_t *nxt, nxt_request_t *req)
+
+{
+    while ( !req->done )
+    {
+	if ( (nxt_reap(nxt, 1) <= 0) && !req->done )
+	{
+	    /* Nothing in flight, so it can never complete */
+	    nxt_complete_request(nxt, req, RCT_COMMAND_FAILED);
+	}
+    }
+    return req->status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Wait for all in-flight requests to complete.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_drain(rct_nxt_t *nxt)
+
+{
+    int     completed;
+
+    do
+    {
+	if ( (completed = nxt_reap(nxt, NXT_MAX_IN_FLIGHT)) < 0 )
+	    return RCT_COMMAND_FAILED;
+    }   while ( completed > 0 );
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Submit a request and wait for its reply.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_transact(rct_nxt_t *nxt, nxt_request_t *req)
+
+{
+    rct_status_t    status;
+
+    if ( (status = nxt_submit(nxt, req)) != RCT_OK )
+	return status;
+    return nxt_wait(nxt, req);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Synchronously send a prebuilt telegram and copy the reply to
+ *  response.  This is the engine-safe replacement for an
+ *  nxt_send_buf()/nxt_recv_buf() pair.  Returns the reply length,
+ *  0 if no reply was requested, or -1 on failure.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_exchange(rct_nxt_t *nxt, char *cmd, int len, char *response,
+		     int response_max)
+
+{
+    nxt_request_t   req;
+
+    nxt_request_init(&req, (unsigned char)cmd[0], (unsigned char)cmd[1]);
+    if ( nxt_request_append(&req, cmd+2, len-2) != RCT_OK )
+	return -1;
+    if ( nxt_transact(nxt, &req) != RCT_OK )
+	return -1;
+    if ( req.response_len > response_max )
+    {
+	fprintf(stderr,
+	    "Error: %s(): %d byte reply is greater than maxlen of %d\n",
+	    __func__, req.response_len, response_max);
+	return -1;
+    }
+    memcpy(response, req.response, req.response_len);
+    return req.response_len;
+}
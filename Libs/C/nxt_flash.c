@@ -0,0 +1,259 @@
+/****************************************************************************
+ *  This file contains the flash layout planner used by
+ *  nxt_upload_files().  Before anything is written, nxt_flash_plan()
+ *  compares the pages an upload set needs with the free flash reported
+ *  by GET_DEVICE_INFO, so a set that cannot fit fails at once instead
+ *  of after a partial upload.
+ *
+ *  The brick does not report where its files lie, so a linear file can
+ *  still fail to open with NXT_STATUS_NO_LINEAR_SPACE when the free
+ *  flash is fragmented.  Rather than deleting everything and starting
+ *  over, nxt_flash_evict() moves the smallest file not being uploaded
+ *  to a local directory and deletes it from the brick, one at a time,
+ *  until the open succeeds.  nxt_flash_restore() uploads the moved
+ *  files again at the end, after the files that needed the space.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Check that the files of an upload set that will be written fit in
+ *  the free flash, counting the old copies RCT_OVERWRITE replaces
+ *  unless RCT_UPLOAD_SWAP keeps them until the end, and list the other
+ *  files on the brick in *plan for nxt_flash_evict().  Returns
+ *  RCT_NO_SPACE if the set does not fit.
+ *  Files are only ever moved to defragment the flash, never to free
+ *  it, so that every one of them can go back.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_flash_plan(rct_nxt_t *nxt, nxt_upload_t *uploads,
+			       int count, rct_flag_t flags,
+			       nxt_flash_plan_t *plan)
+
+{
+    nxt_file_info_t info;
+    nxt_upload_t    *up;
+    rct_status_t    status;
+    int             c;
+
+    memset(plan, 0, sizeof(*plan));
+    if ( (status = nxt_get_device_info(nxt)) != RCT_OK )
+	return status;
+    plan->free_flash = nxt->free_flash;
+
+    for (c = 0; c < count; ++c)
+	if ( (uploads[c].status == RCT_OK) && !uploads[c].unchanged )
+	    plan->needed += NXT_FLASH_PAGES(uploads[c].size) * NXT_FLASH_PAGE;
+
+    for (status = nxt_find_first(nxt, "*.*", &info); status == RCT_OK;
+	 status = nxt_find_next(nxt, &info))
+    {
+	for (c = 0; (c < count) && (strcmp(uploads[c].name, info.name) != 0);
+	     ++c)
+	    ;
+	if ( c < count )
+	{
+	    /* Files in the set are never moved */
+	    up = &uploads[c];
+	    if ( (up->status == RCT_OK) && !up->unchanged &&
+		 (flags & RCT_OVERWRITE) && !(flags & RCT_UPLOAD_SWAP) )
+		plan->reclaimed += NXT_FLASH_PAGES(info.size) * NXT_FLASH_PAGE;
+	}
+	else if ( plan->count < NXT_FLASH_FILES_MAX )
+	    plan->files[plan->count++] = info;
+    }
+    qsort(plan->files, plan->count, sizeof(*plan->files), nxt_flash_cmp);
+
+    debug_printf("Upload needs %lu bytes, %lu free, %lu reclaimed.\n",
+		 plan->needed, plan->free_flash, plan->reclaimed);
+    if ( plan->needed > plan->free_flash + plan->reclaimed )
+    {
+	fprintf(stderr, "Error: %s(): Upload needs %lu bytes of flash, "
+		"but only %lu are free.\n", __func__, plan->needed,
+		plan->free_flash + plan->reclaimed);
+	return RCT_NO_SPACE;
+    }
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  qsort() comparison for nxt_flash_plan(), smallest file first.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_flash_cmp(const void *a, const void *b)
+
+{
+    const nxt_file_info_t   *fa = a,
+			    *fb = b;
+
+    if ( fa->size == fb->size )
+	return 0;
+    return fa->size < fb->size ? -1 : 1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Make room on the brick by moving the smallest file left in *plan
+ *  to plan->tmp_dir.  A file that cannot be copied or deleted, such
+ *  as the running program, is left in place and the next one tried.
+ *  Returns RCT_OK if a file was moved, or RCT_NO_SPACE if none is
+ *  left to move.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_flash_evict(rct_nxt_t *nxt, nxt_flash_plan_t *plan)
+
+{
+    char        path[NXT_MANIFEST_PATH_MAX+1];
+    int         c;
+
+    if ( (*plan->tmp_dir == '\0') &&
+	 (mkdtemp(strcpy(plan->tmp_dir, NXT_FLASH_TMP_TEMPLATE)) == NULL) )
+    {
+	fprintf(stderr, "Error: %s(): Cannot create %s: %s\n",
+		__func__, plan->tmp_dir, strerror(errno));
+	*plan->tmp_dir = '\0';
+	return RCT_NO_SPACE;
+    }
+
+    for (c = 0; c < plan->count; ++c)
+    {
+	if ( plan->state[c] != NXT_FLASH_ON_BRICK )
+	    continue;
+	snprintf(path, sizeof(path), "%s/%s", plan->tmp_dir,
+		 plan->files[c].name);
+	if ( (nxt_flash_copy_out(nxt, &plan->files[c], path) != RCT_OK) ||
+	     (nxt_flash_delete(nxt, plan->files[c].name) != RCT_OK) )
+	{
+	    unlink(path);
+	    plan->state[c] = NXT_FLASH_PINNED;
+	    continue;
+	}
+	fprintf(stderr, "Moved %s (%lu bytes) off the brick to make room.\n",
+		plan->files[c].name, plan->files[c].size);
+	plan->state[c] = NXT_FLASH_MOVED;
+	return RCT_OK;
+    }
+    return RCT_NO_SPACE;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Copy a file from the brick to the local file at path.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_flash_copy_out(rct_nxt_t *nxt, nxt_file_info_t *info,
+				   char *path)
+
+{
+    size_t          size;
+    int             fd,
+		    file_handle;
+    rct_status_t    status;
+
+    if ( (file_handle = nxt_open_file_read(nxt, info->name, &size)) == -1 )
+	return RCT_OPEN_FAILED;
+    if ( (fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1 )
+    {
+	fprintf(stderr, "Error: %s(): Cannot create %s: %s\n",
+		__func__, path, strerror(errno));
+	nxt_close_file(nxt, file_handle);
+	return RCT_CANNOT_OPEN_FILE;
+    }
+    status = nxt_read_file(nxt, file_handle, size, fd);
+    nxt_close_file(nxt, file_handle);
+    if ( close(fd) != 0 )
+	status = RCT_COMMAND_FAILED;
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Delete a file from the brick, failing if the brick refuses.  Its
+ *  manifest entry is kept, since the same contents go back later.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_flash_delete(rct_nxt_t *nxt, char *filename_on_brick)
+
+{
+    nxt_cmd_t   cmd;
+
+    nxt_cmd_init(nxt, &cmd, NXT_SYSTEM_CMD, NXT_SC_DELETE);
+    nxt_cmd_set_filename(&cmd, 0, filename_on_brick);
+    return nxt_cmd_send(nxt, &cmd);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Upload the files moved by nxt_flash_evict() again, largest first,
+ *  and remove the local copies that made it back.  A file that cannot
+ *  be restored is reported and its copy kept.  Returns RCT_OK if all
+ *  of them were restored.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_flash_restore(rct_nxt_t *nxt, nxt_flash_plan_t *plan)
+
+{
+    nxt_upload_t    up;
+    char            path[NXT_MANIFEST_PATH_MAX+1];
+    int             c,
+		    file_handle;
+    rct_status_t    status = RCT_OK;
+
+    if ( *plan->tmp_dir == '\0' )
+	return RCT_OK;
+    for (c = plan->count - 1; c >= 0; --c)
+    {
+	if ( plan->state[c] != NXT_FLASH_MOVED )
+	    continue;
+	snprintf(path, sizeof(path), "%s/%s", plan->tmp_dir,
+		 plan->files[c].name);
+	memset(&up, 0, sizeof(up));
+	up.path = path;
+	up.name = plan->files[c].name;
+	up.size = plan->files[c].size;
+	if ( (file_handle = nxt_upload_open(nxt, -1, &up, RCT_NO_FLAGS)) != -1 )
+	{
+	    up.status = nxt_upload_write(nxt, &up, &file_handle, RCT_NO_FLAGS);
+	    if ( file_handle != -1 )
+		nxt_close_file(nxt, file_handle);
+	}
+	else
+	    up.status = RCT_OPEN_FAILED;
+
+	if ( up.status == RCT_OK )
+	{
+	    unlink(path);
+	    plan->state[c] = NXT_FLASH_ON_BRICK;
+	}
+	else
+	{
+	    fprintf(stderr, "Error: %s(): Cannot put %s back on the brick.  "
+		    "A copy is in %s.\n", __func__, up.name, path);
+	    status = up.status;
+	}
+    }
+    if ( status == RCT_OK )
+	rmdir(plan->tmp_dir);
+    return status;
+}
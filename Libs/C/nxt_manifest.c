@@ -0,0 +1,301 @@
+/****************************************************************************
+ *  This file contains the upload manifests.  For each NXT, identified
+ *  by its Bluetooth address, a manifest under RCT_MANIFEST_DIR in the
+ *  home directory records the name, size and content hash of every
+ *  file uploaded to it.  nxt_upload_file() skips a file whose hash
+ *  matches the manifest, as long as the brick still lists a file of
+ *  that name and size, so redeploying an unchanged project costs one
+ *  FIND_FIRST per file instead of a transfer.
+ *
+ *  A manifest is a text file with one line per file:
+ *
+ *      <hash in hex> <size> <name>
+ *
+ *  The hash is 64-bit FNV-1a, which is plenty to notice that a file
+ *  has been rebuilt, but is not meant to resist deliberate collisions.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Compute the size and content hash of a local file.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_file_hash(const char *path, unsigned long *size,
+			      unsigned long long *hash)
+
+{
+    unsigned char   block[NXT_UPLOAD_BLOCK];
+    ssize_t         bytes;
+    int             fd,
+		    c;
+
+    if ( (fd = open(path, O_RDONLY)) == -1 )
+    {
+	fprintf(stderr, "Error: %s(): Cannot open %s: %s\n",
+		__func__, path, strerror(errno));
+	return RCT_CANNOT_OPEN_FILE;
+    }
+    *size = 0;
+    *hash = NXT_FNV_OFFSET;
+    while ( (bytes = read(fd, block, NXT_UPLOAD_BLOCK)) > 0 )
+    {
+	for (c = 0; c < bytes; ++c)
+	    *hash = (*hash ^ block[c]) * NXT_FNV_PRIME;
+	*size += bytes;
+    }
+    close(fd);
+    if ( bytes < 0 )
+    {
+	fprintf(stderr, "Error: %s(): Cannot read %s.\n", __func__, path);
+	return RCT_CANNOT_OPEN_FILE;
+    }
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Store the path of a brick's manifest in path.  Returns NULL if the
+ *  brick's Bluetooth address cannot be determined, in which case
+ *  manifests are not used.
+ * Author:
+ ***************************************************************************/
+
+char    *nxt_manifest_path(rct_nxt_t *nxt, char *path, size_t maxlen)
+
+{
+    unsigned char   *a = nxt->bluetooth_address;
+    char            name[16];
+
+    /* The address never changes, so it is fetched only once */
+    if ( ((a[0] | a[1] | a[2] | a[3] | a[4] | a[5]) == 0) &&
+	 (nxt_get_device_info(nxt) != RCT_OK) )
+	return NULL;
+    if ( (a[0] | a[1] | a[2] | a[3] | a[4] | a[5]) == 0 )
+	return NULL;
+    if ( get_home_dir(path, maxlen) == NULL )
+	return NULL;
+    snprintf(name, sizeof(name), "%02x%02x%02x%02x%02x%02x",
+	     a[0], a[1], a[2], a[3], a[4], a[5]);
+    strlcat(path, "/" RCT_MANIFEST_DIR "/", maxlen);
+    strlcat(path, name, maxlen);
+    return path;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Read a brick's manifest.  A missing manifest is an empty one.
+ *  Returns RCT_OPEN_FAILED if the brick has no usable manifest path.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_manifest_load(rct_nxt_t *nxt, nxt_manifest_t *manifest)
+
+{
+    FILE                    *fp;
+    nxt_manifest_entry_t    *entry;
+    char                    line[128];
+
+    manifest->count = 0;
+    if ( nxt_manifest_path(nxt, manifest->path,
+			   NXT_MANIFEST_PATH_MAX) == NULL )
+	return RCT_OPEN_FAILED;
+    if ( (fp = fopen(manifest->path, "r")) == NULL )
+	return RCT_OK;
+    while ( (manifest->count < NXT_MANIFEST_MAX) &&
+	    (fgets(line, sizeof(line), fp) != NULL) )
+    {
+	entry = &manifest->entries[manifest->count];
+	if ( sscanf(line, "%llx %lu %19[^\n]", &entry->hash, &entry->size,
+		    entry->name) == 3 )
+	    ++manifest->count;
+    }
+    fclose(fp);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Write a manifest loaded by nxt_manifest_load() back, replacing the
+ *  old one in a single rename() so that it is never left half written.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_manifest_save(nxt_manifest_t *manifest)
+
+{
+    FILE                    *fp;
+    nxt_manifest_entry_t    *entry;
+    char                    tmp[NXT_MANIFEST_PATH_MAX+5],
+			    *slash;
+    int                     c;
+
+    /* Create RCT_DAEMON_DIR and RCT_MANIFEST_DIR as needed */
+    strlcpy(tmp, manifest->path, NXT_MANIFEST_PATH_MAX);
+    for (slash = strchr(tmp + 1, '/'); slash != NULL;
+	 slash = strchr(slash + 1, '/'))
+    {
+	*slash = '\0';
+	if ( (mkdir(tmp, 0700) == -1) && (errno != EEXIST) )
+	{
+	    fprintf(stderr, "Error: %s(): Cannot create %s: %s\n",
+		    __func__, tmp, strerror(errno));
+	    return RCT_CANNOT_OPEN_FILE;
+	}
+	*slash = '/';
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", manifest->path);
+    if ( (fp = fopen(tmp, "w")) == NULL )
+    {
+	fprintf(stderr, "Error: %s(): Cannot create %s: %s\n",
+		__func__, tmp, strerror(errno));
+	return RCT_CANNOT_OPEN_FILE;
+    }
+    for (c = 0; c < manifest->count; ++c)
+    {
+	entry = &manifest->entries[c];
+	fprintf(fp, "%016llx %lu %s\n", entry->hash, entry->size, entry->name);
+    }
+    if ( (fclose(fp) != 0) || (rename(tmp, manifest->path) != 0) )
+    {
+	fprintf(stderr, "Error: %s(): Cannot write %s: %s\n",
+		__func__, manifest->path, strerror(errno));
+	unlink(tmp);
+	return RCT_CANNOT_OPEN_FILE;
+    }
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the manifest entry for a file on the brick, or NULL.
+ * Author:
+ ***************************************************************************/
+
+nxt_manifest_entry_t    *nxt_manifest_find(nxt_manifest_t *manifest,
+					   const char *filename_on_brick)
+
+{
+    int     c;
+
+    for (c = 0; c < manifest->count; ++c)
+    {
+	if ( strcmp(manifest->entries[c].name, filename_on_brick) == 0 )
+	    return &manifest->entries[c];
+    }
+    return NULL;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Record that a file with the given size and hash is on the brick.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_manifest_update(rct_nxt_t *nxt,
+				    const char *filename_on_brick,
+				    unsigned long size, unsigned long long hash)
+
+{
+    nxt_manifest_t          manifest;
+    nxt_manifest_entry_t    *entry;
+
+    if ( nxt_manifest_load(nxt, &manifest) != RCT_OK )
+	return RCT_OK;
+    if ( (entry = nxt_manifest_find(&manifest, filename_on_brick)) == NULL )
+    {
+	if ( manifest.count == NXT_MANIFEST_MAX )
+	    return RCT_OK;
+	entry = &manifest.entries[manifest.count++];
+	strlcpy(entry->name, filename_on_brick, NXT_FILENAME_MAX+1);
+    }
+    entry->size = size;
+    entry->hash = hash;
+    return nxt_manifest_save(&manifest);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Forget a file that has been deleted from the brick.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_manifest_remove(rct_nxt_t *nxt,
+				    const char *filename_on_brick)
+
+{
+    nxt_manifest_t          manifest;
+    nxt_manifest_entry_t    *entry;
+
+    if ( (nxt_manifest_load(nxt, &manifest) != RCT_OK) ||
+	 ((entry = nxt_manifest_find(&manifest, filename_on_brick)) == NULL) )
+	return RCT_OK;
+    *entry = manifest.entries[--manifest.count];
+    return nxt_manifest_save(&manifest);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Forget every file, after the brick's flash has been erased.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_manifest_clear(rct_nxt_t *nxt)
+
+{
+    char    path[NXT_MANIFEST_PATH_MAX+1];
+
+    if ( nxt_manifest_path(nxt, path, sizeof(path)) == NULL )
+	return RCT_OK;
+    if ( (unlink(path) != 0) && (errno != ENOENT) )
+    {
+	fprintf(stderr, "Error: %s(): Cannot remove %s: %s\n",
+		__func__, path, strerror(errno));
+	return RCT_COMMAND_FAILED;
+    }
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return non-zero if the brick already holds the file with the given
+ *  size and hash: the manifest says it was uploaded, and the brick
+ *  still lists a file of that name and size.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_manifest_unchanged(rct_nxt_t *nxt, char *filename_on_brick,
+			       unsigned long size, unsigned long long hash)
+
+{
+    nxt_manifest_t          manifest;
+    nxt_manifest_entry_t    *entry;
+    unsigned long           size_on_brick;
+
+    if ( (nxt_manifest_load(nxt, &manifest) != RCT_OK) ||
+	 ((entry = nxt_manifest_find(&manifest, filename_on_brick)) == NULL) ||
+	 (entry->size != size) || (entry->hash != hash) )
+	return 0;
+    return (nxt_stat_file(nxt, filename_on_brick, &size_on_brick) == RCT_OK)
+	   && (size_on_brick == size);
+}
@@ -0,0 +1,261 @@
+/****************************************************************************
+ *  This file contains the NXT reconnect logic.  When the link fails
+ *  in the middle of a session (typically an RFCOMM drop lasting a few
+ *  hundred milliseconds), the command engine calls nxt_reconnect()
+ *  instead of failing everything in flight.  The transport is closed
+ *  and reopened using the Bluetooth address, USB device or stream
+ *  device already stored in the rct_nxt_t structure, so there is no
+ *  rediscovery.  Once the link is back, the last output state of each
+ *  motor port is replayed and the requests that were in flight are
+ *  sent again, so callers only see a delay.  The response mode is
+ *  host-side state and survives untouched.  Files open on the brick do
+ *  not survive, since the firmware closes them when the link drops;
+ *  nxt->reconnects lets a file transfer notice and reopen them.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Set how long to keep trying to reconnect after the link fails.
+ *  0 disables reconnecting, and a negative value retries forever.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_set_reconnect(rct_nxt_t *nxt, int timeout_ms)
+
+{
+    nxt->reconnect_ms = timeout_ms;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return non-zero if the brick's transport can be reopened from the
+ *  information in nxt.  A descriptor attached by the caller cannot.
+ *  The simulator keeps its brick across a reconnect.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_can_reconnect(rct_nxt_t *nxt)
+
+{
+    if ( (nxt->reconnect_ms == 0) || (nxt->transport == NULL) )
+	return 0;
+    switch(nxt->transport->type)
+    {
+	case    NXT_BLUETOOTH:
+	case    NXT_USB:
+	case    NXT_SIMULATOR:
+	    return 1;
+	case    NXT_STREAM:
+	    return nxt->stream_device != NULL;
+	default:
+	    return 0;
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Reopen a failed link and restore the session, backing off from
+ *  NXT_RECONNECT_MIN_MS to NXT_RECONNECT_MAX_MS between attempts.
+ *  If no reply has arrived since the last reconnect, the link only
+ *  seemed to come back, so the backoff and the nxt->reconnect_ms
+ *  budget carry on from that outage instead of starting over.
+ *  Returns RCT_OK if the session was restored.  Otherwise the brick
+ *  is left closed, and the caller should fail the requests in flight.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_reconnect(rct_nxt_t *nxt)
+
+{
+    rct_status_t    status;
+    int             wait_ms;
+
+    while ( (status = nxt_reconnect_step(nxt)) == RCT_RECONNECTING )
+    {
+	if ( (wait_ms = rct_deadline_remaining(&nxt->outage_retry)) > 0 )
+	    usleep(wait_ms * 1000L);
+    }
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  nxt_reconnect() for the command engine.  On a brick driven by a
+ *  scheduler, the dispatcher must not sleep through the backoff, so
+ *  this makes at most one attempt and returns RCT_RECONNECTING while
+ *  the link stays down.  The dispatcher skips such a brick and calls
+ *  nxt_reconnect_step() again when nxt->outage_retry is reached.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_relink(rct_nxt_t *nxt)
+
+{
+    if ( nxt->reconnect_nowait )
+	return nxt_reconnect_step(nxt);
+    return nxt_reconnect(nxt);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Take one step of a reconnect without waiting.  The first call
+ *  after the link fails closes it, and every call reopens it if the
+ *  next attempt is due.  Returns RCT_OK if the session was restored,
+ *  RCT_RECONNECTING if the link is still down and the next attempt
+ *  is due at nxt->outage_retry, or RCT_NOT_CONNECTED if the brick was
+ *  given up on.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_reconnect_step(rct_nxt_t *nxt)
+
+{
+    rct_status_t    status = RCT_NOT_CONNECTED;
+
+    /*
+     *  A failure while restoring is handled by the outer attempt, and a
+     *  brick given up on stays closed until reopened.
+     */
+    if ( nxt->reconnecting || !NXT_IS_OPEN(nxt) || !nxt_can_reconnect(nxt) )
+	return RCT_NOT_CONNECTED;
+
+    if ( !nxt->link_down )
+    {
+	fprintf(stderr, "%s(): Connection lost, reconnecting...\n", __func__);
+	nxt->reconnecting = 1;
+	nxt->transport->close(nxt);
+	nxt->reconnecting = 0;
+	nxt->link_down = 1;
+	nxt->reconnect_attempts = 0;
+	if ( nxt->outage_delay_ms == 0 )
+	{
+	    /* A new outage, so try at once */
+	    rct_deadline_set(&nxt->outage_deadline, nxt->reconnect_ms);
+	    rct_deadline_set(&nxt->outage_retry, 0);
+	    nxt->outage_delay_ms = NXT_RECONNECT_MIN_MS;
+	}
+	else if ( nxt_reconnect_backoff(nxt) != RCT_RECONNECTING )
+	    return RCT_NOT_CONNECTED;
+    }
+    if ( rct_deadline_remaining(&nxt->outage_retry) > 0 )
+	return RCT_RECONNECTING;
+
+    ++nxt->reconnect_attempts;
+    nxt->reconnecting = 1;
+    if ( nxt->transport->open(nxt) == RCT_OK )
+    {
+	if ( (status = nxt_restore_session(nxt)) != RCT_OK )
+	    nxt->transport->close(nxt);
+    }
+    nxt->reconnecting = 0;
+    if ( status != RCT_OK )
+	return nxt_reconnect_backoff(nxt);
+
+    /* The brick may have been power cycled or reflashed */
+    nxt_cache_flush(nxt);
+    ++nxt->reconnects;
+    nxt->link_down = 0;
+    fprintf(stderr, "%s(): Reconnected after %d attempt%s.\n",
+	    __func__, nxt->reconnect_attempts,
+	    nxt->reconnect_attempts == 1 ? "" : "s");
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Set the time of the next reconnect attempt and double the backoff,
+ *  or give up if the nxt->reconnect_ms budget is spent.  Returns
+ *  RCT_RECONNECTING, or RCT_NOT_CONNECTED if the brick was given up
+ *  on and left closed.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_reconnect_backoff(rct_nxt_t *nxt)
+
+{
+    int     remaining_ms;
+
+    if ( (remaining_ms = rct_deadline_remaining(&nxt->outage_deadline)) == 0 )
+    {
+	fprintf(stderr, "Error: %s(): Gave up after %d attempts.\n",
+		__func__, nxt->reconnect_attempts);
+	nxt->link_down = 0;
+	nxt->outage_delay_ms = 0;
+	nxt->is_open = 0;
+	return RCT_NOT_CONNECTED;
+    }
+    if ( (remaining_ms > 0) && (remaining_ms < nxt->outage_delay_ms) )
+	nxt->outage_delay_ms = remaining_ms;
+    rct_deadline_set(&nxt->outage_retry, nxt->outage_delay_ms);
+    nxt->outage_delay_ms = MIN(nxt->outage_delay_ms * 2, NXT_RECONNECT_MAX_MS);
+    return RCT_RECONNECTING;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Bring a freshly reopened brick back to where the session left off:
+ *  replay the last output state of every port that was set, then
+ *  resend the requests in flight with fresh deadlines.  Everything
+ *  goes out in one nxt_send_bufs() call.  The outputs are sent without
+ *  asking for a reply, so the engine's queue still matches what the
+ *  brick will answer.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_restore_session(rct_nxt_t *nxt)
+
+{
+    nxt_engine_t    *engine = &nxt->engine;
+    nxt_cmd_t       outputs[3];
+    nxt_request_t   *req;
+    struct iovec    iov[3 + NXT_MAX_IN_FLIGHT];
+    int             c,
+		    count = 0;
+
+    for (c = 0; c < 3; ++c)
+    {
+	if ( nxt->outputs_set & (1 << c) )
+	{
+	    nxt_output_cmd(nxt, &outputs[c], c, &nxt->port[c]);
+	    outputs[c].req.cmd[0] |= NXT_NO_RESPONSE;
+	    iov[count].iov_base = outputs[c].req.cmd;
+	    iov[count++].iov_len = outputs[c].req.cmd_len;
+	}
+    }
+    for (c = 0; c < engine->count; ++c)
+    {
+	req = engine->in_flight[(engine->head + c) % NXT_MAX_IN_FLIGHT];
+	rct_deadline_set(&req->deadline, req->timeout_ms != 0 ?
+			 req->timeout_ms : nxt->timeout_ms);
+	gettimeofday(&req->t_sent, NULL);
+	rct_stats_count(NXT_STATS_CLASS(req), req->cmd[1],
+			RCT_COUNT_RETRIES, 1);
+	iov[count].iov_base = req->cmd;
+	iov[count++].iov_len = req->cmd_len;
+    }
+
+    /* Replies to the old link's requests will never arrive */
+    engine->stale_count = 0;
+
+    debug_printf("Restoring %d outputs and %d requests.\n",
+		 count - engine->count, engine->count);
+    if ( (count > 0) && (nxt_send_bufs(nxt, iov, count) != count) )
+	return RCT_COMMAND_FAILED;
+    return RCT_OK;
+}
@@ -0,0 +1,296 @@
+/****************************************************************************
+ *  This file contains the replay transport, which plays the NXT side
+ *  of a capture file (see rct_capture.h) back to the library.  Sends
+ *  are matched against the recorded commands and otherwise discarded,
+ *  and the recorded replies are returned in order, either with their
+ *  original turnaround times or as fast as they are read.  This makes
+ *  latency problems seen in the field reproducible, and gives parser
+ *  and engine changes a benchmark made of real traffic.
+ *
+ *  Select it with nxt_set_replay(), or by setting ROBOCTL_REPLAY to a
+ *  capture file before rct_find_bricks().  ROBOCTL_REPLAY_FAST
+ *  ignores the recorded timing.  ROBOCTL_REPLAY_BRICK selects the
+ *  brick id to play when the capture holds more than one NXT.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Use the capture file at path as the connection to an NXT brick.
+ *  The file is read by nxt_open_brick().
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_set_replay(rct_nxt_t *nxt, char *path)
+
+{
+    rct_status_t    status;
+
+    if ( (status = nxt_set_transport(nxt, &nxt_replay_transport)) != RCT_OK )
+	return status;
+    nxt->stream_device = path;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Load the frames of one NXT brick from the capture file.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_replay_open(rct_nxt_t *nxt)
+
+{
+    nxt_replay_t        *replay;
+    rct_capture_frame_t frame,
+			*frames;
+    FILE                *fp;
+    char                *env;
+    int                 brick_id = -1,
+			max = 0,
+			status;
+
+    if ( nxt->stream_device == NULL )
+    {
+	fprintf(stderr, "Error: %s(): No capture file given.\n", __func__);
+	return RCT_OPEN_FAILED;
+    }
+    if ( (fp = rct_capture_open_read(nxt->stream_device, NULL)) == NULL )
+	return RCT_OPEN_FAILED;
+    if ( (replay = calloc(1, sizeof(*replay))) == NULL )
+    {
+	fprintf(stderr, "Error: %s(): Cannot allocate replay.\n", __func__);
+	fclose(fp);
+	return RCT_OPEN_FAILED;
+    }
+    if ( (env = getenv("ROBOCTL_REPLAY_BRICK")) != NULL )
+	brick_id = strtol(env, NULL, 10);
+    replay->fast = getenv("ROBOCTL_REPLAY_FAST") != NULL;
+
+    while ( (status = rct_capture_read_frame(fp, &frame)) == 1 )
+    {
+	if ( frame.brick_type != RCT_NXT )
+	    continue;
+	if ( brick_id == -1 )
+	    brick_id = frame.brick_id;
+	if ( frame.brick_id != brick_id )
+	    continue;
+	if ( replay->count == max )
+	{
+	    max = max == 0 ? 256 : max * 2;
+	    if ( (frames = realloc(replay->frames,
+				   max * sizeof(*frames))) == NULL )
+	    {
+		status = -1;
+		break;
+	    }
+	    replay->frames = frames;
+	}
+	replay->frames[replay->count++] = frame;
+    }
+    fclose(fp);
+    if ( status == -1 )
+    {
+	fprintf(stderr, "Error: %s(): Cannot load %s.\n",
+		__func__, nxt->stream_device);
+	free(replay->frames);
+	free(replay);
+	return RCT_OPEN_FAILED;
+    }
+
+    gettimeofday(&replay->anchor, NULL);
+    if ( replay->count > 0 )
+	replay->anchor_time = replay->frames[0].time;
+    nxt->transport_data = replay;
+    debug_printf("Replaying %d frames of brick %d from %s%s.\n",
+		 replay->count, brick_id, nxt->stream_device,
+		 replay->fast ? " at full speed" : "");
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Discard the loaded capture.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_replay_close(rct_nxt_t *nxt)
+
+{
+    nxt_replay_t    *replay = nxt->transport_data;
+
+    if ( replay == NULL )
+	return RCT_NOT_CONNECTED;
+    free(replay->frames);
+    free(replay);
+    nxt->transport_data = NULL;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Index of the first frame at or after index going in the given
+ *  direction, or replay->count if there is none.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_replay_next(nxt_replay_t *replay, int index,
+			rct_capture_dir_t direction)
+
+{
+    while ( (index < replay->count) &&
+	    (replay->frames[index].direction != direction) )
+	++index;
+    return index;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Accept a telegram in place of the next recorded command.  The
+ *  recorded reply times are measured from here.  Differences from
+ *  the recording are reported in debug mode, but do not stop the
+ *  replay.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_replay_send(rct_nxt_t *nxt, char *buf, int len)
+
+{
+    nxt_replay_t        *replay = nxt->transport_data;
+    rct_capture_frame_t *frame;
+
+    replay->next_tx = nxt_replay_next(replay, replay->next_tx,
+				      RCT_CAPTURE_TO_BRICK);
+    gettimeofday(&replay->anchor, NULL);
+    if ( replay->next_tx == replay->count )
+    {
+	debug_printf("%s(): Sent past end of capture.\n", __func__);
+	return len;
+    }
+    frame = &replay->frames[replay->next_tx++];
+    replay->anchor_time = frame->time;
+    if ( (frame->len != MIN(len, RCT_CAPTURE_DATA_MAX)) ||
+	 (memcmp(frame->data, buf, frame->len) != 0) )
+	debug_printf("%s(): Command differs from recording at %ld.%06lds.\n",
+		     __func__, (long)frame->time.tv_sec,
+		     (long)frame->time.tv_usec);
+    return len;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Microseconds until the next recorded reply is due, <= 0 if it
+ *  already is.  The reply is due as long after the last send as it
+ *  came after the matching command in the recording.
+ * Author:
+ ***************************************************************************/
+
+long    nxt_replay_usec_until(nxt_replay_t *replay)
+
+{
+    rct_capture_frame_t *frame = &replay->frames[replay->next_rx];
+    struct timeval      now;
+
+    if ( replay->fast )
+	return 0;
+    gettimeofday(&now, NULL);
+    return (frame->time.tv_sec - replay->anchor_time.tv_sec) * 1000000L +
+	   (frame->time.tv_usec - replay->anchor_time.tv_usec) -
+	   ((now.tv_sec - replay->anchor.tv_sec) * 1000000L +
+	   (now.tv_usec - replay->anchor.tv_usec));
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the next recorded reply once it is due, or 0 if it is not
+ *  due within nxt->recv_timeout_ms or the capture has run out.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_replay_recv(rct_nxt_t *nxt, char *buf, int maxlen)
+
+{
+    nxt_replay_t        *replay = nxt->transport_data;
+    rct_capture_frame_t *frame;
+
+    if ( nxt_replay_poll(nxt, nxt->recv_timeout_ms) <= 0 )
+	return 0;
+    frame = &replay->frames[replay->next_rx++];
+    if ( frame->len > maxlen )
+    {
+	fprintf(stderr,
+	    "Error: %s(): %d byte message is greater than maxlen of %d\n",
+	    __func__, frame->len, maxlen);
+	return -1;
+    }
+    memcpy(buf, frame->data, frame->len);
+    return frame->len;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Report whether a recorded reply is due, waiting up to timeout_ms
+ *  (or forever if negative) for it.  A capture that has run out
+ *  behaves like a brick that stopped answering.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_replay_poll(rct_nxt_t *nxt, int timeout_ms)
+
+{
+    nxt_replay_t    *replay = nxt->transport_data;
+    long            wait_us;
+
+    replay->next_rx = nxt_replay_next(replay, replay->next_rx,
+				      RCT_CAPTURE_FROM_BRICK);
+    if ( replay->next_rx == replay->count )
+    {
+	if ( timeout_ms < 0 )
+	{
+	    fprintf(stderr, "Error: %s(): End of capture.\n", __func__);
+	    return -1;
+	}
+	if ( !replay->fast )
+	    usleep(timeout_ms * 1000L);
+	return 0;
+    }
+    if ( (wait_us = nxt_replay_usec_until(replay)) <= 0 )
+	return 1;
+    if ( (timeout_ms >= 0) && (wait_us > timeout_ms * 1000L) )
+    {
+	usleep(timeout_ms * 1000L);
+	return 0;
+    }
+    usleep(wait_us);
+    return 1;
+}
+
+
+const nxt_transport_t   nxt_replay_transport =
+{
+    "replay",
+    NXT_REPLAY,
+    nxt_replay_open,
+    nxt_replay_send,
+    nxt_replay_recv,
+    nxt_replay_close,
+    nxt_replay_poll,
+    NULL,
+    NULL,
+    NULL
+};
@@ -0,0 +1,169 @@
+
+/****************************************************************************
+ *  This file contains the receive ring used by stream connections
+ *  (Bluetooth RFCOMM, ptys, socketpairs).  A stream does not preserve
+ *  message boundaries, so a read() may return part of a packet or
+ *  several packets at once.  The ring collects whatever the kernel
+ *  has in as few syscalls as possible and hands out complete packets,
+ *  reassembled from their 2-byte length headers, in place.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Allocate an empty receive ring.
+ * Author:
+ ***************************************************************************/
+
+nxt_ring_t  *nxt_ring_new(void)
+
+{
+    nxt_ring_t  *ring;
+
+    if ( (ring = malloc(sizeof(*ring))) == NULL )
+    {
+	fprintf(stderr, "Error: %s(): Cannot allocate receive ring.\n",
+		__func__);
+	return NULL;
+    }
+    nxt_ring_flush(ring);
+    return ring;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Discard everything in the ring.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_ring_flush(nxt_ring_t *ring)
+
+{
+    ring->head = ring->tail = 0;
+    ring->peeked = 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Read as much as is available from fd into the free space in the
+ *  ring, using a single readv() even when the free space wraps.
+ *  Returns the number of bytes read, 0 on end of file, or -1 on error.
+ * Author:
+ ***************************************************************************/
+
+ssize_t nxt_ring_fill(nxt_ring_t *ring, int fd)
+
+{
+    struct iovec    iov[2];
+    size_t          start,
+		    space;
+    ssize_t         bytes;
+    int             iovcnt;
+
+    space = NXT_RING_SIZE - NXT_RING_USED(ring);
+    if ( space == 0 )
+    {
+	fprintf(stderr, "Error: %s(): Receive ring is full.\n", __func__);
+	return -1;
+    }
+
+    start = ring->tail & (NXT_RING_SIZE - 1);
+    iov[0].iov_base = ring->buf + start;
+    if ( start + space <= NXT_RING_SIZE )
+    {
+	iov[0].iov_len = space;
+	iovcnt = 1;
+    }
+    else
+    {
+	iov[0].iov_len = NXT_RING_SIZE - start;
+	iov[1].iov_base = ring->buf;
+	iov[1].iov_len = space - iov[0].iov_len;
+	iovcnt = 2;
+    }
+
+    do
+	bytes = readv(fd, iov, iovcnt);
+    while ( (bytes == -1) && (errno == EINTR) );
+    if ( bytes > 0 )
+	ring->tail += bytes;
+    return bytes;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Locate the next complete packet in the ring.  On success, *packet
+ *  points to the payload, which stays valid until nxt_ring_consume().
+ *  The payload is in the ring itself unless it wraps around the end,
+ *  in which case it is assembled in the bounce buffer.
+ *
+ *  Returns the payload length, 0 if no complete packet is buffered
+ *  yet, or -1 if the length header is invalid.  The stream cannot be
+ *  resynchronized after a bad header, so the caller should flush.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_ring_peek(nxt_ring_t *ring, unsigned char **packet)
+
+{
+    size_t          used = NXT_RING_USED(ring),
+		    start,
+		    first;
+    unsigned char   header[2];
+    int             len;
+
+    if ( used < 2 )
+	return 0;
+
+    header[0] = ring->buf[ring->head & (NXT_RING_SIZE - 1)];
+    header[1] = ring->buf[(ring->head + 1) & (NXT_RING_SIZE - 1)];
+    len = buf2short(header) & 0xffff;
+    if ( (len == 0) || (len > (int)sizeof(ring->bounce)) )
+    {
+	fprintf(stderr, "Error: %s(): Invalid packet length %d.\n",
+		__func__, len);
+	return -1;
+    }
+    if ( used < (size_t)len + 2 )
+	return 0;
+
+    start = (ring->head + 2) & (NXT_RING_SIZE - 1);
+    if ( start + len <= NXT_RING_SIZE )
+	*packet = ring->buf + start;
+    else
+    {
+	first = NXT_RING_SIZE - start;
+	memcpy(ring->bounce, ring->buf + start, first);
+	memcpy(ring->bounce + first, ring->buf, len - first);
+	*packet = ring->bounce;
+    }
+    ring->peeked = len + 2;
+    return len;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Release the packet returned by the last nxt_ring_peek().
+ * Author:
+ ***************************************************************************/
+
+void    nxt_ring_consume(nxt_ring_t *ring)
+
+{
+    ring->head += ring->peeked;
+    ring->peeked = 0;
+}
@@ -0,0 +1,881 @@
+/****************************************************************************
+ *  This file contains the multi-brick scheduler.  Several NXTs on one
+ *  host adapter share its bandwidth, and the command engine has no
+ *  idea that other bricks exist, so a long upload to one brick from
+ *  one thread can starve motor commands to another.  The scheduler
+ *  sits above the engine and owns all traffic to the bricks added to
+ *  it.  Requests from any thread are queued per brick and per
+ *  priority class, and a single dispatcher thread takes them
+ *  round-robin, one request per brick per turn, highest class first.
+ *  See rct_nxt.h for the rules that keep a stop from waiting behind
+ *  a transfer.
+ *
+ *  Typical use:
+ *
+ *      sched = nxt_sched_new();
+ *      nxt_sched_add(sched, &brick[0]->nxt);
+ *      nxt_sched_add(sched, &brick[1]->nxt);
+ *      nxt_sched_start(sched);
+ *      ...
+ *      nxt_write_file() to brick[0] in one thread
+ *      nxt_stop_program() to brick[0] in another
+ *      ...
+ *      nxt_sched_free(sched);
+ *
+ *  The engine is not thread-safe, so while the scheduler runs, the
+ *  engine calls of other threads on its bricks are redirected to it
+ *  by nxt_sched_submit_hook() and nxt_sched_reap_hook().  Only the
+ *  dispatcher thread touches the engine.  Completed requests are
+ *  marked done with the lock held, by nxt_sched_done_hook(), since
+ *  other threads wait for that under the lock.
+ *
+ *  Cached queries (see cache.c) that miss the cache in several
+ *  threads at once are collapsed onto one command.  The first is
+ *  copied into a request owned by the scheduler, later ones just wait
+ *  for it, and its reply is copied to all of them.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <usb.h>
+#include "roboctl.h"
+
+/*
+ *  The structure is kept out of the installed headers so that
+ *  programs using the library do not need the pthread headers.
+ */
+
+typedef struct
+{
+    rct_nxt_t       *nxt;
+    nxt_request_t   *head[NXT_PRIORITIES];  /* Linked through req->next */
+    nxt_request_t   *tail[NXT_PRIORITIES];
+    int             queued;
+    int             busy;           /* Taken from the queues, not done */
+    unsigned long   completions;
+    struct timeval  next_send;
+    nxt_request_t   flight[NXT_CACHE_ENTRIES];      /* Sent for waiters */
+    nxt_request_t   *waiters[NXT_CACHE_ENTRIES];    /* Linked by req->next */
+    int             collapsed;      /* Total on the waiters lists */
+}   nxt_sched_brick_t;
+
+struct nxt_sched
+{
+    nxt_sched_brick_t   bricks[NXT_SCHED_MAX_BRICKS];
+    int                 count;
+    int                 next;       /* Brick to look at first */
+    int                 queued;
+    int                 bulk_depth;
+    int                 running;
+    int                 polling;    /* Dispatcher is in nxt_sched_idle() */
+    int                 wake[2];    /* Pipe to end its poll() early */
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      work;       /* Signaled when a request is queued */
+    pthread_cond_t      done;       /* Broadcast when requests complete */
+};
+
+
+/****************************************************************************
+ * Description:
+ *  Create a scheduler with no bricks.  Returns NULL if out of memory.
+ * Author:
+ ***************************************************************************/
+
+nxt_sched_t *nxt_sched_new(void)
+
+{
+    nxt_sched_t *sched;
+
+    if ( (sched = calloc(1, sizeof(*sched))) == NULL )
+    {
+	fprintf(stderr, "Error: %s(): Cannot allocate scheduler.\n", __func__);
+	return NULL;
+    }
+    if ( pipe(sched->wake) != 0 )
+    {
+	fprintf(stderr, "Error: %s(): Cannot create pipe: %s\n",
+		__func__, strerror(errno));
+	free(sched);
+	return NULL;
+    }
+    fcntl(sched->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(sched->wake[1], F_SETFL, O_NONBLOCK);
+    sched->bulk_depth = NXT_SCHED_BULK_DEPTH;
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_cond_init(&sched->work, NULL);
+    pthread_cond_init(&sched->done, NULL);
+    return sched;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Set how many bulk requests may be in flight to a brick.  Deeper
+ *  is faster for transfers, but a stop may have to wait behind that
+ *  many packets.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_sched_set_bulk_depth(nxt_sched_t *sched, int depth)
+
+{
+    if ( (depth < 1) || (depth > NXT_MAX_IN_FLIGHT) )
+    {
+	fprintf(stderr, "Error: %s(): Depth must be 1 to %d.\n",
+		__func__, NXT_MAX_IN_FLIGHT);
+	return RCT_INVALID_DATA;
+    }
+    pthread_mutex_lock(&sched->lock);
+    sched->bulk_depth = depth;
+    pthread_mutex_unlock(&sched->lock);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Hand an open brick over to the scheduler.  From then on, it must
+ *  not be used by more than one thread unless the scheduler is running.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_sched_add(nxt_sched_t *sched, rct_nxt_t *nxt)
+
+{
+    rct_status_t    status = RCT_OK;
+
+    pthread_mutex_lock(&sched->lock);
+    if ( sched->count == NXT_SCHED_MAX_BRICKS )
+    {
+	fprintf(stderr, "Error: %s(): Limit of %d bricks reached.\n",
+		__func__, NXT_SCHED_MAX_BRICKS);
+	status = RCT_INVALID_DATA;
+    }
+    else
+    {
+	memset(&sched->bricks[sched->count], 0, sizeof(nxt_sched_brick_t));
+	sched->bricks[sched->count++].nxt = nxt;
+	nxt->sched = sched;
+	if ( sched->running )
+	    nxt_sched_hook(nxt, 1);
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Route the engine calls made on a brick through its scheduler, or
+ *  stop doing so.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_sched_hook(rct_nxt_t *nxt, int on)
+
+{
+    nxt->sched_submit = on ? nxt_sched_submit_hook : NULL;
+    nxt->sched_reap = on ? nxt_sched_reap_hook : NULL;
+    nxt->sched_done = on ? nxt_sched_done_hook : NULL;
+    nxt->reconnect_nowait = on;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Start the dispatcher thread.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_sched_start(nxt_sched_t *sched)
+
+{
+    int     c;
+
+    pthread_mutex_lock(&sched->lock);
+    sched->running = 1;
+    if ( pthread_create(&sched->thread, NULL, nxt_sched_thread, sched) != 0 )
+    {
+	fprintf(stderr, "Error: %s(): Cannot start dispatcher thread.\n",
+		__func__);
+	sched->running = 0;
+	pthread_mutex_unlock(&sched->lock);
+	return RCT_COMMAND_FAILED;
+    }
+    for (c = 0; c < sched->count; ++c)
+	nxt_sched_hook(sched->bricks[c].nxt, 1);
+    pthread_mutex_unlock(&sched->lock);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Stop the dispatcher and free the scheduler.  Requests already
+ *  queued are sent and their replies collected first.  The bricks
+ *  are left open for direct use.  Other threads must be done with
+ *  them by now.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_sched_free(nxt_sched_t *sched)
+
+{
+    int     c;
+
+    if ( sched->running )
+    {
+	pthread_mutex_lock(&sched->lock);
+	sched->running = 0;
+	nxt_sched_wake(sched);
+	pthread_mutex_unlock(&sched->lock);
+	pthread_join(sched->thread, NULL);
+    }
+    for (c = 0; c < sched->count; ++c)
+    {
+	nxt_sched_hook(sched->bricks[c].nxt, 0);
+	sched->bricks[c].nxt->sched = NULL;
+    }
+    close(sched->wake[0]);
+    close(sched->wake[1]);
+    pthread_cond_destroy(&sched->work);
+    pthread_cond_destroy(&sched->done);
+    pthread_mutex_destroy(&sched->lock);
+    free(sched);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the index of nxt in the scheduler's bricks, or -1 if it
+ *  has not been added.  Called with the lock held.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sched_find(nxt_sched_t *sched, rct_nxt_t *nxt)
+
+{
+    int     c;
+
+    for (c = 0; c < sched->count; ++c)
+    {
+	if ( sched->bricks[c].nxt == nxt )
+	    return c;
+    }
+    return -1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Queue a request for a brick added to the scheduler, in the queue
+ *  for req->priority.  Safe to call from any thread, including
+ *  completion callbacks.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_sched_submit(nxt_sched_t *sched, rct_nxt_t *nxt,
+				 nxt_request_t *req)
+
+{
+    nxt_sched_brick_t   *brick;
+    int                 b,
+			query,
+			collapse,
+			prio = req->priority;
+
+    pthread_mutex_lock(&sched->lock);
+    if ( ((b = nxt_sched_find(sched, nxt)) < 0) || (prio < 0) ||
+	 (prio >= NXT_PRIORITIES) )
+    {
+	pthread_mutex_unlock(&sched->lock);
+	fprintf(stderr, "Error: %s(): Unknown brick or priority.\n",
+		__func__);
+	return RCT_INVALID_DATA;
+    }
+    brick = &sched->bricks[b];
+    req->done = 0;
+    req->next = NULL;
+    if ( (query = nxt_sched_query(req)) >= 0 )
+    {
+	/* Wait for the copy already queued or in flight, or send one */
+	collapse = brick->waiters[query] != NULL;
+	req->next = brick->waiters[query];
+	brick->waiters[query] = req;
+	++brick->collapsed;
+	if ( collapse )
+	{
+	    pthread_mutex_unlock(&sched->lock);
+	    return RCT_OK;
+	}
+	brick->flight[query] = *req;
+	brick->flight[query].callback = NULL;
+	brick->flight[query].next = NULL;
+	req = &brick->flight[query];
+    }
+    if ( brick->tail[prio] == NULL )
+	brick->head[prio] = req;
+    else
+	brick->tail[prio]->next = req;
+    brick->tail[prio] = req;
+    ++brick->queued;
+    ++sched->queued;
+    nxt_sched_wake(sched);
+    pthread_mutex_unlock(&sched->lock);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Wake the dispatcher, whether it is waiting for work or in poll().
+ *  Called with the lock held.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_sched_wake(nxt_sched_t *sched)
+
+{
+    pthread_cond_signal(&sched->work);
+    /* One byte is enough, and the pipe is non-blocking in case it fills */
+    if ( sched->polling && (write(sched->wake[1], "", 1) == 1) )
+	sched->polling = 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the cache slot of a request that may be collapsed onto
+ *  another like it, or -1.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sched_query(const nxt_request_t *req)
+
+{
+    if ( (req->cmd_len != 2) || (req->cmd[0] & NXT_NO_RESPONSE) )
+	return -1;
+    return nxt_cache_query(req->cmd[0], req->cmd[1]);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Wait for a request submitted through the scheduler to complete.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_sched_wait(nxt_sched_t *sched, nxt_request_t *req)
+
+{
+    pthread_mutex_lock(&sched->lock);
+    while ( !req->done )
+	pthread_cond_wait(&sched->done, &sched->lock);
+    pthread_mutex_unlock(&sched->lock);
+    return req->status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Submit a request through the scheduler and wait for its reply.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_sched_transact(nxt_sched_t *sched, rct_nxt_t *nxt,
+				   nxt_request_t *req)
+
+{
+    rct_status_t    status;
+
+    if ( (status = nxt_sched_submit(sched, nxt, req)) != RCT_OK )
+	return status;
+    return nxt_sched_wait(sched, req);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  nxt_submit_batch() on a scheduled brick.  The dispatcher sends
+ *  directly, and other threads queue the requests.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_sched_submit_hook(rct_nxt_t *nxt, nxt_request_t **reqs,
+				      int count)
+
+{
+    rct_status_t    status;
+    int             c;
+
+    if ( pthread_equal(pthread_self(), nxt->sched->thread) )
+	return nxt_engine_submit(nxt, reqs, count);
+    for (c = 0; c < count; ++c)
+    {
+	if ( (status = nxt_sched_submit(nxt->sched, nxt, reqs[c])) != RCT_OK )
+	    return status;
+    }
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  nxt_reap() on a scheduled brick.  The dispatcher receives replies
+ *  directly, and other threads wait until it has completed min
+ *  requests for the brick, or the brick has none left outstanding.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sched_reap_hook(rct_nxt_t *nxt, int min)
+
+{
+    nxt_sched_t         *sched = nxt->sched;
+    nxt_sched_brick_t   *brick;
+    unsigned long       start;
+    int                 completed;
+
+    if ( pthread_equal(pthread_self(), sched->thread) )
+	return nxt_engine_reap(nxt, min);
+
+    pthread_mutex_lock(&sched->lock);
+    brick = &sched->bricks[nxt_sched_find(sched, nxt)];
+    start = brick->completions;
+    while ( ((long)(brick->completions - start) < min) &&
+	    (brick->queued + brick->busy + brick->collapsed > 0) )
+	pthread_cond_wait(&sched->done, &sched->lock);
+    completed = brick->completions - start;
+    pthread_mutex_unlock(&sched->lock);
+    return MAX(completed, 0);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Completion of a request by the engine on a scheduled brick.  The
+ *  callback is called first, without the lock, since the thread
+ *  waiting for req may reuse it as soon as it is done.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_sched_done_hook(rct_nxt_t *nxt, nxt_request_t *req)
+
+{
+    nxt_sched_t *sched = nxt->sched;
+
+    if ( req->callback != NULL )
+	req->callback(nxt, req);
+    pthread_mutex_lock(&sched->lock);
+    req->done = 1;
+    pthread_mutex_unlock(&sched->lock);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return non-zero if brick number b may be sent req now, following
+ *  the rules in rct_nxt.h.  A brick waiting to reconnect gets nothing,
+ *  and in adaptive mode, a command without a reply waits for the gap
+ *  nxt_adaptive_pace() would otherwise sleep through.  Called with the
+ *  lock held.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sched_ready(nxt_sched_t *sched, int b, const nxt_request_t *req,
+			const struct timeval *now)
+
+{
+    nxt_sched_brick_t   *brick = &sched->bricks[b];
+    rct_nxt_t           *nxt = brick->nxt;
+
+    if ( nxt->link_down )
+	return 0;
+    if ( nxt->adaptive.enabled && (req->cmd[0] & NXT_NO_RESPONSE) &&
+	 timercmp(now, &nxt->adaptive.next_send, <) )
+	return 0;
+    switch(req->priority)
+    {
+	case    NXT_PRIO_EMERGENCY:
+	    return brick->busy < NXT_MAX_IN_FLIGHT;
+	case    NXT_PRIO_BULK:
+	    if ( brick->busy >= sched->bulk_depth )
+		return 0;
+	    break;
+	default:
+	    if ( brick->busy >= brick->nxt->engine.window )
+		return 0;
+	    break;
+    }
+    return !timercmp(now, &brick->next_send, <);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Take the next request to send, going round the bricks from where
+ *  the last turn ended, highest class first.  The brick number is
+ *  stored in *bp.  Returns NULL if no brick is ready for a queued
+ *  request.  Called with the lock held.
+ * Author:
+ ***************************************************************************/
+
+nxt_request_t   *nxt_sched_pick(nxt_sched_t *sched, int *bp)
+
+{
+    nxt_sched_brick_t   *brick;
+    nxt_request_t       *req;
+    struct timeval      now;
+    int                 prio,
+			c,
+			b;
+
+    gettimeofday(&now, NULL);
+    for (prio = 0; prio < NXT_PRIORITIES; ++prio)
+    {
+	for (c = 0; c < sched->count; ++c)
+	{
+	    b = (sched->next + c) % sched->count;
+	    brick = &sched->bricks[b];
+	    if ( (brick->head[prio] == NULL) ||
+		 !nxt_sched_ready(sched, b, brick->head[prio], &now) )
+		continue;
+	    req = brick->head[prio];
+	    if ( (brick->head[prio] = req->next) == NULL )
+		brick->tail[prio] = NULL;
+	    req->next = NULL;
+	    --brick->queued;
+	    ++brick->busy;
+	    --sched->queued;
+	    sched->next = (b + 1) % sched->count;
+	    *bp = b;
+	    return req;
+	}
+    }
+    return NULL;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Send one request picked by nxt_sched_pick() to brick number b,
+ *  and set the time before which the brick gets no more.  Emergency
+ *  requests do not delay the others.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_sched_send(nxt_sched_t *sched, int b, nxt_request_t *req)
+
+{
+    nxt_sched_brick_t   *brick = &sched->bricks[b];
+    rct_nxt_t           *nxt = brick->nxt;
+    long                gap_us;
+
+    nxt_engine_submit(nxt, &req, 1);
+    if ( req->priority == NXT_PRIO_EMERGENCY )
+	return;
+    gap_us = nxt->engine.turnaround_us / nxt->engine.window;
+    gettimeofday(&brick->next_send, NULL);
+    brick->next_send.tv_sec += gap_us / 1000000;
+    brick->next_send.tv_usec += gap_us % 1000000;
+    if ( brick->next_send.tv_usec >= 1000000 )
+    {
+	++brick->next_send.tv_sec;
+	brick->next_send.tv_usec -= 1000000;
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Bring the count of outstanding requests per brick up to date after
+ *  the dispatcher has used the engine, and wake the threads waiting
+ *  for completions if there were any.  Requests the engine completed
+ *  are those taken from the queues but no longer in flight.  Requests
+ *  waiting for a collapsed query are completed too.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_sched_sync(nxt_sched_t *sched)
+
+{
+    nxt_sched_brick_t   *brick;
+    int                 c,
+			collapsed = 0,
+			completed = 0;
+
+    pthread_mutex_lock(&sched->lock);
+    for (c = 0; c < sched->count; ++c)
+    {
+	brick = &sched->bricks[c];
+	if ( brick->collapsed > 0 )
+	    collapsed |= 1 << c;
+	if ( brick->busy != brick->nxt->engine.count )
+	{
+	    brick->completions += brick->busy - brick->nxt->engine.count;
+	    brick->busy = brick->nxt->engine.count;
+	    completed = 1;
+	}
+    }
+    pthread_mutex_unlock(&sched->lock);
+    for (c = 0; c < sched->count; ++c)
+    {
+	if ( collapsed & (1 << c) )
+	    completed += nxt_sched_answer(sched, c);
+    }
+    if ( completed )
+    {
+	pthread_mutex_lock(&sched->lock);
+	pthread_cond_broadcast(&sched->done);
+	pthread_mutex_unlock(&sched->lock);
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Complete the requests waiting for copies sent to brick number b
+ *  that have been answered, and return how many there were.  The
+ *  callbacks are called without the lock, as by the engine, and each
+ *  request is then marked done and counted with the lock held.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sched_answer(nxt_sched_t *sched, int b)
+
+{
+    nxt_sched_brick_t   *brick = &sched->bricks[b];
+    nxt_request_t       *flight,
+			*req,
+			*next;
+    int                 query,
+			count = 0;
+
+    for (query = 0; query < NXT_CACHE_ENTRIES; ++query)
+    {
+	flight = &brick->flight[query];
+	pthread_mutex_lock(&sched->lock);
+	if ( (brick->waiters[query] == NULL) || !flight->done )
+	{
+	    pthread_mutex_unlock(&sched->lock);
+	    continue;
+	}
+	/* The copy may be reused as soon as the lock is released */
+	for (req = brick->waiters[query]; req != NULL; req = req->next)
+	{
+	    memcpy(req->response, flight->response, flight->response_len);
+	    req->response_len = flight->response_len;
+	    req->status = flight->status;
+	}
+	req = brick->waiters[query];
+	brick->waiters[query] = NULL;
+	pthread_mutex_unlock(&sched->lock);
+
+	for (; req != NULL; req = next, ++count)
+	{
+	    /* The callback may relink req, and it may be reused once done */
+	    next = req->next;
+	    if ( req->callback != NULL )
+		req->callback(brick->nxt, req);
+	    pthread_mutex_lock(&sched->lock);
+	    req->done = 1;
+	    --brick->collapsed;
+	    ++brick->completions;
+	    pthread_mutex_unlock(&sched->lock);
+	}
+    }
+    return count;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Make the next attempt to reconnect a brick whose link is down, if
+ *  it is due.  If the brick is given up on, its requests in flight
+ *  are failed.  Returns non-zero if the link came back or the brick
+ *  was given up on.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sched_reconnect(rct_nxt_t *nxt)
+
+{
+    switch(nxt_reconnect_step(nxt))
+    {
+	case    RCT_RECONNECTING:
+	    return 0;
+	case    RCT_OK:
+	    return 1;
+	default:
+	    nxt_fail_in_flight(nxt, RCT_COMMAND_FAILED);
+	    return 1;
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Wait until a reply may have arrived, a request has been queued, or
+ *  it is time to send to a brick, expire a request, or retry a
+ *  reconnect.  Replies are waited for in poll() on the descriptors of
+ *  the bricks, together with the pipe nxt_sched_wake() writes to.
+ *  Bricks with requests in flight but no descriptor are checked again
+ *  after NXT_SCHED_TICK_US.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_sched_idle(nxt_sched_t *sched)
+
+{
+    struct pollfd       pfd[NXT_SCHED_MAX_BRICKS + 1];
+    nxt_sched_brick_t   *brick;
+    nxt_request_t       *req;
+    rct_nxt_t           *nxt;
+    struct timeval      now,
+			when;
+    char                buf[64];
+    int                 c,
+			prio,
+			nfds = 1,
+			timeout_ms = -1;
+
+    pfd[0].fd = sched->wake[0];
+    pfd[0].events = POLLIN;
+    gettimeofday(&now, NULL);
+    pthread_mutex_lock(&sched->lock);
+    for (c = 0; c < sched->count; ++c)
+    {
+	brick = &sched->bricks[c];
+	nxt = brick->nxt;
+	if ( nxt->link_down )
+	{
+	    timeout_ms = nxt_sched_sooner(timeout_ms,
+			    rct_deadline_remaining(&nxt->outage_retry));
+	    continue;
+	}
+	if ( nxt->engine.count > 0 )
+	{
+	    req = nxt->engine.in_flight[nxt->engine.head];
+	    timeout_ms = nxt_sched_sooner(timeout_ms,
+			    rct_deadline_remaining(&req->deadline));
+	    if ( nxt->fd != -1 )
+	    {
+		pfd[nfds].fd = nxt->fd;
+		pfd[nfds++].events = POLLIN;
+	    }
+	    else
+		timeout_ms = nxt_sched_sooner(timeout_ms,
+				(NXT_SCHED_TICK_US + 999) / 1000);
+	}
+
+	/* Queued requests held back only by the send spacing */
+	for (prio = 0; (brick->queued > 0) && (prio < NXT_PRIORITIES); ++prio)
+	{
+	    if ( (req = brick->head[prio]) == NULL )
+		continue;
+	    when = timercmp(&now, &brick->next_send, <) ?
+		   brick->next_send : now;
+	    if ( nxt->adaptive.enabled && (req->cmd[0] & NXT_NO_RESPONSE) &&
+		 timercmp(&when, &nxt->adaptive.next_send, <) )
+		when = nxt->adaptive.next_send;
+	    if ( nxt_sched_ready(sched, c, req, &when) )
+		timeout_ms = nxt_sched_sooner(timeout_ms,
+				rct_deadline_remaining(&when));
+	}
+    }
+    sched->polling = 1;
+    pthread_mutex_unlock(&sched->lock);
+
+    while ( (poll(pfd, nfds, timeout_ms) == -1) && (errno == EINTR) )
+	;
+
+    pthread_mutex_lock(&sched->lock);
+    sched->polling = 0;
+    pthread_mutex_unlock(&sched->lock);
+    while ( read(sched->wake[0], buf, sizeof(buf)) > 0 )
+	;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the shorter of two poll() timeouts, where -1 is forever.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sched_sooner(int a_ms, int b_ms)
+
+{
+    if ( a_ms < 0 )
+	return b_ms;
+    if ( b_ms < 0 )
+	return a_ms;
+    return MIN(a_ms, b_ms);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Dispatcher thread.  Alternates between sending what the bricks are
+ *  ready for and collecting replies, and waits in nxt_sched_idle()
+ *  when there is nothing to do.  A brick whose link is down is only
+ *  given a reconnect attempt when one is due.  Exits once stopped and
+ *  everything queued has completed.
+ * Author:
+ ***************************************************************************/
+
+void    *nxt_sched_thread(void *arg)
+
+{
+    nxt_sched_t         *sched = arg;
+    nxt_request_t       *req;
+    rct_nxt_t           *nxt;
+    int                 b,
+			c,
+			active,
+			completed;
+
+    while ( 1 )
+    {
+	/* Requests in flight, and bricks waiting to reconnect */
+	active = 0;
+	for (c = 0; c < sched->count; ++c)
+	{
+	    nxt = sched->bricks[c].nxt;
+	    active += nxt->engine.count + nxt->link_down;
+	}
+
+	pthread_mutex_lock(&sched->lock);
+	while ( sched->running && (sched->queued == 0) && (active == 0) )
+	    pthread_cond_wait(&sched->work, &sched->lock);
+	if ( !sched->running && (sched->queued == 0) && (active == 0) )
+	{
+	    pthread_mutex_unlock(&sched->lock);
+	    break;
+	}
+	req = nxt_sched_pick(sched, &b);
+	pthread_mutex_unlock(&sched->lock);
+
+	if ( req != NULL )
+	    nxt_sched_send(sched, b, req);
+	for (c = completed = 0; c < sched->count; ++c)
+	{
+	    nxt = sched->bricks[c].nxt;
+	    if ( nxt->link_down )
+		completed += nxt_sched_reconnect(nxt);
+	    else if ( nxt->engine.count > 0 )
+		completed += nxt_reap_ready(nxt) != 0;
+	}
+	nxt_sched_sync(sched);
+	if ( (req == NULL) && (completed == 0) )
+	    nxt_sched_idle(sched);
+    }
+    return NULL;
+}
@@ -0,0 +1,805 @@
+
+/****************************************************************************
+ *  This file contains an in-process NXT brick simulator, exposed as
+ *  the nxt_sim_transport backend.  It implements enough of the direct
+ *  and system command sets for legoctl and the library's own command
+ *  path to run unmodified, with an optional fixed turnaround time so
+ *  that pipelining and batching can be measured without hardware.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <sys/time.h>
+#include <usb.h>
+#include "roboctl.h"
+
+
+/****************************************************************************
+ * Description:
+ *  Create a simulated brick with empty flash.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_sim_open(rct_nxt_t *nxt)
+
+{
+    nxt_sim_t   *sim;
+    char        *latency,
+		*drop,
+		*disconnect;
+
+    /* The brick kept its power, and its flash, while the link was down */
+    if ( nxt->reconnecting && (nxt->transport_data != NULL) )
+	return RCT_OK;
+    if ( (sim = calloc(1, sizeof(*sim))) == NULL )
+    {
+	fprintf(stderr, "Error: %s(): Cannot allocate simulator.\n", __func__);
+	return RCT_OPEN_FAILED;
+    }
+    if ( (latency = getenv("ROBOCTL_SIM_LATENCY")) != NULL )
+	sim->latency_us = strtol(latency, NULL, 10);
+    if ( (drop = getenv("ROBOCTL_SIM_DROP")) != NULL )
+	sim->drop_every = strtol(drop, NULL, 10);
+    if ( (disconnect = getenv("ROBOCTL_SIM_DISCONNECT")) != NULL )
+	sim->disconnect_every = strtol(disconnect, NULL, 10);
+    nxt->transport_data = sim;
+    debug_printf("Simulator open, latency %ldus.\n", sim->latency_us);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Destroy a simulated brick, including its flash contents.  When
+ *  nxt_reconnect() closes the link, only the connection is dropped.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_sim_close(rct_nxt_t *nxt)
+
+{
+    nxt_sim_t   *sim = nxt->transport_data;
+    int         c;
+
+    if ( sim == NULL )
+	return RCT_NOT_CONNECTED;
+    if ( nxt->reconnecting )
+    {
+	nxt_sim_disconnect(sim);
+	return RCT_OK;
+    }
+    for (c = 0; c < NXT_SIM_MAX_FILES; ++c)
+	free(sim->files[c].data);
+    free(sim);
+    nxt->transport_data = NULL;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Drop the simulated link: replies not yet received are lost, and
+ *  the brick closes every open file.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_sim_disconnect(nxt_sim_t *sim)
+
+{
+    int     h;
+
+    for (h = 0; h < NXT_SIM_MAX_HANDLES; ++h)
+	sim->handles[h].in_use = 0;
+    sim->head = sim->count = 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Accept a telegram, execute it, and queue the reply (if one was
+ *  requested) to become readable after the simulated latency.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_send(rct_nxt_t *nxt, char *buf, int len)
+
+{
+    nxt_sim_t       *sim = nxt->transport_data;
+    unsigned char   *reply;
+    int             slot,
+		    reply_len;
+    struct timeval  *ready;
+
+    debug_nxt_dump_cmd(buf, len, "simulated");
+    if ( len < 2 )
+	return -1;
+    if ( sim->count == NXT_SIM_QUEUE_LEN )
+    {
+	fprintf(stderr, "Error: %s(): Simulator reply queue is full.\n",
+		__func__);
+	return -1;
+    }
+    if ( (sim->disconnect_every > 0) &&
+	 (++sim->telegrams % sim->disconnect_every == 0) )
+    {
+	debug_printf("Simulator dropping link at 0x%02x.\n",
+		     (unsigned char)buf[1]);
+	nxt_sim_disconnect(sim);
+	return -1;
+    }
+
+    slot = (sim->head + sim->count) % NXT_SIM_QUEUE_LEN;
+    reply = sim->queue[slot];
+    reply_len = nxt_sim_execute(sim, (unsigned char *)buf, len, reply);
+
+    /* Replies are suppressed by the high bit of the command type */
+    if ( !(buf[0] & NXT_NO_RESPONSE) )
+    {
+	if ( (sim->drop_every > 0) && (++sim->replies % sim->drop_every == 0) )
+	{
+	    debug_printf("Simulator dropping reply to 0x%02x.\n",
+			 (unsigned char)buf[1]);
+	    return len;
+	}
+	ready = &sim->queue_ready[slot];
+	gettimeofday(ready, NULL);
+	ready->tv_usec += sim->latency_us;
+	ready->tv_sec += ready->tv_usec / 1000000;
+	ready->tv_usec %= 1000000;
+	sim->queue_len[slot] = reply_len;
+	++sim->count;
+    }
+    return len;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the oldest queued reply, waiting for its simulated latency
+ *  to elapse first.  Returns -1 if no reply is pending, which on a
+ *  real link would mean waiting forever.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_recv(rct_nxt_t *nxt, char *buf, int maxlen)
+
+{
+    nxt_sim_t       *sim = nxt->transport_data;
+    int             len;
+    long            wait_us;
+
+    if ( sim->count == 0 )
+    {
+	fprintf(stderr, "Error: %s(): No reply pending.\n", __func__);
+	return -1;
+    }
+    if ( (wait_us = nxt_sim_usec_until(&sim->queue_ready[sim->head])) > 0 )
+	usleep(wait_us);
+
+    len = sim->queue_len[sim->head];
+    if ( len > maxlen )
+    {
+	fprintf(stderr,
+	    "Error: %s(): %d byte message is greater than maxlen of %d\n",
+	    __func__, len, maxlen);
+	return -1;
+    }
+    memcpy(buf, sim->queue[sim->head], len);
+    sim->head = (sim->head + 1) % NXT_SIM_QUEUE_LEN;
+    --sim->count;
+    return len;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Report whether a reply is ready, waiting up to timeout_ms (or
+ *  forever if negative) for the next one to mature.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_poll(rct_nxt_t *nxt, int timeout_ms)
+
+{
+    nxt_sim_t       *sim = nxt->transport_data;
+    long            wait_us;
+
+    if ( sim->count == 0 )
+    {
+	if ( timeout_ms > 0 )
+	    usleep(timeout_ms * 1000L);
+	return 0;
+    }
+    wait_us = nxt_sim_usec_until(&sim->queue_ready[sim->head]);
+    if ( wait_us <= 0 )
+	return 1;
+    if ( (timeout_ms >= 0) && (wait_us > timeout_ms * 1000L) )
+    {
+	usleep(timeout_ms * 1000L);
+	return 0;
+    }
+    usleep(wait_us);
+    return 1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Microseconds from now until the given time, negative if past.
+ * Author:
+ ***************************************************************************/
+
+long    nxt_sim_usec_until(struct timeval *when)
+
+{
+    struct timeval  now;
+
+    gettimeofday(&now, NULL);
+    return (when->tv_sec - now.tv_sec) * 1000000L +
+	   (when->tv_usec - now.tv_usec);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Execute one command telegram against the simulated brick and
+ *  build the reply.  Returns the reply length.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_execute(nxt_sim_t *sim, unsigned char *cmd, int len,
+			unsigned char *reply)
+
+{
+    int     reply_len = 3;
+
+    reply[0] = NXT_CmdReply;
+    reply[1] = cmd[1];
+    reply[2] = NXT_STATUS_SUCCESS;
+
+    if ( (cmd[0] & ~NXT_NO_RESPONSE) == NXT_DIRECT_CMD )
+    {
+	switch(cmd[1])
+	{
+	    case    NXT_DC_START_PROGRAM:
+		if ( nxt_sim_find_file(sim, (char *)cmd+2) == -1 )
+		    reply[2] = NXT_STATUS_FILE_NOT_FOUND;
+		else
+		    strlcpy(sim->program, (char *)cmd+2, NXT_FILENAME_MAX+1);
+		break;
+	    case    NXT_DC_STOP_PROGRAM:
+		if ( *sim->program == '\0' )
+		    reply[2] = NXT_STATUS_NO_ACTIVE_PROGRAM;
+		*sim->program = '\0';
+		break;
+	    case    NXT_DC_PLAY_SOUND_FILE:
+		if ( nxt_sim_find_file(sim, (char *)cmd+3) == -1 )
+		    reply[2] = NXT_STATUS_FILE_NOT_FOUND;
+		break;
+	    case    NXT_DC_PLAY_TONE:
+	    case    NXT_DC_STOP_SOUND_PLAYBACK:
+		break;
+	    case    NXT_DC_SET_OUTPUT_STATE:
+		if ( cmd[2] < 3 )
+		    memcpy(sim->port[cmd[2]], cmd, MIN(len, NXT_BUFF_LEN));
+		else if ( cmd[2] == 0xff )
+		{
+		    memcpy(sim->port[0], cmd, MIN(len, NXT_BUFF_LEN));
+		    memcpy(sim->port[1], cmd, MIN(len, NXT_BUFF_LEN));
+		    memcpy(sim->port[2], cmd, MIN(len, NXT_BUFF_LEN));
+		}
+		else
+		    reply[2] = NXT_STATUS_OUT_OF_BOUNDARY;
+		break;
+	    case    NXT_DC_BATTERY_LEVEL:
+		short2buf(reply+3, NXT_SIM_BATTERY_MV);
+		reply_len = 5;
+		break;
+	    case    NXT_DC_KEEP_ALIVE:
+		long2buf(reply+3, NXT_SIM_SLEEP_LIMIT);
+		reply_len = 7;
+		break;
+	    default:
+		reply[2] = NXT_STATUS_UNKNOWN_OPCODE;
+		break;
+	}
+    }
+    else
+    {
+	switch(cmd[1])
+	{
+	    case    NXT_SC_OPEN_READ:
+		reply[2] = nxt_sim_open_read(sim, (char *)cmd+2, reply+3);
+		reply_len = 8;
+		break;
+	    case    NXT_SC_READ:
+		reply[3] = cmd[2];
+		reply[2] = nxt_sim_read(sim, cmd[2], buf2short(cmd+3), reply+4);
+		reply_len = 6 + buf2short(reply+4);
+		break;
+	    case    NXT_SC_OPEN_WRITE:
+	    case    NXT_SC_OPEN_WRITE_LINEAR:
+	    case    NXT_SC_OPEN_WRITE_DATA:
+		reply[2] = nxt_sim_open_write(sim, cmd, reply+3);
+		reply_len = 4;
+		break;
+	    case    NXT_SC_OPEN_APPEND_DATA:
+		reply[2] = nxt_sim_open_append(sim, (char *)cmd+2, reply+3);
+		reply_len = 8;
+		break;
+	    case    NXT_SC_WRITE:
+		reply[2] = nxt_sim_write(sim, cmd[2], cmd+3, len-3, reply+4);
+		reply[3] = cmd[2];
+		reply_len = 6;
+		break;
+	    case    NXT_SC_CLOSE:
+		if ( (cmd[2] < NXT_SIM_MAX_HANDLES) &&
+		     sim->handles[cmd[2]].in_use )
+		    sim->handles[cmd[2]].in_use = 0;
+		else
+		    reply[2] = NXT_STATUS_HANDLE_CLOSED;
+		reply[3] = cmd[2];
+		reply_len = 4;
+		break;
+	    case    NXT_SC_FIND_FIRST:
+	    case    NXT_SC_FIND_NEXT:
+		reply[2] = nxt_sim_find(sim, cmd, reply+3);
+		reply_len = 28;
+		break;
+	    case    NXT_SC_DELETE:
+		reply[2] = nxt_sim_delete(sim, (char *)cmd+2);
+		memcpy(reply+3, cmd+2, 20);
+		reply_len = 23;
+		break;
+	    case    NXT_SC_RENAME_FILE:
+		reply[2] = nxt_sim_rename(sim, (char *)cmd+2, (char *)cmd+22);
+		break;
+	    case    NXT_SC_DELETE_USER_FLASH:
+		nxt_sim_delete_all(sim);
+		break;
+	    case    NXT_SC_GET_VERSIONS:
+		reply[3] = 124;     /* Protocol 1.124 */
+		reply[4] = 1;
+		reply[5] = 31;      /* Firmware 1.31 */
+		reply[6] = 1;
+		reply_len = 7;
+		break;
+	    case    NXT_SC_GET_DEVICE_INFO:
+		memset(reply+3, 0, 30);
+		strlcpy((char *)reply+3, "NXT-SIM", NXT_NAME_LEN);
+		memcpy(reply+18, "\x00\x16\x53\x00\x00\x01", 6);
+		long2buf(reply+29, nxt_sim_free_flash(sim));
+		reply_len = 33;
+		break;
+	    case    NXT_SC_BT_FACTORY_RESET:
+		break;
+	    default:
+		reply[2] = NXT_STATUS_UNKNOWN_OPCODE;
+		break;
+	}
+    }
+    return reply_len;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the index of the named file, or -1 if it does not exist.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_find_file(nxt_sim_t *sim, char *name)
+
+{
+    int     c;
+
+    for (c = 0; c < NXT_SIM_MAX_FILES; ++c)
+	if ( sim->files[c].in_use &&
+	     (strncmp(sim->files[c].name, name, NXT_FILENAME_MAX+1) == 0) )
+	    return c;
+    return -1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Execute FIND_FIRST or FIND_NEXT.  The handle, name and size of the
+ *  next matching file are stored in reply[0..24], and the NXT status
+ *  code returned.  The handle is released when nothing more matches,
+ *  as on the brick.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_find(nxt_sim_t *sim, unsigned char *cmd, unsigned char *reply)
+
+{
+    nxt_sim_handle_t    *h;
+    nxt_sim_file_t      *f;
+    int                 handle;
+
+    memset(reply, 0, 25);
+    if ( cmd[1] == NXT_SC_FIND_FIRST )
+    {
+	for (handle = 0; (handle < NXT_SIM_MAX_HANDLES) &&
+			 sim->handles[handle].in_use; ++handle)
+	    ;
+	if ( handle == NXT_SIM_MAX_HANDLES )
+	    return NXT_STATUS_NO_MORE_HANDLE;
+	h = &sim->handles[handle];
+	h->in_use = 1;
+	h->mode = NXT_SC_FIND_FIRST;
+	h->pos = 0;
+	strlcpy(h->pattern, (char *)cmd+2, NXT_FILENAME_MAX+1);
+    }
+    else
+    {
+	handle = cmd[2];
+	if ( (handle >= NXT_SIM_MAX_HANDLES) || !sim->handles[handle].in_use
+	     || (sim->handles[handle].mode != NXT_SC_FIND_FIRST) )
+	    return NXT_STATUS_HANDLE_CLOSED;
+	h = &sim->handles[handle];
+    }
+
+    for (; h->pos < NXT_SIM_MAX_FILES; ++h->pos)
+    {
+	f = &sim->files[h->pos];
+	if ( f->in_use && (fnmatch(h->pattern, f->name, 0) == 0) )
+	{
+	    ++h->pos;
+	    reply[0] = handle;
+	    strlcpy((char *)reply+1, f->name, NXT_FILENAME_MAX+1);
+	    long2buf(reply+21, f->size);
+	    return NXT_STATUS_SUCCESS;
+	}
+    }
+    h->in_use = 0;
+    return NXT_STATUS_FILE_NOT_FOUND;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Bytes of simulated flash not allocated to files.
+ * Author:
+ ***************************************************************************/
+
+unsigned long   nxt_sim_free_flash(nxt_sim_t *sim)
+
+{
+    unsigned long   free_pages = 0;
+    int             page;
+
+    for (page = 0; page < NXT_SIM_FLASH_PAGES; ++page)
+	if ( sim->page_owner[page] == 0 )
+	    ++free_pages;
+    return free_pages * NXT_FLASH_PAGE;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Allocate flash pages for size bytes of file f: the first run of
+ *  free pages long enough if linear is set, or else the first free
+ *  pages anywhere.  Returns NXT_STATUS_SUCCESS, or the status the
+ *  brick gives when it cannot.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_alloc_pages(nxt_sim_t *sim, int f, size_t size, int linear)
+
+{
+    int     pages = NXT_FLASH_PAGES(size),
+	    page,
+	    run = 0;
+
+    if ( (unsigned long)pages * NXT_FLASH_PAGE > nxt_sim_free_flash(sim) )
+	return linear ? NXT_STATUS_NO_LINEAR_SPACE : NXT_STATUS_NO_SPACE;
+    if ( linear )
+    {
+	for (page = 0; (page < NXT_SIM_FLASH_PAGES) && (run < pages); ++page)
+	    run = sim->page_owner[page] == 0 ? run + 1 : 0;
+	if ( run < pages )
+	    return NXT_STATUS_NO_LINEAR_SPACE;
+	memset(sim->page_owner + page - pages, f + 1, pages);
+    }
+    else
+    {
+	for (page = 0; pages > 0; ++page)
+	{
+	    if ( sim->page_owner[page] == 0 )
+	    {
+		sim->page_owner[page] = f + 1;
+		--pages;
+	    }
+	}
+    }
+    return NXT_STATUS_SUCCESS;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Release the flash pages of file f.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_sim_free_pages(nxt_sim_t *sim, int f)
+
+{
+    int     page;
+
+    for (page = 0; page < NXT_SIM_FLASH_PAGES; ++page)
+	if ( sim->page_owner[page] == f + 1 )
+	    sim->page_owner[page] = 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Create a file and a write handle for OPEN_WRITE*.  The handle is
+ *  stored in *handle, and the NXT status code returned.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_open_write(nxt_sim_t *sim, unsigned char *cmd,
+			   unsigned char *handle)
+
+{
+    char            name[NXT_FILENAME_MAX+1];
+    unsigned long   size;
+    int             f,
+		    h,
+		    status;
+
+    strlcpy(name, (char *)cmd+2, NXT_FILENAME_MAX+1);
+    size = buf2long(cmd+22);
+
+    if ( nxt_sim_find_file(sim, name) != -1 )
+	return NXT_STATUS_FILE_EXISTS;
+
+    for (h = 0; (h < NXT_SIM_MAX_HANDLES) && sim->handles[h].in_use; ++h)
+	;
+    for (f = 0; (f < NXT_SIM_MAX_FILES) && sim->files[f].in_use; ++f)
+	;
+    if ( (h == NXT_SIM_MAX_HANDLES) || (f == NXT_SIM_MAX_FILES) )
+	return NXT_STATUS_NO_MORE_HANDLE;
+
+    status = nxt_sim_alloc_pages(sim, f, size,
+				 cmd[1] == NXT_SC_OPEN_WRITE_LINEAR);
+    if ( status != NXT_STATUS_SUCCESS )
+	return status;
+    if ( (sim->files[f].data = malloc(size > 0 ? size : 1)) == NULL )
+    {
+	nxt_sim_free_pages(sim, f);
+	return NXT_STATUS_NO_SPACE;
+    }
+    strlcpy(sim->files[f].name, name, NXT_FILENAME_MAX+1);
+    sim->files[f].size = size;
+    sim->files[f].written = 0;
+    sim->files[f].linear = cmd[1] == NXT_SC_OPEN_WRITE_LINEAR;
+    sim->files[f].in_use = 1;
+
+    sim->handles[h].in_use = 1;
+    sim->handles[h].file = f;
+    sim->handles[h].mode = cmd[1];
+    sim->handles[h].pos = 0;
+    *handle = h;
+    return NXT_STATUS_SUCCESS;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Reopen a data file for OPEN_APPEND_DATA.  The handle and the space
+ *  left in the file are stored in reply[0..4], and the NXT status code
+ *  returned.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_open_append(nxt_sim_t *sim, char *name, unsigned char *reply)
+
+{
+    int     f,
+	    h;
+
+    memset(reply, 0, 5);
+    if ( (f = nxt_sim_find_file(sim, name)) == -1 )
+	return NXT_STATUS_FILE_NOT_FOUND;
+    if ( sim->files[f].linear )
+	return NXT_STATUS_APPEND_NOT_POSS;
+    for (h = 0; h < NXT_SIM_MAX_HANDLES; ++h)
+	if ( sim->handles[h].in_use && (sim->handles[h].file == f) )
+	    return NXT_STATUS_FILE_IS_BUSY;
+    for (h = 0; (h < NXT_SIM_MAX_HANDLES) && sim->handles[h].in_use; ++h)
+	;
+    if ( h == NXT_SIM_MAX_HANDLES )
+	return NXT_STATUS_NO_MORE_HANDLE;
+
+    sim->handles[h].in_use = 1;
+    sim->handles[h].file = f;
+    sim->handles[h].mode = NXT_SC_OPEN_APPEND_DATA;
+    sim->handles[h].pos = sim->files[f].written;
+    reply[0] = h;
+    long2buf(reply+1, sim->files[f].size - sim->files[f].written);
+    return NXT_STATUS_SUCCESS;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Open an existing file for OPEN_READ.  The handle and the file size
+ *  are stored in reply[0..4], and the NXT status code returned.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_open_read(nxt_sim_t *sim, char *name, unsigned char *reply)
+
+{
+    int     f,
+	    h;
+
+    memset(reply, 0, 5);
+    if ( (f = nxt_sim_find_file(sim, name)) == -1 )
+	return NXT_STATUS_FILE_NOT_FOUND;
+    for (h = 0; (h < NXT_SIM_MAX_HANDLES) && sim->handles[h].in_use; ++h)
+	;
+    if ( h == NXT_SIM_MAX_HANDLES )
+	return NXT_STATUS_NO_MORE_HANDLE;
+
+    sim->handles[h].in_use = 1;
+    sim->handles[h].file = f;
+    sim->handles[h].mode = NXT_SC_OPEN_READ;
+    sim->handles[h].pos = 0;
+    reply[0] = h;
+    long2buf(reply+1, sim->files[f].written);
+    return NXT_STATUS_SUCCESS;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Read up to len bytes from the file open on handle.  The count is
+ *  stored little-endian in reply[0..1], followed by the data.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_read(nxt_sim_t *sim, int handle, int len,
+		     unsigned char *reply)
+
+{
+    nxt_sim_handle_t    *h;
+    nxt_sim_file_t      *f;
+    int                 count;
+
+    short2buf(reply, 0);
+    if ( (handle >= NXT_SIM_MAX_HANDLES) || !sim->handles[handle].in_use )
+	return NXT_STATUS_HANDLE_CLOSED;
+    h = &sim->handles[handle];
+    if ( h->mode != NXT_SC_OPEN_READ )
+	return NXT_STATUS_ILLEGAL_HANDLE;
+    f = &sim->files[h->file];
+
+    count = MIN((size_t)MIN(len, NXT_PACKET_MAX - 6), f->written - h->pos);
+    memcpy(reply+2, f->data + h->pos, count);
+    h->pos += count;
+    short2buf(reply, count);
+    return count < len ? NXT_STATUS_EOF : NXT_STATUS_SUCCESS;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Append data to the file open on handle.  The number of bytes
+ *  accepted is stored little-endian in count[0..1].
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_write(nxt_sim_t *sim, int handle, unsigned char *data,
+		      int len, unsigned char *count)
+
+{
+    nxt_sim_handle_t    *h;
+    nxt_sim_file_t      *f;
+    int                 accepted;
+
+    short2buf(count, 0);
+    if ( (handle >= NXT_SIM_MAX_HANDLES) || !sim->handles[handle].in_use )
+	return NXT_STATUS_HANDLE_CLOSED;
+    h = &sim->handles[handle];
+    if ( h->mode == NXT_SC_OPEN_READ )
+	return NXT_STATUS_ILLEGAL_HANDLE;
+    f = &sim->files[h->file];
+
+    accepted = MIN((size_t)len, f->size - h->pos);
+    memcpy(f->data + h->pos, data, accepted);
+    h->pos += accepted;
+    f->written = MAX(f->written, h->pos);
+    short2buf(count, accepted);
+    return accepted < len ? NXT_STATUS_FILE_IS_FULL : NXT_STATUS_SUCCESS;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Delete a file unless it is open.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_delete(nxt_sim_t *sim, char *name)
+
+{
+    int     f,
+	    h;
+
+    if ( (f = nxt_sim_find_file(sim, name)) == -1 )
+	return NXT_STATUS_FILE_NOT_FOUND;
+    for (h = 0; h < NXT_SIM_MAX_HANDLES; ++h)
+	if ( sim->handles[h].in_use && (sim->handles[h].file == f) )
+	    return NXT_STATUS_FILE_IS_BUSY;
+    nxt_sim_free_pages(sim, f);
+    free(sim->files[f].data);
+    memset(&sim->files[f], 0, sizeof(sim->files[f]));
+    return NXT_STATUS_SUCCESS;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Rename a file unless it is open or the new name is taken.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_sim_rename(nxt_sim_t *sim, char *old_name, char *new_name)
+
+{
+    int     f,
+	    h;
+
+    if ( (f = nxt_sim_find_file(sim, old_name)) == -1 )
+	return NXT_STATUS_FILE_NOT_FOUND;
+    if ( nxt_sim_find_file(sim, new_name) != -1 )
+	return NXT_STATUS_FILE_EXISTS;
+    for (h = 0; h < NXT_SIM_MAX_HANDLES; ++h)
+	if ( sim->handles[h].in_use && (sim->handles[h].file == f) )
+	    return NXT_STATUS_FILE_IS_BUSY;
+    strlcpy(sim->files[f].name, new_name, NXT_FILENAME_MAX+1);
+    return NXT_STATUS_SUCCESS;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Execute DELETE_USER_FLASH: close every handle and delete every file.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_sim_delete_all(nxt_sim_t *sim)
+
+{
+    int     c;
+
+    for (c = 0; c < NXT_SIM_MAX_HANDLES; ++c)
+	sim->handles[c].in_use = 0;
+    for (c = 0; c < NXT_SIM_MAX_FILES; ++c)
+	if ( sim->files[c].in_use )
+	    nxt_sim_delete(sim, sim->files[c].name);
+    *sim->program = '\0';
+}
+
+
+const nxt_transport_t   nxt_sim_transport =
+{
+    "simulator",
+    NXT_SIMULATOR,
+    nxt_sim_open,
+    nxt_sim_send,
+    nxt_sim_recv,
+    nxt_sim_close,
+    nxt_sim_poll,
+    NULL,
+    NULL,
+    NULL
+};
@@ -20,10 +20,32 @@ extern int  Debug;
 
 
 
-rct_status_t    nxt_open_file_read(rct_nxt_t *nxt)
+/****************************************************************************
+ * Description:
+ *  Open a file on an NXT brick for reading.  The size of the file is
+ *  stored in *size.  Returns the file handle, or -1 on error.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_open_file_read(rct_nxt_t *nxt, char *filename_on_brick,
+			   size_t *size)
 
 {
-    return  RCT_NOT_IMPLEMENTED;
+    nxt_cmd_t   cmd;
+
+    if ( nxt_validate_filename(filename_on_brick, NULL, __func__) != RCT_OK )
+	return -1;
+
+    nxt_cmd_init(nxt,&cmd,NXT_SYSTEM_CMD,NXT_SC_OPEN_READ);
+    nxt_cmd_set_filename(&cmd,0,filename_on_brick);
+    if ( nxt_cmd_send(nxt,&cmd) != RCT_OK )
+    {
+	fprintf(stderr,"Error: %s(): Cannot open %s for reading.\n",
+		__func__, filename_on_brick);
+	return -1;
+    }
+    *size = (unsigned long)buf2long(cmd.req.response+4);
+    return cmd.req.response[3];
 }
 
 
@@ -34,10 +56,148 @@ rct_status_t    nxt_open_file_write(rct_nxt_t *nxt)
 }
 
 
-rct_status_t    nxt_read_file(rct_nxt_t *nxt)
+/****************************************************************************
+ * Description:
+ *  Copy size bytes from a file opened by nxt_open_file_read() to the
+ *  local file descriptor fd.
+ *
+ *  Like nxt_write_file(), this keeps a full window of reads in flight.
+ *  The brick answers them in order, so each reply holds the chunk
+ *  following the last, and is written to fd as soon as it and those
+ *  before it have arrived.  A slot is reused once its data has been
+ *  written.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_read_file(rct_nxt_t *nxt, int file_handle, size_t size,
+			      int fd)
 
 {
-    return  RCT_NOT_IMPLEMENTED;
+    int             c,
+		    bytes,
+		    batch,
+		    window = nxt->engine.window;
+    size_t          sent,
+		    written,
+		    chunks = (size + NXT_READ_MAX - 1) / NXT_READ_MAX;
+    rct_status_t    status = RCT_OK;
+    nxt_request_t   req[NXT_MAX_IN_FLIGHT],
+		    *pending[NXT_MAX_IN_FLIGHT],
+		    *rp;
+
+    for (sent = written = 0; (written < chunks) && (status == RCT_OK); )
+    {
+	for (batch = 0; (sent + batch < chunks) &&
+			(sent + batch - written < (size_t)window); ++batch)
+	{
+	    rp = &req[(sent + batch) % window];
+	    nxt_request_init(rp, NXT_SYSTEM_CMD, NXT_SC_READ);
+	    rp->cmd[2] = file_handle;
+	    short2buf(rp->cmd+3,
+		      MIN(NXT_READ_MAX, size - (sent + batch) * NXT_READ_MAX));
+	    rp->cmd_len = 5;
+	    pending[batch] = rp;
+	}
+	if ( batch > 0 )
+	{
+	    if ( nxt_submit_batch(nxt, pending, batch) != RCT_OK )
+	    {
+		status = RCT_COMMAND_FAILED;
+		break;
+	    }
+	    sent += batch;
+	}
+	if ( !req[written % window].done )
+	    nxt_reap(nxt, MIN((window + 1) / 2, (int)(sent - written)));
+
+	/* Write out the chunks that have arrived, in order */
+	while ( (written < sent) && req[written % window].done )
+	{
+	    rp = &req[written % window];
+	    bytes = buf2short(rp->cmd+3);
+	    if ( (rp->status != RCT_OK) || (rp->response_len != 6 + bytes)
+		 || (NXT_REPLY_STATUS(rp) != 0)
+		 || (buf2short(rp->response+4) != bytes) )
+	    {
+		fprintf(stderr,"Error: %s(): Read failed at byte %lu.\n",
+			__func__, (unsigned long)written * NXT_READ_MAX);
+		status = RCT_COMMAND_FAILED;
+		break;
+	    }
+	    if ( write(fd, rp->response+6, bytes) != bytes )
+	    {
+		fprintf(stderr,"Error: %s(): Cannot write local file.\n",
+			__func__);
+		status = RCT_COMMAND_FAILED;
+		break;
+	    }
+	    ++written;
+	}
+    }
+
+    /* No request may outlive req[] */
+    for (c = 0; (size_t)c < MIN(sent, (size_t)window); ++c)
+	if ( !req[c].done )
+	    nxt_wait(nxt, &req[c]);
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the number of data bytes to send in each NXT_SC_WRITE.
+ *  Real bricks take at most NXT_MaxBytes per telegram on USB and
+ *  Bluetooth alike, and on the stream transport, which normally leads
+ *  to one.  The simulator takes NXT_PACKET_MAX.  nxt_set_write_chunk()
+ *  overrides this for firmware known to accept more.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_write_chunk(rct_nxt_t *nxt)
+
+{
+    if ( nxt->write_chunk > 0 )
+	return MIN(nxt->write_chunk, NXT_PACKET_MAX - 3);
+    if ( NXT_IS_OPEN(nxt) && (nxt->transport->type == NXT_SIMULATOR) )
+	return NXT_PACKET_MAX - 3;
+    return NXT_WRITE_MAX;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Set the number of data bytes per NXT_SC_WRITE, or 0 to let
+ *  nxt_write_chunk() choose.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_set_write_chunk(rct_nxt_t *nxt, int bytes)
+
+{
+    if ( (bytes < 0) || (bytes > NXT_PACKET_MAX - 3) )
+    {
+	fprintf(stderr, "Error: %s(): Chunk size must be 0 to %d.\n",
+		__func__, NXT_PACKET_MAX - 3);
+	return RCT_INVALID_DATA;
+    }
+    nxt->write_chunk = bytes;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return non-zero if req is an NXT_SC_WRITE whose reply shows that
+ *  all of its data was stored.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_write_ok(nxt_request_t *req)
+
+{
+    return (req->status == RCT_OK) && (req->response_len == 6) &&
+	   (NXT_REPLY_STATUS(req) == NXT_STATUS_SUCCESS) &&
+	   (buf2short(req->response+4) == req->cmd_len - 3);
 }
 
 
@@ -53,10 +213,38 @@ rct_status_t    nxt_read_file(rct_nxt_t *nxt)
 rct_status_t nxt_write_file(rct_nxt_t *nxt,char *filename,int file_handle)
 
 {
-    int     fd,
-	    bytes;
-    char    buff[65],
-	    response[NXT_RESPONSE_MAX+1];
+    return nxt_write_file_at(nxt,filename,file_handle,0);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Copy a local file to an open file on an NXT brick, starting at byte
+ *  offset of the local file.  Used by nxt_upload_files() to finish an
+ *  upload reopened with nxt_open_file_append_data().
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_write_file_at(rct_nxt_t *nxt,char *filename,
+				  int file_handle,size_t offset)
+
+{
+    int             fd,
+		    bytes,
+		    c,
+		    busy,
+		    sent,
+		    batch,
+		    window = nxt->engine.window,
+		    chunk = nxt_write_chunk(nxt),
+		    block_len = 0,
+		    block_pos = 0,
+		    eof = 0;
+    rct_status_t    status = RCT_OK;
+    unsigned char   block[NXT_UPLOAD_BLOCK];
+    nxt_request_t   req[NXT_MAX_IN_FLIGHT],
+		    *pending[NXT_MAX_IN_FLIGHT],
+		    *rp;
     
     fd = open(filename,O_RDONLY);
     if ( fd < 0 )
@@ -64,23 +252,87 @@ rct_status_t nxt_write_file(rct_nxt_t *nxt,char *filename,int file_handle)
 	fprintf(stderr,"nxt_write_file(): Cannot open local file %s for reading.\n",filename);
 	return RCT_CANNOT_OPEN_FILE;
     }
+    if ( (offset > 0) && (lseek(fd,offset,SEEK_SET) == -1) )
+    {
+	fprintf(stderr,"nxt_write_file(): Cannot seek to byte %lu of %s.\n",
+		(unsigned long)offset,filename);
+	close(fd);
+	return RCT_CANNOT_OPEN_FILE;
+    }
+    
+    /*
+     *  Keep a full window of writes in flight.  The brick processes
+     *  commands in order, so this is safe, and saves a round trip per
+     *  chunk.  Each time half the window has been acknowledged, refill
+     *  the free slots and send them together.  A slot is free once the
+     *  write it last held has completed, and its reply is checked
+     *  before it is reused.  Only our own writes are counted, since a
+     *  scheduler may hold some of them back and other requests may be
+     *  in flight.  The file is read NXT_UPLOAD_BLOCK bytes at a time.
+     */
+    for (sent = 0; !eof && (status == RCT_OK); sent += batch)
+    {
+	for (c = busy = 0; c < MIN(sent, window); ++c)
+	    busy += !req[c].done;
+	for (batch = 0; busy + batch < window; ++batch)
+	{
+	    rp = &req[(sent + batch) % window];
+	    if ( (sent + batch >= window) && !nxt_write_ok(rp) )
+	    {
+		fprintf(stderr,"nxt_write_file(): Write failed.\n");
+		status = RCT_COMMAND_FAILED;
+		break;
+	    }
+	    
+	    if ( block_pos == block_len )
+	    {
+		block_pos = 0;
+		if ( (block_len = read(fd,block,NXT_UPLOAD_BLOCK)) <= 0 )
+		{
+		    if ( block_len < 0 )
+		    {
+			fprintf(stderr,"nxt_write_file(): Cannot read %s.\n",
+				filename);
+			status = RCT_COMMAND_FAILED;
+		    }
+		    eof = 1;
+		    break;
+		}
+	    }
+	    
+	    /*
+	     *  John Hay patch for newer firmware
+	     *  Don't recall why I was using null-padded packets
+	     */
+	    nxt_request_init(rp, NXT_SYSTEM_CMD, NXT_SC_WRITE);
+	    rp->cmd[2] = file_handle;
+	    bytes = MIN(chunk, block_len - block_pos);
+	    memcpy(rp->cmd+3, block+block_pos, bytes);
+	    block_pos += bytes;
+	    rp->cmd_len = 3 + bytes;
+	    pending[batch] = rp;
+	}
+	
+	if ( (batch > 0) && (nxt_submit_batch(nxt, pending, batch) != RCT_OK) )
+	    status = RCT_COMMAND_FAILED;
+	else if ( !eof && (status == RCT_OK) )
+	    nxt_reap(nxt, (window + 1) / 2);
+    }
     
-    nxt_init_buff_header(buff,NXT_SC_WRITE,file_handle);
-    while ( (bytes = read(fd,buff+3,61)) > 0 )
+    /* Collect the remaining replies */
+    nxt_drain(nxt);
+    for (c = 0; c < MIN(sent, window); ++c)
     {
-	/*
-	 *  John Hay patch for newer firmware
-	 *  Don't recall why I was using null-padded packets
-	 */
-	//memset(buff+3+bytes,'\0',61-bytes); /* Null pad */
-	//bytes = nxt_send_buf(nxt,buff,64);
-	bytes = nxt_send_buf(nxt,buff,bytes+3);
-	bytes = nxt_recv_buf(nxt,response,NXT_RESPONSE_MAX);
-	debug_nxt_dump_response(response,bytes,"NXT_SC_WRITE");
+	rp = &req[c];
+	if ( (rp->cmd_len > 3) && !nxt_write_ok(rp) && (status == RCT_OK) )
+	{
+	    fprintf(stderr,"nxt_write_file(): Write failed.\n");
+	    status = RCT_COMMAND_FAILED;
+	}
     }
     
     close(fd);
-    return RCT_OK;
+    return status;
 }
 
 
@@ -100,14 +352,13 @@ rct_status_t nxt_close_file(rct_nxt_t *nxt,int file_handle)
 	    response[NXT_RESPONSE_MAX+1];
     
     nxt_init_buff_header(buff,NXT_SC_CLOSE,file_handle);
-    bytes = nxt_send_buf(nxt,buff,3);
-    if ( bytes != 3 )
+    bytes = nxt_exchange(nxt,buff,3,response,NXT_RESPONSE_MAX);
+    if ( bytes < 0 )
     {
 	fprintf(stderr,"nxt_close_file(): Error sending close command.\n");
 	return RCT_COMMAND_FAILED;
     }
     
-    bytes = nxt_recv_buf(nxt,response,NXT_RESPONSE_MAX);
     debug_nxt_dump_response(response,bytes,"NXT_SC_CLOSE");
     if ( bytes != 4 )
     {
@@ -144,28 +395,128 @@ rct_status_t nxt_delete_file(rct_nxt_t *nxt,char *filename)
 
     nxt_build_file_cmd(cmd,NXT_SYSTEM_CMD,NXT_SC_DELETE,filename_on_brick);
     debug_nxt_dump_cmd(cmd,22,"NXT_SC_DELETE");
-    if ( nxt_send_buf(nxt,cmd,22) != 22 )
+    if ( (bytes = nxt_exchange(nxt,cmd,22,response,NXT_RESPONSE_MAX)) < 0 )
     {
 	fprintf(stderr,"nxt_delete_file(): Error sending delete command.\n");
 	return RCT_COMMAND_FAILED;
     }
-    bytes = nxt_recv_buf(nxt,response,NXT_RESPONSE_MAX);
     debug_nxt_dump_response(response,bytes,"NXT_SC_DELETE");
+    nxt_manifest_remove(nxt,filename_on_brick);
     return RCT_OK;
 }
 
 
-rct_status_t    nxt_find_first(rct_nxt_t *nxt)
+/****************************************************************************
+ * Description:
+ *  Send a FIND_FIRST or FIND_NEXT built in cmd and store the file
+ *  found in *info.  Returns RCT_CANNOT_STAT_FILE without complaint if
+ *  there are no more matching files, in which case the brick has
+ *  already released the search handle.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_find_send(rct_nxt_t *nxt, nxt_cmd_t *cmd,
+			      nxt_file_info_t *info)
 
 {
-    return  RCT_NOT_IMPLEMENTED;
+    nxt_request_t   *req = &cmd->req;
+    rct_status_t    status;
+
+    debug_nxt_dump_cmd((char *)req->cmd, req->cmd_len, cmd->desc->name);
+    if ( (status = nxt_transact(nxt, req)) != RCT_OK )
+	return status;
+    return nxt_find_parse(nxt, cmd, info);
 }
 
 
-rct_status_t    nxt_find_next(rct_nxt_t *nxt)
+/****************************************************************************
+ * Description:
+ *  Store the file found by a completed FIND_FIRST or FIND_NEXT in
+ *  *info.  Returns as for nxt_find_send().
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_find_parse(rct_nxt_t *nxt, nxt_cmd_t *cmd,
+			       nxt_file_info_t *info)
 
 {
-    return  RCT_NOT_IMPLEMENTED;
+    nxt_request_t   *req = &cmd->req;
+    rct_status_t    status;
+
+    if ( req->status != RCT_OK )
+	return req->status;
+    if ( (req->response_len == cmd->desc->response_len) &&
+	 (NXT_REPLY_STATUS(req) == NXT_STATUS_FILE_NOT_FOUND) )
+	return RCT_CANNOT_STAT_FILE;
+    if ( (status = nxt_cmd_check(nxt, cmd)) != RCT_OK )
+	return status;
+    info->handle = req->response[3];
+    strlcpy(info->name, (char *)req->response+4, NXT_FILENAME_MAX+1);
+    info->size = (unsigned long)buf2long(req->response+24);
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Start listing the files on an NXT brick that match pattern, which
+ *  may be a name or use the brick's wildcards ("*.*", "*.rxe",
+ *  "name.*").  The first file is stored in *info, and the others are
+ *  found with nxt_find_next(info).  Returns RCT_CANNOT_STAT_FILE if
+ *  there are none.  A search stopped before that must be ended with
+ *  nxt_close_file(nxt, info->handle).
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_find_first(rct_nxt_t *nxt, char *pattern,
+			       nxt_file_info_t *info)
+
+{
+    nxt_cmd_t   cmd;
+
+    nxt_cmd_init(nxt, &cmd, NXT_SYSTEM_CMD, NXT_SC_FIND_FIRST);
+    nxt_cmd_set_filename(&cmd, 0, pattern);
+    return nxt_find_send(nxt, &cmd, info);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Replace *info with the next file of a search begun by
+ *  nxt_find_first().  Returns RCT_CANNOT_STAT_FILE at the end.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_find_next(rct_nxt_t *nxt, nxt_file_info_t *info)
+
+{
+    nxt_cmd_t   cmd;
+
+    nxt_cmd_init(nxt, &cmd, NXT_SYSTEM_CMD, NXT_SC_FIND_NEXT);
+    nxt_cmd_set(&cmd, 0, info->handle);
+    return nxt_find_send(nxt, &cmd, info);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Look up a single file on the brick by name.  Returns RCT_OK and
+ *  stores its size in *size if it exists, or RCT_CANNOT_STAT_FILE.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_stat_file(rct_nxt_t *nxt, char *filename_on_brick,
+			      unsigned long *size)
+
+{
+    nxt_file_info_t info;
+    rct_status_t    status;
+
+    if ( (status = nxt_find_first(nxt, filename_on_brick, &info)) != RCT_OK )
+	return status;
+    nxt_close_file(nxt, info.handle);
+    *size = info.size;
+    return RCT_OK;
 }
 
 
@@ -180,26 +531,18 @@ rct_status_t    nxt_find_next(rct_nxt_t *nxt)
 rct_status_t nxt_get_firmware_version(rct_nxt_t *nxt)
 
 {
-    int     bytes;
-    char    response[NXT_RESPONSE_MAX + 1];
+    nxt_cmd_t   cmd;
 
     /*
-     * NXT brick should respond with 5 bytes: 
-     *  reply command status level-lsb level-msb
+     * NXT brick should respond with 7 bytes: 
+     *  reply command status protocol-minor protocol-major
+     *  firmware-minor firmware-major
+     * nxt_parse_versions() stores them.
      */
-    bytes = nxt_send_simple_cmd(nxt, NXT_SYSTEM_CMD,
-			NXT_SC_GET_VERSIONS, response,
-			NXT_RESPONSE_MAX);
-    if ( bytes == 7 )
+    nxt_cmd_init(nxt, &cmd, NXT_SYSTEM_CMD, NXT_SC_GET_VERSIONS);
+    if ( nxt_cmd_send(nxt, &cmd) != RCT_OK )
     {
-	nxt->firmware_major = response[6];
-	nxt->firmware_minor = response[5];
-	nxt->protocol_major = response[4];
-	nxt->protocol_minor = response[3];
-    }
-    else
-    {
-	fputs("nxt_get_firmware_version(): command failed.\b",stderr);
+	fputs("nxt_get_firmware_version(): command failed.\n",stderr);
 	return RCT_COMMAND_FAILED;
     }
     return 0;
@@ -220,44 +563,25 @@ rct_status_t    nxt_open_file_write_linear(rct_nxt_t *nxt, char *filename_on_bri
 					    size_t size)
 
 {
-    int         bytes,
-		file_handle;
+    int         file_handle;
     rct_status_t    status;
-    char        cmd[27],
-		response[NXT_RESPONSE_MAX+1];
+    nxt_cmd_t   cmd;
     
     status = nxt_validate_filename(filename_on_brick, NULL, __func__);
     if ( status != RCT_OK )
 	return status;
 
-    nxt_build_file_cmd(cmd,NXT_SYSTEM_CMD,NXT_SC_OPEN_WRITE_LINEAR,filename_on_brick);
-    
-    long2buf((unsigned char *)cmd+22,size);
+    nxt_cmd_init(nxt,&cmd,NXT_SYSTEM_CMD,NXT_SC_OPEN_WRITE_LINEAR);
+    nxt_cmd_set_filename(&cmd,0,filename_on_brick);
+    nxt_cmd_set(&cmd,1,size);
     
-    debug_printf("File size in st is %u\n",(unsigned)size);
-    debug_printf("File size in cmd is %ld\n",*(long *)(cmd+22));
-    debug_nxt_dump_cmd(cmd,26,"NXT_SC_OPEN_WRITE_LINEAR");
-    
-    if ( nxt_send_buf(nxt,cmd,26) != 26 )
+    if ( nxt_cmd_send(nxt,&cmd) != RCT_OK )
     {
-	fprintf(stderr,"nxt_open_file_write(): Error sending open command.\n");
+	fprintf(stderr,"nxt_open_file_write(): Open command failed.\n");
 	return -1;
     }
-    bytes = nxt_recv_buf(nxt,response,NXT_RESPONSE_MAX);
-    debug_nxt_dump_response(response,bytes,"NXT_SC_OPEN_WRITE_LINEAR");
-    if ( bytes != 4 )
-    {
-	fprintf(stderr,"nxt_open_file_write(): Bad response to open command.  Got %d bytes, expected 4.\n",bytes);
-	return -1;
-    }
-    status = response[2];
-    if ( status == 0 )
-    {
-	file_handle = (unsigned char)response[3];
-	return file_handle;
-    }
-    else
-	return -1;
+    file_handle = cmd.req.response[3];
+    return file_handle;
 }
 
 
@@ -281,52 +605,56 @@ rct_status_t    nxt_open_file_read_linear(rct_nxt_t *nxt)
 rct_status_t    nxt_open_file_write_data(rct_nxt_t *nxt,char *filename_on_brick, size_t size)
 
 {
-    int         bytes,
-		file_handle;
+    int         file_handle;
     rct_status_t    status;
-    char        cmd[27],
-		response[NXT_RESPONSE_MAX+1];
+    nxt_cmd_t   cmd;
     
     status = nxt_validate_filename(filename_on_brick, NULL, __func__);
     if ( status != RCT_OK )
 	return status;
 
-    nxt_build_file_cmd(cmd,NXT_SYSTEM_CMD,NXT_SC_OPEN_WRITE_DATA,filename_on_brick);
-    
-    /* Add file-size in guaranteed little-endian format */
-    long2buf((unsigned char *)cmd+22,size);
+    nxt_cmd_init(nxt,&cmd,NXT_SYSTEM_CMD,NXT_SC_OPEN_WRITE_DATA);
+    nxt_cmd_set_filename(&cmd,0,filename_on_brick);
+    nxt_cmd_set(&cmd,1,size);
     
-    debug_printf("File size in st is %u\n",(unsigned)size);
-    debug_printf("File size in cmd is %ld\n",*(long *)(cmd+22));
-    debug_nxt_dump_cmd(cmd,26,"NXT_SC_OPEN_WRITE_DATA");
-    
-    if ( nxt_send_buf(nxt,cmd,26) != 26 )
-    {
-	fprintf(stderr,"nxt_open_file_write(): Error sending open command.\n");
-	return -1;
-    }
-    bytes = nxt_recv_buf(nxt,response,NXT_RESPONSE_MAX);
-    debug_nxt_dump_response(response,bytes,"NXT_SC_OPEN_WRITE_DATA");
-    if ( bytes != 4 )
+    if ( nxt_cmd_send(nxt,&cmd) != RCT_OK )
     {
-	fprintf(stderr,"nxt_open_file_write(): Bad response to open command.  Got %d bytes, expected 4.\n",bytes);
+	fprintf(stderr,"nxt_open_file_write(): Open command failed.\n");
 	return -1;
     }
-    status = response[2];
-    if ( status == 0 )
-    {
-	file_handle = (unsigned char)response[3];
-	return file_handle;
-    }
-    else
-	return -1;
+    file_handle = cmd.req.response[3];
+    return file_handle;
 }
 
 
-rct_status_t    nxt_open_file_append_data(rct_nxt_t *nxt)
+/****************************************************************************
+ * Description:
+ *  Reopen a data file on an NXT brick to write more to it.  The number
+ *  of bytes that can still be written, that is the size it was created
+ *  with less what it holds, is stored in *available.  Returns the file
+ *  handle, or -1 on error.  Linear files cannot be appended to.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_open_file_append_data(rct_nxt_t *nxt, char *filename_on_brick,
+				  size_t *available)
 
 {
-    return  RCT_NOT_IMPLEMENTED;
+    nxt_cmd_t   cmd;
+
+    if ( nxt_validate_filename(filename_on_brick, NULL, __func__) != RCT_OK )
+	return -1;
+
+    nxt_cmd_init(nxt,&cmd,NXT_SYSTEM_CMD,NXT_SC_OPEN_APPEND_DATA);
+    nxt_cmd_set_filename(&cmd,0,filename_on_brick);
+    if ( nxt_cmd_send(nxt,&cmd) != RCT_OK )
+    {
+	fprintf(stderr,"Error: %s(): Cannot open %s for appending.\n",
+		__func__, filename_on_brick);
+	return -1;
+    }
+    *available = (unsigned long)buf2long(cmd.req.response+4);
+    return cmd.req.response[3];
 }
 
 
@@ -356,24 +684,14 @@ rct_status_t    nxt_set_brick_name(rct_nxt_t *nxt)
 rct_status_t nxt_get_device_info(rct_nxt_t *nxt)
 
 {
-    int     bytes;
-    char    response[NXT_RESPONSE_MAX + 1];
+    nxt_cmd_t   cmd;
 
     /*
-     * NXT brick should respond with 5 bytes: 
-     *  reply command status level-lsb level-msb
+     * NXT brick should respond with 33 bytes, which
+     * nxt_parse_device_info() stores.
      */
-    bytes = nxt_send_simple_cmd(nxt, NXT_SYSTEM_CMD,
-			NXT_SC_GET_DEVICE_INFO, response,
-			NXT_RESPONSE_MAX);
-    if ( bytes == 33 )
-    {
-	strlcpy(nxt->name,response+3,NXT_NAME_LEN);
-	memcpy(nxt->bluetooth_address,response+18,6);
-	nxt->bluetooth_signal_strength = buf2long((unsigned char *)response+25);
-	nxt->free_flash = buf2long((unsigned char *)response+29);
-    }
-    else
+    nxt_cmd_init(nxt, &cmd, NXT_SYSTEM_CMD, NXT_SC_GET_DEVICE_INFO);
+    if ( nxt_cmd_send(nxt, &cmd) != RCT_OK )
     {
 	fputs("nxt_get_device_info() failed.\n",stderr);
 	return RCT_COMMAND_FAILED;
@@ -382,10 +700,28 @@ rct_status_t nxt_get_device_info(rct_nxt_t *nxt)
 }
 
 
+/****************************************************************************
+ * Description:
+ *  Delete every file on the brick with one command, and forget its
+ *  upload manifest.  Erasing the flash takes the brick a few seconds,
+ *  so the reply is allowed NXT_DELETE_USER_FLASH_MS.
+ * Author:
+ ***************************************************************************/
+
 rct_status_t    nxt_delete_user_flash(rct_nxt_t *nxt)
 
 {
-    return  RCT_NOT_IMPLEMENTED;
+    nxt_cmd_t   cmd;
+
+    nxt_cmd_init(nxt, &cmd, NXT_SYSTEM_CMD, NXT_SC_DELETE_USER_FLASH);
+    cmd.req.timeout_ms = NXT_DELETE_USER_FLASH_MS;
+    if ( nxt_cmd_send(nxt, &cmd) != RCT_OK )
+    {
+	fputs("nxt_delete_user_flash() failed.\n",stderr);
+	return RCT_COMMAND_FAILED;
+    }
+    nxt_manifest_clear(nxt);
+    return RCT_OK;
 }
 
 
@@ -406,17 +742,10 @@ rct_status_t    nxt_poll(rct_nxt_t *nxt)
 rct_status_t    nxt_bluetooth_factory_reset(rct_nxt_t *nxt)
 
 {
-    int     bytes;
-    char    response[NXT_RESPONSE_MAX + 1];
+    nxt_cmd_t   cmd;
 
-    /*
-     * NXT brick should respond with 5 bytes: 
-     *  reply command status level-lsb level-msb
-     */
-    bytes = nxt_send_simple_cmd(nxt, NXT_SYSTEM_CMD,
-			NXT_SC_BT_FACTORY_RESET, response,
-			NXT_RESPONSE_MAX);
-    if ( bytes != 3 )
+    nxt_cmd_init(nxt, &cmd, NXT_SYSTEM_CMD, NXT_SC_BT_FACTORY_RESET);
+    if ( nxt_cmd_send(nxt, &cmd) != RCT_OK )
     {
 	fputs("nxt_bluetooth_factory_reset() failed.\n",stderr);
 	return RCT_COMMAND_FAILED;
@@ -0,0 +1,510 @@
+
+/****************************************************************************
+ *  This file contains the NXT transport backends.  Each backend
+ *  provides an nxt_transport_t table of open/send/recv/close/poll
+ *  operations, which nxt_send_buf(), nxt_recv_buf(), etc. use
+ *  to reach the brick without knowing how it is connected.
+ *
+ *  To add a new backend, define a table like the ones at the bottom
+ *  of this file and either preselect it with nxt_set_transport() or
+ *  teach nxt_open_brick() when to choose it.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <termios.h>
+#include <usb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include "roboctl.h"
+
+extern int  Debug;
+
+
+/****************************************************************************
+ * Description:
+ *  Preselect the transport to be used by nxt_open_brick().  Normally
+ *  the transport is chosen automatically from what rct_find_bricks()
+ *  discovered, so this is only needed for backends that cannot be
+ *  probed, such as the simulator.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_set_transport(rct_nxt_t *nxt,
+				  const nxt_transport_t *transport)
+
+{
+    if ( NXT_IS_OPEN(nxt) )
+    {
+	fprintf(stderr, "Error: %s(): Cannot change transport while open.\n",
+		__func__);
+	return RCT_COMMAND_FAILED;
+    }
+    nxt->transport = transport;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Use an already open descriptor (e.g. one end of a socketpair(2), or
+ *  a pty master) as the connection to an NXT brick.  Telegrams are
+ *  framed exactly as on Bluetooth.  The descriptor is closed by
+ *  nxt_close_brick().
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_attach_fd(rct_nxt_t *nxt, int fd)
+
+{
+    rct_status_t    status;
+
+    if ( (status = nxt_set_transport(nxt, &nxt_stream_transport)) != RCT_OK )
+	return status;
+    nxt->fd = fd;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Connect to the Unix domain socket at path, normally that of a
+ *  roboctld(1) daemon, and use it as the connection to an NXT brick.
+ *  The daemon relays telegrams to and from a brick it keeps open, so
+ *  the framing is the same as for any other stream.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_attach_socket(rct_nxt_t *nxt, const char *path)
+
+{
+    struct sockaddr_un  addr;
+    int                 fd;
+
+    if ( strlen(path) >= sizeof(addr.sun_path) )
+    {
+	fprintf(stderr, "Error: %s(): Socket path too long: %s\n",
+		__func__, path);
+	return RCT_INVALID_FILENAME;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+    if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 )
+	return RCT_CANNOT_CREATE_SOCKET;
+    if ( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 )
+    {
+	debug_printf("%s(): %s: %s\n", __func__, path, strerror(errno));
+	close(fd);
+	return RCT_CANNOT_CONNECT_SOCKET;
+    }
+    return nxt_attach_fd(nxt, fd);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Use a character device (e.g. /dev/rfcomm0 or a pty slave) as the
+ *  connection to an NXT brick.  The device is opened by nxt_open_brick().
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_set_stream_device(rct_nxt_t *nxt, char *device)
+
+{
+    rct_status_t    status;
+
+    if ( (status = nxt_set_transport(nxt, &nxt_stream_transport)) != RCT_OK )
+	return status;
+    nxt->stream_device = device;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Send a telegram over USB.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_usb_send(rct_nxt_t *nxt, char *buf, int len)
+
+{
+    debug_nxt_dump_cmd(buf,len,"");
+    return usb_bulk_write(nxt->usb_handle, NXT_USB_OUT_ENDPOINT, buf, len,
+			  USB_TIMEOUT);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Receive a telegram over USB.  USB bulk transfers preserve message
+ *  boundaries, so no framing is needed.  The read is limited to
+ *  nxt->recv_timeout_ms, and returns 0 if that expires.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_usb_recv(rct_nxt_t *nxt, char *buf, int maxlen)
+
+{
+    int     bytes,
+	    timeout_ms = nxt->recv_timeout_ms;
+
+    /* libusb treats 0 as no timeout, and an expired deadline is 0 here */
+    if ( timeout_ms == 0 )
+	timeout_ms = 1;
+    else if ( timeout_ms < 0 )
+	timeout_ms = 0;
+    bytes = usb_bulk_read(nxt->usb_handle, NXT_USB_IN_ENDPOINT, buf, maxlen,
+			  timeout_ms);
+    if ( bytes == -ETIMEDOUT )
+	return 0;
+    return bytes < 0 ? -1 : bytes;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  libusb-0.1 has no way to ask whether a bulk read would block, so
+ *  always report ready and let usb_bulk_read() apply the deadline.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_usb_poll(rct_nxt_t *nxt, int timeout_ms)
+
+{
+    return 1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Send a telegram over a stream connection (Bluetooth RFCOMM, pty,
+ *  socketpair).  Streams add a 2-byte little-endian message length
+ *  to the beginning of each packet.  Otherwise, the protocol is
+ *  identical to USB.
+ * Author: Jason W. Bacon
+ ***************************************************************************/
+
+int     nxt_stream_send(rct_nxt_t *nxt, char *buf, int len)
+
+{
+    struct iovec    iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    return nxt_stream_sendv(nxt, &iov, 1) == 1 ? len : -1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Send several telegrams over a stream connection.  Length headers
+ *  are interleaved with the callers' buffers in a gather list, so the
+ *  payloads are never copied, and up to NXT_SENDV_MAX telegrams go
+ *  out in each writev().  Returns the number of telegrams sent, or -1
+ *  if none were.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_stream_sendv(rct_nxt_t *nxt, const struct iovec *iov, int count)
+
+{
+    struct iovec    vec[NXT_SENDV_MAX * 2];
+    unsigned char   header[NXT_SENDV_MAX][2];
+    int             c,
+		    n,
+		    sent;
+
+    for (sent = 0; sent < count; sent += n)
+    {
+	for (n = 0; (n < NXT_SENDV_MAX) && (sent + n < count); ++n)
+	{
+	    c = sent + n;
+	    if ( iov[c].iov_len > NXT_PACKET_MAX )
+	    {
+		fprintf(stderr,
+		    "Error: %s(): Message length %d exceeds maximum of %d.\n",
+		    __func__, (int)iov[c].iov_len, NXT_PACKET_MAX);
+		return sent == 0 ? -1 : sent;
+	    }
+	    short2buf(header[n], iov[c].iov_len);
+	    vec[n * 2].iov_base = header[n];
+	    vec[n * 2].iov_len = 2;
+	    vec[n * 2 + 1] = iov[c];
+	    debug_nxt_dump_cmd(iov[c].iov_base, iov[c].iov_len, "");
+	}
+	if ( nxt_writev_all(nxt->fd, vec, n * 2) == -1 )
+	{
+	    fprintf(stderr, "Error: %s(): %s\n", __func__, strerror(errno));
+	    return sent == 0 ? -1 : sent;
+	}
+    }
+    return sent;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  writev() the entire gather list, resuming after short writes.
+ *  The list is modified in the process.  Returns 0 or -1 on error.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_writev_all(int fd, struct iovec *vec, int count)
+
+{
+    ssize_t bytes;
+
+    while ( count > 0 )
+    {
+	if ( (bytes = writev(fd, vec, count)) == -1 )
+	{
+	    if ( errno == EINTR )
+		continue;
+	    return -1;
+	}
+	while ( (count > 0) && ((size_t)bytes >= vec->iov_len) )
+	{
+	    bytes -= vec->iov_len;
+	    ++vec;
+	    --count;
+	}
+	if ( count > 0 )
+	{
+	    vec->iov_base = (char *)vec->iov_base + bytes;
+	    vec->iov_len -= bytes;
+	}
+    }
+    return 0;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the next telegram received on a stream connection, reading
+ *  more data only when no complete packet is already buffered.
+ *  *packet points into the receive ring and remains valid until
+ *  nxt_stream_consume().  Returns the telegram length, 0 if none was
+ *  complete within nxt->recv_timeout_ms, or -1 if the connection failed
+ *  or lost framing, in which case buffered data is discarded.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_stream_peek(rct_nxt_t *nxt, unsigned char **packet)
+
+{
+    int             bytes,
+		    ready;
+    struct timeval  deadline;
+    struct pollfd   pfd;
+
+    if ( (nxt->rx_ring == NULL) && ((nxt->rx_ring = nxt_ring_new()) == NULL) )
+	return -1;
+
+    rct_deadline_set(&deadline, nxt->recv_timeout_ms);
+    pfd.fd = nxt->fd;
+    pfd.events = POLLIN;
+    while ( (bytes = nxt_ring_peek(nxt->rx_ring, packet)) == 0 )
+    {
+	/* A partial packet stays in the ring if the rest is late */
+	do
+	    ready = poll(&pfd, 1, rct_deadline_remaining(&deadline));
+	while ( (ready == -1) && (errno == EINTR) );
+	if ( ready == 0 )
+	    return 0;
+	if ( (ready < 0) || (nxt_ring_fill(nxt->rx_ring, nxt->fd) <= 0) )
+	{
+	    fprintf(stderr, "Error: %s(): Connection lost.\n", __func__);
+	    return -1;
+	}
+    }
+    if ( bytes < 0 )
+	nxt_ring_flush(nxt->rx_ring);
+    return bytes;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Release the telegram returned by nxt_stream_peek().
+ * Author:
+ ***************************************************************************/
+
+void    nxt_stream_consume(rct_nxt_t *nxt)
+
+{
+    nxt_ring_consume(nxt->rx_ring);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Receive a telegram from a stream connection into buf, stripping
+ *  the 2-byte message length.
+ * Author: Jason W. Bacon
+ ***************************************************************************/
+
+int     nxt_stream_recv(rct_nxt_t *nxt, char *buf, int maxlen)
+
+{
+    int             bytes;
+    unsigned char   *packet;
+
+    if ( (bytes = nxt_stream_peek(nxt, &packet)) <= 0 )
+	return bytes;
+    if ( bytes > maxlen )
+    {
+	fprintf(stderr,
+	    "Error: %s(): %d byte message is greater than maxlen of %d\n",
+	    __func__, bytes, maxlen);
+	nxt_stream_consume(nxt);
+	return -1;
+    }
+    memcpy(buf,packet,bytes);
+    nxt_stream_consume(nxt);
+    return bytes;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Wait up to timeout_ms milliseconds for data on a stream connection.
+ *  A negative timeout waits indefinitely.  A packet already sitting
+ *  in the receive ring counts as ready.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_stream_poll(rct_nxt_t *nxt, int timeout_ms)
+
+{
+    struct pollfd   pfd;
+    int             status;
+    unsigned char   *packet;
+
+    if ( (nxt->rx_ring != NULL) && (nxt_ring_peek(nxt->rx_ring, &packet) != 0) )
+	return 1;
+
+    pfd.fd = nxt->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    do
+	status = poll(&pfd, 1, timeout_ms);
+    while ( (status == -1) && (errno == EINTR) );
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Open a stream connection.  If a descriptor was attached with
+ *  nxt_attach_fd(), there is nothing to do.  Otherwise, open the
+ *  device set by nxt_set_stream_device(), putting ttys into raw mode.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_open_brick_stream(rct_nxt_t *nxt)
+
+{
+    struct termios  t;
+
+    if ( nxt->fd != -1 )
+	return RCT_OK;
+
+    if ( nxt->stream_device == NULL )
+    {
+	fprintf(stderr, "Error: %s(): No device or descriptor given.\n",
+		__func__);
+	return RCT_OPEN_FAILED;
+    }
+
+    debug_printf("Opening stream device %s...\n", nxt->stream_device);
+    if ( (nxt->fd = open(nxt->stream_device, O_RDWR|O_NOCTTY)) == -1 )
+    {
+	fprintf(stderr, "Error: %s(): Cannot open %s: %s\n",
+		__func__, nxt->stream_device, strerror(errno));
+	return RCT_OPEN_FAILED;
+    }
+
+    if ( isatty(nxt->fd) && (tcgetattr(nxt->fd, &t) == 0) )
+    {
+	cfmakeraw(&t);
+	tcsetattr(nxt->fd, TCSANOW, &t);
+    }
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Close a stream connection.  Unlike RFCOMM, a local descriptor can
+ *  be reopened immediately, so no delay is needed.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_close_brick_stream(rct_nxt_t *nxt)
+
+{
+    if ( nxt->fd == -1 )
+    {
+	fprintf(stderr, "%s(): Stream connection is not currently open.\n",
+		__func__);
+	return RCT_NOT_CONNECTED;
+    }
+    close(nxt->fd);
+    nxt->fd = -1;
+    free(nxt->rx_ring);
+    nxt->rx_ring = NULL;
+    return RCT_OK;
+}
+
+
+const nxt_transport_t   nxt_usb_transport =
+{
+    "USB",
+    NXT_USB,
+    nxt_open_brick_usb,
+    nxt_usb_send,
+    nxt_usb_recv,
+    nxt_close_brick_usb,
+    nxt_usb_poll,
+    NULL,
+    NULL,
+    NULL
+};
+
+const nxt_transport_t   nxt_bluetooth_transport =
+{
+    "Bluetooth",
+    NXT_BLUETOOTH,
+    nxt_open_brick_bluetooth,
+    nxt_stream_send,
+    nxt_stream_recv,
+    nxt_close_brick_bluetooth,
+    nxt_stream_poll,
+    nxt_stream_peek,
+    nxt_stream_consume,
+    nxt_stream_sendv
+};
+
+const nxt_transport_t   nxt_stream_transport =
+{
+    "stream",
+    NXT_STREAM,
+    nxt_open_brick_stream,
+    nxt_stream_send,
+    nxt_stream_recv,
+    nxt_close_brick_stream,
+    nxt_stream_poll,
+    nxt_stream_peek,
+    nxt_stream_consume,
+    nxt_stream_sendv
+};
@@ -0,0 +1,490 @@
+
+/****************************************************************************
+ *  This file contains an asynchronous USB backend for NXT bricks, based
+ *  on libusb-1.0.  The default USB backend uses the synchronous
+ *  libusb-0.1 calls, so each command ties up the calling thread until
+ *  the brick answers, and bricks are served strictly one at a time.
+ *  Here, bulk OUT and IN transfers are submitted without waiting, up to
+ *  a full engine window per brick, and one event thread shared by all
+ *  bricks completes them.  Replies are queued per brick and collected
+ *  through the usual recv() and poll() transport operations.
+ *
+ *  To use it in place of nxt_usb_transport, build the library with
+ *  -DRCT_LIBUSB1 and link programs with -lusb-1.0 -lpthread.  Bricks
+ *  are still discovered through libusb-0.1, and are matched here by
+ *  bus number and device address.
+ ***************************************************************************/
+
+#ifdef RCT_LIBUSB1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <libusb.h>
+#include <usb.h>
+#include "roboctl.h"
+
+/* Replies a brick may have outstanding, including late ones */
+#define NXT_USB1_QUEUE_LEN  (NXT_MAX_IN_FLIGHT * 2)
+
+/*
+ *  Per-brick state, hung off nxt->transport_data.  It is kept out of
+ *  the installed headers so that programs using the library do not
+ *  need libusb-1.0 or pthread headers.
+ */
+
+typedef struct
+{
+    libusb_device_handle    *handle;
+    pthread_mutex_t         lock;
+    pthread_cond_t          changed;    /* Broadcast on every completion */
+    unsigned char           queue[NXT_USB1_QUEUE_LEN][NXT_PACKET_MAX];
+    int                     queue_len[NXT_USB1_QUEUE_LEN];
+    int                     head;
+    int                     count;
+    struct libusb_transfer  *posted_in[NXT_USB1_QUEUE_LEN];
+    int                     pending;    /* Submitted, not yet completed */
+    int                     error;
+}   nxt_usb1_t;
+
+/* The libusb context and event thread are shared by all bricks */
+libusb_context  *Nxt_usb1_context = NULL;
+pthread_t       Nxt_usb1_thread;
+pthread_mutex_t Nxt_usb1_lock = PTHREAD_MUTEX_INITIALIZER;
+int             Nxt_usb1_users = 0;
+volatile int    Nxt_usb1_running = 0;
+
+
+/****************************************************************************
+ * Description:
+ *  Run libusb's event loop, which calls the completion functions below,
+ *  until the last brick is closed.  The timeout only bounds how long
+ *  shutdown takes to be noticed.
+ * Author:
+ ***************************************************************************/
+
+void    *nxt_usb1_event_thread(void *arg)
+
+{
+    struct timeval  tv;
+
+    while ( Nxt_usb1_running )
+    {
+	tv.tv_sec = 0;
+	tv.tv_usec = 100000;
+	libusb_handle_events_timeout_completed(Nxt_usb1_context, &tv, NULL);
+    }
+    return NULL;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Initialize libusb-1.0 and start the event thread for the first user.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_usb1_start(void)
+
+{
+    rct_status_t    status = RCT_OK;
+    int             err;
+
+    pthread_mutex_lock(&Nxt_usb1_lock);
+    if ( Nxt_usb1_users == 0 )
+    {
+	if ( (err = libusb_init(&Nxt_usb1_context)) != 0 )
+	{
+	    fprintf(stderr, "Error: %s(): libusb_init() failed: %s\n",
+		    __func__, libusb_error_name(err));
+	    status = RCT_OPEN_FAILED;
+	}
+	else
+	{
+	    Nxt_usb1_running = 1;
+	    if ( pthread_create(&Nxt_usb1_thread, NULL,
+				nxt_usb1_event_thread, NULL) != 0 )
+	    {
+		fprintf(stderr, "Error: %s(): Cannot start event thread.\n",
+			__func__);
+		Nxt_usb1_running = 0;
+		libusb_exit(Nxt_usb1_context);
+		status = RCT_OPEN_FAILED;
+	    }
+	}
+    }
+    if ( status == RCT_OK )
+	++Nxt_usb1_users;
+    pthread_mutex_unlock(&Nxt_usb1_lock);
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Stop the event thread and release libusb-1.0 after the last user.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_usb1_stop(void)
+
+{
+    pthread_mutex_lock(&Nxt_usb1_lock);
+    if ( --Nxt_usb1_users == 0 )
+    {
+	Nxt_usb1_running = 0;
+	pthread_join(Nxt_usb1_thread, NULL);
+	libusb_exit(Nxt_usb1_context);
+	Nxt_usb1_context = NULL;
+    }
+    pthread_mutex_unlock(&Nxt_usb1_lock);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Completion function for command (OUT) transfers.  Runs in the event
+ *  thread.
+ * Author:
+ ***************************************************************************/
+
+void LIBUSB_CALL    nxt_usb1_out_done(struct libusb_transfer *xfer)
+
+{
+    nxt_usb1_t  *usb = xfer->user_data;
+
+    pthread_mutex_lock(&usb->lock);
+    if ( xfer->status != LIBUSB_TRANSFER_COMPLETED )
+	usb->error = 1;
+    --usb->pending;
+    pthread_cond_broadcast(&usb->changed);
+    pthread_mutex_unlock(&usb->lock);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Completion function for reply (IN) transfers.  Runs in the event
+ *  thread.  Queues the reply for nxt_usb1_recv().
+ * Author:
+ ***************************************************************************/
+
+void LIBUSB_CALL    nxt_usb1_in_done(struct libusb_transfer *xfer)
+
+{
+    nxt_usb1_t  *usb = xfer->user_data;
+    int         c,
+		slot;
+
+    pthread_mutex_lock(&usb->lock);
+    for (c = 0; c < NXT_USB1_QUEUE_LEN; ++c)
+	if ( usb->posted_in[c] == xfer )
+	    usb->posted_in[c] = NULL;
+
+    if ( xfer->status == LIBUSB_TRANSFER_COMPLETED )
+    {
+	if ( usb->count < NXT_USB1_QUEUE_LEN )
+	{
+	    slot = (usb->head + usb->count++) % NXT_USB1_QUEUE_LEN;
+	    memcpy(usb->queue[slot], xfer->buffer, xfer->actual_length);
+	    usb->queue_len[slot] = xfer->actual_length;
+	}
+    }
+    else if ( xfer->status != LIBUSB_TRANSFER_CANCELLED )
+	usb->error = 1;
+    --usb->pending;
+    pthread_cond_broadcast(&usb->changed);
+    pthread_mutex_unlock(&usb->lock);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Submit a bulk transfer of len bytes.  The transfer and its buffer
+ *  are freed by libusb on completion.  Called with usb->lock held.
+ *  Returns the transfer, or NULL on failure.
+ * Author:
+ ***************************************************************************/
+
+struct libusb_transfer  *nxt_usb1_submit(nxt_usb1_t *usb, int endpoint,
+					 char *buf, int len,
+					 libusb_transfer_cb_fn done)
+
+{
+    struct libusb_transfer  *xfer;
+    unsigned char           *data;
+    int                     err;
+
+    if ( (xfer = libusb_alloc_transfer(0)) == NULL )
+	return NULL;
+    if ( (data = malloc(len)) == NULL )
+    {
+	libusb_free_transfer(xfer);
+	return NULL;
+    }
+    if ( buf != NULL )
+	memcpy(data, buf, len);
+    /* Replies may be slow to come, and are cancelled on close instead */
+    libusb_fill_bulk_transfer(xfer, usb->handle, endpoint, data, len, done,
+	usb, endpoint == NXT_USB_OUT_ENDPOINT ? USB_TIMEOUT : 0);
+    xfer->flags = LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+    if ( (err = libusb_submit_transfer(xfer)) != 0 )
+    {
+	fprintf(stderr, "Error: %s(): %s\n", __func__, libusb_error_name(err));
+	libusb_free_transfer(xfer);
+	return NULL;
+    }
+    ++usb->pending;
+    return xfer;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Open the libusb-1.0 device matching the brick found by
+ *  rct_find_nxt_usb(), and start the event thread if necessary.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_open_brick_usb1(rct_nxt_t *nxt)
+
+{
+    libusb_device                   **list;
+    libusb_device_handle            *handle = NULL;
+    struct libusb_device_descriptor desc;
+    nxt_usb1_t                      *usb;
+    ssize_t                         devices,
+				    c;
+
+    if ( nxt_usb1_start() != RCT_OK )
+	return RCT_OPEN_FAILED;
+
+    if ( (devices = libusb_get_device_list(Nxt_usb1_context, &list)) < 0 )
+	devices = 0;
+    for (c = 0; (c < devices) && (handle == NULL); ++c)
+    {
+	if ( (libusb_get_device_descriptor(list[c], &desc) == 0) &&
+	     (desc.idVendor == USB_ID_VENDOR_LEGO) &&
+	     (desc.idProduct == USB_ID_PRODUCT_NXT) &&
+	     (libusb_get_bus_number(list[c]) == nxt->usb_bus) &&
+	     (libusb_get_device_address(list[c]) == nxt->usb_dev_num) )
+	{
+	    if ( libusb_open(list[c], &handle) != 0 )
+		handle = NULL;
+	}
+    }
+    if ( devices > 0 )
+	libusb_free_device_list(list, 1);
+
+    if ( handle == NULL )
+    {
+	fprintf(stderr, "Error: %s(): Cannot open NXT at USB %u:%u.\n",
+		__func__, nxt->usb_bus, nxt->usb_dev_num);
+	nxt_usb1_stop();
+	return RCT_OPEN_FAILED;
+    }
+    if ( libusb_claim_interface(handle, NXT_USB_INTERFACE) != 0 )
+    {
+	fputs("Error: Cannot claim USB interface.\n", stderr);
+	libusb_close(handle);
+	nxt_usb1_stop();
+	return RCT_CANNOT_CLAIM_INTERFACE;
+    }
+
+    if ( (usb = calloc(1, sizeof(*usb))) == NULL )
+    {
+	libusb_release_interface(handle, NXT_USB_INTERFACE);
+	libusb_close(handle);
+	nxt_usb1_stop();
+	return RCT_OPEN_FAILED;
+    }
+    usb->handle = handle;
+    pthread_mutex_init(&usb->lock, NULL);
+    pthread_cond_init(&usb->changed, NULL);
+    nxt->transport_data = usb;
+    return RCT_OK;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Queue a telegram for sending, and if it asks for a reply, post a
+ *  reply transfer ahead of it.  Returns without waiting for either, so
+ *  transfer errors are reported by the next recv() or poll().
+ * Author:
+ ***************************************************************************/
+
+int     nxt_usb1_send(rct_nxt_t *nxt, char *buf, int len)
+
+{
+    nxt_usb1_t  *usb = nxt->transport_data;
+    int         slot = 0,
+		status = len;
+
+    debug_nxt_dump_cmd(buf, len, "");
+    pthread_mutex_lock(&usb->lock);
+    if ( usb->error )
+	status = -1;
+    else if ( !(buf[0] & NXT_NO_RESPONSE) )
+    {
+	while ( (slot < NXT_USB1_QUEUE_LEN) && (usb->posted_in[slot] != NULL) )
+	    ++slot;
+	if ( slot == NXT_USB1_QUEUE_LEN )
+	{
+	    fprintf(stderr, "Error: %s(): Too many replies outstanding.\n",
+		    __func__);
+	    status = -1;
+	}
+	else if ( (usb->posted_in[slot] = nxt_usb1_submit(usb,
+		    NXT_USB_IN_ENDPOINT, NULL, NXT_PACKET_MAX,
+		    nxt_usb1_in_done)) == NULL )
+	    status = -1;
+    }
+    if ( (status != -1) && (nxt_usb1_submit(usb, NXT_USB_OUT_ENDPOINT, buf,
+	    len, nxt_usb1_out_done) == NULL) )
+    {
+	/* No command, so no reply */
+	if ( !(buf[0] & NXT_NO_RESPONSE) )
+	    libusb_cancel_transfer(usb->posted_in[slot]);
+	status = -1;
+    }
+    pthread_mutex_unlock(&usb->lock);
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Wait until a reply is queued, a transfer fails, or timeout_ms
+ *  (forever if negative) expires.  Called with usb->lock held.
+ * Author:
+ ***************************************************************************/
+
+void    nxt_usb1_wait(nxt_usb1_t *usb, int timeout_ms)
+
+{
+    struct timeval  deadline;
+    struct timespec abstime;
+
+    rct_deadline_set(&deadline, timeout_ms);
+    abstime.tv_sec = deadline.tv_sec;
+    abstime.tv_nsec = deadline.tv_usec * 1000L;
+    while ( (usb->count == 0) && !usb->error )
+    {
+	if ( timeout_ms < 0 )
+	    pthread_cond_wait(&usb->changed, &usb->lock);
+	else if ( pthread_cond_timedwait(&usb->changed, &usb->lock,
+					 &abstime) == ETIMEDOUT )
+	    break;
+    }
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Report whether a reply is queued, waiting up to timeout_ms.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_usb1_poll(rct_nxt_t *nxt, int timeout_ms)
+
+{
+    nxt_usb1_t  *usb = nxt->transport_data;
+    int         status;
+
+    pthread_mutex_lock(&usb->lock);
+    nxt_usb1_wait(usb, timeout_ms);
+    status = usb->count > 0 ? 1 : usb->error ? -1 : 0;
+    pthread_mutex_unlock(&usb->lock);
+    return status;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Remove the oldest queued reply, waiting up to nxt->recv_timeout_ms.
+ * Author:
+ ***************************************************************************/
+
+int     nxt_usb1_recv(rct_nxt_t *nxt, char *buf, int maxlen)
+
+{
+    nxt_usb1_t  *usb = nxt->transport_data;
+    int         bytes;
+
+    pthread_mutex_lock(&usb->lock);
+    nxt_usb1_wait(usb, nxt->recv_timeout_ms);
+    if ( usb->count == 0 )
+	bytes = usb->error ? -1 : 0;
+    else
+    {
+	bytes = usb->queue_len[usb->head];
+	if ( bytes > maxlen )
+	{
+	    fprintf(stderr,
+		"Error: %s(): %d byte message is greater than maxlen of %d\n",
+		__func__, bytes, maxlen);
+	    bytes = -1;
+	}
+	else
+	    memcpy(buf, usb->queue[usb->head], bytes);
+	usb->head = (usb->head + 1) % NXT_USB1_QUEUE_LEN;
+	--usb->count;
+    }
+    pthread_mutex_unlock(&usb->lock);
+    return bytes;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Cancel reply transfers that are still posted, wait for all transfers
+ *  to finish, and release the device.
+ * Author:
+ ***************************************************************************/
+
+rct_status_t    nxt_close_brick_usb1(rct_nxt_t *nxt)
+
+{
+    nxt_usb1_t  *usb = nxt->transport_data;
+    int         c;
+
+    if ( usb == NULL )
+	return RCT_NOT_CONNECTED;
+
+    pthread_mutex_lock(&usb->lock);
+    for (c = 0; c < NXT_USB1_QUEUE_LEN; ++c)
+	if ( usb->posted_in[c] != NULL )
+	    libusb_cancel_transfer(usb->posted_in[c]);
+    while ( usb->pending > 0 )
+	pthread_cond_wait(&usb->changed, &usb->lock);
+    pthread_mutex_unlock(&usb->lock);
+
+    libusb_release_interface(usb->handle, NXT_USB_INTERFACE);
+    libusb_close(usb->handle);
+    pthread_cond_destroy(&usb->changed);
+    pthread_mutex_destroy(&usb->lock);
+    free(usb);
+    nxt->transport_data = NULL;
+    nxt_usb1_stop();
+    return RCT_OK;
+}
+
+
+const nxt_transport_t   nxt_usb1_transport =
+{
+    "USB (libusb-1.0)",
+    NXT_USB,
+    nxt_open_brick_usb1,
+    nxt_usb1_send,
+    nxt_usb1_recv,
+    nxt_close_brick_usb1,
+    nxt_usb1_poll,
+    NULL,
+    NULL,
+    NULL
+};
+
+#endif  /* RCT_LIBUSB1 */
@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/time.h>
 #include "roboctl.h"
 
@@ -15,7 +16,7 @@
 
 rct_status_t    pic_send_command(int fd,const char *raw_cmd,int raw_len,
 			const char *data,int dlen,char *response,
-			int eot)
+			int eot,int timeout_ms)
 
 {
     char        packet[PIC_CMD_MAX+1],
@@ -23,9 +24,17 @@ rct_status_t    pic_send_command(int fd,const char *raw_cmd,int raw_len,
 		checksum = 0;
     int         payload_len,
 		packet_len,
+		response_len,
 		c,
-		sent;
+		sent,
+		code = (unsigned char)raw_cmd[0];
+    struct timeval  t_encode,
+		    t_send,
+		    t_sent,
+		    t_reply;
+    rct_status_t    status;
     
+    rct_stats_now(&t_encode);
     debug_printf("pic_send_command(): raw_cmd: ");
     debug_hex_dump(raw_cmd,raw_len);
     
@@ -73,35 +82,64 @@ rct_status_t    pic_send_command(int fd,const char *raw_cmd,int raw_len,
     debug_hex_dump(packet,packet_len);
     
     /* Transmit to controller */
+    rct_stats_now(&t_send);
+    rct_stats_count(RCT_STATS_PIC,code,RCT_COUNT_COMMANDS,1);
     if ( (sent = write(fd,packet,packet_len)) != packet_len )
     {
 	fprintf(stderr,"Error sending command.  %d bytes to write, sent %d\n",
 		packet_len,sent);
+	rct_stats_count(RCT_STATS_PIC,code,RCT_COUNT_FAILURES,1);
 	return -1;
     }
+    rct_stats_now(&t_sent);
+    rct_capture_frame(RCT_VEX,0,fd,RCT_CAPTURE_TO_BRICK,packet,packet_len);
     
-    pic_read_response(fd,response,eot);
-    
-    return RCT_OK;
+    status = pic_read_response(fd,response,eot,timeout_ms,&response_len);
+    rct_stats_now(&t_reply);
+    rct_stats_phase(RCT_STATS_PIC,code,RCT_PHASE_ENCODE,&t_encode,&t_send);
+    rct_stats_phase(RCT_STATS_PIC,code,RCT_PHASE_SEND,&t_send,&t_sent);
+    rct_stats_count(RCT_STATS_PIC,code,RCT_COUNT_BYTES_SENT,packet_len);
+    if ( status == RCT_OK )
+    {
+	rct_stats_phase(RCT_STATS_PIC,code,RCT_PHASE_WAIT,&t_sent,&t_reply);
+	rct_stats_count(RCT_STATS_PIC,code,RCT_COUNT_BYTES_RECEIVED,
+			response_len);
+    }
+    else
+	rct_stats_count(RCT_STATS_PIC,code,status == RCT_TIMEOUT ?
+			RCT_COUNT_TIMEOUTS : RCT_COUNT_FAILURES,1);
+    return status;
 }
 
 
-rct_status_t    pic_read_response(int fd,char *response,int eot)
+/**
+ *  Read a response up to the eot character, giving up if the whole
+ *  response has not arrived within timeout_ms (< 0 waits forever).
+ *  The number of bytes stored is returned in *len if len is not NULL.
+ */
+
+rct_status_t    pic_read_response(int fd,char *response,int eot,
+				  int timeout_ms,int *len)
 
 {
-    int     esc;
-    char    *dest;
+    int             esc;
+    char            *dest;
+    struct timeval  deadline;
+    rct_status_t    status;
     
     /* Read response */
+    rct_deadline_set(&deadline,timeout_ms);
     dest = response;
     esc = 0;
     do
     {
-	read(fd,dest,1);
+	if ( (status = pic_read_byte(fd,dest,&deadline)) != RCT_OK )
+	    return status;
 	if ( *dest == CHAR_ESC )
 	{
 	    esc = 1;
-	    read(fd,dest,1);
+	    if ( (status = pic_read_byte(fd,dest,&deadline)) != RCT_OK )
+		return status;
 	}
 	else
 	{
@@ -113,6 +151,41 @@ rct_status_t    pic_read_response(int fd,char *response,int eot)
     
     debug_printf("Response packet: ");
     debug_hex_dump(response,dest-response);
+    rct_capture_frame(RCT_VEX,0,fd,RCT_CAPTURE_FROM_BRICK,response,
+		      dest-response);
+    if ( len != NULL )
+	*len = dest-response;
+    return RCT_OK;
+}
+
+
+/**
+ *  Read one byte, waiting no later than deadline.
+ */
+
+rct_status_t    pic_read_byte(int fd,char *dest,struct timeval *deadline)
+
+{
+    struct pollfd   pfd;
+    int             ready;
+    
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    do
+	ready = poll(&pfd,1,rct_deadline_remaining(deadline));
+    while ( (ready == -1) && (errno == EINTR) );
+    
+    if ( ready == 0 )
+    {
+	fprintf(stderr,"Error: %s(): Timed out waiting for controller.\n",
+		__func__);
+	return RCT_TIMEOUT;
+    }
+    if ( (ready < 0) || (read(fd,dest,1) != 1) )
+    {
+	fprintf(stderr,"Error: %s(): Read failed.\n",__func__);
+	return RCT_COMMAND_FAILED;
+    }
     return RCT_OK;
 }
 
@@ -168,6 +241,7 @@ rct_status_t    pic_erase_program_mem(rct_pic_t *pic,
 {
     unsigned long   erase_blocks, addr, blocks;
     char            cmd[7];
+    rct_status_t    status;
 
     erase_blocks = (end_address - start_address) / PIC_ERASE_BLOCK_SIZE + 1;
     debug_printf("Program length: %lu  Erase blocks: %lu\n",
@@ -193,7 +267,10 @@ rct_status_t    pic_erase_program_mem(rct_pic_t *pic,
 		(int)((addr >> 16) & 0xff),
 		(int)0);                    /* high_len */
 	debug_hex_dump(cmd,6);
-	pic_send_command(pic->fd,cmd,6,NULL,0,pic->response,CHAR_EOT);
+	status = pic_send_command(pic->fd,cmd,6,NULL,0,pic->response,CHAR_EOT,
+				  pic->timeout_ms);
+	if ( status != RCT_OK )
+	    return status;
     }
     debug_printf("\n*** pic_erase_program_mem() ***\n");
     //getchar(); 
@@ -219,7 +296,8 @@ rct_status_t    pic_write_program_mem(rct_pic_t *pic,unsigned long address,
 	    (int)((address >> 8) & 0xff),
 	    (int)((address >> 16) & 0xff));
     debug_printf("\n*** pic_write_program_mem() ***\n");
-    return pic_send_command(pic->fd,cmd,5,code,blocks,pic->response,CHAR_EOT);
+    return pic_send_command(pic->fd,cmd,5,code,blocks,pic->response,CHAR_EOT,
+			    pic->timeout_ms);
 }
 
 
@@ -229,14 +307,19 @@ rct_status_t    pic_get_bootloader_version(rct_pic_t *pic)
     char            cmd[2];
     rct_status_t    status;
     
+    /* The bootloader cannot change while the port is open */
+    if ( rct_cache_fresh(&pic->bootloader_cache) )
+	return RCT_OK;
     cmd[0] = PIC_GET_BOOTLOADER_VERSION;
     cmd[1] = 2;
     debug_printf("\n*** pic_get_bootloader_version() ***\n");
-    status = pic_send_command(pic->fd,cmd,2,NULL,0,pic->response,CHAR_EOT);
+    status = pic_send_command(pic->fd,cmd,2,NULL,0,pic->response,CHAR_EOT,
+			      pic->timeout_ms);
     if ( status == RCT_OK )
     {
 	pic->bootloader_major = pic->response[4];
 	pic->bootloader_minor = pic->response[5];
+	rct_cache_store(&pic->bootloader_cache);
     }
     return status;
 }
@@ -269,7 +352,8 @@ rct_status_t    pic_read_program_mem(rct_pic_t *pic,unsigned long address,
 	    (int)((address >> 8) & 0xff),
 	    (int)((address >> 16) & 0xff));
     debug_printf("\n*** pic_read_program_mem() ***\n");
-    return pic_send_command(pic->fd,cmd,5,NULL,0,pic->response,CHAR_EOT);
+    return pic_send_command(pic->fd,cmd,5,NULL,0,pic->response,CHAR_EOT,
+			    pic->timeout_ms);
 }
 
 
@@ -282,7 +366,8 @@ rct_status_t    pic_return_to_user_code(rct_pic_t *pic)
     cmd[0] = PIC_RETURN_TO_USER_CODE;
     cmd[1] = 0x40;
     debug_printf("\n*** pic_return_to_user_code() ***\n");
-    status = pic_send_command(pic->fd,cmd,2,NULL,0,pic->response,'\x40');
+    status = pic_send_command(pic->fd,cmd,2,NULL,0,pic->response,'\x40',
+			      pic->timeout_ms);
     
     /* Read extra trailing response bytes? */
     /*
@@ -320,7 +405,8 @@ rct_status_t    pic_reset(int fd,char *response)
 
 {
     debug_printf("\n*** pic_reset() ***\n");
-    return pic_send_command(fd,"\x00\x00",2,NULL,0,response,CHAR_EOT);
+    return pic_send_command(fd,"\x00\x00",2,NULL,0,response,CHAR_EOT,
+			    PIC_DEFAULT_TIMEOUT_MS);
 }
 
 
@@ -377,6 +463,8 @@ rct_status_t    pic_open_controller(rct_pic_t *pic, char *device)
 	exit(EX_OSERR);
     }
     
+    rct_cache_invalidate(&pic->bootloader_cache);
+    rct_capture_env();
     return RCT_OK;
 }
 
@@ -404,6 +492,8 @@ void    pic_init_struct(rct_pic_t *pic)
 {
     pic->fd = -1;
     pic->device = NULL;
+    pic->timeout_ms = PIC_DEFAULT_TIMEOUT_MS;
+    rct_cache_init(&pic->bootloader_cache, -1);
 }
 
 
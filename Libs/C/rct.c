@@ -8,6 +8,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <usb.h>
 #include <sysexits.h>
 #include "roboctl.h"
@@ -34,6 +36,9 @@ int     rct_find_nxt_bricks(rct_brick_list_t * bricks,char *name)
 
 {
     debug_printf("Finding bricks...\n");
+    /* Bricks named in the environment take precedence over probing */
+    if ( rct_find_nxt_env(bricks) > 0 )
+	return bricks->count;
     if ( rct_find_nxt_usb(bricks) == 0 )
 	puts("No bricks found on USB interface.");
 #if defined(__FreeBSD__) || defined(__linux__)
@@ -44,6 +49,80 @@ int     rct_find_nxt_bricks(rct_brick_list_t * bricks,char *name)
 }
 
 
+/*
+ *  Add a simulated brick if ROBOCTL_SIMULATOR is set, one replaying
+ *  a capture file if ROBOCTL_REPLAY is set, or a brick connected
+ *  through a serial or pty device if ROBOCTL_NXT_DEVICE is set.  This
+ *  allows tools to be exercised with no hardware attached.
+ *  Otherwise, use the brick held open by roboctld(1) if it is running.
+ */
+
+int     rct_find_nxt_env(rct_brick_list_t *bricks)
+
+{
+    rct_nxt_t   *nxt;
+    char        *device,
+		socket_path[PATH_MAX+1];
+    int         count = 0;
+
+    nxt = &bricks->bricks[bricks->count].nxt;
+    if ( getenv("ROBOCTL_SIMULATOR") != NULL )
+    {
+	rct_init_brick_struct(&bricks->bricks[bricks->count],RCT_NXT);
+	nxt_set_transport(nxt,&nxt_sim_transport);
+	++count;
+    }
+    else if ( (device = getenv("ROBOCTL_REPLAY")) != NULL )
+    {
+	rct_init_brick_struct(&bricks->bricks[bricks->count],RCT_NXT);
+	nxt_set_replay(nxt,device);
+	++count;
+    }
+    else if ( (device = getenv("ROBOCTL_NXT_DEVICE")) != NULL )
+    {
+	rct_init_brick_struct(&bricks->bricks[bricks->count],RCT_NXT);
+	nxt_set_stream_device(nxt,device);
+	++count;
+    }
+    else if ( rct_daemon_socket(socket_path,PATH_MAX) != NULL )
+    {
+	rct_init_brick_struct(&bricks->bricks[bricks->count],RCT_NXT);
+	if ( nxt_attach_socket(nxt,socket_path) == RCT_OK )
+	{
+	    debug_printf("Using roboctld at %s\n",socket_path);
+	    ++count;
+	}
+    }
+    rct_increase_count(bricks,count);
+    return count;
+}
+
+
+/*
+ *  Store the path of the roboctld(1) socket in path: $ROBOCTL_SOCKET
+ *  if set, or RCT_DAEMON_SOCKET under the home directory.  Returns
+ *  NULL if ROBOCTL_SOCKET is set but empty, which disables the daemon.
+ */
+
+char    *rct_daemon_socket(char *path,size_t maxlen)
+
+{
+    char    *env;
+
+    if ( (env = getenv("ROBOCTL_SOCKET")) != NULL )
+    {
+	if ( *env == '\0' )
+	    return NULL;
+	strlcpy(path,env,maxlen);
+	return path;
+    }
+    if ( get_home_dir(path,maxlen) == NULL )
+	return NULL;
+    strlcat(path,"/" RCT_DAEMON_SOCKET,maxlen);
+    return path;
+}
+
+
 int     rct_find_nxt_usb(rct_brick_list_t * bricks)
 
 {
@@ -76,6 +155,10 @@ int     rct_find_nxt_usb(rct_brick_list_t * bricks)
 		{
 		    rct_init_brick_struct(&bricks->bricks[count],RCT_NXT);
 		    NXT_SET_USB_DEV(&(bricks->bricks[count].nxt),dev);
+		    /* Lets other USB libraries find the same device */
+		    bricks->bricks[count].nxt.usb_bus =
+			strtol(bus->dirname, NULL, 10);
+		    bricks->bricks[count].nxt.usb_dev_num = dev->devnum;
 		    ++count;
 		}
 	    }
@@ -0,0 +1,83 @@
+#ifndef _STDIO_H_
+#include <stdio.h>
+#endif
+
+/*
+ *  Wire-level capture of NXT and VEX (PIC) traffic.  Frames are
+ *  recorded where they cross the transport layer, so a capture shows
+ *  exactly what went to and came from the brick, with timestamps.
+ *  Enable it with rct_capture_open(), or by setting ROBOCTL_CAPTURE
+ *  to a file name before opening a brick.  nxt_replay_transport feeds
+ *  the NXT frames in a capture back into the library.
+ *
+ *  All integers in a capture file are little-endian.  The file begins
+ *  with a header:
+ *
+ *      0   6   "RCTCAP"
+ *      6   2   Format version (RCT_CAPTURE_VERSION)
+ *      8   4   Start time, seconds since the epoch
+ *      12  4   Start time, microseconds
+ *
+ *  followed by frames, each a header and len bytes of data:
+ *
+ *      0   4   Seconds since start
+ *      4   4   Microseconds
+ *      8   2   len
+ *      10  1   Direction (rct_capture_dir_t)
+ *      11  1   Brick type (rct_brick_type_t)
+ *      12  1   Transport (nxt_connection_t, 0 for VEX serial)
+ *      13  1   Brick id: assigned when an NXT is opened, or the
+ *              serial descriptor of a VEX controller
+ *      14  2   Reserved, 0
+ *
+ *  NXT frames hold unframed telegrams (no Bluetooth length prefix).
+ *  VEX frames hold the packet as sent, and the response as read.
+ */
+
+#define RCT_CAPTURE_MAGIC       "RCTCAP"
+#define RCT_CAPTURE_VERSION     1
+#define RCT_CAPTURE_HEADER_LEN  16
+#define RCT_CAPTURE_FRAME_LEN   16
+#define RCT_CAPTURE_DATA_MAX    256     /* Longer frames are truncated */
+#define RCT_CAPTURE_BUFSIZ      65536   /* stdio buffer for writing */
+
+typedef enum
+{
+    RCT_CAPTURE_TO_BRICK,
+    RCT_CAPTURE_FROM_BRICK
+}   rct_capture_dir_t;
+
+typedef struct
+{
+    struct timeval      time;       /* Since start of capture */
+    rct_capture_dir_t   direction;
+    rct_brick_type_t    brick_type;
+    int                 transport;
+    int                 brick_id;
+    int                 len;
+    unsigned char       data[RCT_CAPTURE_DATA_MAX];
+}   rct_capture_frame_t;
+
+/* State of the capture being written, if any (capture.c) */
+typedef struct
+{
+    FILE                *fp;
+    struct timeval      start;
+    int                 next_id;
+    int                 atexit_done;
+}   rct_capture_t;
+
+/*
+ *  Replay transport state.  Only the frames of one NXT brick (the
+ *  first in the capture, or ROBOCTL_REPLAY_BRICK) are loaded.
+ */
+typedef struct
+{
+    rct_capture_frame_t *frames;
+    int                 count;
+    int                 next_tx;        /* Next frame to match a send */
+    int                 next_rx;        /* Next reply to hand out */
+    int                 fast;           /* Ignore recorded timing */
+    struct timeval      anchor;         /* When the last send happened */
+    struct timeval      anchor_time;    /* ... and its recorded time */
+}   nxt_replay_t;
@@ -13,6 +13,13 @@
 #define USB_STATUS_SUCCESS  0x00
 
 #define NXT_BUFF_LEN        100
+/*
+ *  Largest telegram the library will frame.  The brick itself accepts
+ *  at most NXT_MaxBytes per telegram, but simulated and bridged
+ *  transports are not limited to that.
+ */
+#define NXT_PACKET_MAX      256
+#define NXT_SENDV_MAX       16      /* Telegrams per writev() */
 #define NXT_RESPONSE_MAX    1024
 #define NXT_NAME_LEN        15
 #define NXT_FILENAME_MAX    19
@@ -33,9 +40,47 @@ typedef enum
 {
     NXT_NO_CONNECTION,
     NXT_BLUETOOTH,
-    NXT_USB
+    NXT_USB,
+    NXT_STREAM,         /* pty, socketpair, or other pre-opened descriptor */
+    NXT_SIMULATOR,
+    NXT_REPLAY
 }   nxt_connection_t;
 
+/*
+ *  Transport operations.  Each connection type provides one of these
+ *  tables, and the command layer (nxt_send_buf(), nxt_recv_buf(), etc.)
+ *  goes through it rather than checking the connection type.  send()
+ *  and recv() deal in unframed NXT telegrams: any framing the link
+ *  requires (e.g. the Bluetooth 2-byte length) is the transport's job.
+ *  recv() returns 0 if no telegram arrived within nxt->recv_timeout_ms.
+ *  poll() returns > 0 if a response can be read without blocking, 0 if
+ *  the timeout expired, and -1 on error.
+ *
+ *  Transports that buffer incoming data may also provide peek() and
+ *  consume(), which hand out a received telegram in place rather than
+ *  copying it to the caller.  Both are NULL otherwise.  Likewise,
+ *  sendv(), if not NULL, sends several telegrams (one per iovec) in
+ *  as few system calls as possible and returns the number sent.
+ */
+
+struct rct_nxt;
+struct iovec;
+
+typedef struct
+{
+    const char          *name;
+    nxt_connection_t    type;
+    rct_status_t        (*open)(struct rct_nxt *nxt);
+    int                 (*send)(struct rct_nxt *nxt, char *buf, int len);
+    int                 (*recv)(struct rct_nxt *nxt, char *buf, int maxlen);
+    rct_status_t        (*close)(struct rct_nxt *nxt);
+    int                 (*poll)(struct rct_nxt *nxt, int timeout_ms);
+    int                 (*peek)(struct rct_nxt *nxt, unsigned char **packet);
+    void                (*consume)(struct rct_nxt *nxt);
+    int                 (*sendv)(struct rct_nxt *nxt,
+				 const struct iovec *iov, int count);
+}   nxt_transport_t;
+
 #define NXT_VENDOR(dev)     ((dev)->descriptor.idVendor)
 #define NXT_PRODUCT(dev)    ((dev)->descriptor.idProduct)
 
@@ -57,6 +102,11 @@ typedef enum
 #define NXT_SystemCmdNoReply (NXT_SystemCmd | NXT_NoResponseMask)
 #define NXT_MaxBytes         64
 #define NXT_NameMaxLen       15
+#define NXT_READ_MAX         (NXT_MaxBytes - 6)  /* Data per READ reply */
+#define NXT_WRITE_MAX        (NXT_MaxBytes - 3)  /* Data per WRITE */
+#define NXT_UPLOAD_BLOCK     4096    /* Bytes read from disk at once */
+#define NXT_UPLOAD_RESUMES   3       /* Link drops survived per file */
+#define NXT_SWAP_PREFIX      '~'     /* Marks RCT_UPLOAD_SWAP temp files */
 
 /* Direct commands */
 #define NXT_DC_START_PROGRAM            0x00
@@ -141,8 +191,372 @@ typedef enum
 #define NXT_STATUS_ILLEGAL_FILENAME     0x92
 #define NXT_STATUS_ILLEGAL_HANDLE       0x93
 
-/* NXT parameters */
+/*
+ *  Asynchronous command engine.  A request holds one command telegram
+ *  and, once complete, the brick's reply.  Up to nxt->engine.window
+ *  requests may be outstanding per brick.  The NXT executes commands
+ *  in order, so replies are matched to the oldest outstanding request
+ *  with the same command code.  Requests whose replies are skipped
+ *  over are completed with RCT_COMMAND_FAILED.
+ *
+ *  On completion, req->callback (if not NULL) is called.  Use
+ *  nxt_enqueue_completion as the callback to collect completed requests
+ *  with nxt_get_completion() instead.
+ *
+ *  Each request must be answered within req->timeout_ms of being sent,
+ *  or nxt->timeout_ms if that is 0, or it completes with RCT_TIMEOUT.
+ *  A negative timeout waits indefinitely.  If the reply turns up later,
+ *  it is recognized and discarded.
+ */
+
+#define NXT_MAX_IN_FLIGHT       16
+#define NXT_DEFAULT_WINDOW      4
+#define NXT_DEFAULT_TIMEOUT_MS  1000
+
+/* DELETE_USER_FLASH erases the whole flash before it replies */
+#define NXT_DELETE_USER_FLASH_MS    10000
+
+/*
+ *  If the link fails, nxt_reconnect() reopens it, retrying for up to
+ *  nxt->reconnect_ms with exponential backoff between attempts, then
+ *  restores the output states and resends the requests in flight.
+ *  A link that fails again before any reply has come back is the same
+ *  outage, and does not get a fresh budget.
+ */
+#define NXT_RECONNECT_MS        3000
+#define NXT_RECONNECT_MIN_MS    20
+#define NXT_RECONNECT_MAX_MS    500
+
+/*
+ *  Priority classes.  nxt_request_init() picks one from the command
+ *  code: stopping a program or sound is an emergency, other direct
+ *  commands are control or, if they only read state, telemetry, and
+ *  system commands are bulk apart from the brick information queries.
+ *  A SET_OUTPUT_STATE that stops a motor is also an emergency.  The
+ *  class matters only to the scheduler, which always sends the highest
+ *  class waiting, so a stop overtakes a file transfer between packets.
+ */
+
+typedef enum
+{
+    NXT_PRIO_EMERGENCY,
+    NXT_PRIO_CONTROL,
+    NXT_PRIO_TELEMETRY,
+    NXT_PRIO_BULK,
+    NXT_PRIORITIES
+}   nxt_priority_t;
+
+typedef struct nxt_request nxt_request_t;
+typedef void (*nxt_callback_t)(struct rct_nxt *nxt, nxt_request_t *req);
+
+struct nxt_request
+{
+    unsigned char   cmd[NXT_PACKET_MAX];
+    int             cmd_len;
+    unsigned char   response[NXT_PACKET_MAX];
+    int             response_len;
+    rct_status_t    status;
+    int             done;
+    int             timeout_ms;     /* 0 = use the brick's default */
+    struct timeval  deadline;
+    nxt_callback_t  callback;
+    void            *arg;           /* For use by the callback */
+    nxt_request_t   *next;          /* Completion queue link */
+    nxt_priority_t  priority;
+    struct timeval  t_init;         /* For rct_stats, clear if off */
+    struct timeval  t_sent;
+};
+
+/* Status byte from the brick, valid once a request has completed OK */
+#define NXT_REPLY_STATUS(req)   ((req)->response[2])
+
+/* rct_stats_class_t of a request */
+#define NXT_STATS_CLASS(req)    ((req)->cmd[0] & ~NXT_NO_RESPONSE)
+
 typedef struct
+{
+    nxt_request_t   *in_flight[NXT_MAX_IN_FLIGHT];
+    int             head;
+    int             count;
+    int             window;
+    nxt_request_t   *done_head;
+    nxt_request_t   *done_tail;
+
+    /* Command codes of timed out requests whose replies may yet arrive */
+    unsigned char   stale[NXT_MAX_IN_FLIGHT];
+    int             stale_head;
+    int             stale_count;
+
+    long            turnaround_us;  /* Smoothed, send to reply */
+}   nxt_engine_t;
+
+/*
+ *  Multi-brick scheduler (nxt_sched.c).  Bricks added to a scheduler
+ *  are driven by its dispatcher thread.  While it runs, the engine
+ *  calls of other threads on those bricks, and so all the synchronous
+ *  nxt_ command functions, are routed through it.  Each brick has a
+ *  queue per priority class, and the dispatcher takes one request at
+ *  a time from each brick in turn, highest class first.
+ *
+ *  Emergency requests go out at once, ignoring the window and the
+ *  send spacing.  Control and telemetry requests may fill the window,
+ *  and sends to each brick are spaced by its turnaround time divided
+ *  by its window.  Bulk requests are limited to the scheduler's bulk
+ *  depth, NXT_SCHED_BULK_DEPTH unless changed with
+ *  nxt_sched_set_bulk_depth(), so a stop waits behind at most that
+ *  many packets of a transfer.  Completion callbacks run in the
+ *  dispatcher thread.
+ *
+ *  The dispatcher never sleeps on behalf of one brick.  A brick whose
+ *  link has failed is skipped while nxt_reconnect_step() backs off,
+ *  keeping its requests in flight, and unverified commands in
+ *  adaptive mode wait in the queue instead of in nxt_adaptive_pace().
+ *  When there is nothing to send, the dispatcher waits in poll() for
+ *  a reply, a new request, or the next send or deadline.  Bricks
+ *  without a descriptor to poll are checked every NXT_SCHED_TICK_US.
+ *
+ *  The scheduler uses pthreads, like the rest of the library, so
+ *  programs must be linked with -lpthread.
+ */
+
+#define NXT_SCHED_MAX_BRICKS    8
+#define NXT_SCHED_BULK_DEPTH    1       /* Bulk requests in flight */
+#define NXT_SCHED_TICK_US       500     /* Polling interval when busy */
+
+typedef struct nxt_sched nxt_sched_t;   /* Opaque, see nxt_sched.c */
+
+/* A file on the brick, as found by nxt_find_first() */
+typedef struct
+{
+    char            name[NXT_FILENAME_MAX+1];
+    unsigned long   size;
+    int             handle;         /* For nxt_find_next() */
+}   nxt_file_info_t;
+
+/* One file of nxt_upload_files() */
+typedef struct
+{
+    char                *path;
+    char                *name;      /* On the brick */
+    unsigned long       size;
+    unsigned long long  hash;
+    rct_status_t        status;
+    int                 unchanged;  /* Manifest says it is on the brick */
+    int                 open_status;/* NXT status of the last open */
+}   nxt_upload_t;
+
+/* Upload manifest of one brick (nxt_manifest.c) */
+#define NXT_MANIFEST_MAX    128
+#define NXT_MANIFEST_PATH_MAX   1024
+#define NXT_FNV_OFFSET      0xcbf29ce484222325ULL
+#define NXT_FNV_PRIME       0x100000001b3ULL
+
+typedef struct
+{
+    char                name[NXT_FILENAME_MAX+1];
+    unsigned long       size;
+    unsigned long long  hash;
+}   nxt_manifest_entry_t;
+
+typedef struct
+{
+    char                    path[NXT_MANIFEST_PATH_MAX+1];
+    int                     count;
+    nxt_manifest_entry_t    entries[NXT_MANIFEST_MAX];
+}   nxt_manifest_t;
+
+/*
+ *  Flash layout planning (nxt_flash.c).  Files take whole pages of
+ *  flash, and linear files need them in one run.  The brick reports
+ *  only the total free, so nxt_flash_plan() can tell in advance that
+ *  an upload set will not fit at all, but fragmentation shows up only
+ *  as NXT_STATUS_NO_LINEAR_SPACE from an open.  nxt_flash_evict() then
+ *  moves the smallest other file on the brick to a local directory,
+ *  and nxt_flash_restore() puts the moved files back afterwards, where
+ *  they fill whatever space is left.
+ */
+#define NXT_FLASH_PAGE          256
+#define NXT_FLASH_PAGES(size)   (((size) + NXT_FLASH_PAGE - 1) / NXT_FLASH_PAGE)
+#define NXT_FLASH_FILES_MAX     64
+#define NXT_FLASH_TMP_TEMPLATE  "/tmp/nxt-flash.XXXXXX"
+
+/* Per file of nxt_flash_plan_t */
+#define NXT_FLASH_ON_BRICK      0
+#define NXT_FLASH_MOVED         1
+#define NXT_FLASH_PINNED        2   /* Could not be moved */
+
+typedef struct
+{
+    unsigned long   free_flash;
+    unsigned long   needed;     /* By the files to be written */
+    unsigned long   reclaimed;  /* By the old copies they replace */
+    int             count;
+    nxt_file_info_t files[NXT_FLASH_FILES_MAX]; /* Others, smallest first */
+    int             state[NXT_FLASH_FILES_MAX];
+    char            tmp_dir[sizeof(NXT_FLASH_TMP_TEMPLATE)];
+}   nxt_flash_plan_t;
+
+/*
+ *  Query cache (cache.c).  nxt_cmd_send() answers the idempotent
+ *  queries flagged NXT_CMD_CACHED in their descriptors from the last
+ *  reply until its TTL runs out, so repeated calls to functions like
+ *  rct_print_battery_level() cost no link traffic.  Commands that
+ *  change the flash or the brick name drop the cached device info,
+ *  and opening or reconnecting the brick drops everything.  On a brick
+ *  driven by a scheduler, concurrent requests for the same query are
+ *  also collapsed onto one command in flight.  The cache is not
+ *  locked, so entries may be refreshed twice by racing threads.
+ */
+
+#define NXT_CACHE_BATTERY_MS        10000
+#define NXT_CACHE_VERSIONS_MS       -1      /* Until the brick is reopened */
+#define NXT_CACHE_DEVICE_INFO_MS    5000
+
+typedef enum
+{
+    NXT_CACHE_BATTERY,
+    NXT_CACHE_VERSIONS,
+    NXT_CACHE_DEVICE_INFO,
+    NXT_CACHE_ENTRIES
+}   nxt_cache_query_t;
+
+typedef struct
+{
+    rct_cache_entry_t   entry;
+    unsigned char       response[NXT_PACKET_MAX];
+    int                 response_len;
+}   nxt_cached_reply_t;
+
+/*
+ *  File listing (nxt_dir.c).  nxt_list_files() reads the whole
+ *  directory with a FIND_FIRST followed by windows of FIND_NEXT
+ *  requests sent together, and keeps it for NXT_CACHE_LISTING_MS.
+ *  Commands that add, remove or rename files drop it (see
+ *  nxt_cache_sent()), as does reopening the brick.  nxt_dir_open()
+ *  filters the listing through an fnmatch(3) glob, so patterns are not
+ *  limited to the brick's own wildcards.
+ */
+#define NXT_CACHE_LISTING_MS        5000
+
+typedef struct
+{
+    rct_cache_entry_t   entry;
+    int                 count;
+    int                 max;
+    nxt_file_info_t     *files;
+}   nxt_listing_t;
+
+/* Iterator over the files matching a glob */
+typedef struct
+{
+    int                 count;
+    int                 next;
+    nxt_file_info_t     *files;
+}   nxt_dir_t;
+
+/*
+ *  Adaptive response mode (nxt_adaptive.c).  Commands that allow it go
+ *  out without asking for a reply, and after every verify_every of
+ *  them a NXT_DC_KEEP_ALIVE probe is submitted asynchronously.  Probe
+ *  replies and timeouts feed a moving average of the loss rate and
+ *  round trip time, and the gap enforced between unverified commands
+ *  doubles on loss and shrinks by a quarter while probes get through,
+ *  so it is gone within about 20 probes of the losses stopping.
+ */
+
+#define NXT_ADAPTIVE_VERIFY_EVERY   10
+#define NXT_ADAPTIVE_DECAY          4       /* Good probe cuts gap by 1/4 */
+#define NXT_ADAPTIVE_STEP_US        500     /* but by at least this much */
+#define NXT_ADAPTIVE_MIN_GAP_US     2000    /* First gap after a loss */
+#define NXT_ADAPTIVE_MAX_GAP_US     100000
+
+typedef struct
+{
+    int             enabled;
+    int             verify_every;
+    int             unverified;     /* Sent since the last probe */
+    unsigned long   probes;
+    unsigned long   replies;
+    unsigned long   lost;
+    double          loss_rate;      /* Moving average, 0.0 to 1.0 */
+    long            rtt_us;         /* Smoothed probe round trip */
+    long            gap_us;         /* Between unverified commands */
+    struct timeval  next_send;
+    struct timeval  probe_sent;
+    nxt_request_t   probe;
+}   nxt_adaptive_t;
+
+/*
+ *  Command descriptors (nxt_cmd.c).  Each direct and system command
+ *  with a fixed layout has a static descriptor giving the offset and
+ *  type of every field, the telegram and reply lengths, and an optional
+ *  parser that stores reply data in the rct_nxt_t structure.
+ *
+ *  An nxt_cmd_t is a command built from a descriptor.  nxt_cmd_init()
+ *  copies a template made once per descriptor, with everything but the
+ *  fields filled in, and the fields are then patched with
+ *  nxt_cmd_set() and nxt_cmd_set_filename().  A command may be sent
+ *  any number of times, changing only the fields that differ.
+ */
+
+typedef enum
+{
+    NXT_FIELD_NONE = 0,
+    NXT_FIELD_UBYTE,
+    NXT_FIELD_UWORD,
+    NXT_FIELD_ULONG,
+    NXT_FIELD_FILENAME          /* 20 bytes, null-padded */
+}   nxt_field_type_t;
+
+typedef struct
+{
+    unsigned char   type;
+    unsigned char   offset;
+}   nxt_field_t;
+
+#define NXT_CMD_MAX_FIELDS      8
+
+/* Descriptor flags */
+#define NXT_CMD_REPLY_OPTIONAL  0x01    /* Honors nxt->response_mask */
+#define NXT_CMD_CACHED          0x02    /* Read-only, see nxt_cache_find() */
+
+typedef struct
+{
+    char            *name;
+    unsigned char   cmd_len;
+    unsigned char   response_len;
+    unsigned char   flags;
+    nxt_field_t     fields[NXT_CMD_MAX_FIELDS];
+    rct_status_t    (*parse)(struct rct_nxt *nxt,
+			     const unsigned char *response);
+}   nxt_cmd_desc_t;
+
+typedef struct
+{
+    const nxt_cmd_desc_t    *desc;
+    nxt_request_t           req;
+}   nxt_cmd_t;
+
+/*
+ *  Receive ring for stream connections, which do not preserve message
+ *  boundaries.  head and tail count bytes consumed and received since
+ *  the ring was flushed, so tail - head is the amount buffered.
+ */
+
+#define NXT_RING_SIZE           4096    /* Must be a power of 2 */
+#define NXT_RING_USED(r)        ((r)->tail - (r)->head)
+
+typedef struct
+{
+    unsigned char   buf[NXT_RING_SIZE];
+    size_t          head;
+    size_t          tail;
+    int             peeked;     /* Bytes to release in nxt_ring_consume() */
+    unsigned char   bounce[NXT_PACKET_MAX]; /* For packets that wrap */
+}   nxt_ring_t;
+
+/* NXT parameters */
+typedef struct rct_nxt
 {
     char                    name[NXT_NAME_LEN+1];
     unsigned long           free_flash;
@@ -163,11 +577,49 @@ typedef struct
     /* Used only for bluetooth connections */
     //char                    *bluetooth_passcode;
     //char                    *bluetooth_pin;
-    int                     bluetooth_fd;
     unsigned char           bluetooth_address[7];
     unsigned long           bluetooth_signal_strength;
     
-    nxt_output_state_t      port[3];
+    /* Used by stream connections (Bluetooth, pty, socketpair) */
+    int                     fd;
+    char                    *stream_device;
+    nxt_ring_t              *rx_ring;       /* Allocated on first receive */
+
+    /* Selected by nxt_open_brick() unless preset by the caller */
+    const nxt_transport_t   *transport;
+    void                    *transport_data;
+    int                     is_open;
+    int                     timeout_ms;     /* Default reply deadline */
+    int                     recv_timeout_ms;/* Budget for the next recv() */
+    int                     capture_id;     /* Brick id in capture files */
+    int                     write_chunk;    /* 0 = see nxt_write_chunk() */
+
+    nxt_engine_t            engine;
+
+    /* Session state restored by nxt_reconnect() */
+    int                     reconnect_ms;   /* Budget, 0 = don't, < 0 = ever */
+    int                     reconnecting;
+    int                     reconnect_nowait; /* See nxt_relink() */
+    int                     reconnect_attempts;
+    int                     link_down;      /* Closed, reconnect pending */
+    unsigned int            reconnects;     /* Sessions restored so far */
+    int                     outage_delay_ms;/* Next backoff, 0 = no outage */
+    struct timeval          outage_deadline;
+    struct timeval          outage_retry;   /* Time of the next attempt */
+    unsigned int            outputs_set;    /* Bit per port[] to restore */
+    nxt_output_state_t      port[3];        /* Last SET_OUTPUT_STATE */
+
+    nxt_adaptive_t          adaptive;
+    nxt_cached_reply_t      cache[NXT_CACHE_ENTRIES];
+    nxt_listing_t           listing;        /* See nxt_dir.c */
+
+    /* Set while the brick is driven by a scheduler */
+    nxt_sched_t             *sched;
+    rct_status_t            (*sched_submit)(struct rct_nxt *nxt,
+				nxt_request_t **reqs, int count);
+    int                     (*sched_reap)(struct rct_nxt *nxt, int min);
+    void                    (*sched_done)(struct rct_nxt *nxt,
+				nxt_request_t *req);
 }   rct_nxt_t;
 
 
@@ -177,9 +629,17 @@ typedef struct
 	(snprintf((n)->bluetooth_address,7,"%c%c%c%c%c%c", \
 	(a),(b),(c),(d),(e),(f)))
 
-#define NXT_BLUETOOTH_IS_OPEN(nxt)  ((nxt)->bluetooth_fd != -1)
-#define NXT_USB_IS_OPEN(nxt)        ((nxt)->usb_handle != NULL)
-#define NXT_IS_OPEN(nxt) (\
-	    NXT_BLUETOOTH_IS_OPEN((nxt)) || NXT_USB_IS_OPEN((nxt)) \
-	    )
+#define NXT_IS_OPEN(nxt)            ((nxt)->is_open)
+#define NXT_BLUETOOTH_IS_OPEN(nxt)  \
+	(NXT_IS_OPEN(nxt) && (nxt)->transport->type == NXT_BLUETOOTH)
+#define NXT_USB_IS_OPEN(nxt)        \
+	(NXT_IS_OPEN(nxt) && (nxt)->transport->type == NXT_USB)
+
+/* Transport tables (nxt_transport.c, nxt_sim.c, nxt_usb1.c, nxt_replay.c) */
+extern const nxt_transport_t    nxt_usb_transport;
+extern const nxt_transport_t    nxt_usb1_transport; /* If RCT_LIBUSB1 */
+extern const nxt_transport_t    nxt_bluetooth_transport;
+extern const nxt_transport_t    nxt_stream_transport;
+extern const nxt_transport_t    nxt_sim_transport;
+extern const nxt_transport_t    nxt_replay_transport;
 
@@ -0,0 +1,71 @@
+
+/*
+ *  In-process NXT simulator, used as a transport backend so that the
+ *  command path can be exercised and benchmarked with no brick attached.
+ *  Select it with nxt_set_transport(nxt, &nxt_sim_transport), or by
+ *  setting ROBOCTL_SIMULATOR in the environment before rct_find_bricks().
+ *  ROBOCTL_SIM_LATENCY sets the simulated turnaround time in microseconds.
+ *  ROBOCTL_SIM_DROP=n loses every nth reply, to exercise timeouts.
+ *  ROBOCTL_SIM_DISCONNECT=n fails the link on every nth telegram, to
+ *  exercise nxt_reconnect().  As on a real brick, flash survives and
+ *  open files are closed.
+ */
+
+#define NXT_SIM_FLASH_SIZE      (128 * 1024)
+#define NXT_SIM_FLASH_PAGES     (NXT_SIM_FLASH_SIZE / NXT_FLASH_PAGE)
+#define NXT_SIM_MAX_FILES       64
+#define NXT_SIM_MAX_HANDLES     16
+#define NXT_SIM_QUEUE_LEN       64
+#define NXT_SIM_BATTERY_MV      8200
+#define NXT_SIM_SLEEP_LIMIT     600000  /* ms */
+
+/* Direct command status codes not covered by NXT_STATUS_* */
+#define NXT_STATUS_NO_ACTIVE_PROGRAM    0xEC
+#define NXT_STATUS_UNKNOWN_OPCODE       0xBE
+
+typedef struct
+{
+    char            name[NXT_FILENAME_MAX+1];
+    unsigned char   *data;
+    size_t          size;       /* Size given when opened for writing */
+    size_t          written;
+    int             linear;
+    int             in_use;
+}   nxt_sim_file_t;
+
+typedef struct
+{
+    int             in_use;
+    int             file;       /* Index into files[] */
+    int             mode;       /* NXT_SC_OPEN_* or FIND_FIRST */
+    size_t          pos;        /* Next file to look at for FIND_NEXT */
+    char            pattern[NXT_FILENAME_MAX+1];
+}   nxt_sim_handle_t;
+
+typedef struct
+{
+    nxt_sim_file_t      files[NXT_SIM_MAX_FILES];
+    nxt_sim_handle_t    handles[NXT_SIM_MAX_HANDLES];
+
+    /*
+     *  Owner of each flash page, as an index into files[] plus one, or
+     *  0 if free.  Linear files need a run of free pages, and others
+     *  take any, so deleting files fragments the flash as on a brick.
+     */
+    unsigned char       page_owner[NXT_SIM_FLASH_PAGES];
+    char                program[NXT_FILENAME_MAX+1];
+    unsigned char       port[3][NXT_BUFF_LEN];  /* Last SET_OUTPUT_STATE */
+
+    /* Responses not yet collected by recv(), oldest first */
+    unsigned char       queue[NXT_SIM_QUEUE_LEN][NXT_PACKET_MAX];
+    int                 queue_len[NXT_SIM_QUEUE_LEN];
+    struct timeval      queue_ready[NXT_SIM_QUEUE_LEN];
+    int                 head;
+    int                 count;
+
+    long                latency_us;
+    long                drop_every;
+    long                disconnect_every;
+    unsigned long       replies;
+    unsigned long       telegrams;
+}   nxt_sim_t;
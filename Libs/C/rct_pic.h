@@ -27,6 +27,9 @@
 
 #define PIC_BAUD_RATE   B115200
 
+/* Erasing a full 128 block chunk of flash takes a while */
+#define PIC_DEFAULT_TIMEOUT_MS  3000
+
 #ifndef MIN
 #define MIN(x,y)    ((x) < (y) ? (x) : (y))
 #endif
@@ -57,6 +60,8 @@ typedef struct
     int             bootloader_major;
     int             bootloader_minor;
     char            *device;
+    int             timeout_ms;     /* Response deadline, < 0 for none */
+    rct_cache_entry_t   bootloader_cache;
     char            response[PIC_RESPONSE_MAX+1];
     struct termios  current_port_settings;
     struct termios  original_port_settings;
@@ -2,19 +2,49 @@
 void rct_init_brick_struct(rct_brick_t *brick, rct_brick_type_t type);
 rct_status_t rct_open_brick(rct_brick_t *brick);
 rct_status_t rct_upload_file(rct_brick_t *brick, char *filename, rct_flag_t flags);
+rct_status_t rct_upload_files(rct_brick_t *brick, char *filenames[], int count, rct_flag_t flags);
 rct_status_t rct_play_sound_file(rct_brick_t *brick, rct_flag_t flags, char *filename);
 rct_status_t rct_play_tone(rct_brick_t *brick, int herz, int milliseconds);
 rct_status_t rct_delete_file(rct_brick_t *brick, char *filename);
+rct_status_t rct_delete_files(rct_brick_t *brick, char *patterns[], int count);
 rct_status_t rct_start_program(rct_brick_t *brick, char *filename);
 rct_status_t rct_stop_program(rct_brick_t *brick);
 rct_status_t rct_download_file(rct_brick_t *brick, char *filename);
 rct_status_t rct_close_brick(rct_brick_t *brick);
 rct_status_t rct_get_battery_level(rct_brick_t *brick);
 rct_status_t rct_print_battery_level(rct_brick_t *brick);
+rct_status_t rct_print_files(rct_brick_t *brick, char *glob);
 rct_status_t rct_get_firmware_version(rct_brick_t *brick);
 rct_status_t rct_print_firmware_version(rct_brick_t *brick);
 rct_status_t rct_print_device_info(rct_brick_t *brick);
 rct_status_t rct_motor_on(rct_brick_t *brick, int port, int power);
+rct_status_t rct_set_timeout(rct_brick_t *brick, int timeout_ms);
+/* cache.c */
+void rct_cache_init(rct_cache_entry_t *entry, int ttl_ms);
+int rct_cache_fresh(const rct_cache_entry_t *entry);
+void rct_cache_store(rct_cache_entry_t *entry);
+void rct_cache_invalidate(rct_cache_entry_t *entry);
+void nxt_cache_init(rct_nxt_t *nxt);
+void nxt_cache_flush(rct_nxt_t *nxt);
+int nxt_cache_query(int cmd_type, int cmd_code);
+nxt_cached_reply_t *nxt_cache_find(rct_nxt_t *nxt, const nxt_request_t *req);
+rct_status_t nxt_cache_set_ttl(rct_nxt_t *nxt, int cmd_type, int cmd_code, int ttl_ms);
+void nxt_cache_sent(rct_nxt_t *nxt, const nxt_request_t *req);
+/* capture.c */
+rct_status_t rct_capture_open(const char *path);
+void rct_capture_env(void);
+void rct_capture_close(void);
+int rct_capture_new_id(void);
+void rct_capture_frame(rct_brick_type_t brick_type, int transport, int brick_id, rct_capture_dir_t direction, const void *buf, int len);
+FILE *rct_capture_open_read(const char *path, struct timeval *start);
+int rct_capture_read_frame(FILE *fp, rct_capture_frame_t *frame);
+void rct_capture_put16(unsigned char *buf, unsigned long val);
+void rct_capture_put32(unsigned char *buf, unsigned long val);
+unsigned int rct_capture_get16(const unsigned char *buf);
+unsigned long rct_capture_get32(const unsigned char *buf);
+/* deadline.c */
+void rct_deadline_set(struct timeval *deadline, int timeout_ms);
+int rct_deadline_remaining(const struct timeval *deadline);
 /* debug.c */
 int debug_printf(char *format, ...);
 /* get_home_dir.c */
@@ -29,13 +59,25 @@ rct_status_t nxt_print_firmware_version(rct_nxt_t *nxt);
 int nxt_send_simple_cmd(rct_nxt_t *nxt, int cmd_type, int cmd, char *response, int response_max);
 int nxt_send_cmd(rct_nxt_t *nxt, int cmd_type, int cmd, char *response, int response_max, char *format, ...);
 int nxt_send_buf(rct_nxt_t *nxt, char *buf, int len);
+int nxt_send_bufs(rct_nxt_t *nxt, const struct iovec *iov, int count);
 rct_status_t nxt_send_str(rct_nxt_t *nxt, char *str);
-rct_status_t nxt_recv_buf(rct_nxt_t *nxt, char *buf, int maxlen);
+int nxt_recv_buf(rct_nxt_t *nxt, char *buf, int maxlen);
+int nxt_poll_response(rct_nxt_t *nxt, int timeout_ms);
+int nxt_recv_packet(rct_nxt_t *nxt, unsigned char * *packet, unsigned char *buf);
+void nxt_release_packet(rct_nxt_t *nxt);
+void nxt_capture(rct_nxt_t *nxt, rct_capture_dir_t direction, const void *buf, int len);
 rct_status_t nxt_close_brick(rct_nxt_t *nxt);
 rct_status_t nxt_close_brick_usb(rct_nxt_t *nxt);
 rct_status_t nxt_close_brick_bluetooth(rct_nxt_t *nxt);
 rct_status_t nxt_validate_filename(char *filename, char *correct_ext, const char *caller);
 rct_status_t nxt_upload_file(rct_nxt_t *nxt, char *filename_on_pc, rct_flag_t flags);
+rct_status_t nxt_upload_files(rct_nxt_t *nxt, char *filenames[], int count, rct_flag_t flags);
+char *nxt_swap_name(const char *filename_on_brick, char *swap_name);
+rct_status_t nxt_upload_swap(rct_nxt_t *nxt, int file_handle, char *swap_name, char *filename_on_brick);
+int nxt_upload_cmp(const void *a, const void *b);
+int nxt_is_linear_file(const char *filename_on_brick);
+rct_status_t nxt_upload_write(rct_nxt_t *nxt, nxt_upload_t *up, int *file_handle, rct_flag_t flags);
+int nxt_upload_open(rct_nxt_t *nxt, int prev_handle, nxt_upload_t *up, rct_flag_t flags);
 void nxt_init_struct(rct_nxt_t *nxt);
 short buf2short(unsigned char *buf);
 void short2buf(unsigned char *buf, long val);
@@ -54,12 +96,44 @@ rct_status_t nxt_check_response(rct_nxt_t *nxt, char *response, int bytes, int e
 void nxt_response_on(rct_nxt_t *nxt);
 void nxt_response_off(rct_nxt_t *nxt);
 char *nxt_pc_to_brick_filename(char *filename_on_pc);
+/* nxt_adaptive.c */
+void nxt_response_adaptive(rct_nxt_t *nxt, int verify_every);
+void nxt_adaptive_pace(rct_nxt_t *nxt);
+void nxt_adaptive_sent(rct_nxt_t *nxt, int count);
+void nxt_adaptive_probe_done(rct_nxt_t *nxt, nxt_request_t *req);
+/* nxt_cmd.c */
+const nxt_cmd_desc_t *nxt_cmd_desc(int cmd_type, int cmd_code);
+const char *nxt_cmd_stats_name(rct_stats_class_t cls, int code);
+const nxt_cmd_t *nxt_cmd_template(int cmd_type, int cmd_code);
+void nxt_cmd_templates_init(void);
+void nxt_cmd_template_build(nxt_cmd_t *tmpl, int cmd_type, int cmd_code);
+rct_status_t nxt_cmd_init(rct_nxt_t *nxt, nxt_cmd_t *cmd, int cmd_type, int cmd_code);
+void nxt_cmd_set(nxt_cmd_t *cmd, int field, unsigned long value);
+void nxt_cmd_set_filename(nxt_cmd_t *cmd, int field, const char *filename);
+rct_status_t nxt_cmd_send(rct_nxt_t *nxt, nxt_cmd_t *cmd);
+rct_status_t nxt_cmd_check(rct_nxt_t *nxt, nxt_cmd_t *cmd);
+rct_status_t nxt_cmd_decode(rct_nxt_t *nxt, nxt_cmd_t *cmd);
+rct_status_t nxt_parse_battery_level(rct_nxt_t *nxt, const unsigned char *response);
+rct_status_t nxt_parse_versions(rct_nxt_t *nxt, const unsigned char *response);
+rct_status_t nxt_parse_device_info(rct_nxt_t *nxt, const unsigned char *response);
+/* nxt_dir.c */
+rct_status_t nxt_list_files(rct_nxt_t *nxt);
+rct_status_t nxt_listing_add(nxt_listing_t *listing, nxt_file_info_t *info);
+void nxt_listing_free(rct_nxt_t *nxt);
+rct_status_t nxt_dir_open(rct_nxt_t *nxt, nxt_dir_t *dir, const char *glob);
+rct_status_t nxt_dir_open_globs(rct_nxt_t *nxt, nxt_dir_t *dir, char *globs[], int count);
+int nxt_dir_match(const char *name, char *globs[], int count);
+nxt_file_info_t *nxt_dir_read(nxt_dir_t *dir);
+void nxt_dir_close(nxt_dir_t *dir);
+rct_status_t nxt_print_files(rct_nxt_t *nxt, const char *glob);
+rct_status_t nxt_delete_files(rct_nxt_t *nxt, char *globs[], int count);
 /* nxt_direct_cmd.c */
 rct_status_t nxt_start_program(rct_nxt_t *nxt, char *raw_filename);
 rct_status_t nxt_stop_program(rct_nxt_t *nxt);
 rct_status_t nxt_play_sound_file(rct_nxt_t *nxt, rct_flag_t flags, char *const raw_filename);
 rct_status_t nxt_play_tone(rct_nxt_t *nxt, int herz, int milliseconds);
 rct_status_t nxt_set_output_state(rct_nxt_t *nxt, int port, int power, nxt_output_mode_t mode, nxt_output_regulation_mode_t regulation, int ratio, nxt_output_runstate_t runstate, unsigned long tacholimit);
+void nxt_output_cmd(rct_nxt_t *nxt, nxt_cmd_t *cmd, int port, const nxt_output_state_t *state);
 rct_status_t nxt_set_input_mode(rct_nxt_t *nxt);
 rct_status_t nxt_get_output_state(rct_nxt_t *nxt);
 rct_status_t nxt_get_input_values(rct_nxt_t *nxt);
@@ -74,22 +148,145 @@ rct_status_t nxt_ls_write(rct_nxt_t *nxt);
 rct_status_t nxt_ls_read(rct_nxt_t *nxt);
 rct_status_t nxt_get_current_program_name(rct_nxt_t *nxt);
 rct_status_t nxt_message_read(rct_nxt_t *nxt);
+/* nxt_engine.c */
+void nxt_engine_init(nxt_engine_t *engine);
+rct_status_t nxt_set_window(rct_nxt_t *nxt, int window);
+void nxt_set_timeout(rct_nxt_t *nxt, int timeout_ms);
+void nxt_request_init(nxt_request_t *req, int cmd_type, int cmd_code);
+nxt_priority_t nxt_default_priority(int cmd_type, int cmd_code);
+rct_status_t nxt_request_append(nxt_request_t *req, const void *data, int len);
+rct_status_t nxt_submit(rct_nxt_t *nxt, nxt_request_t *req);
+rct_status_t nxt_submit_batch(rct_nxt_t *nxt, nxt_request_t * *reqs, int count);
+rct_status_t nxt_engine_submit(rct_nxt_t *nxt, nxt_request_t * *reqs, int count);
+void nxt_park_requests(rct_nxt_t *nxt, nxt_request_t * *reqs, int count);
+int nxt_reap(rct_nxt_t *nxt, int min);
+int nxt_engine_reap(rct_nxt_t *nxt, int min);
+int nxt_reap_ready(rct_nxt_t *nxt);
+void nxt_expire_oldest(rct_nxt_t *nxt);
+void nxt_retire_stale(rct_nxt_t *nxt, int code);
+int nxt_is_stale_reply(rct_nxt_t *nxt, unsigned char *response);
+int nxt_match_reply(rct_nxt_t *nxt, unsigned char *response, int bytes);
+nxt_request_t *nxt_dequeue_in_flight(rct_nxt_t *nxt);
+int nxt_fail_in_flight(rct_nxt_t *nxt, rct_status_t status);
+void nxt_complete_request(rct_nxt_t *nxt, nxt_request_t *req, rct_status_t status);
+void nxt_stats_sent(nxt_request_t *req, const struct timeval *t_submit, const struct timeval *t_send, const struct timeval *t_sent);
+void nxt_stats_completed(nxt_request_t *req);
+void nxt_enqueue_completion(rct_nxt_t *nxt, nxt_request_t *req);
+nxt_request_t *nxt_get_completion(rct_nxt_t *nxt);
+rct_status_t nxt_wait(rct_nxt_t *nxt, nxt_request_t *req);
+rct_status_t nxt_drain(rct_nxt_t *nxt);
+rct_status_t nxt_transact(rct_nxt_t *nxt, nxt_request_t *req);
+int nxt_exchange(rct_nxt_t *nxt, char *cmd, int len, char *response, int response_max);
+/* nxt_flash.c */
+rct_status_t nxt_flash_plan(rct_nxt_t *nxt, nxt_upload_t *uploads, int count, rct_flag_t flags, nxt_flash_plan_t *plan);
+int nxt_flash_cmp(const void *a, const void *b);
+rct_status_t nxt_flash_evict(rct_nxt_t *nxt, nxt_flash_plan_t *plan);
+rct_status_t nxt_flash_copy_out(rct_nxt_t *nxt, nxt_file_info_t *info, char *path);
+rct_status_t nxt_flash_delete(rct_nxt_t *nxt, char *filename_on_brick);
+rct_status_t nxt_flash_restore(rct_nxt_t *nxt, nxt_flash_plan_t *plan);
+/* nxt_manifest.c */
+rct_status_t nxt_file_hash(const char *path, unsigned long *size, unsigned long long *hash);
+char *nxt_manifest_path(rct_nxt_t *nxt, char *path, size_t maxlen);
+rct_status_t nxt_manifest_load(rct_nxt_t *nxt, nxt_manifest_t *manifest);
+rct_status_t nxt_manifest_save(nxt_manifest_t *manifest);
+nxt_manifest_entry_t *nxt_manifest_find(nxt_manifest_t *manifest, const char *filename_on_brick);
+rct_status_t nxt_manifest_update(rct_nxt_t *nxt, const char *filename_on_brick, unsigned long size, unsigned long long hash);
+rct_status_t nxt_manifest_remove(rct_nxt_t *nxt, const char *filename_on_brick);
+rct_status_t nxt_manifest_clear(rct_nxt_t *nxt);
+int nxt_manifest_unchanged(rct_nxt_t *nxt, char *filename_on_brick, unsigned long size, unsigned long long hash);
 /* nxt_output.c */
 void nxt_output_init(nxt_output_state_t *nxt_output);
+/* nxt_reconnect.c */
+void nxt_set_reconnect(rct_nxt_t *nxt, int timeout_ms);
+int nxt_can_reconnect(rct_nxt_t *nxt);
+rct_status_t nxt_reconnect(rct_nxt_t *nxt);
+rct_status_t nxt_relink(rct_nxt_t *nxt);
+rct_status_t nxt_reconnect_step(rct_nxt_t *nxt);
+rct_status_t nxt_reconnect_backoff(rct_nxt_t *nxt);
+rct_status_t nxt_restore_session(rct_nxt_t *nxt);
+/* nxt_replay.c */
+rct_status_t nxt_set_replay(rct_nxt_t *nxt, char *path);
+rct_status_t nxt_replay_open(rct_nxt_t *nxt);
+rct_status_t nxt_replay_close(rct_nxt_t *nxt);
+int nxt_replay_next(nxt_replay_t *replay, int index, rct_capture_dir_t direction);
+int nxt_replay_send(rct_nxt_t *nxt, char *buf, int len);
+long nxt_replay_usec_until(nxt_replay_t *replay);
+int nxt_replay_recv(rct_nxt_t *nxt, char *buf, int maxlen);
+int nxt_replay_poll(rct_nxt_t *nxt, int timeout_ms);
+/* nxt_ring.c */
+nxt_ring_t *nxt_ring_new(void);
+void nxt_ring_flush(nxt_ring_t *ring);
+ssize_t nxt_ring_fill(nxt_ring_t *ring, int fd);
+int nxt_ring_peek(nxt_ring_t *ring, unsigned char * *packet);
+void nxt_ring_consume(nxt_ring_t *ring);
+/* nxt_sched.c */
+nxt_sched_t *nxt_sched_new(void);
+rct_status_t nxt_sched_set_bulk_depth(nxt_sched_t *sched, int depth);
+rct_status_t nxt_sched_add(nxt_sched_t *sched, rct_nxt_t *nxt);
+void nxt_sched_hook(rct_nxt_t *nxt, int on);
+rct_status_t nxt_sched_start(nxt_sched_t *sched);
+void nxt_sched_free(nxt_sched_t *sched);
+int nxt_sched_find(nxt_sched_t *sched, rct_nxt_t *nxt);
+rct_status_t nxt_sched_submit(nxt_sched_t *sched, rct_nxt_t *nxt, nxt_request_t *req);
+void nxt_sched_wake(nxt_sched_t *sched);
+int nxt_sched_query(const nxt_request_t *req);
+rct_status_t nxt_sched_wait(nxt_sched_t *sched, nxt_request_t *req);
+rct_status_t nxt_sched_transact(nxt_sched_t *sched, rct_nxt_t *nxt, nxt_request_t *req);
+rct_status_t nxt_sched_submit_hook(rct_nxt_t *nxt, nxt_request_t * *reqs, int count);
+int nxt_sched_reap_hook(rct_nxt_t *nxt, int min);
+void nxt_sched_done_hook(rct_nxt_t *nxt, nxt_request_t *req);
+int nxt_sched_ready(nxt_sched_t *sched, int b, const nxt_request_t *req, const struct timeval *now);
+nxt_request_t *nxt_sched_pick(nxt_sched_t *sched, int *bp);
+void nxt_sched_send(nxt_sched_t *sched, int b, nxt_request_t *req);
+void nxt_sched_sync(nxt_sched_t *sched);
+int nxt_sched_answer(nxt_sched_t *sched, int b);
+int nxt_sched_reconnect(rct_nxt_t *nxt);
+void nxt_sched_idle(nxt_sched_t *sched);
+int nxt_sched_sooner(int a_ms, int b_ms);
+void *nxt_sched_thread(void *arg);
+/* nxt_sim.c */
+rct_status_t nxt_sim_open(rct_nxt_t *nxt);
+rct_status_t nxt_sim_close(rct_nxt_t *nxt);
+void nxt_sim_disconnect(nxt_sim_t *sim);
+int nxt_sim_send(rct_nxt_t *nxt, char *buf, int len);
+int nxt_sim_recv(rct_nxt_t *nxt, char *buf, int maxlen);
+int nxt_sim_poll(rct_nxt_t *nxt, int timeout_ms);
+long nxt_sim_usec_until(struct timeval *when);
+int nxt_sim_execute(nxt_sim_t *sim, unsigned char *cmd, int len, unsigned char *reply);
+int nxt_sim_find_file(nxt_sim_t *sim, char *name);
+int nxt_sim_find(nxt_sim_t *sim, unsigned char *cmd, unsigned char *reply);
+unsigned long nxt_sim_free_flash(nxt_sim_t *sim);
+int nxt_sim_alloc_pages(nxt_sim_t *sim, int f, size_t size, int linear);
+void nxt_sim_free_pages(nxt_sim_t *sim, int f);
+int nxt_sim_open_write(nxt_sim_t *sim, unsigned char *cmd, unsigned char *handle);
+int nxt_sim_open_append(nxt_sim_t *sim, char *name, unsigned char *reply);
+int nxt_sim_open_read(nxt_sim_t *sim, char *name, unsigned char *reply);
+int nxt_sim_read(nxt_sim_t *sim, int handle, int len, unsigned char *reply);
+int nxt_sim_write(nxt_sim_t *sim, int handle, unsigned char *data, int len, unsigned char *count);
+int nxt_sim_delete(nxt_sim_t *sim, char *name);
+int nxt_sim_rename(nxt_sim_t *sim, char *old_name, char *new_name);
+void nxt_sim_delete_all(nxt_sim_t *sim);
 /* nxt_system_cmd.c */
-rct_status_t nxt_open_file_read(rct_nxt_t *nxt);
+int nxt_open_file_read(rct_nxt_t *nxt, char *filename_on_brick, size_t *size);
 rct_status_t nxt_open_file_write(rct_nxt_t *nxt);
-rct_status_t nxt_read_file(rct_nxt_t *nxt);
+rct_status_t nxt_read_file(rct_nxt_t *nxt, int file_handle, size_t size, int fd);
+int nxt_write_chunk(rct_nxt_t *nxt);
+rct_status_t nxt_set_write_chunk(rct_nxt_t *nxt, int bytes);
+int nxt_write_ok(nxt_request_t *req);
 rct_status_t nxt_write_file(rct_nxt_t *nxt, char *filename, int file_handle);
+rct_status_t nxt_write_file_at(rct_nxt_t *nxt, char *filename, int file_handle, size_t offset);
 rct_status_t nxt_close_file(rct_nxt_t *nxt, int file_handle);
 rct_status_t nxt_delete_file(rct_nxt_t *nxt, char *filename);
-rct_status_t nxt_find_first(rct_nxt_t *nxt);
-rct_status_t nxt_find_next(rct_nxt_t *nxt);
+rct_status_t nxt_find_send(rct_nxt_t *nxt, nxt_cmd_t *cmd, nxt_file_info_t *info);
+rct_status_t nxt_find_parse(rct_nxt_t *nxt, nxt_cmd_t *cmd, nxt_file_info_t *info);
+rct_status_t nxt_find_first(rct_nxt_t *nxt, char *pattern, nxt_file_info_t *info);
+rct_status_t nxt_find_next(rct_nxt_t *nxt, nxt_file_info_t *info);
+rct_status_t nxt_stat_file(rct_nxt_t *nxt, char *filename_on_brick, unsigned long *size);
 rct_status_t nxt_get_firmware_version(rct_nxt_t *nxt);
 rct_status_t nxt_open_file_write_linear(rct_nxt_t *nxt, char *filename_on_brick, size_t size);
 rct_status_t nxt_open_file_read_linear(rct_nxt_t *nxt);
 rct_status_t nxt_open_file_write_data(rct_nxt_t *nxt, char *filename_on_brick, size_t size);
-rct_status_t nxt_open_file_append_data(rct_nxt_t *nxt);
+int nxt_open_file_append_data(rct_nxt_t *nxt, char *filename_on_brick, size_t *available);
 rct_status_t nxt_boot(rct_nxt_t *nxt);
 rct_status_t nxt_set_brick_name(rct_nxt_t *nxt);
 rct_status_t nxt_get_device_info(rct_nxt_t *nxt);
@@ -104,9 +301,28 @@ rct_status_t nxt_request_next_module(rct_nxt_t *nxt);
 rct_status_t nxt_close_module_handle(rct_nxt_t *nxt);
 rct_status_t nxt_read_io_map(rct_nxt_t *nxt);
 rct_status_t nxt_write_io_map(rct_nxt_t *nxt);
+/* nxt_transport.c */
+rct_status_t nxt_set_transport(rct_nxt_t *nxt, const nxt_transport_t *transport);
+rct_status_t nxt_attach_fd(rct_nxt_t *nxt, int fd);
+rct_status_t nxt_attach_socket(rct_nxt_t *nxt, const char *path);
+rct_status_t nxt_set_stream_device(rct_nxt_t *nxt, char *device);
+int nxt_usb_send(rct_nxt_t *nxt, char *buf, int len);
+int nxt_usb_recv(rct_nxt_t *nxt, char *buf, int maxlen);
+int nxt_usb_poll(rct_nxt_t *nxt, int timeout_ms);
+int nxt_stream_send(rct_nxt_t *nxt, char *buf, int len);
+int nxt_stream_sendv(rct_nxt_t *nxt, const struct iovec *iov, int count);
+int nxt_writev_all(int fd, struct iovec *vec, int count);
+int nxt_stream_peek(rct_nxt_t *nxt, unsigned char * *packet);
+void nxt_stream_consume(rct_nxt_t *nxt);
+int nxt_stream_recv(rct_nxt_t *nxt, char *buf, int maxlen);
+int nxt_stream_poll(rct_nxt_t *nxt, int timeout_ms);
+rct_status_t nxt_open_brick_stream(rct_nxt_t *nxt);
+rct_status_t nxt_close_brick_stream(rct_nxt_t *nxt);
+/* nxt_usb1.c */
 /* pic.c */
-rct_status_t pic_send_command(int fd, const char *raw_cmd, int raw_len, const char *data, int dlen, char *response, int eot);
-rct_status_t pic_read_response(int fd, char *response, int eot);
+rct_status_t pic_send_command(int fd, const char *raw_cmd, int raw_len, const char *data, int dlen, char *response, int eot, int timeout_ms);
+rct_status_t pic_read_response(int fd, char *response, int eot, int timeout_ms, int *len);
+rct_status_t pic_read_byte(int fd, char *dest, struct timeval *deadline);
 void debug_hex_dump(const char *str, int len);
 int memcpy_esc(char *dest, const char *src, int slen);
 rct_status_t pic_erase_program_mem(rct_pic_t *pic, unsigned long start_address, unsigned long end_address);
@@ -124,6 +340,8 @@ int pic_valid_program_range(unsigned long start_address, unsigned long end_addre
 /* rct.c */
 int rct_find_bricks(rct_brick_list_t *bricks, char *name, unsigned int flags);
 int rct_find_nxt_bricks(rct_brick_list_t *bricks, char *name);
+int rct_find_nxt_env(rct_brick_list_t *bricks);
+char *rct_daemon_socket(char *path, size_t maxlen);
 int rct_find_nxt_usb(rct_brick_list_t *bricks);
 int rct_find_nxt_bluetooth(rct_brick_list_t *bricks, char *name);
 rct_brick_t *rct_get_brick_from_list(rct_brick_list_t *list, int n);
@@ -133,6 +351,22 @@ rct_status_t rct_increase_count(rct_brick_list_t *bricks, int n);
 /* rcx.c */
 void rcx_init_struct(rct_rcx_t *rcx);
 int rcx_open_brick(rct_rcx_t *rcx);
+/* stats.c */
+void rct_stats_enable(int enable);
+void rct_stats_reset(void);
+void rct_stats_now(struct timeval *tv);
+rct_cmd_stats_t *rct_stats_cmd(rct_stats_class_t cls, int code, int create);
+void rct_stats_init_cmd(rct_cmd_stats_t *cmd);
+const rct_cmd_stats_t *rct_stats_get(rct_stats_class_t cls, int code);
+void rct_stats_phase(rct_stats_class_t cls, int code, rct_stats_phase_t phase, const struct timeval *start, const struct timeval *end);
+void rct_stats_count(rct_stats_class_t cls, int code, rct_stats_counter_t counter, unsigned long n);
+int rct_hist_bucket(unsigned long value);
+unsigned long rct_hist_bucket_max(int bucket);
+void rct_hist_record(rct_hist_t *hist, unsigned long value);
+unsigned long rct_hist_percentile(const rct_hist_t *hist, double percent);
+const char *rct_stats_cmd_name(rct_stats_class_t cls, int code);
+void rct_stats_set_namer(rct_stats_class_t cls, rct_stats_namer_t namer);
+void rct_stats_print(FILE *fp);
 /* strings.c */
 /* usb.c */
 int usb_device_info(struct usb_device *dev);
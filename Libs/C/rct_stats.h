@@ -0,0 +1,90 @@
+#ifndef _STDIO_H_
+#include <stdio.h>
+#endif
+
+/*
+ *  Command statistics (stats.c).  When enabled with rct_stats_enable(),
+ *  every NXT and PIC command is timed in up to four phases, and each
+ *  phase goes into a latency histogram for its command code:
+ *
+ *      encode  From nxt_request_init() to submission (NXT only)
+ *      send    Writing the telegram to the transport
+ *      wait    From the end of the send to the reply being read
+ *      decode  Checking and parsing the reply (descriptor commands)
+ *
+ *  Counters track commands, bytes, timeouts, failures and retries.
+ *  The tables are process-wide, and are updated under a lock, so
+ *  commands may run in several threads, such as the scheduler's
+ *  dispatcher.  rct_stats_get() returns the live entry for a command,
+ *  which is freed by rct_stats_reset().
+ *
+ *  Histograms are log-linear in the manner of HdrHistogram: values
+ *  below 2^RCT_HIST_SUB_BITS microseconds are exact, and larger values
+ *  fall into 2^RCT_HIST_SUB_BITS buckets per power of 2, so reported
+ *  percentiles are within about 6% of the recorded values.
+ */
+
+#define RCT_HIST_SUB_BITS       4
+#define RCT_HIST_SUB_BUCKETS    (1 << RCT_HIST_SUB_BITS)
+#define RCT_HIST_MAX_BITS       32      /* Values up to ~71 minutes */
+#define RCT_HIST_BUCKETS        \
+	((RCT_HIST_MAX_BITS - RCT_HIST_SUB_BITS + 1) * RCT_HIST_SUB_BUCKETS)
+
+/* Values match the NXT command type byte, so NXT classes index directly */
+typedef enum
+{
+    RCT_STATS_NXT_DIRECT = NXT_DIRECT_CMD,
+    RCT_STATS_NXT_SYSTEM = NXT_SYSTEM_CMD,
+    RCT_STATS_PIC,
+    RCT_STATS_CLASSES
+}   rct_stats_class_t;
+
+typedef enum
+{
+    RCT_PHASE_ENCODE,
+    RCT_PHASE_SEND,
+    RCT_PHASE_WAIT,
+    RCT_PHASE_DECODE,
+    RCT_PHASES
+}   rct_stats_phase_t;
+
+typedef enum
+{
+    RCT_COUNT_COMMANDS,
+    RCT_COUNT_BYTES_SENT,
+    RCT_COUNT_BYTES_RECEIVED,
+    RCT_COUNT_TIMEOUTS,
+    RCT_COUNT_FAILURES,
+    RCT_COUNT_RETRIES,
+    RCT_COUNTERS
+}   rct_stats_counter_t;
+
+typedef struct
+{
+    unsigned long       count;
+    unsigned long       min;
+    unsigned long       max;
+    unsigned long long  sum;
+    unsigned int        buckets[RCT_HIST_BUCKETS];
+}   rct_hist_t;
+
+typedef struct
+{
+    unsigned long       counters[RCT_COUNTERS];
+    rct_hist_t          phases[RCT_PHASES];
+}   rct_cmd_stats_t;
+
+/*
+ *  Returns the printable name of a command code, or NULL.  Set per
+ *  class by the code that sends those commands, so that the stats
+ *  code does not drag in the command tables of other brick types.
+ */
+typedef const char  *(*rct_stats_namer_t)(rct_stats_class_t cls, int code);
+
+typedef struct
+{
+    int                 enabled;
+    /* Allocated on first use, indexed by command code */
+    rct_cmd_stats_t     *cmds[RCT_STATS_CLASSES][256];
+    rct_stats_namer_t   namers[RCT_STATS_CLASSES];
+}   rct_stats_t;
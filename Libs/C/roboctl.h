@@ -2,11 +2,6 @@
 #include <sys/time.h>
 #endif
 
-#include "rct_machdep.h"
-#include "rct_rcx.h"
-#include "rct_nxt.h"
-#include "rct_pic.h"
-
 #define     RCT_MAX_BRICKS      64
 #define     RCT_FIRMWARE_LEN    64
 
@@ -27,20 +22,11 @@ typedef enum
 
     RCT_OVERWRITE=          0x0100,
     RCT_LOOP=               0x0200, 
-    RCT_UPLOAD_PLAY_SOUND = 0x0400
+    RCT_UPLOAD_PLAY_SOUND = 0x0400,
+    RCT_UPLOAD_FORCE =      0x0800, /* Even if the manifest matches */
+    RCT_UPLOAD_SWAP =       0x1000  /* Write a temp file, then rename */
 }   rct_flag_t;
 
-// USB ID codes
-#define     RCT_VENDOR_LEGO         0x0694
-#define     RCT_PRODUCT_NXT         0x0002
-
-typedef enum
-{
-    X = 1,
-    Y = 2,
-    Z = X|Y
-}   junk_t;
-
 typedef enum
 {
     RCT_OK = 0,
@@ -57,9 +43,47 @@ typedef enum
     RCT_CANNOT_CONNECT_SOCKET,
     RCT_CANNOT_BIND_SOCKET,
     RCT_INVALID_DATA,
-    RCT_USAGE
+    RCT_USAGE,
+    RCT_TIMEOUT,
+    RCT_NO_SPACE,
+    RCT_RECONNECTING    /* Link down, see nxt_reconnect_step() */
 }   rct_status_t;
 
+/*
+ *  Freshness of a cached query result (cache.c).  ttl_ms is how long
+ *  a result stays fresh: 0 disables caching, and a negative value
+ *  keeps it until the brick is reopened.
+ */
+typedef struct
+{
+    int             ttl_ms;
+    int             valid;
+    struct timeval  expires;
+}   rct_cache_entry_t;
+
+/* Brick-specific headers use the types above */
+#include "rct_machdep.h"
+#include "rct_rcx.h"
+#include "rct_nxt.h"
+#include "rct_nxt_sim.h"
+#include "rct_pic.h"
+
+// USB ID codes
+#define     RCT_VENDOR_LEGO         0x0694
+#define     RCT_PRODUCT_NXT         0x0002
+
+/* roboctld(1) socket and upload manifests, relative to the home directory */
+#define     RCT_DAEMON_DIR          ".roboctl"
+#define     RCT_DAEMON_SOCKET       RCT_DAEMON_DIR "/roboctld.sock"
+#define     RCT_MANIFEST_DIR        RCT_DAEMON_DIR "/manifests"
+
+typedef enum
+{
+    X = 1,
+    Y = 2,
+    Z = X|Y
+}   junk_t;
+
 typedef enum {
     RCT_CMD_NONE,
     RCT_CMD_STATUS,
@@ -71,7 +95,8 @@ typedef enum {
     RCT_CMD_START,
     RCT_CMD_STOP,
     RCT_CMD_PLAY_SOUND,
-    RCT_CMD_PLAY_TONE
+    RCT_CMD_PLAY_TONE,
+    RCT_CMD_LIST
 }   rct_cmd_t;
 
 typedef enum
@@ -81,6 +106,10 @@ typedef enum
     RCT_VEX
 }   rct_brick_type_t;
 
+/* Capture files use the brick types above */
+#include "rct_capture.h"
+#include "rct_stats.h"
+
 /* 
  *  Musical notes for *_play_tone().
  *  The NXT bottoms out at 200Hz.  Lower frequencies are included for
@@ -0,0 +1,631 @@
+/****************************************************************************
+ *  Header-only C++17 binding for the roboctl library.
+ *
+ *  Each NXT and PIC command is a type.  Its telegram layout and size
+ *  are computed at compile time from its field list, so there is no
+ *  format string to interpret, and a command with the wrong number or
+ *  type of fields, an oversized telegram, or a string literal too long
+ *  for a filename field does not compile.  Replies are decoded into
+ *  plain structs straight from the reply buffer of the request.
+ *
+ *  Example:
+ *
+ *      namespace nxt = roboctl::nxt;
+ *
+ *      auto battery = nxt::transact<nxt::BatteryLevel>(&brick->nxt);
+ *      if ( battery )
+ *          printf("%u mV\n", battery.reply.millivolts);
+ *      nxt::transact<nxt::StartProgram>(&brick->nxt, "prog.rxe");
+ *
+ *  Errors are reported through rct_status_t, as in the C API.
+ ***************************************************************************/
+
+#ifndef _ROBOCTL_HPP_
+#define _ROBOCTL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <usb.h>
+
+extern "C"
+{
+#include "roboctl.h"
+}
+
+namespace roboctl
+{
+
+/*
+ *  Field encoders.  size is the number of bytes a field occupies in
+ *  the telegram.  Fields with takes_value false are constants and
+ *  consume no argument.
+ */
+
+template <typename T, std::size_t N>
+struct Int
+{
+    using value_type = T;
+    static constexpr std::size_t size = N;
+    static constexpr bool takes_value = true;
+
+    static void put(unsigned char *p, value_type value)
+    {
+	std::uint32_t   v = static_cast<std::uint32_t>(value);
+
+	for (std::size_t c = 0; c < N; ++c, v >>= 8)
+	    p[c] = v & 0xff;
+    }
+};
+
+using UByte = Int<std::uint8_t, 1>;
+using SByte = Int<std::int8_t, 1>;
+using UWord = Int<std::uint16_t, 2>;
+using ULong = Int<std::uint32_t, 4>;
+using UAddr = Int<std::uint32_t, 3>;    /* 24-bit PIC address */
+
+template <unsigned char V>
+struct Fixed
+{
+    static constexpr std::size_t size = 1;
+    static constexpr bool takes_value = false;
+
+    static void put(unsigned char *p)
+    {
+	*p = V;
+    }
+};
+
+/* NXT filename: 15.3 plus null, padded to 20 bytes */
+struct Filename
+{
+    using value_type = const char *;
+    static constexpr std::size_t size = NXT_FILENAME_MAX + 1;
+    static constexpr bool takes_value = true;
+
+    template <typename S>
+    static void put(unsigned char *p, S &&filename)
+    {
+	using T = std::remove_reference_t<S>;
+
+	/* String literals can be checked at compile time */
+	if constexpr ( std::is_array_v<T> &&
+		       std::is_const_v<std::remove_extent_t<T>> )
+	    static_assert(std::extent_v<T> <= NXT_FILENAME_MAX + 1,
+			  "NXT filenames are limited to 15.3 characters");
+	std::strncpy(reinterpret_cast<char *>(p), filename, NXT_FILENAME_MAX);
+	p[NXT_FILENAME_MAX] = '\0';
+    }
+};
+
+/*
+ *  Byte layout of a list of fields.
+ */
+
+template <typename... Fields>
+struct Layout
+{
+    static constexpr std::size_t size = (std::size_t{0} + ... + Fields::size);
+    static constexpr std::size_t values =
+	(std::size_t{0} + ... + (Fields::takes_value ? 1 : 0));
+
+    template <std::size_t I>
+    using field = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+    /* Byte offset of field I */
+    template <std::size_t I>
+    static constexpr std::size_t offset()
+    {
+	constexpr std::size_t   sizes[] = { Fields::size..., 0 };
+	std::size_t             off = 0;
+
+	for (std::size_t c = 0; c < I; ++c)
+	    off += sizes[c];
+	return off;
+    }
+
+    /* Index of the argument that supplies field I */
+    template <std::size_t I>
+    static constexpr std::size_t argument()
+    {
+	constexpr bool  takes[] = { Fields::takes_value..., false };
+	std::size_t     arg = 0;
+
+	for (std::size_t c = 0; c < I; ++c)
+	    arg += takes[c];
+	return arg;
+    }
+
+    template <std::size_t I, typename Tuple>
+    static void put_field(unsigned char *p, const Tuple &args)
+    {
+	using F = field<I>;
+
+	if constexpr ( F::takes_value )
+	{
+	    using A = std::tuple_element_t<argument<I>(), Tuple>;
+	    static_assert(std::is_convertible_v<A, typename F::value_type>,
+			  "Argument does not match the command field type");
+	    F::put(p + offset<I>(), std::get<argument<I>()>(args));
+	}
+	else
+	    F::put(p + offset<I>());
+    }
+
+    template <typename Tuple, std::size_t... I>
+    static void encode_fields([[maybe_unused]] unsigned char *p,
+			      [[maybe_unused]] const Tuple &args,
+		       std::index_sequence<I...>)
+    {
+	(put_field<I>(p, args), ...);
+    }
+
+    template <typename... Args>
+    static void encode(unsigned char *p, Args &&...args)
+    {
+	static_assert(sizeof...(Args) == values,
+		      "Wrong number of fields for this command");
+	encode_fields(p, std::forward_as_tuple(args...),
+	       std::index_sequence_for<Fields...>{});
+    }
+};
+
+/* Little-endian reply fields */
+inline std::uint16_t get_uword(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+inline std::uint32_t get_ulong(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) |
+	   (static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+template <typename Reply>
+struct Result
+{
+    rct_status_t    status = RCT_OK;
+    Reply           reply = {};
+
+    explicit operator bool() const
+    {
+	return status == RCT_OK;
+    }
+};
+
+namespace nxt
+{
+
+/*
+ *  Replies.  size is the full reply length, including the reply type,
+ *  command code and status bytes.
+ */
+
+struct StatusReply
+{
+    static constexpr std::size_t size = 3;
+    static StatusReply decode(const unsigned char *) { return {}; }
+};
+
+struct BatteryReply
+{
+    static constexpr std::size_t size = 5;
+    unsigned            millivolts;
+
+    static BatteryReply decode(const unsigned char *r)
+    {
+	return { get_uword(r + 3) };
+    }
+};
+
+struct KeepAliveReply
+{
+    static constexpr std::size_t size = 7;
+    std::uint32_t       sleep_limit_ms;
+
+    static KeepAliveReply decode(const unsigned char *r)
+    {
+	return { get_ulong(r + 3) };
+    }
+};
+
+struct OutputStateReply
+{
+    static constexpr std::size_t size = 25;
+    unsigned            port;
+    int                 power;
+    unsigned            mode;
+    unsigned            regulation;
+    int                 turn_ratio;
+    unsigned            run_state;
+    std::uint32_t       tacho_limit;
+    std::int32_t        tacho_count;
+    std::int32_t        block_tacho_count;
+    std::int32_t        rotation_count;
+
+    static OutputStateReply decode(const unsigned char *r)
+    {
+	return { r[3], static_cast<std::int8_t>(r[4]), r[5], r[6],
+		 static_cast<std::int8_t>(r[7]), r[8], get_ulong(r + 9),
+		 static_cast<std::int32_t>(get_ulong(r + 13)),
+		 static_cast<std::int32_t>(get_ulong(r + 17)),
+		 static_cast<std::int32_t>(get_ulong(r + 21)) };
+    }
+};
+
+struct InputValuesReply
+{
+    static constexpr std::size_t size = 16;
+    unsigned            port;
+    bool                valid;
+    bool                calibrated;
+    unsigned            sensor_type;
+    unsigned            sensor_mode;
+    unsigned            raw;
+    unsigned            normalized;
+    int                 scaled;
+    int                 calibrated_value;
+
+    static InputValuesReply decode(const unsigned char *r)
+    {
+	return { r[3], r[4] != 0, r[5] != 0, r[6], r[7], get_uword(r + 8),
+		 get_uword(r + 10), static_cast<std::int16_t>(get_uword(r + 12)),
+		 static_cast<std::int16_t>(get_uword(r + 14)) };
+    }
+};
+
+struct FilenameReply
+{
+    static constexpr std::size_t size = 23;
+    char                filename[NXT_FILENAME_MAX + 1];
+
+    static FilenameReply decode(const unsigned char *r)
+    {
+	FilenameReply   reply;
+
+	std::memcpy(reply.filename, r + 3, NXT_FILENAME_MAX);
+	reply.filename[NXT_FILENAME_MAX] = '\0';
+	return reply;
+    }
+};
+
+struct HandleReply
+{
+    static constexpr std::size_t size = 4;
+    unsigned            handle;
+
+    static HandleReply decode(const unsigned char *r)
+    {
+	return { r[3] };
+    }
+};
+
+struct OpenReadReply
+{
+    static constexpr std::size_t size = 8;
+    unsigned            handle;
+    std::uint32_t       file_size;
+
+    static OpenReadReply decode(const unsigned char *r)
+    {
+	return { r[3], get_ulong(r + 4) };
+    }
+};
+
+struct FindReply
+{
+    static constexpr std::size_t size = 28;
+    unsigned            handle;
+    char                filename[NXT_FILENAME_MAX + 1];
+    std::uint32_t       file_size;
+
+    static FindReply decode(const unsigned char *r)
+    {
+	FindReply   reply;
+
+	reply.handle = r[3];
+	std::memcpy(reply.filename, r + 4, NXT_FILENAME_MAX);
+	reply.filename[NXT_FILENAME_MAX] = '\0';
+	reply.file_size = get_ulong(r + 24);
+	return reply;
+    }
+};
+
+struct VersionsReply
+{
+    static constexpr std::size_t size = 7;
+    unsigned            protocol_minor;
+    unsigned            protocol_major;
+    unsigned            firmware_minor;
+    unsigned            firmware_major;
+
+    static VersionsReply decode(const unsigned char *r)
+    {
+	return { r[3], r[4], r[5], r[6] };
+    }
+};
+
+struct DeviceInfoReply
+{
+    static constexpr std::size_t size = 33;
+    char                name[NXT_NAME_LEN + 1];
+    unsigned char       bluetooth_address[6];
+    std::uint32_t       bluetooth_signal_strength;
+    std::uint32_t       free_flash;
+
+    static DeviceInfoReply decode(const unsigned char *r)
+    {
+	DeviceInfoReply reply;
+
+	std::memcpy(reply.name, r + 3, NXT_NAME_LEN);
+	reply.name[NXT_NAME_LEN] = '\0';
+	std::memcpy(reply.bluetooth_address, r + 18, 6);
+	reply.bluetooth_signal_strength = get_ulong(r + 25);
+	reply.free_flash = get_ulong(r + 29);
+	return reply;
+    }
+};
+
+/*
+ *  A command.  Direct commands that return only a status honor
+ *  nxt->response_mask, like their C counterparts.
+ */
+
+template <unsigned char Type, unsigned char Code, typename Reply,
+	  typename... Fields>
+struct Command
+{
+    using reply_type = Reply;
+    using layout = Layout<Fields...>;
+
+    static constexpr unsigned char  type = Type;
+    static constexpr unsigned char  code = Code;
+    static constexpr std::size_t    size = 2 + layout::size;
+    static constexpr bool           reply_optional =
+	(Type == NXT_DIRECT_CMD) && std::is_same_v<Reply, StatusReply>;
+
+    static_assert(size <= NXT_MaxBytes,
+		  "Command is larger than the NXT accepts");
+    static_assert(Reply::size <= NXT_MaxBytes,
+		  "Reply is larger than the NXT sends");
+
+    template <typename... Args>
+    static void encode(rct_nxt_t *nxt, nxt_request_t *req, Args &&...args)
+    {
+	nxt_request_init(req,
+		reply_optional ? (Type | nxt->response_mask) : Type, Code);
+	layout::encode(req->cmd + 2, args...);
+	req->cmd_len = size;
+    }
+};
+
+using StartProgram = Command<NXT_DIRECT_CMD, NXT_DC_START_PROGRAM,
+			     StatusReply, Filename>;
+using StopProgram = Command<NXT_DIRECT_CMD, NXT_DC_STOP_PROGRAM,
+			    StatusReply>;
+/* Loop flag, filename */
+using PlaySoundFile = Command<NXT_DIRECT_CMD, NXT_DC_PLAY_SOUND_FILE,
+			      StatusReply, UByte, Filename>;
+/* Frequency (Hz), duration (ms) */
+using PlayTone = Command<NXT_DIRECT_CMD, NXT_DC_PLAY_TONE,
+			 StatusReply, UWord, UWord>;
+/* Port, power, mode, regulation, turn ratio, run state, tacho limit */
+using SetOutputState = Command<NXT_DIRECT_CMD, NXT_DC_SET_OUTPUT_STATE,
+			       StatusReply, UByte, SByte, UByte, UByte,
+			       SByte, UByte, ULong>;
+/* Port, sensor type, sensor mode */
+using SetInputMode = Command<NXT_DIRECT_CMD, NXT_DC_SET_INPUT_MODE,
+			     StatusReply, UByte, UByte, UByte>;
+using GetOutputState = Command<NXT_DIRECT_CMD, NXT_DC_GET_OUTPUT_STATE,
+			       OutputStateReply, UByte>;
+using GetInputValues = Command<NXT_DIRECT_CMD, NXT_DC_GET_INPUT_VALUES,
+			       InputValuesReply, UByte>;
+using ResetInputScaledValue = Command<NXT_DIRECT_CMD,
+				      NXT_DC_RESET_INPUT_SCALED_VALUE,
+				      StatusReply, UByte>;
+/* Port, relative flag */
+using ResetMotorPosition = Command<NXT_DIRECT_CMD,
+				   NXT_DC_RESET_MOTOR_POSITION,
+				   StatusReply, UByte, UByte>;
+using BatteryLevel = Command<NXT_DIRECT_CMD, NXT_DC_BATTERY_LEVEL,
+			     BatteryReply>;
+using StopSoundPlayback = Command<NXT_DIRECT_CMD,
+				  NXT_DC_STOP_SOUND_PLAYBACK, StatusReply>;
+using KeepAlive = Command<NXT_DIRECT_CMD, NXT_DC_KEEP_ALIVE,
+			  KeepAliveReply>;
+using GetCurrentProgramName = Command<NXT_DIRECT_CMD,
+				      NXT_DC_GET_CURRENT_PROGRAM_NAME,
+				      FilenameReply>;
+
+using OpenRead = Command<NXT_SYSTEM_CMD, NXT_SC_OPEN_READ,
+			 OpenReadReply, Filename>;
+/* Filename, file size */
+using OpenWrite = Command<NXT_SYSTEM_CMD, NXT_SC_OPEN_WRITE,
+			  HandleReply, Filename, ULong>;
+using Close = Command<NXT_SYSTEM_CMD, NXT_SC_CLOSE, HandleReply, UByte>;
+using Delete = Command<NXT_SYSTEM_CMD, NXT_SC_DELETE, FilenameReply,
+		       Filename>;
+/* Wildcard pattern */
+using FindFirst = Command<NXT_SYSTEM_CMD, NXT_SC_FIND_FIRST, FindReply,
+			  Filename>;
+/* Handle */
+using FindNext = Command<NXT_SYSTEM_CMD, NXT_SC_FIND_NEXT, FindReply,
+			 UByte>;
+using GetVersions = Command<NXT_SYSTEM_CMD, NXT_SC_GET_VERSIONS,
+			    VersionsReply>;
+using OpenWriteLinear = Command<NXT_SYSTEM_CMD, NXT_SC_OPEN_WRITE_LINEAR,
+				HandleReply, Filename, ULong>;
+using OpenWriteData = Command<NXT_SYSTEM_CMD, NXT_SC_OPEN_WRITE_DATA,
+			      HandleReply, Filename, ULong>;
+using OpenAppendData = Command<NXT_SYSTEM_CMD, NXT_SC_OPEN_APPEND_DATA,
+			       OpenReadReply, Filename>;
+using GetDeviceInfo = Command<NXT_SYSTEM_CMD, NXT_SC_GET_DEVICE_INFO,
+			      DeviceInfoReply>;
+using DeleteUserFlash = Command<NXT_SYSTEM_CMD, NXT_SC_DELETE_USER_FLASH,
+				StatusReply>;
+using BluetoothFactoryReset = Command<NXT_SYSTEM_CMD,
+				      NXT_SC_BT_FACTORY_RESET, StatusReply>;
+
+/*
+ *  Check and decode the reply to a completed request built with
+ *  Cmd::encode().  The brick's status byte is returned in *nxt_status
+ *  if not NULL.  Use this with nxt_submit() to pipeline commands.
+ */
+
+template <typename Cmd>
+Result<typename Cmd::reply_type> decode(const nxt_request_t &req,
+					int *nxt_status = nullptr)
+{
+    Result<typename Cmd::reply_type>    result;
+
+    if ( (result.status = req.status) != RCT_OK )
+	return result;
+
+    /* No reply was requested */
+    if ( req.cmd[0] & NXT_NO_RESPONSE )
+	return result;
+
+    if ( (req.response_len != (int)Cmd::reply_type::size) ||
+	 (req.response[1] != Cmd::code) )
+    {
+	result.status = RCT_COMMAND_FAILED;
+	return result;
+    }
+    if ( nxt_status != nullptr )
+	*nxt_status = NXT_REPLY_STATUS(&req);
+    if ( NXT_REPLY_STATUS(&req) != NXT_STATUS_SUCCESS )
+	result.status = RCT_COMMAND_FAILED;
+    else
+	result.reply = Cmd::reply_type::decode(req.response);
+    return result;
+}
+
+/*
+ *  Send a command and wait for its reply.
+ */
+
+template <typename Cmd, typename... Args>
+Result<typename Cmd::reply_type> transact(rct_nxt_t *nxt, Args &&...args)
+{
+    nxt_request_t   req;
+    Result<typename Cmd::reply_type>    result;
+
+    Cmd::encode(nxt, &req, args...);
+    if ( (result.status = nxt_transact(nxt, &req)) != RCT_OK )
+	return result;
+    return decode<Cmd>(req);
+}
+
+}   // namespace nxt
+
+namespace pic
+{
+
+struct StatusReply
+{
+    static StatusReply decode(const char *) { return {}; }
+};
+
+/* Response to PIC_GET_BOOTLOADER_VERSION */
+struct BootloaderReply
+{
+    int                 major;
+    int                 minor;
+
+    static BootloaderReply decode(const char *r)
+    {
+	return { r[4], r[5] };
+    }
+};
+
+/* Unparsed response, valid until the next command */
+struct RawReply
+{
+    const char          *bytes;
+
+    static RawReply decode(const char *r)
+    {
+	return { r };
+    }
+};
+
+/*
+ *  A PIC bootloader command.  Eot is the character that ends the
+ *  controller's response.
+ */
+
+template <pic_cmd_t Code, char Eot, typename Reply, typename... Fields>
+struct Command
+{
+    using reply_type = Reply;
+    using layout = Layout<Fields...>;
+
+    static constexpr pic_cmd_t      code = Code;
+    static constexpr char           eot = Eot;
+    static constexpr std::size_t    size = 1 + layout::size;
+
+    static_assert(size <= PIC_CMD_MAX, "Command is larger than PIC_CMD_MAX");
+
+    template <typename... Args>
+    static void encode(unsigned char *cmd, Args &&...args)
+    {
+	cmd[0] = Code;
+	layout::encode(cmd + 1, args...);
+    }
+};
+
+using GetBootloaderVersion = Command<PIC_GET_BOOTLOADER_VERSION, CHAR_EOT,
+				     BootloaderReply, Fixed<2>>;
+/* Bytes, address */
+using ReadProgramMem = Command<PIC_READ_PROGRAM_MEM, CHAR_EOT, RawReply,
+			       UByte, UAddr>;
+/* Write blocks, address, followed by 8 bytes per block */
+using WriteProgramMem = Command<PIC_WRITE_PROGRAM_MEM, CHAR_EOT,
+				StatusReply, UByte, UAddr>;
+using ReturnToUserCode = Command<PIC_RETURN_TO_USER_CODE, '\x40',
+				 StatusReply, Fixed<0x40>>;
+/* Erase blocks, address, high byte of erase blocks */
+using EraseProgramMem = Command<PIC_ERASE_PROGRAM_MEM, CHAR_EOT,
+				StatusReply, UByte, UAddr, UByte>;
+
+/*
+ *  Send a command and wait for the response.  Write commands take
+ *  their data and block count from data and blocks.
+ */
+
+template <typename Cmd, typename... Args>
+Result<typename Cmd::reply_type> transact_data(rct_pic_t *pic,
+					       const char *data, int blocks,
+					       Args &&...args)
+{
+    Result<typename Cmd::reply_type>    result;
+    std::array<unsigned char, Cmd::size> cmd;
+
+    Cmd::encode(cmd.data(), args...);
+    result.status = pic_send_command(pic->fd,
+				     reinterpret_cast<const char *>(cmd.data()),
+				     Cmd::size, data, blocks, pic->response,
+				     Cmd::eot, pic->timeout_ms);
+    if ( result.status == RCT_OK )
+	result.reply = Cmd::reply_type::decode(pic->response);
+    return result;
+}
+
+template <typename Cmd, typename... Args>
+Result<typename Cmd::reply_type> transact(rct_pic_t *pic, Args &&...args)
+{
+    static_assert(Cmd::code != PIC_WRITE_PROGRAM_MEM,
+		  "Use transact_data() for write commands");
+    return transact_data<Cmd>(pic, nullptr, 0, args...);
+}
+
+}   // namespace pic
+
+}   // namespace roboctl
+
+#endif  // _ROBOCTL_HPP_
@@ -0,0 +1,383 @@
+/****************************************************************************
+ *  This file contains the command statistics: per-command latency
+ *  histograms and counters, the query API, and the dump printed by
+ *  the --stats flag of the command-line tools.  See rct_stats.h.
+ *
+ *  Nothing is timed unless statistics are enabled, so the hooks in
+ *  the command path cost one test of Stats.enabled otherwise.
+ *
+ *  Samples come from caller threads and from the scheduler's dispatcher
+ *  thread, so every update, like the creation and freeing of the
+ *  per-command entries, is made under Stats_lock.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <usb.h>
+#include "roboctl.h"
+
+rct_stats_t     Stats = { 0 };
+pthread_mutex_t Stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/****************************************************************************
+ * Description:
+ *  Turn statistics collection on or off.  Statistics already
+ *  collected are kept.
+ * Author:
+ ***************************************************************************/
+
+void    rct_stats_enable(int enable)
+
+{
+    Stats.enabled = enable;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Discard all statistics collected so far.
+ * Author:
+ ***************************************************************************/
+
+void    rct_stats_reset(void)
+
+{
+    int     cls,
+	    code;
+
+    pthread_mutex_lock(&Stats_lock);
+    for (cls = 0; cls < RCT_STATS_CLASSES; ++cls)
+    {
+	for (code = 0; code < 256; ++code)
+	{
+	    free(Stats.cmds[cls][code]);
+	    Stats.cmds[cls][code] = NULL;
+	}
+    }
+    pthread_mutex_unlock(&Stats_lock);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Store the current time in *tv if statistics are enabled, or clear
+ *  it so that a phase starting then is not recorded.
+ * Author:
+ ***************************************************************************/
+
+void    rct_stats_now(struct timeval *tv)
+
+{
+    if ( Stats.enabled )
+	gettimeofday(tv, NULL);
+    else
+	timerclear(tv);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Return the statistics for a command, allocating them if create is
+ *  set and they do not exist yet.  Returns NULL if there are none.
+ *  Called with Stats_lock held.
+ * Author:
+ ***************************************************************************/
+
+rct_cmd_stats_t *rct_stats_cmd(rct_stats_class_t cls, int code, int create)
+
+{
+    rct_cmd_stats_t **cmd;
+
+    if ( (cls < 0) || (cls >= RCT_STATS_CLASSES) )
+	return NULL;
+    cmd = &Stats.cmds[cls][code & 0xff];
+    if ( (*cmd == NULL) && create &&
+	 ((*cmd = malloc(sizeof(**cmd))) != NULL) )
+	rct_stats_init_cmd(*cmd);
+    return *cmd;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Initialize an empty set of command statistics.
+ * Author:
+ ***************************************************************************/
+
+void    rct_stats_init_cmd(rct_cmd_stats_t *cmd)
+
+{
+    int     phase;
+
+    memset(cmd, 0, sizeof(*cmd));
+    for (phase = 0; phase < RCT_PHASES; ++phase)
+	cmd->phases[phase].min = (unsigned long)-1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Public query API: return the statistics collected for a command,
+ *  or NULL if it has not been used.  They stay valid until
+ *  rct_stats_reset().
+ * Author:
+ ***************************************************************************/
+
+const rct_cmd_stats_t   *rct_stats_get(rct_stats_class_t cls, int code)
+
+{
+    const rct_cmd_stats_t   *cmd;
+
+    pthread_mutex_lock(&Stats_lock);
+    cmd = rct_stats_cmd(cls, code, 0);
+    pthread_mutex_unlock(&Stats_lock);
+    return cmd;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Record the time from start to end as one sample of a phase.
+ *  Nothing is recorded if statistics are off or start is clear.
+ * Author:
+ ***************************************************************************/
+
+void    rct_stats_phase(rct_stats_class_t cls, int code,
+			rct_stats_phase_t phase,
+			const struct timeval *start, const struct timeval *end)
+
+{
+    rct_cmd_stats_t *cmd;
+    long            usec;
+
+    if ( !Stats.enabled || !timerisset(start) )
+	return;
+    usec = (end->tv_sec - start->tv_sec) * 1000000L +
+	   (end->tv_usec - start->tv_usec);
+    pthread_mutex_lock(&Stats_lock);
+    if ( (cmd = rct_stats_cmd(cls, code, 1)) != NULL )
+	rct_hist_record(&cmd->phases[phase], usec < 0 ? 0 : usec);
+    pthread_mutex_unlock(&Stats_lock);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Add n to one of a command's counters.
+ * Author:
+ ***************************************************************************/
+
+void    rct_stats_count(rct_stats_class_t cls, int code,
+			rct_stats_counter_t counter, unsigned long n)
+
+{
+    rct_cmd_stats_t *cmd;
+
+    if ( !Stats.enabled )
+	return;
+    pthread_mutex_lock(&Stats_lock);
+    if ( (cmd = rct_stats_cmd(cls, code, 1)) != NULL )
+	cmd->counters[counter] += n;
+    pthread_mutex_unlock(&Stats_lock);
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Index of the histogram bucket holding value.
+ * Author:
+ ***************************************************************************/
+
+int     rct_hist_bucket(unsigned long value)
+
+{
+    int     msb;
+
+    if ( value < RCT_HIST_SUB_BUCKETS )
+	return value;
+    if ( value >> (RCT_HIST_MAX_BITS - 1) >> 1 )
+	value = (1UL << (RCT_HIST_MAX_BITS - 1) << 1) - 1;
+    for (msb = RCT_HIST_SUB_BITS; value >> (msb + 1); ++msb)
+	;
+    return (msb - RCT_HIST_SUB_BITS + 1) * RCT_HIST_SUB_BUCKETS +
+	   (value >> (msb - RCT_HIST_SUB_BITS)) - RCT_HIST_SUB_BUCKETS;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Largest value that falls in a histogram bucket.
+ * Author:
+ ***************************************************************************/
+
+unsigned long   rct_hist_bucket_max(int bucket)
+
+{
+    int     shift;
+
+    if ( bucket < RCT_HIST_SUB_BUCKETS )
+	return bucket;
+    shift = bucket / RCT_HIST_SUB_BUCKETS - 1;
+    return ((unsigned long)(RCT_HIST_SUB_BUCKETS +
+	    bucket % RCT_HIST_SUB_BUCKETS) << shift) + (1UL << shift) - 1;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Add one value to a histogram.
+ * Author:
+ ***************************************************************************/
+
+void    rct_hist_record(rct_hist_t *hist, unsigned long value)
+
+{
+    ++hist->buckets[rct_hist_bucket(value)];
+    ++hist->count;
+    hist->sum += value;
+    if ( value < hist->min )
+	hist->min = value;
+    if ( value > hist->max )
+	hist->max = value;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Value below which percent percent of the recorded values fall,
+ *  to the precision of the buckets.  Returns 0 for an empty histogram.
+ * Author:
+ ***************************************************************************/
+
+unsigned long   rct_hist_percentile(const rct_hist_t *hist, double percent)
+
+{
+    unsigned long   target,
+		    seen = 0;
+    int             bucket;
+
+    if ( hist->count == 0 )
+	return 0;
+    target = (unsigned long)(hist->count * percent / 100.0 + 0.5);
+    if ( target < 1 )
+	target = 1;
+    for (bucket = 0; bucket < RCT_HIST_BUCKETS; ++bucket)
+    {
+	if ( (seen += hist->buckets[bucket]) >= target )
+	    return MIN(rct_hist_bucket_max(bucket), hist->max);
+    }
+    return hist->max;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Printable name for a command code.  NXT names come from the
+ *  namer registered by nxt_init_struct().
+ * Author:
+ ***************************************************************************/
+
+const char  *rct_stats_cmd_name(rct_stats_class_t cls, int code)
+
+{
+    if ( Stats.namers[cls] != NULL )
+	return Stats.namers[cls](cls, code);
+    if ( cls == RCT_STATS_PIC )
+    {
+	switch(code)
+	{
+	    case    PIC_GET_BOOTLOADER_VERSION:
+		return "GET_BOOTLOADER_VERSION";
+	    case    PIC_READ_PROGRAM_MEM:
+		return "READ_PROGRAM_MEM";
+	    case    PIC_WRITE_PROGRAM_MEM:
+		return "WRITE_PROGRAM_MEM";
+	    case    PIC_RETURN_TO_USER_CODE:
+		return "RETURN_TO_USER_CODE";
+	    case    PIC_ERASE_PROGRAM_MEM:
+		return "ERASE_PROGRAM_MEM";
+	    default:
+		return NULL;
+	}
+    }
+    return NULL;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Set the function rct_stats_print() uses to name the commands of
+ *  a class.
+ * Author:
+ ***************************************************************************/
+
+void    rct_stats_set_namer(rct_stats_class_t cls, rct_stats_namer_t namer)
+
+{
+    if ( (cls >= 0) && (cls < RCT_STATS_CLASSES) )
+	Stats.namers[cls] = namer;
+}
+
+
+/****************************************************************************
+ * Description:
+ *  Print the counters and latency percentiles of every command used.
+ *  The lock is held throughout, so the figures are consistent.
+ * Author:
+ ***************************************************************************/
+
+void    rct_stats_print(FILE *fp)
+
+{
+    static const char   *class_names[RCT_STATS_CLASSES] =
+			    { "NXT direct", "NXT system", "PIC" },
+			*phase_names[RCT_PHASES] =
+			    { "encode", "send", "wait", "decode" };
+    const rct_cmd_stats_t   *cmd;
+    const rct_hist_t        *hist;
+    const char              *name;
+    int                     cls,
+			    code,
+			    phase;
+
+    fputs("\nCommand statistics (latencies in microseconds)\n", fp);
+    pthread_mutex_lock(&Stats_lock);
+    for (cls = 0; cls < RCT_STATS_CLASSES; ++cls)
+    {
+	for (code = 0; code < 256; ++code)
+	{
+	    if ( (cmd = rct_stats_cmd(cls, code, 0)) == NULL )
+		continue;
+	    fprintf(fp, "\n%s 0x%02x", class_names[cls], code);
+	    if ( (name = rct_stats_cmd_name(cls, code)) != NULL )
+		fprintf(fp, " %s", name);
+	    fprintf(fp, ": %lu commands, %lu bytes sent, %lu received\n"
+		"    %lu timeouts, %lu failures, %lu retries\n",
+		cmd->counters[RCT_COUNT_COMMANDS],
+		cmd->counters[RCT_COUNT_BYTES_SENT],
+		cmd->counters[RCT_COUNT_BYTES_RECEIVED],
+		cmd->counters[RCT_COUNT_TIMEOUTS],
+		cmd->counters[RCT_COUNT_FAILURES],
+		cmd->counters[RCT_COUNT_RETRIES]);
+	    fprintf(fp, "    %-8s %8s %8s %8s %8s %8s %8s %8s\n", "phase",
+		"count", "min", "mean", "p50", "p90", "p99", "max");
+	    for (phase = 0; phase < RCT_PHASES; ++phase)
+	    {
+		hist = &cmd->phases[phase];
+		if ( hist->count == 0 )
+		    continue;
+		fprintf(fp, "    %-8s %8lu %8lu %8lu %8lu %8lu %8lu %8lu\n",
+		    phase_names[phase], hist->count, hist->min,
+		    (unsigned long)(hist->sum / hist->count),
+		    rct_hist_percentile(hist, 50.0),
+		    rct_hist_percentile(hist, 90.0),
+		    rct_hist_percentile(hist, 99.0), hist->max);
+	    }
+	}
+    }
+    pthread_mutex_unlock(&Stats_lock);
+}